@@ -19,6 +19,7 @@ set(OBKM_SRC
 	${OBK_SRCS}cmnds/cmd_tasmota.c
 	${OBK_SRCS}cmnds/cmd_tcp.c
 	${OBK_SRCS}cmnds/cmd_test.c
+	${OBK_SRCS}cmnds/cmd_timerQueue.c
 	${OBK_SRCS}cmnds/cmd_tokenizer.c
 	${OBK_SRCS}devicegroups/deviceGroups_read.c
 	${OBK_SRCS}devicegroups/deviceGroups_util.c
@@ -26,6 +27,8 @@ set(OBKM_SRC
 	${OBK_SRCS}hal/generic/hal_adc_generic.c
 	${OBK_SRCS}hal/generic/hal_flashConfig_generic.c
 	${OBK_SRCS}hal/generic/hal_flashVars_generic.c
+	${OBK_SRCS}hal/generic/hal_flashVars_journal.c
+	${OBK_SRCS}hal/generic/hal_flashStats.c
 	${OBK_SRCS}hal/generic/hal_generic.c
 	${OBK_SRCS}hal/generic/hal_main_generic.c
 	${OBK_SRCS}hal/generic/hal_pins_generic.c
@@ -62,6 +65,7 @@ set(OBKM_SRC
 	${OBK_SRCS}driver/drv_battery.c
 	${OBK_SRCS}driver/drv_bl0937.c
 	${OBK_SRCS}driver/drv_bl0942.c
+	${OBK_SRCS}driver/drv_bl_energy.c
 	${OBK_SRCS}driver/drv_bl_shared.c
 	${OBK_SRCS}driver/drv_bmpi2c.c
 	${OBK_SRCS}driver/drv_bp1658cj.c
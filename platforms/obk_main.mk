@@ -34,6 +34,7 @@ OBKM_SRC  += $(OBK_SRCS)cmnds/cmd_simulatorOnly.c
 OBKM_SRC  += $(OBK_SRCS)cmnds/cmd_tasmota.c
 OBKM_SRC  += $(OBK_SRCS)cmnds/cmd_tcp.c
 OBKM_SRC  += $(OBK_SRCS)cmnds/cmd_test.c
+OBKM_SRC  += $(OBK_SRCS)cmnds/cmd_timerQueue.c
 OBKM_SRC  += $(OBK_SRCS)cmnds/cmd_tokenizer.c
 OBKM_SRC  += $(OBK_SRCS)devicegroups/deviceGroups_read.c
 OBKM_SRC  += $(OBK_SRCS)devicegroups/deviceGroups_util.c
@@ -41,6 +42,8 @@ OBKM_SRC  += $(OBK_SRCS)devicegroups/deviceGroups_write.c
 OBKM_SRC  += $(OBK_SRCS)hal/generic/hal_adc_generic.c
 OBKM_SRC  += $(OBK_SRCS)hal/generic/hal_flashConfig_generic.c
 OBKM_SRC  += $(OBK_SRCS)hal/generic/hal_flashVars_generic.c
+OBKM_SRC  += $(OBK_SRCS)hal/generic/hal_flashVars_journal.c
+OBKM_SRC  += $(OBK_SRCS)hal/generic/hal_flashStats.c
 OBKM_SRC  += $(OBK_SRCS)hal/generic/hal_generic.c
 OBKM_SRC  += $(OBK_SRCS)hal/generic/hal_main_generic.c
 OBKM_SRC  += $(OBK_SRCS)hal/generic/hal_ota_generic.c
@@ -80,6 +83,7 @@ OBKM_SRC  += $(OBK_SRCS)driver/drv_aht2x.c
 OBKM_SRC  += $(OBK_SRCS)driver/drv_battery.c
 OBKM_SRC  += $(OBK_SRCS)driver/drv_bl0937.c
 OBKM_SRC  += $(OBK_SRCS)driver/drv_bl0942.c
+OBKM_SRC  += $(OBK_SRCS)driver/drv_bl_energy.c
 OBKM_SRC  += $(OBK_SRCS)driver/drv_bl_shared.c
 #OBKM_SRC += $(OBK_SRCS)driver/drv_bmp280.c
 OBKM_SRC  += $(OBK_SRCS)driver/drv_bmpi2c.c
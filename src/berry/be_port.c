@@ -14,6 +14,7 @@
 
 #include "../littlefs/our_lfs.h"
 #include "../logging/logging.h"
+#include "be_run.h"
 
 /* this file contains configuration for the file system. */
 
@@ -56,7 +57,7 @@ static int mode_to_flags(const char *mode) {
 	return -1;
 }
 
-void *be_fopen(const char *filename, const char *modes) {
+void *be_fopen_raw(const char *filename, const char *modes) {
 	if (!lfs_present())
 		init_lfs(1);
 	if (lfs_present()) {
@@ -76,6 +77,23 @@ void *be_fopen(const char *filename, const char *modes) {
 	return NULL;
 }
 
+static bool is_bytecode_name(const char *filename) {
+	int len = strlen(filename);
+	return len > 4 && !stricmp(filename + len - 4, ".bec");
+}
+
+// Every read of a compiled module goes through here, including the module
+// loader for "import x". An outdated x.bec is removed and reported as missing,
+// so the loader moves on to x.be.
+void *be_fopen(const char *filename, const char *modes) {
+	if (modes[0] == 'r' && is_bytecode_name(filename) && berryBytecodeIsStale(filename)) {
+		ADDLOG_INFO(LOG_FEATURE_BERRY, "Removing outdated %s", filename);
+		lfs_remove(&lfs, filename);
+		return NULL;
+	}
+	return be_fopen_raw(filename, modes);
+}
+
 int be_fclose(void *hfile) {
 	int ret = lfs_file_close(&lfs, (lfs_file_t *)hfile);
 	free(hfile);
@@ -139,6 +157,10 @@ size_t be_fsize(void *hfile) {
 
 #else // !ENABLE_LITTLEFS
 
+void *be_fopen_raw(const char *filename, const char *modes) {
+	return NULL;
+}
+
 void *be_fopen(const char *filename, const char *modes) {
 	return NULL;
 }
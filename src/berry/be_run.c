@@ -1,6 +1,10 @@
 #include "be_run.h"
 #include "../logging/logging.h"
+#include "../littlefs/our_lfs.h"
 #include "be_debug.h"
+#include "be_gc.h"
+#include "be_sys.h"
+#include "be_vm.h"
 
 const char berryPrelude[] =
 	"_suspended_closures = {}\n"
@@ -19,6 +23,20 @@ const char berryPrelude[] =
 	"\n"
 	"def remove_closure(idx)\n"
 	"  _suspended_closures.remove(idx)\n"
+	"end\n"
+	"\n"
+	"# fixed arity versions of run_closure, used by event dispatch,\n"
+	"# they don't build an argument list for every call\n"
+	"def _run_closure0(idx)\n"
+	"  _suspended_closures[idx]()\n"
+	"end\n"
+	"\n"
+	"def _run_closure1(idx, a)\n"
+	"  _suspended_closures[idx](a)\n"
+	"end\n"
+	"\n"
+	"def _run_closure2(idx, a, b)\n"
+	"  _suspended_closures[idx](a, b)\n"
 	"end\n";
 
 void be_error_pop_all(bvm *vm) {
@@ -40,6 +58,24 @@ void be_dumpstack(bvm *vm) {
 	}
 }
 
+// calls the function left on top of the stack by a load
+static bool berryCallLoaded(bvm *vm) {
+	int ret_code2 = be_pcall(vm, 0);
+	if (ret_code2 != 0) {
+		ADDLOG_INFO(LOG_FEATURE_BERRY, "be_pcall fail, retcode %d", ret_code2);
+		be_dumpstack(vm);
+		be_error_pop_all(vm);
+		return false;
+	}
+
+	if (be_top(vm) > 1) {
+		be_error_pop_all(vm);
+	} else {
+		be_pop(vm, 1);
+	}
+	return true;
+}
+
 bool berryRun(bvm *vm, const char *prog) {
 	bool success = true;
 	ADDLOG_INFO(LOG_FEATURE_BERRY, "[berry start]");
@@ -51,134 +87,444 @@ bool berryRun(bvm *vm, const char *prog) {
 		success = false;
 		goto err;
 	}
+	success = berryCallLoaded(vm);
 
-	int ret_code2 = be_pcall(vm, 0);
-	if (ret_code2 != 0) {
-		ADDLOG_INFO(LOG_FEATURE_BERRY, "be_pcall fail, retcode %d", ret_code2);
+err:
+	ADDLOG_INFO(LOG_FEATURE_BERRY, "[berry end]");
+	return success;
+}
+
+// Compiled code is kept in LFS as <name>.bec, which is also where the Berry
+// module loader looks first, so "import x" picks up x.bec instead of
+// compiling x.be. The loader stops reading at the end of the bytecode,
+// so a small trailer appended after it records the source it was built from
+// and the firmware that built it (bytecode format follows the Berry version).
+// be_fopen checks the trailer whenever a .bec is opened for reading,
+// except right after berryCompileFile or berryRunCached has checked it.
+#define BERRY_BYTECODE_MAGIC	0x484B424F // "OBKH", module, source is <name>.be
+#define BERRY_PAGE_MAGIC		0x504B424F // "OBKP", Berry page, checked by berryRunCached
+#define BERRY_HASH_BASIS		2166136261u
+
+typedef struct berryBytecodeTrailer_s {
+	uint32_t magic;
+	uint32_t hash;
+	uint32_t srcLen;
+	uint32_t version;
+} berryBytecodeTrailer_t;
+
+extern const char* g_build_str;
+
+static int g_bytecodeHits = 0;
+static int g_bytecodeCompiles = 0;
+static int g_bytecodeFailures = 0;
+// bytecode just checked by us, next be_fopen of it skips the check once
+static char g_bytecodeChecked[64];
+
+static uint32_t berryHashBytes(uint32_t h, const byte *p, int len) {
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+	return h;
+}
+static uint32_t berryBytecodeVersion() {
+	static uint32_t version = 0;
+
+	if (version == 0) {
+		version = berryHashBytes(BERRY_HASH_BASIS, (const byte*)g_build_str, strlen(g_build_str));
+	}
+	return version;
+}
+void berryGetBytecodeName(const char *fname, char *out, int outSize) {
+	int len;
+
+	if (*fname == '/' || *fname == '\\') {
+		fname++;
+	}
+	len = strlen(fname);
+	if (len > 3 && !stricmp(fname + len - 3, ".be")) {
+		snprintf(out, outSize, "%sc", fname);
+	}
+	else {
+		snprintf(out, outSize, "%s.bec", fname);
+	}
+}
+void berryGetBytecodeStats(int *hits, int *compiles, int *failures) {
+	*hits = g_bytecodeHits;
+	*compiles = g_bytecodeCompiles;
+	*failures = g_bytecodeFailures;
+}
+void berryDropBytecode(const char *fname) {
+#if ENABLE_LITTLEFS
+	char becName[64];
+
+	if (!lfs_present()) {
+		return;
+	}
+	berryGetBytecodeName(fname, becName, sizeof(becName));
+	lfs_remove(&lfs, becName);
+	g_bytecodeChecked[0] = 0;
+#endif
+}
+// hashes the source in small chunks, so a cache hit never loads it whole
+static bool berryHashFile(const char *fname, uint32_t *hash, uint32_t *len) {
+	byte buf[64];
+	void *f;
+	int n;
+
+	f = be_fopen_raw(fname, "rb");
+	if (f == 0) {
+		return false;
+	}
+	*hash = BERRY_HASH_BASIS;
+	*len = 0;
+	while ((n = (int)be_fread(f, buf, sizeof(buf))) > 0) {
+		*hash = berryHashBytes(*hash, buf, n);
+		*len += n;
+	}
+	be_fclose(f);
+	return true;
+}
+static bool berryReadTrailer(const char *becName, berryBytecodeTrailer_t *tr) {
+	bool bRead;
+	size_t size;
+	void *f;
+
+	f = be_fopen_raw(becName, "rb");
+	if (f == 0) {
+		return false;
+	}
+	bRead = false;
+	size = be_fsize(f);
+	if (size > sizeof(*tr) && be_fseek(f, size - sizeof(*tr)) >= 0
+		&& be_fread(f, tr, sizeof(*tr)) == sizeof(*tr)) {
+		bRead = tr->magic == BERRY_BYTECODE_MAGIC || tr->magic == BERRY_PAGE_MAGIC;
+	}
+	be_fclose(f);
+	return bRead;
+}
+static bool berryBytecodeMatches(const char *becName, uint32_t magic, uint32_t hash, uint32_t len) {
+	berryBytecodeTrailer_t tr;
+
+	if (!berryReadTrailer(becName, &tr)) {
+		return false;
+	}
+	return tr.magic == magic && tr.version == berryBytecodeVersion()
+		&& tr.hash == hash && tr.srcLen == len;
+}
+// called by be_fopen, so "import x" never loads an outdated x.bec
+bool berryBytecodeIsStale(const char *becName) {
+	berryBytecodeTrailer_t tr;
+	char srcName[64];
+	uint32_t hash, len;
+	int n;
+
+	if (g_bytecodeChecked[0] && !strcmp(becName, g_bytecodeChecked)) {
+		g_bytecodeChecked[0] = 0;
+		return false;
+	}
+	if (!berryReadTrailer(becName, &tr)) {
+		// not built by us (for example uploaded precompiled), up to the loader
+		return false;
+	}
+	if (tr.version != berryBytecodeVersion()) {
+		return true;
+	}
+	if (tr.magic == BERRY_PAGE_MAGIC) {
+		return false;
+	}
+	// x.bec was built from x.be
+	n = strlen(becName);
+	if (n >= (int)sizeof(srcName)) {
+		return true;
+	}
+	memcpy(srcName, becName, n - 1);
+	srcName[n - 1] = 0;
+	if (!berryHashFile(srcName, &hash, &len)) {
+		// source removed, bytecode alone is still a valid module
+		return false;
+	}
+	return tr.hash != hash || tr.srcLen != len;
+}
+// saves the closure on top of the stack, leaves it there
+static bool berrySaveBytecode(bvm *vm, const char *becName, uint32_t magic, uint32_t hash, uint32_t len) {
+	berryBytecodeTrailer_t tr;
+	void *f;
+
+	// be_savecode raises (without a protected call around it) when it
+	// can not open the file, so make sure it can before calling it
+	f = be_fopen(becName, "wb");
+	if (f == 0) {
+		ADDLOG_ERROR(LOG_FEATURE_BERRY, "Can't create %s", becName);
+		return false;
+	}
+	be_fclose(f);
+	be_savecode(vm, becName);
+
+	tr.magic = magic;
+	tr.hash = hash;
+	tr.srcLen = len;
+	tr.version = berryBytecodeVersion();
+	f = be_fopen(becName, "ab");
+	if (f == 0) {
+		return false;
+	}
+	if (be_fwrite(f, &tr, sizeof(tr)) != sizeof(tr)) {
+		be_fclose(f);
+		return false;
+	}
+	be_fclose(f);
+	return true;
+}
+int berryCompileFile(bvm *vm, const char *fname, bool bForce) {
+	char becName[64];
+	uint32_t hash, len;
+	char *src;
+	void *f;
+	int res;
+
+	if (*fname == '/' || *fname == '\\') {
+		fname++;
+	}
+	if (!berryHashFile(fname, &hash, &len)) {
+		return BERRY_BYTECODE_NO_SOURCE;
+	}
+	berryGetBytecodeName(fname, becName, sizeof(becName));
+	if (!bForce && berryBytecodeMatches(becName, BERRY_BYTECODE_MAGIC, hash, len)) {
+		// the following import loads it without hashing the source again
+		strcpy(g_bytecodeChecked, becName);
+		g_bytecodeHits++;
+		return BERRY_BYTECODE_HIT;
+	}
+	src = (char*)malloc(len + 1);
+	if (src == 0) {
+		g_bytecodeFailures++;
+		return BERRY_BYTECODE_ERROR;
+	}
+	f = be_fopen_raw(fname, "rb");
+	if (f == 0 || be_fread(f, src, len) != len) {
+		if (f) {
+			be_fclose(f);
+		}
+		free(src);
+		g_bytecodeFailures++;
+		return BERRY_BYTECODE_ERROR;
+	}
+	be_fclose(f);
+	src[len] = 0;
+	res = be_loadbuffer(vm, fname, src, len);
+	free(src);
+	if (res != 0) {
+		ADDLOG_INFO(LOG_FEATURE_BERRY, "Compiling %s failed, retcode %d", fname, res);
 		be_dumpstack(vm);
 		be_error_pop_all(vm);
-		success = false;
-		goto err;
+		// don't let an old copy hide the error
+		berryDropBytecode(fname);
+		g_bytecodeFailures++;
+		return BERRY_BYTECODE_ERROR;
+	}
+	if (!berrySaveBytecode(vm, becName, BERRY_BYTECODE_MAGIC, hash, len)) {
+		be_pop(vm, 1);
+		berryDropBytecode(fname);
+		g_bytecodeFailures++;
+		return BERRY_BYTECODE_ERROR;
 	}
+	be_pop(vm, 1);
+	strcpy(g_bytecodeChecked, becName);
+	g_bytecodeCompiles++;
+	ADDLOG_INFO(LOG_FEATURE_BERRY, "Compiled %s to %s", fname, becName);
+	return BERRY_BYTECODE_COMPILED;
+}
+// Like berryRun, but for code generated from a file (Berry pages), cached as cacheName.bec
+bool berryRunCached(bvm *vm, const char *prog, const char *cacheName) {
+	char becName[64];
+	uint32_t hash, len;
+	bool success;
 
-	if (be_top(vm) > 1) {
+	len = strlen(prog);
+	hash = berryHashBytes(BERRY_HASH_BASIS, (const byte*)prog, len);
+	berryGetBytecodeName(cacheName, becName, sizeof(becName));
+	ADDLOG_INFO(LOG_FEATURE_BERRY, "[berry start]");
+	if (berryBytecodeMatches(becName, BERRY_PAGE_MAGIC, hash, len)) {
+		strcpy(g_bytecodeChecked, becName);
+		if (be_loadfile(vm, becName) == 0) {
+			g_bytecodeHits++;
+			success = berryCallLoaded(vm);
+			goto done;
+		}
 		be_error_pop_all(vm);
-	} else {
-		be_pop(vm, 1);
 	}
+	if (be_loadstring(vm, prog) != 0) {
+		ADDLOG_INFO(LOG_FEATURE_BERRY, "be_loadstring fail: %s", prog);
+		be_dumpstack(vm);
+		be_error_pop_all(vm);
+		g_bytecodeFailures++;
+		success = false;
+		goto done;
+	}
+	if (berrySaveBytecode(vm, becName, BERRY_PAGE_MAGIC, hash, len)) {
+		g_bytecodeCompiles++;
+	}
+	else {
+		berryDropBytecode(cacheName);
+		g_bytecodeFailures++;
+	}
+	success = berryCallLoaded(vm);
 
-err:
+done:
 	ADDLOG_INFO(LOG_FEATURE_BERRY, "[berry end]");
 	return success;
 }
 
-void berryRunClosure(bvm *vm, int closureId) {
-	//int s1 = Berry_GetStackSizeCurrent();
-	if (!be_getglobal(vm, "run_closure")) {
+static const char *g_dispatchHelpers[BERRY_DISPATCH_MAX_ARGS + 1] = {
+	"_run_closure0",
+	"_run_closure1",
+	"_run_closure2",
+};
+static int g_dispatchEvents = 0;
+static int g_dispatchBatches = 0;
+static int g_dispatchGCRuns = 0;
+static int g_dispatchStatsStart = 0;
+static bvm *g_batchVM = 0;
+static int g_batchDepth = 0;
+static int g_batchEvents = 0;
+static size_t g_batchThreshold = 0;
+static size_t g_batchRaisedThreshold = 0;
+
+void berryDispatchBegin(bvm *vm, berryDispatch_t *d) {
+	memset(d, 0, sizeof(*d));
+	d->vm = vm;
+	d->base = be_top(vm);
+}
+void berryDispatchShareStr(berryDispatch_t *d, int slot, const char *s) {
+	if (d->shared[slot]) {
 		return;
 	}
-	be_pushint(vm, closureId);
-	// call run_closure(closureId)
-	be_call(vm, 1);
-	//int s2 = Berry_GetStackSizeCurrent();
-	be_pop(vm, 2);
-	//int s3 = Berry_GetStackSizeCurrent();
-	//printf("%i %i %i\n", s1, s2, s3);
+	be_pushstring(d->vm, s);
+	d->shared[slot] = be_top(d->vm);
 }
-void berryRunClosureBytes(bvm *vm, int closureId, byte *data, int len) {
-	//int s1 = Berry_GetStackSizeCurrent();
-	if (!be_getglobal(vm, "run_closure")) {
+// all handlers of the event get the same bytes instance
+void berryDispatchShareBytes(berryDispatch_t *d, int slot, const byte *data, int len) {
+	if (d->shared[slot]) {
 		return;
 	}
-	be_pushint(vm, closureId);
-	be_pushbytes(vm, data, len);
-	// call run_closure(closureId)
-	be_call(vm, 2);
-	//int s2 = Berry_GetStackSizeCurrent();
-	be_pop(vm, 3);
-	//int s3 = Berry_GetStackSizeCurrent();
-	//printf("%i %i %i\n", s1, s2, s3);
+	be_pushbytes(d->vm, data, len);
+	d->shared[slot] = be_top(d->vm);
 }
-void berryRunClosureIntBytes(bvm *vm, int closureId, int x, const byte *data, int len) {
-	//int s1 = Berry_GetStackSizeCurrent();
-	if (!be_getglobal(vm, "run_closure")) {
-		return;
+void berryDispatchPushShared(berryDispatch_t *d, int slot) {
+	be_pushvalue(d->vm, d->shared[slot]);
+}
+bool berryDispatchPrepare(berryDispatch_t *d, int closureId, int argc) {
+	if (d->helpers[argc] == 0) {
+		if (!be_getglobal(d->vm, g_dispatchHelpers[argc])) {
+			// prelude not loaded??
+			be_pop(d->vm, 1);
+			return false;
+		}
+		d->helpers[argc] = be_top(d->vm);
 	}
-	be_pushint(vm, closureId);
-	be_pushint(vm, x);
-	be_pushbytes(vm, data, len);
-	// call run_closure(closureId)
-	be_call(vm, 3);
-	//int s2 = Berry_GetStackSizeCurrent();
-	be_pop(vm, 4);
-	//int s3 = Berry_GetStackSizeCurrent();
-	//printf("%i %i %i\n", s1, s2, s3);
+	be_pushvalue(d->vm, d->helpers[argc]);
+	be_pushint(d->vm, closureId);
+	return true;
 }
-void berryRunClosureIntInt(bvm *vm, int closureId, int x, int y) {
-	//int s1 = Berry_GetStackSizeCurrent();
-	if (!be_getglobal(vm, "run_closure")) {
-		return;
+void berryDispatchCall(berryDispatch_t *d, int argc) {
+	// closure id is the first argument of the helper
+	be_call(d->vm, argc + 1);
+	be_pop(d->vm, argc + 2);
+	g_dispatchEvents++;
+}
+void berryDispatchEnd(berryDispatch_t *d) {
+	int n;
+
+	n = be_top(d->vm) - d->base;
+	if (n > 0) {
+		be_pop(d->vm, n);
 	}
-	be_pushint(vm, closureId);
-	be_pushint(vm, x);
-	be_pushint(vm, y);
-	// call run_closure(closureId)
-	be_call(vm, 3);
-	//int s2 = Berry_GetStackSizeCurrent();
-	be_pop(vm, 4);
-	//int s3 = Berry_GetStackSizeCurrent();
-	//printf("%i %i %i\n", s1, s2, s3);
 }
 
-void berryRunClosurePtr(bvm *vm, int closureId, void* x) {
-	//int s1 = Berry_GetStackSizeCurrent();
-	if (!be_getglobal(vm, "run_closure")) {
-		return;
+// Berry has no API to hold off the automatic collection, these two
+// are the only places that touch the collector state (struct bgc) directly
+static void berryHoldGC(bvm *vm) {
+	// handlers still get an automatic collection if they allocate a lot,
+	// the heap can only grow to a few times what it would without a batch
+	g_batchThreshold = vm->gc.threshold;
+	if (g_batchThreshold < ((size_t)-1) / BERRY_BATCH_GC_SLACK) {
+		g_batchRaisedThreshold = g_batchThreshold * BERRY_BATCH_GC_SLACK;
 	}
-	be_pushint(vm, closureId);
-	be_pushcomptr(vm, x);
-	// call run_closure(closureId)
-	be_call(vm, 2);
-	//int s2 = Berry_GetStackSizeCurrent();
-	be_pop(vm, 3);
-	//int s3 = Berry_GetStackSizeCurrent();
-	//printf("%i %i %i\n", s1, s2, s3);
+	else {
+		g_batchRaisedThreshold = g_batchThreshold;
+	}
+	vm->gc.threshold = g_batchRaisedThreshold;
 }
-void berryRunClosureInt(bvm *vm, int closureId, int x) {
-	int s1 = Berry_GetStackSizeCurrent();
-	if (!be_getglobal(vm, "run_closure")) {
+static bool berryReleaseGC(bvm *vm) {
+	// a collection inside the batch (raised threshold reached, or gc.collect())
+	// already set a new threshold from the current usage, keep that one
+	if (vm->gc.threshold == g_batchRaisedThreshold) {
+		vm->gc.threshold = g_batchThreshold;
+	}
+	// same condition as the automatic collection we held off
+	if (vm->gc.usage > vm->gc.threshold) {
+		be_gc_collect(vm);
+		return true;
+	}
+	return false;
+}
+void berryBatchBegin(bvm *vm) {
+	if (g_batchDepth++ > 0) {
 		return;
 	}
-	be_pushint(vm, closureId);
-	be_pushint(vm, x);
-	be_call(vm, 2);
-	//int s2 = Berry_GetStackSizeCurrent();
-	be_pop(vm, 3);
-	//int s3 = Berry_GetStackSizeCurrent();
-	//printf("%i %i %i\n", s1, s2, s3);
+	g_batchVM = vm;
+	g_batchEvents = g_dispatchEvents;
+	if (vm) {
+		berryHoldGC(vm);
+	}
 }
-void berryRunClosureStr(bvm *vm, int closureId, const char * x, const char * y) {
-	//int s1 = Berry_GetStackSizeCurrent();
-	if (!be_getglobal(vm, "run_closure")) {
+void berryBatchEnd() {
+	bvm *vm;
+
+	if (g_batchDepth <= 0 || --g_batchDepth > 0) {
 		return;
 	}
-	// call run_closure(closureId)
-	be_pushint(vm, closureId);
-	be_pushstring(vm, x);
-	//int s2;
-	if (y) {
-		be_pushstring(vm, y);
-		be_call(vm, 3);
-		//s2 = Berry_GetStackSizeCurrent();
-		be_pop(vm, 4);
+	vm = g_batchVM;
+	g_batchVM = 0;
+	if (vm == 0) {
+		return;
 	}
-	else {
-		be_call(vm, 2);
-		//s2 = Berry_GetStackSizeCurrent();
-		be_pop(vm, 3);
+	if (g_batchEvents != g_dispatchEvents) {
+		g_dispatchBatches++;
 	}
-	//int s3 = Berry_GetStackSizeCurrent();
-	//printf("%i %i %i\n", s1, s2, s3);
+	if (berryReleaseGC(vm)) {
+		g_dispatchGCRuns++;
+	}
+}
+// VM is being deleted, possibly from a handler inside a batch
+void berryBatchDetach(bvm *vm) {
+	if (g_batchVM == vm) {
+		g_batchVM = 0;
+	}
+}
+void berryGetDispatchStats(int *events, int *batches, int *gcRuns, int *seconds) {
+	*events = g_dispatchEvents;
+	*batches = g_dispatchBatches;
+	*gcRuns = g_dispatchGCRuns;
+	*seconds = (xTaskGetTickCount() - g_dispatchStatsStart) * portTICK_PERIOD_MS / 1000;
+}
+void berryResetDispatchStats() {
+	g_dispatchEvents = 0;
+	g_dispatchBatches = 0;
+	g_dispatchGCRuns = 0;
+	g_dispatchStatsStart = xTaskGetTickCount();
+	g_batchEvents = 0;
+}
+
+void berryRunClosure(bvm *vm, int closureId) {
+	berryDispatch_t d;
+
+	berryDispatchBegin(vm, &d);
+	if (berryDispatchPrepare(&d, closureId, 0)) {
+		berryDispatchCall(&d, 0);
+	}
+	berryDispatchEnd(&d);
 }
 void berryRemoveClosure(bvm *vm, int closureId) {
 	//int s1 = Berry_GetStackSizeCurrent();
@@ -6,13 +6,58 @@ extern const char berryPrelude[];
 void be_dumpstack(bvm *vm);
 
 bool berryRun(bvm *vm, const char *prog);
+bool berryRunCached(bvm *vm, const char *prog, const char *cacheName);
+
+// results of berryCompileFile
+#define BERRY_BYTECODE_NO_SOURCE	-2
+#define BERRY_BYTECODE_ERROR		-1
+#define BERRY_BYTECODE_HIT			0
+#define BERRY_BYTECODE_COMPILED		1
+
+int berryCompileFile(bvm *vm, const char *fname, bool bForce);
+bool berryBytecodeIsStale(const char *becName);
+void berryDropBytecode(const char *fname);
+void berryGetBytecodeName(const char *fname, char *out, int outSize);
+void berryGetBytecodeStats(int *hits, int *compiles, int *failures);
 void berryRunClosure(bvm* vm, int closureId);
-void berryRunClosureBytes(bvm *vm, int closureId, byte *data, int len);
-void berryRunClosureIntBytes(bvm *vm, int closureId, int x, const byte *data, int len);
-void berryRunClosureIntInt(bvm *vm, int closureId, int x, int y);
-void berryRunClosureInt(bvm *vm, int closureId, int x);
-void berryRunClosureStr(bvm *vm, int closureId, const char *x, const char *y);
-void berryRunClosurePtr(bvm *vm, int closureId, void *x);
+// be_fopen without the .bec check
+void *be_fopen_raw(const char *filename, const char *modes);
+
+// Runs the closures that handle one event. The helpers that look up a
+// suspended closure and the arguments shared by all handlers are pushed
+// once and stay on the stack until berryDispatchEnd.
+// Usage: berryDispatchShare* (optional, before the first Prepare),
+// then for each closure Prepare, push arguments, Call.
+#define BERRY_DISPATCH_MAX_ARGS		2
+#define BERRY_DISPATCH_MAX_SHARED	2
+
+typedef struct berryDispatch_s {
+	bvm *vm;
+	int base;
+	// stack indexes, 0 if not pushed yet
+	int helpers[BERRY_DISPATCH_MAX_ARGS + 1];
+	int shared[BERRY_DISPATCH_MAX_SHARED];
+} berryDispatch_t;
+
+void berryDispatchBegin(bvm *vm, berryDispatch_t *d);
+void berryDispatchShareStr(berryDispatch_t *d, int slot, const char *s);
+void berryDispatchShareBytes(berryDispatch_t *d, int slot, const byte *data, int len);
+bool berryDispatchPrepare(berryDispatch_t *d, int closureId, int argc);
+void berryDispatchPushShared(berryDispatch_t *d, int slot);
+void berryDispatchCall(berryDispatch_t *d, int argc);
+void berryDispatchEnd(berryDispatch_t *d);
+
+// Automatic garbage collection is held off between these and done
+// (if needed) once at the end. Batches nest. Inside a batch the collection
+// threshold is raised BERRY_BATCH_GC_SLACK times, not removed, so handler
+// code that allocates a lot is still collected.
+#define BERRY_BATCH_GC_SLACK		4
+
+void berryBatchBegin(bvm *vm);
+void berryBatchEnd();
+void berryBatchDetach(bvm *vm);
+void berryGetDispatchStats(int *events, int *batches, int *gcRuns, int *seconds);
+void berryResetDispatchStats();
 void berryRemoveClosure(bvm *vm, int closureId);
 void berryResumeClosure(bvm *vm, int closureId);
 void berryFreeAllClosures(bvm *vm);
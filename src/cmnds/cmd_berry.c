@@ -34,11 +34,53 @@ typedef struct berryInstance_s
 	int closureId;
 	eventWait_t wait;
 	bool bFire;
+	// scheduled for delayed closures and for waiters that were fired
+	timerEntry_t timer;
+	// list of threads waiting on the same event code, newest first
+	struct berryInstance_s* nextWaiter;
+	// NULL when not in a waiter list
+	struct berryInstance_s** prevWaiter;
 
 	struct berryInstance_s* next;
 } berryInstance_t;
 
 berryInstance_t *g_berryThreads = 0;
+static timerQueue_t g_berryTimers;
+// event handlers and change handlers, by event code
+static berryInstance_t *g_berryWaiters[CMD_EVENT_MAX_TYPES];
+
+static void Berry_RemoveWaiter(berryInstance_t *t) {
+	if (t->prevWaiter == 0) {
+		return;
+	}
+	*t->prevWaiter = t->nextWaiter;
+	if (t->nextWaiter) {
+		t->nextWaiter->prevWaiter = t->prevWaiter;
+	}
+	t->prevWaiter = 0;
+	// nextWaiter is left as is, so a loop that is visiting us can move on
+}
+static void Berry_AddWaiter(berryInstance_t *t) {
+	berryInstance_t **head;
+
+	Berry_RemoveWaiter(t);
+	if (t->wait.waitingForEvent >= CMD_EVENT_MAX_TYPES) {
+		return;
+	}
+	head = &g_berryWaiters[t->wait.waitingForEvent];
+	t->nextWaiter = *head;
+	if (*head) {
+		(*head)->prevWaiter = &t->nextWaiter;
+	}
+	*head = t;
+	t->prevWaiter = head;
+}
+static berryInstance_t *Berry_FirstWaiter(byte eventCode) {
+	if (eventCode >= CMD_EVENT_MAX_TYPES) {
+		return 0;
+	}
+	return g_berryWaiters[eventCode];
+}
 
 berryInstance_t *Berry_RegisterThread() {
 	berryInstance_t *r;
@@ -54,107 +96,189 @@ berryInstance_t *Berry_RegisterThread() {
 	if (r == 0) {
 		r = malloc(sizeof(berryInstance_t));
 		memset(r, 0, sizeof(berryInstance_t));
+		TimerQueue_InitEntry(&r->timer, r);
 		r->next = g_berryThreads;
 		g_berryThreads = r;
 	}
+	TimerQueue_Cancel(&g_berryTimers, &r->timer);
+	Berry_RemoveWaiter(r);
 	r->uniqueID = 0;
 	r->currentDelayMS = 0;
 	return r;
 }
 
 void CMD_Berry_ProcessWaitersForEvent(byte eventCode, int argument) {
-	berryInstance_t *t;
+	berryInstance_t *t, *next;
 
 
-	t = g_berryThreads;
+	t = Berry_FirstWaiter(eventCode);
 
 	while (t) {
+		next = t->nextWaiter;
 		if (CheckEventCondition(&t->wait, eventCode, argument)) {
 			t->bFire = true;
+			TimerQueue_Schedule(&g_berryTimers, &t->timer, 0);
 		}
-		t = t->next;
+		t = next;
 	}
 	// TODO: better
 	CMD_Berry_RunEventHandlers_IntInt(eventCode, argument, 0);
 }
+void Berry_BeginEventBatch() {
+	berryBatchBegin(g_vm);
+}
+void Berry_EndEventBatch() {
+	berryBatchEnd();
+}
 void CMD_Berry_RunEventHandlers_IntInt(byte eventCode, int argument, int argument2) {
-	berryInstance_t *t;
-
-	t = g_berryThreads;
+	berryInstance_t *t, *next;
+	berryDispatch_t d;
 
+	t = Berry_FirstWaiter(eventCode);
+	if (t == 0 || g_vm == 0) {
+		return;
+	}
+	berryBatchBegin(g_vm);
+	berryDispatchBegin(g_vm, &d);
 	while (t) {
+		// closure may cancel this handler
+		next = t->nextWaiter;
 		if (t->wait.waitingForEvent == eventCode
 			&& t->wait.waitingForRelation == 'a') {
-			berryRunClosureIntInt(g_vm, t->closureId, argument, argument2);
+			if (berryDispatchPrepare(&d, t->closureId, 2)) {
+				be_pushint(g_vm, argument);
+				be_pushint(g_vm, argument2);
+				berryDispatchCall(&d, 2);
+			}
 		} else if (t->wait.waitingForEvent == eventCode
 			&& t->wait.waitingForRelation == 'm'
 			&& t->wait.waitingForArgument == argument) {
-			berryRunClosureInt(g_vm, t->closureId, argument2);
+			if (berryDispatchPrepare(&d, t->closureId, 1)) {
+				be_pushint(g_vm, argument2);
+				berryDispatchCall(&d, 1);
+			}
 		}
-		t = t->next;
+		t = next;
 	}
+	berryDispatchEnd(&d);
+	berryBatchEnd();
 }
 
 int CMD_Berry_RunEventHandlers_StrPtr(byte eventCode, const char *argument, void* argument2) {
-	berryInstance_t *t;
-
-	t = g_berryThreads;
-
+	berryInstance_t *t, *next;
+	berryDispatch_t d;
 	int calls = 0;
+
+	t = Berry_FirstWaiter(eventCode);
+	if (t == 0 || g_vm == 0) {
+		return 0;
+	}
+	berryBatchBegin(g_vm);
+	berryDispatchBegin(g_vm, &d);
 	while (t) {
+		// closure may cancel this handler
+		next = t->nextWaiter;
 		if (t->wait.waitingForEvent == eventCode
 			&& t->wait.waitingForRelation == 'a') {
-			berryRunClosureStr(g_vm, t->closureId, argument, argument2);
+			berryDispatchShareStr(&d, 0, argument);
+			if (berryDispatchPrepare(&d, t->closureId, 2)) {
+				berryDispatchPushShared(&d, 0);
+				be_pushcomptr(g_vm, argument2);
+				berryDispatchCall(&d, 2);
+			}
 			calls++;
 		} else if (t->wait.waitingForEvent == eventCode
 			&& t->wait.waitingForRelation == 'm'
 			&& !stricmp(t->wait.waitingForArgumentStr,argument)) {
-			berryRunClosurePtr(g_vm, t->closureId, argument2);
+			if (berryDispatchPrepare(&d, t->closureId, 1)) {
+				be_pushcomptr(g_vm, argument2);
+				berryDispatchCall(&d, 1);
+			}
 			calls++;
 		}
-		t = t->next;
+		t = next;
 	}
+	berryDispatchEnd(&d);
+	berryBatchEnd();
 	return calls;
 }
 
 void CMD_Berry_RunEventHandlers_IntBytes(byte eventCode, int argument, const byte *data, int size) {
-	berryInstance_t *t;
-
-	t = g_berryThreads;
+	berryInstance_t *t, *next;
+	berryDispatch_t d;
 
+	t = Berry_FirstWaiter(eventCode);
+	if (t == 0 || g_vm == 0) {
+		return;
+	}
+	berryBatchBegin(g_vm);
+	berryDispatchBegin(g_vm, &d);
 	while (t) {
+		// closure may cancel this handler
+		next = t->nextWaiter;
 		if (t->wait.waitingForEvent == eventCode
 			&& t->wait.waitingForRelation == 'a') {
-			berryRunClosureIntBytes(g_vm, t->closureId, argument, data, size);
+			berryDispatchShareBytes(&d, 0, data, size);
+			if (berryDispatchPrepare(&d, t->closureId, 2)) {
+				be_pushint(g_vm, argument);
+				berryDispatchPushShared(&d, 0);
+				berryDispatchCall(&d, 2);
+			}
 		}
 		else if (t->wait.waitingForEvent == eventCode
 			&& t->wait.waitingForRelation == 'm'
 			&& t->wait.waitingForArgument == argument) {
-			berryRunClosureBytes(g_vm, t->closureId, data, size);
+			berryDispatchShareBytes(&d, 0, data, size);
+			if (berryDispatchPrepare(&d, t->closureId, 1)) {
+				berryDispatchPushShared(&d, 0);
+				berryDispatchCall(&d, 1);
+			}
 		}
-		t = t->next;
+		t = next;
 	}
+	berryDispatchEnd(&d);
+	berryBatchEnd();
 }
 int CMD_Berry_RunEventHandlers_Str(byte eventCode, const char *argument, const char *argument2) {
-	berryInstance_t *t;
-
-	t = g_berryThreads;
-
+	berryInstance_t *t, *next;
+	berryDispatch_t d;
 	int c_run = 0;
+
+	t = Berry_FirstWaiter(eventCode);
+	if (t == 0 || g_vm == 0) {
+		return 0;
+	}
+	berryBatchBegin(g_vm);
+	berryDispatchBegin(g_vm, &d);
 	while (t) {
+		// closure may cancel this handler
+		next = t->nextWaiter;
 		if (t->wait.waitingForEvent == eventCode
 			&& t->wait.waitingForRelation == 'a') {
-			berryRunClosureStr(g_vm, t->closureId, argument, argument2);
+			berryDispatchShareStr(&d, 0, argument);
+			berryDispatchShareStr(&d, 1, argument2);
+			if (berryDispatchPrepare(&d, t->closureId, 2)) {
+				berryDispatchPushShared(&d, 0);
+				berryDispatchPushShared(&d, 1);
+				berryDispatchCall(&d, 2);
+			}
 			c_run++;
 		}
 		else if (t->wait.waitingForEvent == eventCode
 			&& t->wait.waitingForRelation == 'm'
 			&& !stricmp(t->wait.waitingForArgumentStr,argument)) {
-			berryRunClosureStr(g_vm, t->closureId, argument2, "");
+			berryDispatchShareStr(&d, 1, argument2);
+			if (berryDispatchPrepare(&d, t->closureId, 2)) {
+				berryDispatchPushShared(&d, 1);
+				be_pushstring(g_vm, "");
+				berryDispatchCall(&d, 2);
+			}
 			c_run++;
 		}
-		t = t->next;
+		t = next;
 	}
+	berryDispatchEnd(&d);
+	berryBatchEnd();
 	return c_run;
 }
 int be_addClosure(bvm *vm, const char *eventName, int relation, int reqArg, const char *reqArgStr, int argumentIndex) {
@@ -196,6 +320,7 @@ int be_addClosure(bvm *vm, const char *eventName, int relation, int reqArg, cons
 		}
 		th->wait.waitingForRelation = relation;
 		th->closureId = closure_id;
+		Berry_AddWaiter(th);
 
 		// remove the 2 values we pushed on the stack
 		be_pop(vm, 2);
@@ -295,6 +420,7 @@ int be_setTimeoutInternal(bvm *vm, int repeats) {
 			th->totalDelayMS = delay_ms;
 			th->closureId = closure_id;
 			th->delayRepeats = repeats;
+			TimerQueue_Schedule(&g_berryTimers, &th->timer, delay_ms);
 
 			// remove the 2 values we pushed on the stack
 			be_pop(vm, 2);
@@ -461,6 +587,37 @@ void eval_berry_snippet(const char *s) {
 		berryRun(g_vm, s);
 	}
 }
+void eval_berry_cached(const char *s, const char *cacheName) {
+	if (BasicInit()) {
+		berryRunCached(g_vm, s, cacheName);
+	}
+}
+// Makes sure fname.bec matches fname, so a following "import" loads bytecode
+int Berry_CompileFile(const char *fname, bool bForce) {
+	if (BasicInit()) {
+		return berryCompileFile(g_vm, fname, bForce);
+	}
+	return BERRY_BYTECODE_ERROR;
+}
+static commandResult_t CMD_BerryCompile(const void *context, const char *cmd, const char *args, int cmdFlags) {
+	int hits, compiles, failures;
+	int res;
+
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() >= 1) {
+		res = Berry_CompileFile(Tokenizer_GetArg(0), true);
+		if (res == BERRY_BYTECODE_NO_SOURCE) {
+			ADDLOG_ERROR(LOG_FEATURE_BERRY, "berryCompile: no file %s", Tokenizer_GetArg(0));
+			return CMD_RES_BAD_ARGUMENT;
+		}
+		if (res == BERRY_BYTECODE_ERROR) {
+			return CMD_RES_ERROR;
+		}
+	}
+	berryGetBytecodeStats(&hits, &compiles, &failures);
+	ADDLOG_INFO(LOG_FEATURE_BERRY, "Bytecode cache: %i hits, %i compiles, %i failures", hits, compiles, failures);
+	return CMD_RES_OK;
+}
 
 void berryThreadComplete(berryInstance_t *thread) {
 	// Free the associated closure if it exists
@@ -481,6 +638,8 @@ void berryThreadComplete(berryInstance_t *thread) {
 		}
 	}
 
+	TimerQueue_Cancel(&g_berryTimers, &thread->timer);
+	Berry_RemoveWaiter(thread);
 	// Reset all Berry-specific flags and data
 	thread->closureId = -1;
 	thread->uniqueID = 0;
@@ -507,6 +666,7 @@ void stopBerrySVM() {
 void CMD_StopBerry() {
 	if (g_vm) {
 		stopBerrySVM();
+		berryBatchDetach(g_vm);
 		be_vm_delete(g_vm);
 		g_vm = NULL;
 	}
@@ -561,53 +721,64 @@ int Berry_GetStackSizeCurrent() {
 }
 
 void Berry_RunThreads(int deltaMS) {
-	int c_sleep, c_run;
-
-	c_sleep = 0;
-	c_run = 0;
-
+	berryInstance_t *t;
+	timerEntry_t *e;
 
-	berryInstance_t *g_activeThread = g_berryThreads;
-	while (g_activeThread) {
-		if (g_activeThread->uniqueID > 0) {
-			if (g_activeThread->wait.waitingForEvent) {
-				if (g_activeThread->bFire) {
-					berryRunClosure(g_vm, g_activeThread->closureId);
-					g_activeThread->bFire = false;
-				}
-				// do nothing
+	TimerQueue_Advance(&g_berryTimers, deltaMS);
+	if (TimerQueue_GetNextDelay(&g_berryTimers) != 0) {
+		return;
+	}
+	// everything due in this tick shares one collection check
+	berryBatchBegin(g_vm);
+	while ((e = TimerQueue_PopDue(&g_berryTimers)) != 0) {
+		t = (berryInstance_t*)e->owner;
+		if (t->uniqueID <= 0) {
+			continue;
+		}
+		if (t->wait.waitingForEvent) {
+			if (t->bFire) {
+				t->bFire = false;
+				berryRunClosure(g_vm, t->closureId);
+			}
+		}
+		else if (t->currentDelayMS > 0) {
+			// reschedule before running, closure may cancel itself
+			if (t->delayRepeats == -1) {
+				t->currentDelayMS = t->totalDelayMS;
+				TimerQueue_Schedule(&g_berryTimers, &t->timer, t->currentDelayMS);
+				berryRunClosure(g_vm, t->closureId);
+			}
+			else if (t->delayRepeats > 0) {
+				t->delayRepeats--;
+				t->currentDelayMS = t->totalDelayMS;
+				TimerQueue_Schedule(&g_berryTimers, &t->timer, t->currentDelayMS);
+				berryRunClosure(g_vm, t->closureId);
 			}
 			else {
-				if (g_activeThread->currentDelayMS > 0) {
-					g_activeThread->currentDelayMS -= deltaMS;
-					// the following block is needed to handle with long freezes on simulator
-					if (g_activeThread->currentDelayMS <= 0) {
-						if (g_activeThread->delayRepeats == -1) {
-							berryRunClosure(g_vm, g_activeThread->closureId);
-							g_activeThread->currentDelayMS = g_activeThread->totalDelayMS;
-						}
-						else if (g_activeThread->delayRepeats > 0) {
-							g_activeThread->delayRepeats--;
-							berryRunClosure(g_vm, g_activeThread->closureId);
-							g_activeThread->currentDelayMS = g_activeThread->totalDelayMS;
-						}
-						else {
-							// finish totally
-							berryRunClosure(g_vm, g_activeThread->closureId);
-							berryRemoveClosure(g_vm, g_activeThread->closureId);
-							g_activeThread->closureId = 0;
-							g_activeThread->uniqueID = 0;//free
-						}
-					}
-				}
-				else {
-					Berry_RunThread(g_activeThread);
-				}
+				// finish totally
+				berryRunClosure(g_vm, t->closureId);
+				berryRemoveClosure(g_vm, t->closureId);
+				t->closureId = 0;
+				t->uniqueID = 0;//free
 			}
 		}
-		g_activeThread = g_activeThread->next;
+		else {
+			Berry_RunThread(t);
+		}
 	}
+	berryBatchEnd();
+}
+static commandResult_t CMD_BerryDispatchStats(const void *context, const char *cmd, const char *args, int cmdFlags) {
+	int events, batches, gcRuns, seconds;
 
+	Tokenizer_TokenizeString(args, 0);
+	berryGetDispatchStats(&events, &batches, &gcRuns, &seconds);
+	ADDLOG_INFO(LOG_FEATURE_BERRY, "Berry dispatch: %i handler calls in %i s (%i/s), %i batches, %i GC runs",
+		events, seconds, seconds > 0 ? events / seconds : events, batches, gcRuns);
+	if (Tokenizer_GetArgInteger(0)) {
+		berryResetDispatchStats();
+	}
+	return CMD_RES_OK;
 }
 void CMD_InitBerry() {
 	//cmddetail:{"name":"berry","args":"[Berry code]",
@@ -620,6 +791,16 @@ void CMD_InitBerry() {
 	//cmddetail:"fn":"CMD_StopBerryCommand","file":"cmnds/cmd_berry.c","requires":"",
 	//cmddetail:"examples":"stopBerry"}
 	CMD_RegisterCommand("stopBerry", CMD_StopBerryCommand, NULL);
+	//cmddetail:{"name":"berryCompile","args":"[FileName]",
+	//cmddetail:"descr":"Compiles given Berry file to bytecode (.bec next to it, loaded by import instead of the source) and prints bytecode cache statistics. Without argument, only prints statistics",
+	//cmddetail:"fn":"CMD_BerryCompile","file":"cmnds/cmd_berry.c","requires":"",
+	//cmddetail:"examples":"berryCompile autoexec.be"}
+	CMD_RegisterCommand("berryCompile", CMD_BerryCompile, NULL);
+	//cmddetail:{"name":"berryDispatchStats","args":"[bReset]",
+	//cmddetail:"descr":"Prints how many Berry event handlers and timers ran (also per second), in how many batches, and how many garbage collections ran at the end of a batch. Pass 1 to reset the counters after printing",
+	//cmddetail:"fn":"CMD_BerryDispatchStats","file":"cmnds/cmd_berry.c","requires":"",
+	//cmddetail:"examples":"berryDispatchStats 1"}
+	CMD_RegisterCommand("berryDispatchStats", CMD_BerryDispatchStats, NULL);
 }
 
 #endif
@@ -302,31 +302,126 @@ typedef struct eventHandler_s {
 	int requiredArgument;
 	int requiredArgument2;
 	int requiredArgument3;
-	// command to execute when it happens
-	char *command;
+	// command to execute when it happens, parsed once when handler is added
+	cmdPrepared_t *command;
 	// for UART event handlers?
 	char *requiredArgumentText;
 
+	// full list, in order of adding, for listing and freeing
 	struct eventHandler_s *next;
+	// next in dispatch bucket
+	struct eventHandler_s *nextInBucket;
+	// order of adding, buckets are merged by it so handlers
+	// still run newest first, just like walking the full list
+	int order;
 } eventHandler_t;
 
+// Handlers are also sorted into buckets, so firing an event
+// only visits handlers that can match it.
+// Plain handlers with integer argument ("addEventHandler OnClick 5 ...")
+// are hashed by event code and argument, because they need an exact match.
+// Change handlers (relations) and string argument handlers
+// are hashed by event code only.
+#define EVENT_HASH_SIZE 32
+
 static eventHandler_t *g_eventHandlers = 0;
+static eventHandler_t *g_eventsByArgument[EVENT_HASH_SIZE];
+static eventHandler_t *g_eventsByCode[EVENT_HASH_SIZE];
+
+static int g_eventHandlersCount = 0;
+static int g_eventHandlersAdded = 0;
+static int g_eventDispatches = 0;
+static int g_eventHandlersRan = 0;
+static int g_eventHandlersVisited = 0;
+// most handlers one dispatch had to look at
+static int g_eventDispatchMaxVisited = 0;
+
+static int EVENT_HashArgument(byte eventCode, int argument) {
+	unsigned int h = eventCode * 31 + (unsigned int)argument;
+	h ^= h >> 5;
+	return h & (EVENT_HASH_SIZE - 1);
+}
+static int EVENT_HashCode(byte eventCode) {
+	return eventCode & (EVENT_HASH_SIZE - 1);
+}
+static void EVENT_AddToBucket(eventHandler_t *ev) {
+	eventHandler_t **bucket;
+
+	// keep newest first, as in the full list
+	ev->next = g_eventHandlers;
+	g_eventHandlers = ev;
 
+	if (ev->eventType == EVENT_DEFAULT && ev->requiredArgumentText == 0) {
+		bucket = &g_eventsByArgument[EVENT_HashArgument(ev->eventCode, ev->requiredArgument)];
+	}
+	else {
+		bucket = &g_eventsByCode[EVENT_HashCode(ev->eventCode)];
+	}
+	ev->order = g_eventHandlersAdded++;
+	ev->nextInBucket = *bucket;
+	*bucket = ev;
+	g_eventHandlersCount++;
+}
+static int EVENT_BeginDispatch() {
+	g_eventDispatches++;
+	return g_eventHandlersVisited;
+}
+static void EVENT_EndDispatch(int startVisited) {
+	int visited = g_eventHandlersVisited - startVisited;
+	if (visited > g_eventDispatchMaxVisited) {
+		g_eventDispatchMaxVisited = visited;
+	}
+}
+// runs handlers with exact integer argument match, used by FireEvent, FireEvent2 and FireEvent3
+static int EVENT_FireMatching(const char *who, byte eventCode, int argument, int argument2, int argument3, int argsToCheck) {
+	struct eventHandler_s *ev, *byArg, *byCode;
+	int ran = 0;
+
+	byArg = g_eventsByArgument[EVENT_HashArgument(eventCode, argument)];
+	byCode = g_eventsByCode[EVENT_HashCode(eventCode)];
+	// both buckets are newest first, merge them to keep that order
+	while (byArg || byCode) {
+		if (byCode == 0 || (byArg && byArg->order > byCode->order)) {
+			ev = byArg;
+			byArg = byArg->nextInBucket;
+		}
+		else {
+			ev = byCode;
+			byCode = byCode->nextInBucket;
+		}
+		g_eventHandlersVisited++;
+		if (eventCode == ev->eventCode && argument == ev->requiredArgument
+			&& (argsToCheck < 2 || argument2 == ev->requiredArgument2)
+			&& (argsToCheck < 3 || argument3 == ev->requiredArgument3)) {
+			ADDLOG_INFO(LOG_FEATURE_EVENT, "%s: executing command %s", who, CMD_GetPreparedCommandText(ev->command));
+			CMD_ExecutePreparedCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
+			ran++;
+		}
+	}
+	g_eventHandlersRan += ran;
+	return ran;
+}
 
 void EventHandlers_ProcessVariableChange_Integer(byte eventCode, int oldValue, int newValue) {
 	struct eventHandler_s *ev;
+	int startVisited;
 
-	ev = g_eventHandlers;
+	startVisited = EVENT_BeginDispatch();
+	// only change handlers can match, and they are all bucketed by code
+	ev = g_eventsByCode[EVENT_HashCode(eventCode)];
 
 	while(ev) {
+		g_eventHandlersVisited++;
 		if(eventCode==ev->eventCode) {
 			if(EVENT_EvaluateChangeCondition(ev->eventType, ev->requiredArgument, oldValue, newValue)) {
-				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_ProcessVariableChange_Integer: executing command %s",ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
+				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_ProcessVariableChange_Integer: executing command %s",CMD_GetPreparedCommandText(ev->command));
+				CMD_ExecutePreparedCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
+				g_eventHandlersRan++;
 			}
 		}
-		ev = ev->next;
+		ev = ev->nextInBucket;
 	}
+	EVENT_EndDispatch(startVisited);
 
 #if ENABLE_OBK_SCRIPTING
 	CMD_Script_ProcessWaitersForEvent(eventCode, newValue);
@@ -338,16 +433,20 @@ void EventHandlers_AddEventHandler_Integer(byte eventCode, int type, int require
 	eventHandler_t *ev = malloc(sizeof(eventHandler_t));
 	memset(ev,0,sizeof(eventHandler_t));
 
-	ev->next = g_eventHandlers;
-	g_eventHandlers = ev;
-
 	ev->requiredArgumentText = NULL;
 	ev->eventType = type;
-	ev->command = strdup(commandToRun);
+	ev->command = CMD_PrepareCommand(commandToRun);
+	if (ev->command == 0) {
+		free(ev->requiredArgumentText);
+		free(ev);
+		return;
+	}
 	ev->eventCode = eventCode;
 	ev->requiredArgument = requiredArgument;
 	ev->requiredArgument2 = requiredArgument2;
 	ev->requiredArgument3 = requiredArgument3;
+
+	EVENT_AddToBucket(ev);
 }
 
 void EventHandlers_AddEventHandler_String(byte eventCode, int type, const char *requiredArgument, const char *commandToRun)
@@ -355,50 +454,37 @@ void EventHandlers_AddEventHandler_String(byte eventCode, int type, const char *
 	eventHandler_t *ev = malloc(sizeof(eventHandler_t));
 	memset(ev,0,sizeof(eventHandler_t));
 
-	ev->next = g_eventHandlers;
-	g_eventHandlers = ev;
-
 	ev->requiredArgumentText = strdup(requiredArgument);
 	ev->eventType = type;
-	ev->command = strdup(commandToRun);
+	ev->command = CMD_PrepareCommand(commandToRun);
+	if (ev->command == 0) {
+		free(ev->requiredArgumentText);
+		free(ev);
+		return;
+	}
 	ev->eventCode = eventCode;
 	ev->requiredArgument = 0;
 	ev->requiredArgument2 = 0;
+
+	EVENT_AddToBucket(ev);
 }
 int EventHandlers_FireEvent3(byte eventCode, int argument, int argument2, int argument3) {
-	struct eventHandler_s *ev;
+	int startVisited;
+	int ran;
 
-	ev = g_eventHandlers;
-	int ran = 0;
-	while (ev) {
-		if (eventCode == ev->eventCode) {
-			if (argument == ev->requiredArgument && argument2 == ev->requiredArgument2 && argument3 == ev->requiredArgument3) {
-				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent3: executing command %s", ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
-				ran++;
-			}
-		}
-		ev = ev->next;
-	}
+	startVisited = EVENT_BeginDispatch();
+	ran = EVENT_FireMatching("EventHandlers_FireEvent3", eventCode, argument, argument2, argument3, 3);
+	EVENT_EndDispatch(startVisited);
 	return ran;
 }
 int EventHandlers_FireEvent2(byte eventCode, int argument, int argument2) {
-	struct eventHandler_s *ev;
-	int ret = 0;
+	int startVisited;
+	int ran;
 
-	ev = g_eventHandlers;
-
-	while(ev) {
-		if(eventCode==ev->eventCode) {
-			if(argument == ev->requiredArgument && argument2 == ev->requiredArgument2) {
-				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent2: executing command %s",ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
-				ret++;
-			}
-		}
-		ev = ev->next;
-	}
-	return ret;
+	startVisited = EVENT_BeginDispatch();
+	ran = EVENT_FireMatching("EventHandlers_FireEvent2", eventCode, argument, argument2, 0, 2);
+	EVENT_EndDispatch(startVisited);
+	return ran;
 }
 // for simulator only
 const char *EventHandlers_GetHandlerCommand2(byte eventCode, int argument, int argument2) {
@@ -410,7 +496,7 @@ const char *EventHandlers_GetHandlerCommand2(byte eventCode, int argument, int a
 	while (ev) {
 		if (eventCode == ev->eventCode) {
 			if (argument == ev->requiredArgument && argument2 == ev->requiredArgument2) {
-				return ev->command;
+				return CMD_GetPreparedCommandText(ev->command);
 			}
 		}
 		ev = ev->next;
@@ -420,19 +506,11 @@ const char *EventHandlers_GetHandlerCommand2(byte eventCode, int argument, int a
 
 
 void EventHandlers_FireEvent(byte eventCode, int argument) {
-	struct eventHandler_s *ev;
+	int startVisited;
 
-	ev = g_eventHandlers;
-
-	while(ev) {
-		if(eventCode==ev->eventCode) {
-			if(argument == ev->requiredArgument) {
-				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent: executing command %s",ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
-			}
-		}
-		ev = ev->next;
-	}
+	startVisited = EVENT_BeginDispatch();
+	EVENT_FireMatching("EventHandlers_FireEvent", eventCode, argument, 0, 0, 1);
+	EVENT_EndDispatch(startVisited);
 
 #if ENABLE_OBK_SCRIPTING
 	CMD_Script_ProcessWaitersForEvent(eventCode, argument);
@@ -440,21 +518,25 @@ void EventHandlers_FireEvent(byte eventCode, int argument) {
 }
 void EventHandlers_FireEvent_String(byte eventCode, const char *argument) {
 	struct eventHandler_s *ev;
+	int startVisited;
 
-	ev = g_eventHandlers;
+	startVisited = EVENT_BeginDispatch();
+	ev = g_eventsByCode[EVENT_HashCode(eventCode)];
 
 	while(ev) {
+		g_eventHandlersVisited++;
 		if(eventCode==ev->eventCode) {
 			if(ev->requiredArgumentText != 0) {
 				if(!stricmp(argument,ev->requiredArgumentText)) {
-					ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent_String: executing command %s",ev->command);
-					CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
+					ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent_String: executing command %s",CMD_GetPreparedCommandText(ev->command));
+					CMD_ExecutePreparedCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
+					g_eventHandlersRan++;
 				}
 			}
 		}
-		ev = ev->next;
+		ev = ev->nextInBucket;
 	}
-
+	EVENT_EndDispatch(startVisited);
 }
 
 // NOTE: this also handles addEventHandler2, an event handler with two arguments
@@ -531,7 +613,8 @@ commandResult_t CMD_ClearAllHandlers(const void *context, const char *cmd, const
 	while(ev != 0) {
 		next = ev->next;
 
-		free(ev->command);
+		CMD_FreePreparedCommand(ev->command);
+		free(ev->requiredArgumentText);
 		free(ev);
 
 		ev = next;
@@ -540,6 +623,9 @@ commandResult_t CMD_ClearAllHandlers(const void *context, const char *cmd, const
 
 	addLogAdv(LOG_INFO, LOG_FEATURE_CMD, "Fried %i handlers", c);
 	g_eventHandlers = 0;
+	memset(g_eventsByArgument, 0, sizeof(g_eventsByArgument));
+	memset(g_eventsByCode, 0, sizeof(g_eventsByCode));
+	g_eventHandlersCount = 0;
 
 	return CMD_RES_OK;
 }
@@ -592,7 +678,7 @@ static commandResult_t CMD_ListEventHandlers(const void *context, const char *cm
 
 	while(ev) {
 
-		ADDLOG_INFO(LOG_FEATURE_EVENT, "Event %i has code %i and command %s",c,ev->eventCode,ev->command);
+		ADDLOG_INFO(LOG_FEATURE_EVENT, "Event %i has code %i and command %s",c,ev->eventCode,CMD_GetPreparedCommandText(ev->command));
 		ev = ev->next;
 		c++;
 	}
@@ -600,17 +686,55 @@ static commandResult_t CMD_ListEventHandlers(const void *context, const char *cm
 	return CMD_RES_OK;
 }
 int EventHandlers_GetActiveCount() {
-	struct eventHandler_s *ev;
-	int c;
-
-	ev = g_eventHandlers;
-	c = 0;
-
-	while (ev) {
-		ev = ev->next;
-		c++;
+	return g_eventHandlersCount;
+}
+// eventHandlerStats [reset]
+static commandResult_t CMD_EventHandlerStats(const void *context, const char *cmd, const char *args, int cmdFlags) {
+	int i;
+	int usedBuckets;
+	int longestBucket;
+	int len;
+	int preparedRuns, preparedFallbacks;
+	eventHandler_t *ev;
+
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() > 0 && !stricmp(Tokenizer_GetArg(0), "reset")) {
+		g_eventDispatches = 0;
+		g_eventHandlersRan = 0;
+		g_eventHandlersVisited = 0;
+		g_eventDispatchMaxVisited = 0;
+		ADDLOG_INFO(LOG_FEATURE_EVENT, "Event handler stats cleared");
+		return CMD_RES_OK;
+	}
+	usedBuckets = 0;
+	longestBucket = 0;
+	for (i = 0; i < EVENT_HASH_SIZE * 2; i++) {
+		if (i < EVENT_HASH_SIZE) {
+			ev = g_eventsByArgument[i];
+		}
+		else {
+			ev = g_eventsByCode[i - EVENT_HASH_SIZE];
+		}
+		if (ev == 0)
+			continue;
+		usedBuckets++;
+		len = 0;
+		while (ev) {
+			len++;
+			ev = ev->nextInBucket;
+		}
+		if (len > longestBucket)
+			longestBucket = len;
 	}
-	return c;
+	ADDLOG_INFO(LOG_FEATURE_EVENT, "Event handlers: %i, buckets used %i/%i, longest bucket %i",
+		g_eventHandlersCount, usedBuckets, EVENT_HASH_SIZE * 2, longestBucket);
+	ADDLOG_INFO(LOG_FEATURE_EVENT, "Dispatches: %i, handlers visited %i (max %i in one), handlers ran %i",
+		g_eventDispatches, g_eventHandlersVisited, g_eventDispatchMaxVisited, g_eventHandlersRan);
+	CMD_GetPreparedCommandStats(&preparedRuns, &preparedFallbacks);
+	ADDLOG_INFO(LOG_FEATURE_EVENT, "Prepared commands: %i runs, %i by name lookup",
+		preparedRuns, preparedFallbacks);
+
+	return CMD_RES_OK;
 }
 void EventHandlers_Init() {
 
@@ -634,6 +758,11 @@ void EventHandlers_Init() {
 	//cmddetail:"fn":"CMD_ClearAllHandlers","file":"cmnds/cmd_eventHandlers.c","requires":"",
 	//cmddetail:"examples":""}
     CMD_RegisterCommand("clearAllHandlers", CMD_ClearAllHandlers, NULL);
+	//cmddetail:{"name":"eventHandlerStats","args":"[Optional: reset]",
+	//cmddetail:"descr":"Prints number of event handlers, how they are spread over dispatch buckets and how many events were dispatched, with total and max dispatch time. Use 'reset' to clear the counters.",
+	//cmddetail:"fn":"CMD_EventHandlerStats","file":"cmnds/cmd_eventHandlers.c","requires":"",
+	//cmddetail:"examples":""}
+    CMD_RegisterCommand("eventHandlerStats", CMD_EventHandlerStats, NULL);
 
 }
 
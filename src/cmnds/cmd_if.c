@@ -579,7 +579,7 @@ static int g_totalConstants = sizeof(g_constants) / sizeof(g_constants[0]);
 // Etc etc
 // Returns true if constant matches
 // Returns false if no constants found
-const char *CMD_ExpandConstantFloat(const char *s, const char *stop, float *out) {
+static const constant_t *CMD_FindConstant(const char *s, const char *stop, const char **after) {
 #if ENABLE_EXPAND_CONSTANT
 	const constant_t *var;
 	int i;
@@ -588,12 +588,23 @@ const char *CMD_ExpandConstantFloat(const char *s, const char *stop, float *out)
 		bool bAllowWildCard = strstr(var->constantName, "*") != 0;
 		const char *ret = strCompareBound(s, var->constantName, stop, bAllowWildCard);
 		if (ret) {
-			*out = var->getValue(s);
-			ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_ExpandConstantFloat: %s", var->name);
-			return ret;
+			*after = ret;
+			return var;
 		}
 	}
 #endif
+	return 0;
+}
+const char *CMD_ExpandConstantFloat(const char *s, const char *stop, float *out) {
+	const constant_t *var;
+	const char *ret;
+
+	var = CMD_FindConstant(s, stop, &ret);
+	if (var) {
+		*out = var->getValue(s);
+		ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_ExpandConstantFloat: %s", var->constantName);
+		return ret;
+	}
 	return false;
 }
 
@@ -873,16 +884,66 @@ const char *CMD_FindMatchingBrace(const char *s) {
 	return s;
 
 }
-float CMD_EvaluateExpression(const char *s, const char *stop) {
-	byte opCode;
-	const char *op;
-	float a, b, c;
-	int idx;
+static float CMD_ApplyOperator(byte opCode, float a, float b) {
+	float c;
 
-	if (s == 0)
-		return 0;
-	if (*s == 0)
-		return 0;
+	switch (opCode)
+	{
+	case OP_EQUAL:
+		c = a == b;
+		break;
+	case OP_EQUAL_OR_GREATER:
+		c = a >= b;
+		break;
+	case OP_EQUAL_OR_LESS:
+		c = a <= b;
+		break;
+	case OP_NOT_EQUAL:
+		c = a != b;
+		break;
+	case OP_GREATER:
+		c = a > b;
+		break;
+	case OP_LESS:
+		c = a < b;
+		break;
+	case OP_AND:
+		c = ((int)a) && ((int)b);
+		break;
+	case OP_OR:
+		c = ((int)a) || ((int)b);
+		break;
+	case OP_ADD:
+		c = a + b;
+		break;
+	case OP_SUB:
+		c = a - b;
+		break;
+	case OP_MUL:
+		c = a * b;
+		break;
+	case OP_DIV:
+		c = a / b;
+		break;
+	case OP_MODULO:
+		if (b == 0) {
+			c = 0;
+		}
+		else {
+			c = ((int)a) % ((int)b);
+		}
+		break;
+	default:
+		c = 0;
+		break;
+	}
+	return c;
+}
+// shared by interpreter and compiler - culls whitespaces and outer braces
+// Returns false if nothing is left
+static bool CMD_TrimExpression(const char **ps, const char **pstop) {
+	const char *s = *ps;
+	const char *stop = *pstop;
 
 	// cull whitespaces at the end of expression
 	if (stop == 0) {
@@ -895,22 +956,48 @@ float CMD_EvaluateExpression(const char *s, const char *stop) {
 	while (isspace(((int)*s))) {
 		s++;
 		if (s >= stop) {
-			return 0;
+			return false;
 		}
 	}
 	while (*s == '(' && stop[-1] == ')' && CMD_FindMatchingBrace(s) == (stop-1)) {
 		s++;
 		stop--;
 	}
+	*ps = s;
+	*pstop = stop;
+	return true;
+}
+static void CMD_CopyToDebugBuffer(const char *s, const char *stop) {
+	int idx;
+
 	if (g_expDebugBuffer == 0) {
 		g_expDebugBuffer = malloc(EXPRESSION_DEBUG_BUFFER_SIZE);
 	}
-	if (1) {
-		idx = stop - s;
-		memcpy(g_expDebugBuffer, s, idx);
-		g_expDebugBuffer[idx] = 0;
-		ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: will run '%s'", g_expDebugBuffer);
+	idx = stop - s;
+	if (idx < 0)
+		idx = 0;
+	if (idx > EXPRESSION_DEBUG_BUFFER_SIZE - 1)
+		idx = EXPRESSION_DEBUG_BUFFER_SIZE - 1;
+	memcpy(g_expDebugBuffer, s, idx);
+	g_expDebugBuffer[idx] = 0;
+}
+// Old, recursive evaluator. It re-scans the text on every call.
+// Still used as a fallback when expression does not fit into compiled program.
+float CMD_EvaluateExpression_Interpreted(const char *s, const char *stop) {
+	byte opCode;
+	const char *op;
+	float a, b, c;
+
+	if (s == 0)
+		return 0;
+	if (*s == 0)
+		return 0;
+
+	if (CMD_TrimExpression(&s, &stop) == false) {
+		return 0;
 	}
+	CMD_CopyToDebugBuffer(s, stop);
+	ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: will run '%s'", g_expDebugBuffer);
 	op = CMD_FindOperator(s, stop, &opCode);
 	if (op) {
 		const char *p2;
@@ -921,81 +1008,410 @@ float CMD_EvaluateExpression(const char *s, const char *stop) {
 		// second token block begins at 'p2' and ends at NULL
 		p2 = op + g_operators[opCode].len;
 
-		a = CMD_EvaluateExpression(s, op);
-		b = CMD_EvaluateExpression(p2, stop);
+		a = CMD_EvaluateExpression_Interpreted(s, op);
+		b = CMD_EvaluateExpression_Interpreted(p2, stop);
 
-		// Why, again, %f crashes?
-		//ADDLOG_INFO(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: a = %f, b = %f", a, b);
-		// It crashes even on sprintf.
-		//sprintf(g_expDebugBuffer,"CMD_EvaluateExpression: a = %f, b = %f", a, b);
-		//ADDLOG_INFO(LOG_FEATURE_EVENT, g_expDebugBuffer);
+		return CMD_ApplyOperator(opCode, a, b);
+	}
+	if (s[0] == '!') {
+		return !CMD_EvaluateExpression_Interpreted(s + 1, stop);
+	}
+	if (CMD_ExpandConstantFloat(s, stop, &c)) {
+		return c;
+	}
 
-		switch (opCode)
-		{
-		case OP_EQUAL:
-			c = a == b;
-			break;
-		case OP_EQUAL_OR_GREATER:
-			c = a >= b;
-			break;
-		case OP_EQUAL_OR_LESS:
-			c = a <= b;
-			break;
-		case OP_NOT_EQUAL:
-			c = a != b;
-			break;
-		case OP_GREATER:
-			c = a > b;
-			break;
-		case OP_LESS:
-			c = a < b;
-			break;
-		case OP_AND:
-			c = ((int)a) && ((int)b);
-			break;
-		case OP_OR:
-			c = ((int)a) || ((int)b);
+	CMD_CopyToDebugBuffer(s, stop);
+	ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: will call atof for %s", g_expDebugBuffer);
+	return atof(g_expDebugBuffer);
+}
+
+/*
+Expression compiler.
+
+Expression text is compiled once into a small postfix program, for example
+"$CH1*10+5" becomes: CHANNEL 1, VALUE 10, MUL, VALUE 5, ADD.
+Constants are resolved at compile time - $CH, $FLAG and $Flash become
+direct indexes, other constants become a pointer to their getter.
+Subexpressions without constants are folded into a single value.
+The text is split in exactly the same way as in the interpreter above,
+so both give the same results.
+
+Compiled programs are kept in a small cache keyed by expression text,
+so 'if' lines in script loops and expressions in event handlers
+are compiled only on first use.
+*/
+
+#ifndef EXPRESSION_MAX_INSTRUCTIONS
+#define EXPRESSION_MAX_INSTRUCTIONS 48
+#endif
+#ifndef EXPRESSION_MAX_STACK
+#define EXPRESSION_MAX_STACK 16
+#endif
+// compiled expressions kept by one prepared command
+#ifndef EXPRESSION_SLOTS
+#define EXPRESSION_SLOTS 4
+#endif
+
+typedef enum {
+	EXP_PUSH_VALUE,
+	EXP_PUSH_CHANNEL,
+	EXP_PUSH_FLAG,
+	EXP_PUSH_FLASHVAR,
+	EXP_PUSH_GETTER,
+	EXP_NOT,
+	EXP_OPERATOR,
+} expInstructionType_t;
+
+typedef struct expInstruction_s {
+	byte type;
+	// opCode_t for EXP_OPERATOR
+	byte opCode;
+	// channel, flag or flash var index
+	short index;
+	union {
+		float value;
+		const constant_t *constant;
+	} u;
+} expInstruction_t;
+
+struct expProgram_s {
+	byte numInstructions;
+	byte maxStack;
+	expInstruction_t code[1];
+};
+
+typedef struct expCompiler_s {
+	expInstruction_t code[EXPRESSION_MAX_INSTRUCTIONS];
+	int numInstructions;
+	int stack;
+	int maxStack;
+	bool bFailed;
+} expCompiler_t;
+
+static expCompiler_t *g_expCompiler = 0;
+
+static expInstruction_t *EXP_Emit(expCompiler_t *c, byte type, int stackChange) {
+	expInstruction_t *i;
+
+	if (c->numInstructions >= EXPRESSION_MAX_INSTRUCTIONS) {
+		c->bFailed = true;
+		return 0;
+	}
+	c->stack += stackChange;
+	if (c->stack > c->maxStack) {
+		c->maxStack = c->stack;
+	}
+	if (c->maxStack > EXPRESSION_MAX_STACK) {
+		c->bFailed = true;
+		return 0;
+	}
+	i = &c->code[c->numInstructions++];
+	memset(i, 0, sizeof(*i));
+	i->type = type;
+	return i;
+}
+static void EXP_EmitValue(expCompiler_t *c, float value) {
+	expInstruction_t *i = EXP_Emit(c, EXP_PUSH_VALUE, 1);
+	if (i) {
+		i->u.value = value;
+	}
+}
+static void EXP_EmitNot(expCompiler_t *c) {
+	expInstruction_t *last;
+
+	if (c->bFailed)
+		return;
+	last = &c->code[c->numInstructions - 1];
+	if (last->type == EXP_PUSH_VALUE) {
+		last->u.value = !last->u.value;
+		return;
+	}
+	EXP_Emit(c, EXP_NOT, 0);
+}
+static void EXP_EmitOperator(expCompiler_t *c, byte opCode) {
+	expInstruction_t *a, *b, *i;
+
+	if (c->bFailed)
+		return;
+	// two constant values on top can be folded into one
+	a = &c->code[c->numInstructions - 2];
+	b = &c->code[c->numInstructions - 1];
+	if (a->type == EXP_PUSH_VALUE && b->type == EXP_PUSH_VALUE) {
+		a->u.value = CMD_ApplyOperator(opCode, a->u.value, b->u.value);
+		c->numInstructions--;
+		c->stack--;
+		return;
+	}
+	i = EXP_Emit(c, EXP_OPERATOR, -1);
+	if (i) {
+		i->opCode = opCode;
+	}
+}
+static void EXP_EmitConstant(expCompiler_t *c, const constant_t *var, const char *s) {
+	expInstruction_t *i;
+
+	if (var->getValue == getChannelValue) {
+		i = EXP_Emit(c, EXP_PUSH_CHANNEL, 1);
+		if (i) {
+			i->index = atoi(s + 3);
+		}
+	}
+	else if (var->getValue == getFlagValue) {
+		i = EXP_Emit(c, EXP_PUSH_FLAG, 1);
+		if (i) {
+			i->index = atoi(s + 5);
+		}
+	}
+	else if (var->getValue == getFlashValue) {
+		i = EXP_Emit(c, EXP_PUSH_FLASHVAR, 1);
+		if (i) {
+			i->index = atoi(s + 5);
+		}
+	}
+	else if (strchr(var->constantName, '*')) {
+		// wildcard getter needs the source text, we don't keep it
+		c->bFailed = true;
+	}
+	else {
+		i = EXP_Emit(c, EXP_PUSH_GETTER, 1);
+		if (i) {
+			i->u.constant = var;
+		}
+	}
+}
+static void CMD_CompileExpression_r(expCompiler_t *c, const char *s, const char *stop) {
+	byte opCode;
+	const char *op;
+	const constant_t *var;
+	const char *after;
+
+	if (c->bFailed)
+		return;
+	if (s == 0 || *s == 0 || (stop != 0 && stop <= s)) {
+		EXP_EmitValue(c, 0);
+		return;
+	}
+	if (CMD_TrimExpression(&s, &stop) == false) {
+		EXP_EmitValue(c, 0);
+		return;
+	}
+	op = CMD_FindOperator(s, stop, &opCode);
+	if (op) {
+		CMD_CompileExpression_r(c, s, op);
+		CMD_CompileExpression_r(c, op + g_operators[opCode].len, stop);
+		EXP_EmitOperator(c, opCode);
+		return;
+	}
+	if (s[0] == '!') {
+		CMD_CompileExpression_r(c, s + 1, stop);
+		EXP_EmitNot(c);
+		return;
+	}
+	var = CMD_FindConstant(s, stop, &after);
+	if (var) {
+		EXP_EmitConstant(c, var, s);
+		return;
+	}
+	CMD_CopyToDebugBuffer(s, stop);
+	EXP_EmitValue(c, atof(g_expDebugBuffer));
+}
+// Returns 0 if expression can't be compiled (too long or too deep),
+// caller should use CMD_EvaluateExpression_Interpreted then.
+// Free the result with CMD_FreeExpression.
+expProgram_t *CMD_CompileExpression(const char *s, const char *stop) {
+	expCompiler_t *c;
+	expProgram_t *p;
+	int size;
+
+	if (g_expCompiler == 0) {
+		g_expCompiler = malloc(sizeof(expCompiler_t));
+		if (g_expCompiler == 0)
+			return 0;
+	}
+	c = g_expCompiler;
+	c->numInstructions = 0;
+	c->stack = 0;
+	c->maxStack = 0;
+	c->bFailed = false;
+
+	CMD_CompileExpression_r(c, s, stop);
+	if (c->bFailed) {
+		ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_CompileExpression: too complex, will interpret");
+		return 0;
+	}
+	size = sizeof(expProgram_t) + (c->numInstructions - 1) * sizeof(expInstruction_t);
+	p = malloc(size);
+	if (p == 0)
+		return 0;
+	p->numInstructions = c->numInstructions;
+	p->maxStack = c->maxStack;
+	memcpy(p->code, c->code, c->numInstructions * sizeof(expInstruction_t));
+	return p;
+}
+void CMD_FreeExpression(expProgram_t *p) {
+	free(p);
+}
+float CMD_RunExpression(const expProgram_t *p) {
+	float stack[EXPRESSION_MAX_STACK];
+	const expInstruction_t *i;
+	int sp;
+	int n;
+
+	sp = 0;
+	i = p->code;
+	for (n = 0; n < p->numInstructions; n++, i++) {
+		switch (i->type) {
+		case EXP_PUSH_VALUE:
+			stack[sp++] = i->u.value;
 			break;
-		case OP_ADD:
-			c = a + b;
+		case EXP_PUSH_CHANNEL:
+			stack[sp++] = CHANNEL_Get(i->index);
 			break;
-		case OP_SUB:
-			c = a - b;
+		case EXP_PUSH_FLAG:
+			stack[sp++] = CFG_HasFlag(i->index);
 			break;
-		case OP_MUL:
-			c = a * b;
+		case EXP_PUSH_FLASHVAR:
+			stack[sp++] = HAL_FlashVars_GetChannelValue(i->index);
 			break;
-		case OP_DIV:
-			c = a / b;
+		case EXP_PUSH_GETTER:
+			stack[sp++] = i->u.constant->getValue(i->u.constant->constantName);
 			break;
-		case OP_MODULO:
-			if (b == 0) {
-				c = 0;
-			}
-			else {
-				c = ((int)a) % ((int)b);
-			}
+		case EXP_NOT:
+			stack[sp - 1] = !stack[sp - 1];
 			break;
-		default:
-			c = 0;
+		case EXP_OPERATOR:
+			sp--;
+			stack[sp - 1] = CMD_ApplyOperator(i->opCode, stack[sp - 1], stack[sp]);
 			break;
 		}
-		return c;
 	}
-	if (s[0] == '!') {
-		return !CMD_EvaluateExpression(s + 1, stop);
+	return stack[0];
+}
+
+typedef struct expSlot_s {
+	int len;
+	char *text;
+	// 0 if it could not be compiled
+	expProgram_t *program;
+} expSlot_t;
+
+struct expSlots_s {
+	expSlot_t slots[EXPRESSION_SLOTS];
+};
+
+// slots of the prepared command being executed, see CMD_PushExpressionOwner
+static expSlots_t **g_expOwner = 0;
+// index of next expression evaluated by that command
+static int g_expCursor = 0;
+static int g_expCompiledRuns = 0;
+static int g_expCompiles = 0;
+
+// plain numbers like "5" or "0x10" are cheap to parse,
+// not worth a slot
+static bool EXP_IsWorthCompiling(const char *s, int len) {
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (s[i] == '$' || s[i] == '(' || s[i] == '!')
+			return true;
+		// skip leading minus, it's a sign
+		if (i > 0 && strchr("<>=&|+-*/%", s[i]))
+			return true;
 	}
-	if (CMD_ExpandConstantFloat(s, stop, &c)) {
-		return c;
+	return false;
+}
+void CMD_PushExpressionOwner(expSlots_t **owner, expOwnerState_t *saved) {
+	saved->owner = g_expOwner;
+	saved->cursor = g_expCursor;
+	g_expOwner = owner;
+	g_expCursor = 0;
+}
+void CMD_PopExpressionOwner(const expOwnerState_t *saved) {
+	g_expOwner = saved->owner;
+	g_expCursor = saved->cursor;
+}
+void CMD_FreeExpressionSlots(expSlots_t *e) {
+	int i;
+
+	if (e == 0) {
+		return;
+	}
+	for (i = 0; i < EXPRESSION_SLOTS; i++) {
+		free(e->slots[i].text);
+		CMD_FreeExpression(e->slots[i].program);
 	}
+	free(e);
+}
+static bool EXP_SlotMatches(const expSlot_t *slot, const char *s, int len) {
+	return slot->text && slot->len == len && !memcmp(slot->text, s, len);
+}
+// A command evaluates its expressions in the same order every time, so the
+// n-th one is almost always in slot n. Others (if/else branches) are looked
+// for in the remaining few slots before compiling into slot n.
+static expSlot_t *CMD_GetExpressionSlot(const char *s, int len) {
+	expSlots_t *e;
+	expSlot_t *slot;
+	int i, idx;
+
+	e = *g_expOwner;
+	if (e == 0) {
+		e = (expSlots_t*)malloc(sizeof(expSlots_t));
+		if (e == 0) {
+			return 0;
+		}
+		memset(e, 0, sizeof(expSlots_t));
+		*g_expOwner = e;
+	}
+	idx = g_expCursor % EXPRESSION_SLOTS;
+	g_expCursor++;
+	for (i = 0; i < EXPRESSION_SLOTS; i++) {
+		slot = &e->slots[(idx + i) % EXPRESSION_SLOTS];
+		if (EXP_SlotMatches(slot, s, len)) {
+			return slot;
+		}
+	}
+	slot = &e->slots[idx];
+	free(slot->text);
+	CMD_FreeExpression(slot->program);
+	slot->program = 0;
+	slot->text = malloc(len + 1);
+	if (slot->text == 0) {
+		return 0;
+	}
+	memcpy(slot->text, s, len);
+	slot->text[len] = 0;
+	slot->len = len;
+	slot->program = CMD_CompileExpression(slot->text, 0);
+	g_expCompiles++;
+	return slot;
+}
+float CMD_EvaluateExpression(const char *s, const char *stop) {
+	expSlot_t *slot;
+	int len;
 
-	if (1) {
-		idx = stop - s;
-		memcpy(g_expDebugBuffer, s, idx);
-		g_expDebugBuffer[idx] = 0;
+	if (s == 0)
+		return 0;
+	if (*s == 0)
+		return 0;
+	// only prepared commands (event handlers, script lines...) keep their
+	// expressions compiled, and only whole strings
+	if (g_expOwner == 0 || stop != 0) {
+		return CMD_EvaluateExpression_Interpreted(s, stop);
 	}
-	ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: will call atof for %s", g_expDebugBuffer);
-	return atof(g_expDebugBuffer);
+	len = strlen(s);
+	if (EXP_IsWorthCompiling(s, len) == false) {
+		return CMD_EvaluateExpression_Interpreted(s, stop);
+	}
+	slot = CMD_GetExpressionSlot(s, len);
+	if (slot == 0 || slot->program == 0) {
+		return CMD_EvaluateExpression_Interpreted(s, stop);
+	}
+	g_expCompiledRuns++;
+	return CMD_RunExpression(slot->program);
+}
+void CMD_GetExpressionStats(int *compiledRuns, int *compiles) {
+	*compiledRuns = g_expCompiledRuns;
+	*compiles = g_expCompiles;
 }
 
 // if MQTTOnline then "qq" else "qq"
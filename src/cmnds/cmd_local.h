@@ -5,6 +5,8 @@
 
 #define CMD_FLAG_FREE_NAME		1
 #define CMD_FLAG_FREE_CONTEXT	2
+// context is a cmdPrepared_t
+#define CMD_FLAG_FREE_PREPARED	4
 
 typedef struct command_s {
 	const char *name;
@@ -19,8 +21,32 @@ command_t *CMD_Find(const char *name);
 void CMD_ListAllCommands(void *userData, void (*callback)(command_t *cmd, void *userData));
 int get_cmd(const char *s, char *dest, int maxlen, int stripnum);
 
+// command text parsed once and executed many times
+typedef struct cmdPrepared_s cmdPrepared_t;
+cmdPrepared_t *CMD_PrepareCommand(const char *s);
+commandResult_t CMD_ExecutePreparedCommand(cmdPrepared_t *p, int cmdFlags);
+const char *CMD_GetPreparedCommandText(const cmdPrepared_t *p);
+void CMD_FreePreparedCommand(cmdPrepared_t *p);
+void CMD_GetPreparedCommandStats(int *runs, int *fallbacks);
+
 
 float CMD_EvaluateExpression(const char *s, const char *stop);
+float CMD_EvaluateExpression_Interpreted(const char *s, const char *stop);
+typedef struct expProgram_s expProgram_t;
+expProgram_t *CMD_CompileExpression(const char *s, const char *stop);
+float CMD_RunExpression(const expProgram_t *p);
+void CMD_FreeExpression(expProgram_t *p);
+// compiled expressions attached to a prepared command
+typedef struct expSlots_s expSlots_t;
+typedef struct expOwnerState_s {
+	expSlots_t **owner;
+	int cursor;
+} expOwnerState_t;
+// expressions evaluated until Pop are compiled into *owner (allocated on demand)
+void CMD_PushExpressionOwner(expSlots_t **owner, expOwnerState_t *saved);
+void CMD_PopExpressionOwner(const expOwnerState_t *saved);
+void CMD_FreeExpressionSlots(expSlots_t *e);
+void CMD_GetExpressionStats(int *compiledRuns, int *compiles);
 commandResult_t CMD_If(const void *context, const char *cmd, const char *args, int cmdFlags);
 void CMD_ExpandConstantsWithinString(const char *in, char *out, int outLen);
 void CMD_Script_ProcessWaitersForEvent(byte eventCode, int argument);
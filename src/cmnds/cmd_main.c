@@ -12,7 +12,9 @@
 #include "../driver/drv_public.h"
 #include "../hal/hal_adc.h"
 #include "../hal/hal_flashVars.h"
+#include "../hal/hal_flashStats.h"
 #include "../httpserver/http_tcp_server.h"
+#include "../httpserver/new_http.h"
 #include "../hal/hal_generic.h"
 
 int cmd_uartInitIndex = 0;
@@ -93,6 +95,8 @@ static int generateHashValue(const char* fname) {
 }
 
 command_t* g_commands[HASH_SIZE] = { NULL };
+// bumped when commands are added or freed, so prepared commands know to look them up again
+static int g_commandsGeneration = 0;
 bool g_powersave;
 
 #if defined(PLATFORM_LN882H)
@@ -343,6 +347,8 @@ static commandResult_t CMD_DeepSleep(const void* context, const char* cmd, const
 	}
 
 	timeMS = Tokenizer_GetArgInteger(0);
+	// RAM copy of flash vars is lost in deep sleep, write pending changes now
+	HAL_FlashVars_Flush();
 #if defined(PLATFORM_BEKEN) && !defined(PLATFORM_BEKEN_NEW)
 	// It requires a define in SDK file:
 	// OpenBK7231T\platforms\bk7231t\bk7231t_os\beken378\func\include\manual_ps_pub.h
@@ -407,15 +413,16 @@ static commandResult_t CMD_DeepSleep(const void* context, const char* cmd, const
 static commandResult_t CMD_ScheduleHADiscovery(const void* context, const char* cmd, const char* args, int cmdFlags) {
 	int delay;
 
-	if (args && *args) {
-		delay = atoi(args);
+	Tokenizer_TokenizeString(args, 0);
+	delay = Tokenizer_GetArgIntegerDefault(0, 5);
+
+	if (Tokenizer_GetArgIntegerDefault(1, 0)) {
+		Main_ScheduleForcedHomeAssistantDiscovery(delay);
 	}
 	else {
-		delay = 5;
+		Main_ScheduleHomeAssistantDiscovery(delay);
 	}
 
-	Main_ScheduleHomeAssistantDiscovery(delay);
-
 	return CMD_RES_OK;
 }
 #endif
@@ -635,6 +642,42 @@ static commandResult_t CMD_SetStartValue(const void* context, const char* cmd, c
 
 	return CMD_RES_OK;
 }
+static commandResult_t CMD_FlashStats(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	const flashUserStats_t* u;
+	const flashSectorStats_t* sectors;
+	int count;
+	int i;
+
+	Tokenizer_TokenizeString(args, 0);
+
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Flash usage in last %i seconds:", HAL_FlashStats_GetSeconds());
+	for (i = 0; i < FLASH_USER_MAX; i++) {
+		u = HAL_FlashStats_GetUser(i);
+		ADDLOG_INFO(LOG_FEATURE_CMD, "%s: %i writes, %i bytes, %i erases, %i writes/min (max %i)",
+			HAL_FlashStats_GetUserName(i), u->writes, u->bytes, u->erases,
+			u->writesLastMinute, u->maxWritesPerMinute);
+	}
+	count = HAL_FlashStats_GetSectors(&sectors);
+	for (i = 0; i < count; i++) {
+		if (sectors[i].address == FLASH_STATS_ADDR_UNKNOWN) {
+			ADDLOG_INFO(LOG_FEATURE_CMD, "Sector ? (%s): %i erases",
+				HAL_FlashStats_GetUserName(sectors[i].user), sectors[i].erases);
+		}
+		else {
+			ADDLOG_INFO(LOG_FEATURE_CMD, "Sector 0x%X (%s): %i erases", sectors[i].address,
+				HAL_FlashStats_GetUserName(sectors[i].user), sectors[i].erases);
+		}
+	}
+	if (count) {
+		ADDLOG_INFO(LOG_FEATURE_CMD, "At this rate most erased sector reaches %i cycles in %i days",
+			FLASH_STATS_RATED_ERASES, HAL_FlashStats_GetLifetimeDays());
+	}
+	if (Tokenizer_GetArgIntegerDefault(0, 0)) {
+		HAL_FlashStats_Reset();
+	}
+
+	return CMD_RES_OK;
+}
 static commandResult_t CMD_OpenAP(const void* context, const char* cmd, const char* args, int cmdFlags) {
 
 	g_openAP = 5;
@@ -718,21 +761,16 @@ void CMD_RunUartCmndIfRequired() {
 
 // run an aliased command
 static commandResult_t runcmd(const void* context, const char* cmd, const char* args, int cmdFlags) {
-	char* c = (char*)context;
-	//   char *p = c;
+	cmdPrepared_t* c = (cmdPrepared_t*)context;
 
-	//   while (*p && !isWhiteSpace(*p)) {
-	//       p++;
-	   //}
-	//   if (*p) p++;
 	if (*args) {
-		return CMD_ExecuteCommandArgs(c, args, cmdFlags);
+		return CMD_ExecuteCommandArgs(CMD_GetPreparedCommandText(c), args, cmdFlags);
 	}
-	return CMD_ExecuteCommand(c, cmdFlags);
+	return CMD_ExecutePreparedCommand(c, cmdFlags);
 }
 
 commandResult_t CMD_CreateAliasHelper(const char *alias, const char *ocmd) {
-	char* cmdMem;
+	cmdPrepared_t* cmdMem;
 	char* aliasMem;
 	command_t* existing;
 
@@ -742,7 +780,10 @@ commandResult_t CMD_CreateAliasHelper(const char *alias, const char *ocmd) {
 		return CMD_RES_BAD_ARGUMENT;
 	}
 
-	cmdMem = strdup(ocmd);
+	cmdMem = CMD_PrepareCommand(ocmd);
+	if (cmdMem == 0) {
+		return CMD_RES_ERROR;
+	}
 	aliasMem = strdup(alias);
 
 	ADDLOG_INFO(LOG_FEATURE_CMD, "New alias has been set: %s runs %s", alias, ocmd);
@@ -754,7 +795,7 @@ commandResult_t CMD_CreateAliasHelper(const char *alias, const char *ocmd) {
 	command_t *cmd = CMD_RegisterCommand(aliasMem, runcmd, cmdMem);
 	if (cmd) {
 		cmd->commandFlags |= CMD_FLAG_FREE_NAME;
-		cmd->commandFlags |= CMD_FLAG_FREE_CONTEXT;
+		cmd->commandFlags |= CMD_FLAG_FREE_PREPARED;
 	}
 	return CMD_RES_OK;
 }
@@ -943,6 +984,53 @@ commandResult_t CMD_DeepSleep_SetEdge(const void* context, const char* cmd, cons
 	return CMD_RES_OK;
 }
 
+// HTTPStats [reset]
+static commandResult_t CMD_HTTPStats(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() > 0 && !stricmp(Tokenizer_GetArg(0), "reset")) {
+		int queueDepth = g_httpStats.queueDepth;
+		memset(&g_httpStats, 0, sizeof(g_httpStats));
+		g_httpStats.queueDepth = queueDepth;
+		return CMD_RES_OK;
+	}
+	ADDLOG_INFO(LOG_FEATURE_HTTP, "Connections %i, requests %i (%i on kept open connection), rejected %i",
+		g_httpStats.connections, g_httpStats.requests, g_httpStats.keepAliveRequests, g_httpStats.rejected);
+	ADDLOG_INFO(LOG_FEATURE_HTTP, "Queue depth %i, max %i",
+		g_httpStats.queueDepth, g_httpStats.maxQueueDepth);
+	ADDLOG_INFO(LOG_FEATURE_HTTP, "Latency avg %i ms, max %i ms",
+		g_httpStats.requests ? (int)(g_httpStats.latencyTotalMs / g_httpStats.requests) : 0,
+		(int)g_httpStats.latencyMaxMs);
+	ADDLOG_INFO(LOG_FEATURE_HTTP, "Time to first byte avg %i ms, max %i ms",
+		g_httpStats.replies ? (int)(g_httpStats.ttfbTotalMs / g_httpStats.replies) : 0,
+		(int)g_httpStats.ttfbMaxMs);
+	return CMD_RES_OK;
+}
+
+// HTTPPoolSize [count]
+// Must be in early.bat to have effect on device, workers are created when server starts
+static commandResult_t CMD_HTTPPoolSize(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	int count;
+
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() < 1) {
+		ADDLOG_INFO(LOG_FEATURE_HTTP, "HTTP pool size %i (max %i)", g_httpPoolSize, HTTP_WORKER_POOL_MAX);
+		return CMD_RES_OK;
+	}
+	count = Tokenizer_GetArgInteger(0);
+	if (count < 1 || count > HTTP_WORKER_POOL_MAX) {
+		ADDLOG_ERROR(LOG_FEATURE_HTTP, "HTTP pool size must be 1-%i", HTTP_WORKER_POOL_MAX);
+		return CMD_RES_BAD_ARGUMENT;
+	}
+	g_httpPoolSize = count;
+	return CMD_RES_OK;
+}
+
+static commandResult_t CMD_HTTPRoutes(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	Tokenizer_TokenizeString(args, 0);
+	HTTP_PrintRoutes(Tokenizer_GetArgsCount() > 0 && !stricmp(Tokenizer_GetArg(0), "reset"));
+	return CMD_RES_OK;
+}
+
 #if MQTT_USE_TLS
 static commandResult_t CMD_WebServer(const void* context, const char* cmd, const char* args, int cmdFlags) {	
 	int arg_count;
@@ -1031,8 +1119,8 @@ void CMD_Init_Early() {
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("ota_http", CMD_HTTPOTA, NULL);
 #if ENABLE_HA_DISCOVERY
-	//cmddetail:{"name":"scheduleHADiscovery","args":"[Seconds]",
-	//cmddetail:"descr":"This will schedule HA discovery, the discovery will happen with given number of seconds, but timer only counts when MQTT is connected. It will not work without MQTT online, so you must set MQTT credentials first.",
+	//cmddetail:{"name":"scheduleHADiscovery","args":"[Seconds][Force]",
+	//cmddetail:"descr":"This will schedule HA discovery, the discovery will happen with given number of seconds, but timer only counts when MQTT is connected. It will not work without MQTT online, so you must set MQTT credentials first. Entities already sent unchanged are skipped, unless Force is 1.",
 	//cmddetail:"fn":"CMD_ScheduleHADiscovery","file":"cmnds/cmd_main.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("scheduleHADiscovery", CMD_ScheduleHADiscovery, NULL);
@@ -1057,6 +1145,11 @@ void CMD_Init_Early() {
 	//cmddetail:"fn":"CMD_SetStartValue","file":"cmnds/cmd_main.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("SetStartValue", CMD_SetStartValue, NULL);
+	//cmddetail:{"name":"flashStats","args":"[bReset]",
+	//cmddetail:"descr":"Prints flash writes, written bytes, erases and writes per minute for flash vars, LFS, config and OTA, the most erased sectors and estimated days until they reach rated erase cycles. Counted since boot. Pass 1 to reset counters.",
+	//cmddetail:"fn":"CMD_FlashStats","file":"cmnds/cmd_main.c","requires":"",
+	//cmddetail:"examples":"flashStats"}
+	CMD_RegisterCommand("flashStats", CMD_FlashStats, NULL);
 	//cmddetail:{"name":"OpenAP","args":"",
 	//cmddetail:"descr":"Temporarily disconnects from programmed WiFi network and opens Access Point",
 	//cmddetail:"fn":"CMD_OpenAP","file":"cmnds/cmd_main.c","requires":"",
@@ -1105,6 +1198,21 @@ void CMD_Init_Early() {
 	//cmddetail:"fn":"CMD_IndexRefreshInterval","file":"cmnds/cmd_main.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("IndexRefreshInterval", CMD_IndexRefreshInterval, NULL);
+	//cmddetail:{"name":"HTTPStats","args":"[reset]",
+	//cmddetail:"descr":"Prints HTTP server counters: connections, requests served on kept open (keep-alive) connections, accept queue depth, request latency and time to first byte of reply. Use 'HTTPStats reset' to clear them.",
+	//cmddetail:"fn":"CMD_HTTPStats","file":"cmnds/cmd_main.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("HTTPStats", CMD_HTTPStats, NULL);
+	//cmddetail:{"name":"HTTPPoolSize","args":"[count]",
+	//cmddetail:"descr":"Sets number of HTTP worker threads (on simulator: connections kept open), 1-8. Workers are created when the HTTP server starts, so on device it must be set in early.bat. Without argument prints current value.",
+	//cmddetail:"fn":"CMD_HTTPPoolSize","file":"cmnds/cmd_main.c","requires":"",
+	//cmddetail:"examples":"HTTPPoolSize 3"}
+	CMD_RegisterCommand("HTTPPoolSize", CMD_HTTPPoolSize, NULL);
+	//cmddetail:{"name":"HTTPRoutes","args":"[reset]",
+	//cmddetail:"descr":"Prints HTTP route table: every page and registered handler with its hash bucket, method, hit count and average/max handling time. Use 'HTTPRoutes reset' to clear the counters.",
+	//cmddetail:"fn":"CMD_HTTPRoutes","file":"cmnds/cmd_main.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("HTTPRoutes", CMD_HTTPRoutes, NULL);
 
 #if MQTT_USE_TLS
 	//cmddetail:{"name":"WebServer","args":"[0 - Stop / 1 - Start]",
@@ -1174,12 +1282,15 @@ void CMD_FreeAllCommands() {
 			if (cmd->commandFlags & CMD_FLAG_FREE_CONTEXT) {
 				free((char*)cmd->context);
 			}
+			if (cmd->commandFlags & CMD_FLAG_FREE_PREPARED) {
+				CMD_FreePreparedCommand((cmdPrepared_t*)cmd->context);
+			}
 			free(cmd);
 			cmd = next;
 		}
 		g_commands[i] = 0;
 	}
-
+	g_commandsGeneration++;
 }
 command_t *CMD_RegisterCommand(const char* name, commandHandler_t handler, void* context) {
 	int hash;
@@ -1198,6 +1309,7 @@ command_t *CMD_RegisterCommand(const char* name, commandHandler_t handler, void*
 
 	hash = generateHashValue(name);
 	newCmd = (command_t*)malloc(sizeof(command_t));
+	g_commandsGeneration++;
 	newCmd->commandFlags = 0;
 	newCmd->handler = handler;
 	newCmd->name = name;
@@ -1246,6 +1358,19 @@ int get_cmd(const char* s, char* dest, int maxlen, int stripnum) {
 }
 
 
+// find command by full name, or by name without trailing numbers (POWER1 -> POWER)
+static command_t *CMD_ResolveCommandName(const char *name) {
+	command_t *newCmd;
+	char nonums[32];
+
+	newCmd = CMD_Find(name);
+	if (newCmd == 0) {
+		// get the complete string up to numbers.
+		get_cmd(name, nonums, sizeof(nonums), 1);
+		newCmd = CMD_Find(nonums);
+	}
+	return newCmd;
+}
 // execute a command from cmd and args - used below and in MQTT
 commandResult_t CMD_ExecuteCommandArgs(const char* cmd, const char* args, int cmdFlags) {
 	command_t* newCmd;
@@ -1327,4 +1452,197 @@ commandResult_t CMD_ExecuteCommand(const char* s, int cmdFlags) {
 	return CMD_ExecuteCommandArgs(copy, args, cmdFlags);
 }
 
+// Prepared command - text split once into command name and args, with the
+// command_t already looked up. Used for handlers that run the same command
+// text many times (event handlers, repeating events, aliases).
+// Args are still passed to the handler as text, so $CH etc are expanded
+// at run time, just like before.
+typedef struct cmdPreparedPart_s {
+	// resolved command or NULL if not found at prepare time
+	command_t *cmd;
+	const char *name;
+	const char *args;
+} cmdPreparedPart_t;
+
+struct cmdPrepared_s {
+	// original text, for listings and reuse checks
+	const char *text;
+	// value of g_commandsGeneration when parts were resolved
+	int generation;
+	short numParts;
+	// was a plain backlog split into parts?
+	byte bBacklog;
+	// nonzero while executing, so a handler can't free us under our feet
+	byte running;
+	byte bFreePending;
+	// compiled forms of expressions in args, 0 until first needed
+	expSlots_t *exps;
+	cmdPreparedPart_t parts[1];
+};
+
+static int g_preparedRuns = 0;
+static int g_preparedFallbacks = 0;
+
+// splits in place into name and args, returns 0 for empty string
+static int CMD_PreparePart(char *s, cmdPreparedPart_t *part) {
+	while (isWhiteSpace(*s)) {
+		s++;
+	}
+	if (*s == 0) {
+		return 0;
+	}
+	part->name = s;
+	while (*s && !isWhiteSpace(*s)) {
+		s++;
+	}
+	if (*s) {
+		*s = 0;
+		s++;
+		while (*s && isWhiteSpace(*s)) {
+			s++;
+		}
+	}
+	part->args = s;
+	part->cmd = CMD_ResolveCommandName(part->name);
+	return 1;
+}
+static bool CMD_IsPlainBacklog(const cmdPreparedPart_t *part) {
+	if (part->cmd == 0 || stricmp(part->cmd->name, "backlog")) {
+		return false;
+	}
+#if ENABLE_OBK_SCRIPTING
+	// backlog with delays is handled by script VM, keep it as a single command
+	if (strcasestr(part->args, "delay_ms") || strcasestr(part->args, "delay_s") || strcasestr(part->args, "waitFor")) {
+		return false;
+	}
+#endif
+	return true;
+}
+cmdPrepared_t *CMD_PrepareCommand(const char *s) {
+	cmdPrepared_t *p;
+	cmdPreparedPart_t first;
+	char *text, *work, *next;
+	const char *c;
+	int len, maxParts;
+
+	len = strlen(s);
+	// worst case - a backlog with one command per ';'
+	maxParts = 1;
+	for (c = s; *c; c++) {
+		if (*c == ';') {
+			maxParts++;
+		}
+	}
+	p = (cmdPrepared_t*)malloc(sizeof(cmdPrepared_t) + (maxParts - 1) * sizeof(cmdPreparedPart_t) + 2 * (len + 1));
+	if (p == 0) {
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "CMD_PrepareCommand: failed to malloc for %s", s);
+		return 0;
+	}
+	text = (char*)&p->parts[maxParts];
+	work = text + len + 1;
+	memcpy(text, s, len + 1);
+	memcpy(work, s, len + 1);
+	p->text = text;
+	p->generation = g_commandsGeneration;
+	p->numParts = 0;
+	p->bBacklog = 0;
+	p->running = 0;
+	p->bFreePending = 0;
+	p->exps = 0;
+
+	if (CMD_PreparePart(work, &first) == 0) {
+		return p;
+	}
+	if (CMD_IsPlainBacklog(&first) == false) {
+		p->parts[0] = first;
+		p->numParts = 1;
+		return p;
+	}
+	// same splitting as in cmnd_backlog_old, but done only once
+	p->bBacklog = 1;
+	work = (char*)first.args;
+	while (*work) {
+		next = work;
+		while (*next && *next != ';') {
+			next++;
+		}
+		if (*next) {
+			*next = 0;
+			next++;
+		}
+		if (CMD_PreparePart(work, &p->parts[p->numParts])) {
+			p->numParts++;
+		}
+		work = next;
+	}
+	return p;
+}
+const char *CMD_GetPreparedCommandText(const cmdPrepared_t *p) {
+	return p->text;
+}
+void CMD_FreePreparedCommand(cmdPrepared_t *p) {
+	if (p == 0) {
+		return;
+	}
+	if (p->running) {
+		// called from within one of our own commands, free when done
+		p->bFreePending = 1;
+		return;
+	}
+	CMD_FreeExpressionSlots(p->exps);
+	free(p);
+}
+commandResult_t CMD_ExecutePreparedCommand(cmdPrepared_t *p, int cmdFlags) {
+	cmdPreparedPart_t *part;
+	commandResult_t res, localRes;
+	expOwnerState_t expState;
+	int i;
+
+	if (p == 0 || p->numParts == 0) {
+		return CMD_RES_EMPTY_STRING;
+	}
+	if ((cmdFlags & COMMAND_FLAG_SOURCE_TCP) == 0) {
+		ADDLOG_DEBUG(LOG_FEATURE_CMD, "cmd [%s]", p->text);
+	}
+	// commands were added or removed since last time, look them up again
+	if (p->generation != g_commandsGeneration) {
+		for (i = 0; i < p->numParts; i++) {
+			p->parts[i].cmd = CMD_ResolveCommandName(p->parts[i].name);
+		}
+		p->generation = g_commandsGeneration;
+	}
+	g_preparedRuns++;
+	p->running++;
+	CMD_PushExpressionOwner(&p->exps, &expState);
+	res = CMD_RES_OK;
+	for (i = 0; i < p->numParts; i++) {
+		part = &p->parts[i];
+		if (part->cmd && part->cmd->handler) {
+			localRes = part->cmd->handler(part->cmd->context, part->name, part->args, cmdFlags);
+		}
+		else {
+			// unknown (maybe Berry OnCMD), let the normal path handle and report it
+			g_preparedFallbacks++;
+			localRes = CMD_ExecuteCommandArgs(part->name, part->args, cmdFlags);
+		}
+		if (p->bBacklog == 0) {
+			res = localRes;
+		}
+		else if (localRes != CMD_RES_OK && localRes != CMD_RES_EMPTY_STRING) {
+			res = localRes;
+		}
+	}
+	CMD_PopExpressionOwner(&expState);
+	p->running--;
+	if (p->running == 0 && p->bFreePending) {
+		CMD_FreeExpressionSlots(p->exps);
+		free(p);
+	}
+	return res;
+}
+void CMD_GetPreparedCommandStats(int *runs, int *fallbacks) {
+	*runs = g_preparedRuns;
+	*fallbacks = g_preparedFallbacks;
+}
+
 
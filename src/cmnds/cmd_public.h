@@ -13,10 +13,64 @@ typedef enum commandResult_e {
 
 } commandResult_t;
 
+// Entry of a timer queue, embedded in whatever needs waking up later
+// (script threads, Berry timers, repeating events).
+typedef struct timerEntry_s
+{
+	// absolute time in queue clock, compared with wrap in mind
+	unsigned int due;
+	// keeps FIFO order for equal due times
+	unsigned int seq;
+	// position in heap or -1 when not scheduled
+	int heapIndex;
+	void* owner;
+} timerEntry_t;
+
+// Min-heap of entries keyed on due time, so an update only touches due entries
+typedef struct timerQueue_s
+{
+	timerEntry_t** heap;
+	int count;
+	int alloc;
+	unsigned int now;
+	unsigned int seq;
+	struct timerQueue_s* nextQueue;
+	bool bRegistered;
+} timerQueue_t;
+
+// executable line of a script file, comments, labels and empty lines are not stored
+typedef struct scriptLine_s
+{
+	// offset of the line text in data, text is NULL terminated in place
+	int ofs;
+	int len;
+	// 1-based line number in the original file, for profiling
+	int lineNo;
+	unsigned int hits;
+	// parsed on second execution, lines that run once don't pay for it
+	struct cmdPrepared_s* cmd;
+} scriptLine_t;
+
+typedef struct scriptLabel_s
+{
+	unsigned int hash;
+	// label name in data, not terminated
+	int ofs;
+	int len;
+	// first executable line at or after the label
+	int lineIndex;
+} scriptLabel_t;
+
 typedef struct scriptFile_s
 {
 	char* fname;
 	char* data;
+	int dataLen;
+	scriptLine_t* lines;
+	int numLines;
+	// open addressing hash table, size is a power of two, empty slots have len 0
+	scriptLabel_t* labels;
+	int labelsSize;
 
 	struct scriptFile_s* next;
 } scriptFile_t;
@@ -32,11 +86,19 @@ typedef struct scriptInstance_s
 {
 	scriptFile_t* curFile;
 	int uniqueID;
+	// NULL when thread is free
 	const char* curLine;
+	// index of next line to run in curFile->lines
+	int curLineIndex;
 	int totalDelayMS;
 	int currentDelayMS;
 	eventWait_t wait;
 	int delayRepeats;
+	timerEntry_t timer;
+	// list of threads blocked in waitFor on the same event code
+	struct scriptInstance_s* nextWaiter;
+	// NULL when not in a waiter list
+	struct scriptInstance_s** prevWaiter;
 
 	struct scriptInstance_s* next;
 } scriptInstance_t;
@@ -224,9 +286,23 @@ bool Tokenizer_IsArgInteger(int i);
 float Tokenizer_GetArgFloat(int i);
 int Tokenizer_GetArgIntegerRange(int i, int rangeMax, int rangeMin);
 void Tokenizer_TokenizeString(const char* s, int flags);
+// cmd_timerQueue.c
+void TimerQueue_InitEntry(timerEntry_t *e, void *owner);
+// delays below 1ms are rounded up, so entry is never due in the update that scheduled it
+void TimerQueue_Schedule(timerQueue_t *q, timerEntry_t *e, int delayMS);
+void TimerQueue_Cancel(timerQueue_t *q, timerEntry_t *e);
+void TimerQueue_CancelAll(timerQueue_t *q);
+void TimerQueue_Advance(timerQueue_t *q, int deltaMS);
+// removes and returns the earliest due entry, or NULL if nothing is due
+timerEntry_t *TimerQueue_PopDue(timerQueue_t *q);
+// ms until entry is due, 0 if overdue, -1 if not scheduled
+int TimerQueue_GetRemaining(const timerQueue_t *q, const timerEntry_t *e);
+int TimerQueue_GetNextDelay(const timerQueue_t *q);
+// ms until the earliest entry in any queue is due, -1 if all are empty
+int Timers_GetNextDeadline();
 // cmd_repeatingEvents.c
 void RepeatingEvents_Init();
-void RepeatingEvents_RunUpdate(float deltaTimeSeconds);
+void RepeatingEvents_RunUpdate(int deltaMS);
 void SIM_GenerateRepeatingEventsDesc(char *o, int outLen);
 void SIM_GeneratePowerStateDesc(char *o, int outLen);
 // cmd_eventHandlers.c
@@ -316,12 +392,19 @@ int CMD_InitSendCommands();
 void CMD_StartTCPCommandLine();
 // cmd_script.c
 int CMD_GetCountActiveScriptThreads();
+int CMD_GetCountScriptWaitersForEvent(byte eventCode);
+int SVM_GetScriptLineHits(const char *fname, int lineNo);
 // cmd_berry.c
 void CMD_InitBerry();
 void CMD_Berry_RunEventHandlers_IntInt(byte eventCode, int argument, int argument2);
 void CMD_Berry_RunEventHandlers_IntBytes(byte eventCode, int argument, const byte *data, int size);
 int CMD_Berry_RunEventHandlers_StrPtr(byte eventCode, const char *argument, void* argument2);
 int CMD_Berry_RunEventHandlers_Str(byte eventCode, const char *argument, const char *argument2);
+// events fired between these share one garbage collection check
+void Berry_BeginEventBatch();
+void Berry_EndEventBatch();
+// be_run.c, removes the compiled copy of fname after it was changed
+void berryDropBytecode(const char *fname);
 
 const char* CMD_GetResultString(commandResult_t r);
 
@@ -12,13 +12,13 @@
 // turn off TuyaMCU after 5 seconds
 // addRepeatingEvent 5 1 setChannel 1 0
 typedef struct repeatingEvent_s {
-	// command string to execute
-	char *command;
+	// command to execute, parsed once when event is added
+	cmdPrepared_t *command;
 	//char *condition;
 	// how often event repeats
-	float intervalSeconds;
-	// current value until next repeat (decremented every second)
-	float currentInterval;
+	int intervalMS;
+	// when the next repeat is due, scheduled only while active
+	timerEntry_t timer;
 	// number of times to repeat.
 	// If set to -1, then it's infinite repeater
 	// If set to EVENT_CANCELED_TIMES, then event structure is ready to be reused
@@ -31,6 +31,14 @@ typedef struct repeatingEvent_s {
 #define EVENT_CANCELED_TIMES -999
 
 static repeatingEvent_t *g_repeatingEvents = 0;
+static timerQueue_t g_repeatingTimers;
+
+static int RepeatingEvents_SecondsToMS(float seconds) {
+	int ms;
+
+	ms = (int)(seconds * 1000.0f + 0.5f);
+	return ms > 0 ? ms : 1;
+}
 
 void RepeatingEvents_CancelRepeatingEvents(int userID)
 {
@@ -41,7 +49,8 @@ void RepeatingEvents_CancelRepeatingEvents(int userID)
 		if(ev->userID == userID) {
 			// mark as finished
 			ev->times = EVENT_CANCELED_TIMES;
-			addLogAdv(LOG_INFO, LOG_FEATURE_CMD,"Event with id %i and cmd %s has been canceled",ev->userID,ev->command);
+			TimerQueue_Cancel(&g_repeatingTimers, &ev->timer);
+			addLogAdv(LOG_INFO, LOG_FEATURE_CMD,"Event with id %i and cmd %s has been canceled",ev->userID,CMD_GetPreparedCommandText(ev->command));
 		}
 	}
 
@@ -49,17 +58,17 @@ void RepeatingEvents_CancelRepeatingEvents(int userID)
 void RepeatingEvents_AddRepeatingEvent(const char *command, float secondsInterval, int times, int userID)
 {
 	repeatingEvent_t *ev;
-	char *cmd_copy;
+	cmdPrepared_t *cmd_copy;
 
 	// reuse existing
 	for(ev = g_repeatingEvents; ev; ev = ev->next) {
 		// is this event canceled/empty?
 		if(ev->times == EVENT_CANCELED_TIMES) {
-			if(!strcmp(ev->command,command)) {
-				ev->intervalSeconds = secondsInterval;
-				// fire after delay
-				ev->currentInterval = secondsInterval;
+			if(!strcmp(CMD_GetPreparedCommandText(ev->command),command)) {
+				ev->intervalMS = RepeatingEvents_SecondsToMS(secondsInterval);
 				ev->times = times;
+				// fire after delay
+				TimerQueue_Schedule(&g_repeatingTimers, &ev->timer, ev->intervalMS);
 				return;
 			}
 		}
@@ -70,9 +79,9 @@ void RepeatingEvents_AddRepeatingEvent(const char *command, float secondsInterva
 		addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: failed to malloc new event");
 		return;
 	}
-	cmd_copy = strdup(command);
+	cmd_copy = CMD_PrepareCommand(command);
 	if(cmd_copy == 0) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: failed to malloc command text copy");
+		addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: failed to prepare command");
 		free(ev);
 		return;
 	}
@@ -80,14 +89,14 @@ void RepeatingEvents_AddRepeatingEvent(const char *command, float secondsInterva
 	ev->next = g_repeatingEvents;
 	g_repeatingEvents = ev;
 	ev->command = cmd_copy;
-	ev->intervalSeconds = secondsInterval;
+	ev->intervalMS = RepeatingEvents_SecondsToMS(secondsInterval);
 	ev->times = times;
 	ev->userID = userID;
+	TimerQueue_InitEntry(&ev->timer, ev);
 	// fire next frame
 	// TODO: is this what we want? or do we want to fire after full interval?
-	//ev->currentInterval = 1;
 	// fire after full interval
-	ev->currentInterval = secondsInterval;
+	TimerQueue_Schedule(&g_repeatingTimers, &ev->timer, ev->intervalMS);
 }
 void SIM_GenerateRepeatingEventsDesc(char *o, int outLen) {
 	repeatingEvent_t *cur;
@@ -100,10 +109,10 @@ void SIM_GenerateRepeatingEventsDesc(char *o, int outLen) {
 			//ci++;
 			snprintf(buffer, outLen,"ID %i, repeats %i",(int) cur->userID, (int)cur->times);
 			strcat_safe(o, buffer, outLen);
-			snprintf(buffer, outLen, ", interval %i", (int)cur->intervalSeconds);
-			snprintf(buffer, outLen, " (cur left %i), cmd: ", (int)cur->currentInterval);
+			snprintf(buffer, outLen, ", interval %i", cur->intervalMS / 1000);
+			snprintf(buffer, outLen, " (cur left %i), cmd: ", TimerQueue_GetRemaining(&g_repeatingTimers, &cur->timer) / 1000);
 			strcat_safe(o, buffer, outLen);
-			strcat_safe(o, cur->command, outLen);
+			strcat_safe(o, CMD_GetPreparedCommandText(cur->command), outLen);
 		}
 		cur = cur->next;
 	}
@@ -123,41 +132,31 @@ int RepeatingEvents_GetActiveCount() {
 	}
 	return c_active;
 }
-void RepeatingEvents_RunUpdate(float deltaTimeSeconds) {
+void RepeatingEvents_RunUpdate(int deltaMS) {
 	repeatingEvent_t *cur;
-	int c_checked = 0;
+	timerEntry_t *e;
 	int c_ran = 0;
 
-	cur = g_repeatingEvents;
-	while(cur) {
-		c_checked++;
-		// debug only check
-		if(cur == cur->next) {
-			addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: single linked list was broken?");
-			cur->next = 0;
-			return;
-		}
+	TimerQueue_Advance(&g_repeatingTimers, deltaMS);
+	while ((e = TimerQueue_PopDue(&g_repeatingTimers)) != 0) {
+		cur = (repeatingEvent_t*)e->owner;
+		c_ran++;
 		// -1 means 'forever'
-		if(cur->times > 0 || cur->times == -1) {
-			cur->currentInterval-= deltaTimeSeconds;
-			if(cur->currentInterval<=0){
-				c_ran++;
-				// -1 means 'forever'
-				if(cur->times != -1) {
-					cur->times -= 1;
-					if (cur->times <= 0) {
-						// if finished all calls, mark as empty so we can reuse later
-						cur->times = EVENT_CANCELED_TIMES;
-					}
-				}
-				cur->currentInterval = cur->intervalSeconds;
-				CMD_ExecuteCommand(cur->command, COMMAND_FLAG_SOURCE_SCRIPT);
+		if(cur->times != -1) {
+			cur->times -= 1;
+			if (cur->times <= 0) {
+				// if finished all calls, mark as empty so we can reuse later
+				cur->times = EVENT_CANCELED_TIMES;
 			}
 		}
-		cur = cur->next;
+		// reschedule before running, the command may cancel or even free us
+		if (cur->times != EVENT_CANCELED_TIMES) {
+			TimerQueue_Schedule(&g_repeatingTimers, &cur->timer, cur->intervalMS);
+		}
+		CMD_ExecutePreparedCommand(cur->command, COMMAND_FLAG_SOURCE_SCRIPT);
 	}
 
-	//addLogAdv(LOG_INFO, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond checked %i events, ran %i\n",c_checked,c_ran);
+	//addLogAdv(LOG_INFO, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond ran %i\n",c_ran);
 }
 // addRepeatingEventID 1234 5 -1 DGR_SendPower "testgr" 1 1 
 // cancelRepeatingEvent 1234
@@ -205,11 +204,12 @@ commandResult_t RepeatingEvents_Cmd_ClearRepeatingEvents(const void *context, co
 	repeatingEvent_t *rem;
 	int c = 0;
 
+	TimerQueue_CancelAll(&g_repeatingTimers);
 	cur = g_repeatingEvents;
 	while (cur) {
 		rem = cur;
 		cur = cur->next;
-		free(rem->command);
+		CMD_FreePreparedCommand(rem->command);
 		free(rem);
 		c++;
 	}
@@ -244,8 +244,8 @@ static commandResult_t RepeatingEvents_Cmd_ListRepeatingEvents(const void *conte
 	c = 0;
 
 	while (ev) {
-		ADDLOG_INFO(LOG_FEATURE_EVENT, "Repeater %i has ID %i, interval %i, reps %i, and command %s",
-			c,  ev->userID, ev->intervalSeconds, ev->times, ev->command);
+		ADDLOG_INFO(LOG_FEATURE_EVENT, "Repeater %i has ID %i, interval %i ms, reps %i, and command %s",
+			c,  ev->userID, ev->intervalMS, ev->times, CMD_GetPreparedCommandText(ev->command));
 		ev = ev->next;
 		c++;
 	}
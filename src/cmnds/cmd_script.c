@@ -231,6 +231,43 @@ int svm_deltaMS;
 scriptFile_t *g_scriptFiles = 0;
 scriptInstance_t *g_scriptThreads = 0;
 scriptInstance_t *g_activeThread = 0;
+// sleeping and runnable threads, waiting (waitFor) and free ones are not here
+static timerQueue_t g_scriptTimers;
+// threads blocked in waitFor, by event code, so an event only visits its own waiters
+static scriptInstance_t *g_scriptWaiters[CMD_EVENT_MAX_TYPES];
+
+static void SVM_RemoveWaiter(scriptInstance_t *t) {
+	if (t->prevWaiter == 0) {
+		return;
+	}
+	*t->prevWaiter = t->nextWaiter;
+	if (t->nextWaiter) {
+		t->nextWaiter->prevWaiter = t->prevWaiter;
+	}
+	t->prevWaiter = 0;
+	// nextWaiter is left as is, so a loop that is visiting us can move on
+}
+static void SVM_AddWaiter(scriptInstance_t *t) {
+	scriptInstance_t **head;
+
+	SVM_RemoveWaiter(t);
+	if (t->wait.waitingForEvent >= CMD_EVENT_MAX_TYPES) {
+		return;
+	}
+	head = &g_scriptWaiters[t->wait.waitingForEvent];
+	t->nextWaiter = *head;
+	if (*head) {
+		(*head)->prevWaiter = &t->nextWaiter;
+	}
+	*head = t;
+	t->prevWaiter = head;
+}
+static void SVM_ClearWait(scriptInstance_t *t) {
+	SVM_RemoveWaiter(t);
+	t->wait.waitingForArgument = 0;
+	t->wait.waitingForEvent = 0;
+	t->wait.waitingForRelation = 0;
+}
 
 
 scriptInstance_t *SVM_RegisterThread() {
@@ -247,15 +284,21 @@ scriptInstance_t *SVM_RegisterThread() {
 	if(r == 0) {
 		r = malloc(sizeof(scriptInstance_t));
 		memset(r,0,sizeof(scriptInstance_t));
+		TimerQueue_InitEntry(&r->timer, r);
 		r->next = g_scriptThreads;
 		g_scriptThreads = r;
 	}
+	TimerQueue_Cancel(&g_scriptTimers, &r->timer);
+	// a stopped thread may still have been parked in waitFor
+	SVM_ClearWait(r);
 	r->uniqueID = 0;
 	r->curLine = 0;
 	r->curFile = 0;
 	r->currentDelayMS = 0;
 	return r;
 }
+static void SVM_IndexFile(scriptFile_t *f);
+
 scriptFile_t *SVM_RegisterFile(const char *fname) {
 	scriptFile_t *r;
 
@@ -289,6 +332,7 @@ scriptFile_t *SVM_RegisterFile(const char *fname) {
 	g_scriptFiles = r;
 	if(r->data == 0)
 		return 0;
+	SVM_IndexFile(r);
 	return r;
 }
 scriptFile_t *SVM_RegisterFileForText(const char *txt) {
@@ -318,6 +362,7 @@ scriptFile_t *SVM_RegisterFileForText(const char *txt) {
 	g_scriptFiles = r;
 	if (r->data == 0)
 		return 0;
+	SVM_IndexFile(r);
 	return r;
 }
 const char *SVM_SkipWS(const char *p) {
@@ -342,38 +387,168 @@ const char *SVM_SkipLine(const char *p) {
 	return p;
 }
 
-const char *SVM_FindLabel(const char *text, const char *label, const char *fname) {
-	int labLen;
+static unsigned int SVM_HashLabel(const char *s, int len) {
+	unsigned int h;
+
+	// FNV-1a
+	h = 2166136261u;
+	while (len--) {
+		h ^= (byte)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+static void SVM_AddLabel(scriptFile_t *f, int ofs, int len, int lineIndex) {
+	scriptLabel_t *l;
+	unsigned int h, mask;
+	int i;
+
+	h = SVM_HashLabel(f->data + ofs, len);
+	mask = f->labelsSize - 1;
+	i = h & mask;
+	while (f->labels[i].len) {
+		l = &f->labels[i];
+		// first label with given name wins, just like the old linear search
+		if (l->hash == h && l->len == len && !strncmp(f->data + l->ofs, f->data + ofs, len)) {
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+	l = &f->labels[i];
+	l->hash = h;
+	l->ofs = ofs;
+	l->len = len;
+	l->lineIndex = lineIndex;
+}
+// Builds line table and label hash, so threads can run and jump by index
+// instead of scanning text. Executable lines are NULL terminated in place.
+static void SVM_IndexFile(scriptFile_t *f) {
+	char *p, *start, *end, *c;
+	int pass, len, lineNo, numLines, numLabels;
+	scriptLine_t *line;
+
+	f->dataLen = strlen(f->data);
+	numLines = 0;
+	numLabels = 0;
+	for (pass = 0; pass < 2; pass++) {
+		numLines = 0;
+		numLabels = 0;
+		lineNo = 0;
+		p = f->data;
+		while (*p) {
+			lineNo++;
+			start = (char*)SVM_SkipWS(p);
+			end = (char*)SVM_SkipLine(start);
+			p = end;
+			if (start[0] == '/' && start[1] == '/') {
+				continue;
+			}
+			while (end > start && (end[-1] == ' ' || end[-1] == '\r' || end[-1] == '\n' || end[-1] == '\t')) {
+				end--;
+			}
+			len = end - start;
+			if (len == 0) {
+				continue;
+			}
+			// "label:" or "label: command", label name can't have whitespace
+			c = start;
+			while (c < end && *c != ':' && *c != ' ' && *c != '\t') {
+				c++;
+			}
+			if (c > start && c < end && *c == ':') {
+				if (pass == 1) {
+					SVM_AddLabel(f, start - f->data, c - start, numLines);
+				}
+				numLabels++;
+			}
+			// skip labels
+			if (start[len - 1] == ':') {
+				continue;
+			}
+			if (pass == 1) {
+				line = &f->lines[numLines];
+				line->ofs = start - f->data;
+				line->len = len;
+				line->lineNo = lineNo;
+				line->hits = 0;
+				line->cmd = 0;
+				start[len] = 0;
+			}
+			numLines++;
+		}
+		if (pass == 0) {
+			if (numLines) {
+				f->lines = (scriptLine_t*)malloc(numLines * sizeof(scriptLine_t));
+			}
+			if (numLabels) {
+				f->labelsSize = 4;
+				while (f->labelsSize < numLabels * 2) {
+					f->labelsSize *= 2;
+				}
+				f->labels = (scriptLabel_t*)malloc(f->labelsSize * sizeof(scriptLabel_t));
+				if (f->labels) {
+					memset(f->labels, 0, f->labelsSize * sizeof(scriptLabel_t));
+				}
+			}
+			if ((numLines && f->lines == 0) || (numLabels && f->labels == 0)) {
+				ADDLOG_ERROR(LOG_FEATURE_CMD, "SVM_IndexFile: failed to malloc for %s", f->fname);
+				free(f->lines);
+				free(f->labels);
+				f->lines = 0;
+				f->labels = 0;
+				f->labelsSize = 0;
+				f->numLines = 0;
+				return;
+			}
+		}
+	}
+	f->numLines = numLines;
+	ADDLOG_EXTRADEBUG(LOG_FEATURE_CMD, "SVM_IndexFile: %s has %i lines and %i labels", f->fname, numLines, numLabels);
+}
+static int SVM_FindLabelIndex(scriptFile_t *f, const char *label) {
+	scriptLabel_t *l;
+	unsigned int h, mask;
+	int i, len;
 
-	if(label == 0)
-		return text;
+	if (label == 0)
+		return 0;
 	if (!strcmp(label, "*"))
-		return text;
+		return 0;
 	if (*label == 0)
-		return text;
-
-	labLen = strlen(label);
+		return 0;
 
-	while(*text) {
-		text = SVM_SkipWS(text); 
-		if(strncmp(text,label,labLen) == 0 && text[labLen] == ':') {
-			return text;
-		}
-		if(text[0] == '/' && text[1] == '/') {
-			text = SVM_SkipLine(text); 
-			text = SVM_SkipWS(text); 
-		} else {
-			text = SVM_SkipLine(text); 
-			text = SVM_SkipWS(text); 
+	if (f->labelsSize) {
+		len = strlen(label);
+		h = SVM_HashLabel(label, len);
+		mask = f->labelsSize - 1;
+		i = h & mask;
+		while (f->labels[i].len) {
+			l = &f->labels[i];
+			if (l->hash == h && l->len == len && !strncmp(f->data + l->ofs, label, len)) {
+				return l->lineIndex;
+			}
+			i = (i + 1) & mask;
 		}
 	}
-	ADDLOG_INFO(LOG_FEATURE_CMD, "Label %s not found in %s - will go to the start of file",label,fname);
-	return text;
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Label %s not found in %s - script will stop", label, f->fname);
+	return f->numLines;
+}
+static void SVM_SetThreadLine(scriptInstance_t *th, scriptFile_t *f, int index) {
+	th->curFile = f;
+	th->curLineIndex = index;
+	// curLine is also a "thread is running" flag, so it must not be NULL here
+	if (index < f->numLines) {
+		th->curLine = f->data + f->lines[index].ofs;
+	}
+	else {
+		th->curLine = f->data + f->dataLen;
+	}
 }
 void SVM_RunThread(scriptInstance_t *t, int maxLoops) {
 	int loop = 0;
-	const char *start, *end;
-	int len, p;
+	scriptFile_t *f;
+	scriptLine_t *line;
+	int i;
 	
 	if(g_scrBuffer == NULL) {
 		g_scrBufferSize = 256;
@@ -395,84 +570,72 @@ void SVM_RunThread(scriptInstance_t *t, int maxLoops) {
 		if (loop > maxLoops) {
 			return;
 		}
-		t->curLine = SVM_SkipWS(t->curLine); 
-		if(t->curLine[0] == 0) {
+		f = t->curFile;
+		i = t->curLineIndex;
+		if(i >= f->numLines) {
 			t->curLine = 0;
 			t->curFile = 0;
 			return;
 		}
-		if(t->curLine[0] == '/' && t->curLine[1] == '/') {
-			t->curLine = SVM_SkipLine(t->curLine); 
-			t->curLine = SVM_SkipWS(t->curLine); 
+		line = &f->lines[i];
+		line->hits++;
+		// advance before running, so goto etc can overwrite it
+		SVM_SetThreadLine(t, f, i + 1);
+
+		// Line and file must not be touched after the command has run,
+		// because resetSVM frees them. The prepared command itself is kept
+		// alive until it returns, and the first run works on a copy.
+		if(line->cmd == 0 && line->hits > 1) {
+			line->cmd = CMD_PrepareCommand(f->data + line->ofs);
+		}
+		if(line->cmd) {
+			CMD_ExecutePreparedCommand(line->cmd, 0);
 		} else {
-			start = t->curLine;
-			end = SVM_SkipLine(start);
-			t->curLine = SVM_SkipWS(end); 
-
-			while(end > start && (end[-1]==' '||end[-1]=='\r'||end[-1]=='\n'||end[-1]=='\t')) {
-				end--;
+			if(line->len >= g_scrBufferSize) {
+				g_scrBufferSize = line->len + 256;
+				g_scrBuffer = (char*)realloc(g_scrBuffer, g_scrBufferSize+1);
 			}
-			len = (end - start);
-			//ADDLOG_EXTRADEBUG(LOG_FEATURE_CMD, "Script len: %i",len);
-
-			// skip empty lines and skip labels
-			if(len > 0 && start[len-1] != ':') {
-				if(len >= g_scrBufferSize) {
-					g_scrBufferSize = len + 256;
-					g_scrBuffer = (char*)realloc(g_scrBuffer, g_scrBufferSize+1);
-				}
-				if (g_scrBuffer == NULL) {
-					return;
-				}
-				memcpy(g_scrBuffer,start,len);
-				g_scrBuffer[len] = 0;
-
-				p = start-t->curFile->data;
-				///ADDLOG_EXTRADEBUG(LOG_FEATURE_CMD, "[Loop %i] Script line: %s, char index %i",loop,g_scrBuffer,p);
-				CMD_ExecuteCommand(g_scrBuffer,0);
-
-				// did we get a sleep?
-				if(t->currentDelayMS > 0) {
-					return;
-				}	
+			if (g_scrBuffer == NULL) {
+				return;
 			}
+			memcpy(g_scrBuffer, f->data + line->ofs, line->len + 1);
+			CMD_ExecuteCommand(g_scrBuffer,0);
 		}
+
+		// did we get a sleep?
+		if(t->currentDelayMS > 0) {
+			return;
+		}	
 	}
 }
 
+// Puts thread back in timer queue after it has run. Threads that still
+// have work but no delay (hit maxLoops, just started or woken up) run on
+// the next update.
+static void SVM_ScheduleThread(scriptInstance_t *t) {
+	if (t->curLine == 0 || t->wait.waitingForEvent) {
+		TimerQueue_Cancel(&g_scriptTimers, &t->timer);
+		return;
+	}
+	TimerQueue_Schedule(&g_scriptTimers, &t->timer, t->currentDelayMS);
+}
+static void SVM_UnscheduleThread(scriptInstance_t *t) {
+	TimerQueue_Cancel(&g_scriptTimers, &t->timer);
+}
 void SVM_RunThreads(int deltaMS) {
-	int c_sleep, c_run;
+	timerEntry_t *e;
 
-	c_sleep = 0;
-	c_run = 0;
 	svm_deltaMS = deltaMS;
-
-
-	g_activeThread = g_scriptThreads;
-	while(g_activeThread) {
-		if (g_activeThread->wait.waitingForEvent) {
-			// do nothing
-			c_sleep++;
-		}
-		else {
-			if (g_activeThread->currentDelayMS > 0) {
-				g_activeThread->currentDelayMS -= deltaMS;
-				// the following block is needed to handle with long freezes on simulator
-				if (g_activeThread->currentDelayMS <= 0) {
-					g_activeThread->currentDelayMS = 0;
-					SVM_RunThread(g_activeThread, 20);
-				}
-				c_sleep++;
-			}
-			else {
-				SVM_RunThread(g_activeThread, 20);
-				c_run++;
-			}
-		}
-		g_activeThread = g_activeThread->next;
+	TimerQueue_Advance(&g_scriptTimers, deltaMS);
+
+	while ((e = TimerQueue_PopDue(&g_scriptTimers)) != 0) {
+		g_activeThread = (scriptInstance_t*)e->owner;
+		// delay has passed, overshoot is dropped like before
+		g_activeThread->currentDelayMS = 0;
+		SVM_RunThread(g_activeThread, 20);
+		SVM_ScheduleThread(g_activeThread);
 	}
-
-	//ADDLOG_INFO(LOG_FEATURE_CMD, "SCR sleep %i, ran %i",c_sleep,c_run);
+	g_activeThread = 0;
 }
 bool CheckEventCondition(eventWait_t *w, byte eventCode, int argument) {
 	if (w->waitingForEvent != eventCode) {
@@ -512,21 +675,25 @@ bool CheckEventCondition(eventWait_t *w, byte eventCode, int argument) {
 	return bMatch;
 }
 void CMD_Script_ProcessWaitersForEvent(byte eventCode, int argument) {
-	scriptInstance_t *t;
+	scriptInstance_t *t, *next;
 
 #if ENABLE_OBK_BERRY
 	extern void CMD_Berry_ProcessWaitersForEvent(byte eventCode, int argument);
 	CMD_Berry_ProcessWaitersForEvent(eventCode, argument);
 #endif
-	t = g_scriptThreads;
+	if (eventCode >= CMD_EVENT_MAX_TYPES) {
+		return;
+	}
+	t = g_scriptWaiters[eventCode];
 
 	while (t) {
+		next = t->nextWaiter;
 		if(CheckEventCondition(&t->wait,eventCode,argument)) {
 			// unlock!
-			t->wait.waitingForArgument = 0;
-			t->wait.waitingForEvent = 0;
+			SVM_ClearWait(t);
+			SVM_ScheduleThread(t);
 		}
-		t = t->next;
+		t = next;
 	}
 }
 void SVM_GoTo(scriptInstance_t *th, const char *fname, const char *label) {
@@ -545,13 +712,13 @@ void SVM_GoTo(scriptInstance_t *th, const char *fname, const char *label) {
 
 		return;
 	}
-	th->curFile = f;
-	th->curLine = SVM_FindLabel(f->data,label,f->fname);
+	SVM_SetThreadLine(th, f, SVM_FindLabelIndex(f, label));
 
 	return;
 }
 void SVM_FreeAllFiles() {
 	scriptFile_t *f; 
+	int i;
 
 	f = g_scriptFiles;
 	while(f) {
@@ -559,6 +726,11 @@ void SVM_FreeAllFiles() {
 
 		n = f->next;
 
+		for (i = 0; i < f->numLines; i++) {
+			CMD_FreePreparedCommand(f->lines[i].cmd);
+		}
+		free(f->lines);
+		free(f->labels);
 		free(f->data);
 		free(f->fname);
 		free(f);
@@ -576,8 +748,10 @@ void SVM_StopAllScripts() {
 		t->curFile = 0;
 		t->uniqueID = 0;
 		t->currentDelayMS = 0;
+		SVM_ClearWait(t);
 		t = t->next;
 	}
+	TimerQueue_CancelAll(&g_scriptTimers);
 }
 
 void SVM_StopScripts(int id, int bExcludeSelf) {
@@ -593,6 +767,8 @@ void SVM_StopScripts(int id, int bExcludeSelf) {
 				t->curFile = 0;
 				t->uniqueID = 0;
 				t->currentDelayMS = 0;
+				SVM_UnscheduleThread(t);
+				SVM_ClearWait(t);
 			} 
 		}
 		t = t->next;
@@ -600,11 +776,11 @@ void SVM_StopScripts(int id, int bExcludeSelf) {
 }
 void SVM_GoToLocal(scriptInstance_t *th, const char *label) {
 
-	if(th == 0) {
+	if(th == 0 || th->curFile == 0) {
 
 		return;
 	}
-	th->curLine = SVM_FindLabel(th->curFile->data,label,th->curFile->fname);
+	SVM_SetThreadLine(th, th->curFile, SVM_FindLabelIndex(th->curFile, label));
 
 	return;
 }
@@ -632,8 +808,8 @@ void SVM_StartBacklog(const char *command) {
 		return ;
 	}
 	th->uniqueID = 0;
-	th->curFile = f;
-	th->curLine = f->data;
+	SVM_SetThreadLine(th, f, 0);
+	SVM_ScheduleThread(th);
 	//return th;
 }
 scriptInstance_t *SVM_StartScript(const char *fname, const char *label, int uniqueID) {
@@ -648,6 +824,8 @@ scriptInstance_t *SVM_StartScript(const char *fname, const char *label, int uniq
 		if (*fname == '/' || *fname == '\\') {
 			fname++;
 		}
+		extern int Berry_CompileFile(const char *fname, bool bForce);
+		Berry_CompileFile(fname, false);
 		char tmp[64];
 		sprintf(tmp, "berry import %s",fname);
 		tmp[strlen(tmp) - 3] = 0;
@@ -676,8 +854,8 @@ scriptInstance_t *SVM_StartScript(const char *fname, const char *label, int uniq
 		return NULL;
 	}
 	th->uniqueID = uniqueID;
-	th->curFile = f;
-	th->curLine = SVM_FindLabel(f->data,label,f->fname);
+	SVM_SetThreadLine(th, f, SVM_FindLabelIndex(f, label));
+	SVM_ScheduleThread(th);
 
 	if(label==0) {
 		ADDLOG_INFO(LOG_FEATURE_CMD, "CMD_StartScript: started %s at the beginning",fname);
@@ -694,6 +872,7 @@ void SVM_RunStartupCommandAsScript() {
 		// Hacky as hell?
 		g_activeThread = th;
 		SVM_RunThread(g_activeThread, 200);
+		SVM_ScheduleThread(g_activeThread);
 		g_activeThread = 0;
 	}
 	else {
@@ -838,6 +1017,19 @@ static commandResult_t CMD_StopScript(const void *context, const char *cmd, cons
 
 	return CMD_RES_OK;
 }
+int CMD_GetCountScriptWaitersForEvent(byte eventCode) {
+	scriptInstance_t *t;
+	int cnt;
+
+	if (eventCode >= CMD_EVENT_MAX_TYPES) {
+		return 0;
+	}
+	cnt = 0;
+	for (t = g_scriptWaiters[eventCode]; t; t = t->nextWaiter) {
+		cnt++;
+	}
+	return cnt;
+}
 int CMD_GetCountActiveScriptThreads() {
 	scriptInstance_t *t;
 	int cnt;
@@ -874,6 +1066,48 @@ static commandResult_t CMD_ListScripts(const void *context, const char *cmd, con
 
 	return CMD_RES_OK;
 }
+int SVM_GetScriptLineHits(const char *fname, int lineNo) {
+	scriptFile_t *f;
+	int i;
+
+	f = g_scriptFiles;
+	while (f) {
+		if (!stricmp(fname, f->fname)) {
+			for (i = 0; i < f->numLines; i++) {
+				if (f->lines[i].lineNo == lineNo) {
+					return f->lines[i].hits;
+				}
+			}
+			return 0;
+		}
+		f = f->next;
+	}
+	return 0;
+}
+static commandResult_t CMD_ScriptProfile(const void *context, const char *cmd, const char *args, int cmdFlags){
+	scriptFile_t *f;
+	scriptLine_t *line;
+	int i, bReset;
+
+	Tokenizer_TokenizeString(args, 0);
+	bReset = Tokenizer_GetArgInteger(0);
+
+	f = g_scriptFiles;
+	while (f) {
+		for (i = 0; i < f->numLines; i++) {
+			line = &f->lines[i];
+			if (line->hits) {
+				ADDLOG_INFO(LOG_FEATURE_CMD, "%s:%i %u hits - %s", f->fname, line->lineNo, line->hits, f->data + line->ofs);
+			}
+			if (bReset) {
+				line->hits = 0;
+			}
+		}
+		f = f->next;
+	}
+
+	return CMD_RES_OK;
+}
 static commandResult_t CMD_StopAllScripts(const void *context, const char *cmd, const char *args, int cmdFlags){
 
 
@@ -941,6 +1175,7 @@ commandResult_t CMD_waitFor(const void *context, const char *cmd, const char *ar
 	g_activeThread->wait.waitingForEvent = eventCode;
 	g_activeThread->wait.waitingForArgument = reqArg;
 	g_activeThread->wait.waitingForRelation = relation;
+	SVM_AddWaiter(g_activeThread);
 
 	return CMD_RES_OK;
 }
@@ -996,4 +1231,9 @@ void CMD_InitScripting(){
 	//cmddetail:"fn":"CMD_waitFor","file":"cmnds/cmd_script.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("waitFor", CMD_waitFor, NULL);
+	//cmddetail:{"name":"scriptProfile","args":"[bReset]",
+	//cmddetail:"descr":"Prints how many times each line of loaded script files was executed. Pass 1 to also reset the counters.",
+	//cmddetail:"fn":"CMD_ScriptProfile","file":"cmnds/cmd_script.c","requires":"",
+	//cmddetail:"examples":"scriptProfile 1"}
+	CMD_RegisterCommand("scriptProfile", CMD_ScriptProfile, NULL);
 }
@@ -305,6 +305,9 @@ int LFS_WriteFile(const char *fname, const byte *data, int len, bool bAppend) {
 			lfsres = lfs_file_write(&lfs, &file, data, len);
 			lfs_file_close(&lfs, &file);
 			ADDLOG_DEBUG(LOG_FEATURE_CMD, "LFS_ReadFile: closed file %s", fname);
+#if ENABLE_OBK_BERRY
+			berryDropBytecode(fname);
+#endif
 			return lfsres;
 		}
 		else {
@@ -0,0 +1,173 @@
+
+#include "../new_common.h"
+#include "cmd_local.h"
+#include "../logging/logging.h"
+
+// Shared scheduler for everything that used to count down a delay in every
+// quick tick. Each user has its own queue (so the order in which script
+// threads, Berry timers and repeating events run within a tick stays the
+// same), but they all share this implementation and report a common
+// next deadline.
+
+static timerQueue_t *g_timerQueues = 0;
+
+// due times are free running, so compare them like tick counts
+static bool TimerQueue_Before(const timerEntry_t *a, const timerEntry_t *b) {
+	if (a->due != b->due) {
+		return (int)(a->due - b->due) < 0;
+	}
+	return (int)(a->seq - b->seq) < 0;
+}
+static void TimerQueue_Set(timerQueue_t *q, int i, timerEntry_t *e) {
+	q->heap[i] = e;
+	e->heapIndex = i;
+}
+static void TimerQueue_SiftUp(timerQueue_t *q, int i) {
+	timerEntry_t *e;
+	int parent;
+
+	e = q->heap[i];
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!TimerQueue_Before(e, q->heap[parent])) {
+			break;
+		}
+		TimerQueue_Set(q, i, q->heap[parent]);
+		i = parent;
+	}
+	TimerQueue_Set(q, i, e);
+}
+static void TimerQueue_SiftDown(timerQueue_t *q, int i) {
+	timerEntry_t *e;
+	int child;
+
+	e = q->heap[i];
+	while (1) {
+		child = i * 2 + 1;
+		if (child >= q->count) {
+			break;
+		}
+		if (child + 1 < q->count && TimerQueue_Before(q->heap[child + 1], q->heap[child])) {
+			child++;
+		}
+		if (!TimerQueue_Before(q->heap[child], e)) {
+			break;
+		}
+		TimerQueue_Set(q, i, q->heap[child]);
+		i = child;
+	}
+	TimerQueue_Set(q, i, e);
+}
+static void TimerQueue_RemoveAt(timerQueue_t *q, int i) {
+	timerEntry_t *last;
+
+	q->heap[i]->heapIndex = -1;
+	q->count--;
+	if (i == q->count) {
+		return;
+	}
+	last = q->heap[q->count];
+	TimerQueue_Set(q, i, last);
+	if (i > 0 && TimerQueue_Before(last, q->heap[(i - 1) / 2])) {
+		TimerQueue_SiftUp(q, i);
+	}
+	else {
+		TimerQueue_SiftDown(q, i);
+	}
+}
+void TimerQueue_InitEntry(timerEntry_t *e, void *owner) {
+	e->due = 0;
+	e->seq = 0;
+	e->heapIndex = -1;
+	e->owner = owner;
+}
+void TimerQueue_Schedule(timerQueue_t *q, timerEntry_t *e, int delayMS) {
+	timerEntry_t **n;
+	int newAlloc;
+
+	if (q->bRegistered == false) {
+		q->nextQueue = g_timerQueues;
+		g_timerQueues = q;
+		q->bRegistered = true;
+	}
+	if (e->heapIndex >= 0) {
+		TimerQueue_RemoveAt(q, e->heapIndex);
+	}
+	if (q->count >= q->alloc) {
+		newAlloc = q->alloc ? q->alloc * 2 : 8;
+		n = (timerEntry_t**)realloc(q->heap, newAlloc * sizeof(timerEntry_t*));
+		if (n == 0) {
+			ADDLOG_ERROR(LOG_FEATURE_CMD, "TimerQueue_Schedule: failed to grow queue to %i", newAlloc);
+			return;
+		}
+		q->heap = n;
+		q->alloc = newAlloc;
+	}
+	if (delayMS < 1) {
+		delayMS = 1;
+	}
+	e->due = q->now + delayMS;
+	e->seq = q->seq++;
+	q->heap[q->count] = e;
+	e->heapIndex = q->count;
+	q->count++;
+	TimerQueue_SiftUp(q, e->heapIndex);
+}
+void TimerQueue_Cancel(timerQueue_t *q, timerEntry_t *e) {
+	if (e->heapIndex < 0) {
+		return;
+	}
+	TimerQueue_RemoveAt(q, e->heapIndex);
+}
+void TimerQueue_CancelAll(timerQueue_t *q) {
+	int i;
+
+	for (i = 0; i < q->count; i++) {
+		q->heap[i]->heapIndex = -1;
+	}
+	q->count = 0;
+}
+void TimerQueue_Advance(timerQueue_t *q, int deltaMS) {
+	q->now += deltaMS;
+}
+timerEntry_t *TimerQueue_PopDue(timerQueue_t *q) {
+	timerEntry_t *e;
+
+	if (q->count == 0) {
+		return 0;
+	}
+	e = q->heap[0];
+	if ((int)(e->due - q->now) > 0) {
+		return 0;
+	}
+	TimerQueue_RemoveAt(q, 0);
+	return e;
+}
+int TimerQueue_GetRemaining(const timerQueue_t *q, const timerEntry_t *e) {
+	int left;
+
+	if (e->heapIndex < 0) {
+		return -1;
+	}
+	left = (int)(e->due - q->now);
+	return left > 0 ? left : 0;
+}
+int TimerQueue_GetNextDelay(const timerQueue_t *q) {
+	if (q->count == 0) {
+		return -1;
+	}
+	return TimerQueue_GetRemaining(q, q->heap[0]);
+}
+int Timers_GetNextDeadline() {
+	timerQueue_t *q;
+	int best, d;
+
+	best = -1;
+	for (q = g_timerQueues; q; q = q->nextQueue) {
+		d = TimerQueue_GetNextDelay(q);
+		if (d >= 0 && (best < 0 || d < best)) {
+			best = d;
+		}
+	}
+	return best;
+}
@@ -111,12 +111,38 @@ static void ScaleAndUpdate(bl0942_data_t * data) {
     //    adeviceindex, voltage, current, power, frequency, energyWh);
 }
 
+static const byte g_bl0942Header[1] = { BL0942_UART_PACKET_HEAD };
+
+// returns false on bad checksum
+static bool BL0942_UART_ParsePacket(const byte* packet, bl0942_data_t* data) {
+  byte checksum;
+  int i;
+
+  checksum = BL0942_UART_CMD_READ(BL0942_UART_ADDR);
+  for (i = 0; i < BL0942_UART_PACKET_LEN - 1; i++) {
+    checksum += packet[i];
+  }
+  checksum ^= 0xFF;
+  if (checksum != packet[BL0942_UART_PACKET_LEN - 1]) {
+    ADDLOG_WARN(LOG_FEATURE_ENERGYMETER,
+      "Skipping packet with bad checksum %02X wanted %02X\n",
+      packet[BL0942_UART_PACKET_LEN - 1], checksum);
+    return false;
+  }
+  data->i_rms = (packet[3] << 16) | (packet[2] << 8) | packet[1];
+  data->v_rms = (packet[6] << 16) | (packet[5] << 8) | packet[4];
+  data->watt = Int24ToInt32((packet[12] << 16) | (packet[11] << 8) | packet[10]);
+  data->cf_cnt = (packet[15] << 16) | (packet[14] << 8) | packet[13];
+  data->freq = (packet[17] << 8) | packet[16];
+  return true;
+}
+
 #if !ENABLE_BL_TWIN
 static int BL0942_UART_TryToGetNextPacket() {
   int cs;
-  int i;
-  int c_garbage_consumed = 0;
-  byte checksum;
+  int c_garbage_consumed;
+  byte packet[BL0942_UART_PACKET_LEN];
+  bl0942_data_t data;
 
   cs = UART_GetDataSize();
 
@@ -124,16 +150,13 @@ static int BL0942_UART_TryToGetNextPacket() {
     return 0;
   }
   // skip garbage data (should not happen)
-  while(cs > 0) {
-    if (UART_GetByte(0) != BL0942_UART_PACKET_HEAD) {
-      UART_ConsumeBytes(1);
-      c_garbage_consumed++;
-      cs--;
-    } else {
-      break;
-    }
+  c_garbage_consumed = UART_FindHeader(g_bl0942Header, sizeof(g_bl0942Header));
+  if (c_garbage_consumed < 0) {
+    c_garbage_consumed = cs;
   }
   if(c_garbage_consumed > 0){
+    UART_ConsumeBytes(c_garbage_consumed);
+    cs -= c_garbage_consumed;
     ADDLOG_WARN(LOG_FEATURE_ENERGYMETER,
       "Consumed %i unwanted non-header byte in BL0942 buffer\n",
       c_garbage_consumed);
@@ -141,45 +164,20 @@ static int BL0942_UART_TryToGetNextPacket() {
   if(cs < BL0942_UART_PACKET_LEN) {
     return 0;
   }
-  if (UART_GetByte(0) != 0x55)
-    return 0;
-  checksum = BL0942_UART_CMD_READ(BL0942_UART_ADDR);
-
-  for(i = 0; i < BL0942_UART_PACKET_LEN-1; i++) {
-    checksum += UART_GetByte(i);
-  }
-  checksum ^= 0xFF;
-
-  if (checksum != UART_GetByte(BL0942_UART_PACKET_LEN - 1)) {
-    ADDLOG_WARN(LOG_FEATURE_ENERGYMETER,
-      "Skipping packet with bad checksum %02X wanted %02X\n",
-      UART_GetByte(BL0942_UART_PACKET_LEN - 1), checksum);
-    UART_ConsumeBytes(BL0942_UART_PACKET_LEN);
+  UART_ReadBytes(packet, BL0942_UART_PACKET_LEN);
+  if (!BL0942_UART_ParsePacket(packet, &data)) {
     return 1;
   }
-
-  bl0942_data_t data;
-  data.i_rms =
-    (UART_GetByte(3) << 16) | (UART_GetByte(2) << 8) | UART_GetByte(1);
-  data.v_rms =
-    (UART_GetByte(6) << 16) | (UART_GetByte(5) << 8) | UART_GetByte(4);
-  data.watt = Int24ToInt32((UART_GetByte(12) << 16) |
-    (UART_GetByte(11) << 8) | UART_GetByte(10));
-  data.cf_cnt =
-    (UART_GetByte(15) << 16) | (UART_GetByte(14) << 8) | UART_GetByte(13);
-  data.freq = (UART_GetByte(17) << 8) | UART_GetByte(16);
   ScaleAndUpdate(&data);
-
-  UART_ConsumeBytes(BL0942_UART_PACKET_LEN);
   return BL0942_UART_PACKET_LEN;
 }
 
 #else
 static int BL0942_UART_TryToGetNextPacket(int adeviceindex, int auartindex) {
 	int cs;
-	int i;
-	int c_garbage_consumed = 0;
-	byte checksum;
+	int c_garbage_consumed;
+	byte packet[BL0942_UART_PACKET_LEN];
+	bl0942_data_t data;
 
 	cs = UART_GetDataSizeEx(auartindex);
 
@@ -187,16 +185,13 @@ static int BL0942_UART_TryToGetNextPacket(int adeviceindex, int auartindex) {
 		return 0;
 	}
 	// skip garbage data (should not happen)
-	while(cs > 0) {
-        if (UART_GetByteEx(auartindex,0) != BL0942_UART_PACKET_HEAD) {
-			UART_ConsumeBytesEx(auartindex, 1);
-			c_garbage_consumed++;
-			cs--;
-		} else {
-			break;
-		}
+	c_garbage_consumed = UART_FindHeaderEx(auartindex, g_bl0942Header, sizeof(g_bl0942Header));
+	if (c_garbage_consumed < 0) {
+		c_garbage_consumed = cs;
 	}
 	if(c_garbage_consumed > 0){
+		UART_ConsumeBytesEx(auartindex, c_garbage_consumed);
+		cs -= c_garbage_consumed;
         ADDLOG_WARN(LOG_FEATURE_ENERGYMETER,
                     "Consumed %i unwanted non-header byte in BL0942 buffer\n",
                     c_garbage_consumed);
@@ -204,35 +199,11 @@ static int BL0942_UART_TryToGetNextPacket(int adeviceindex, int auartindex) {
 	if(cs < BL0942_UART_PACKET_LEN) {
 		return 0;
 	}
-    if (UART_GetByteEx(auartindex, 0) != 0x55)
-		return 0;
-    checksum = BL0942_UART_CMD_READ(BL0942_UART_ADDR);
-
-    for(i = 0; i < BL0942_UART_PACKET_LEN-1; i++) {
-        checksum += UART_GetByteEx(auartindex, i);
-	}
-	checksum ^= 0xFF;
-
-    if (checksum != UART_GetByteEx(auartindex, BL0942_UART_PACKET_LEN - 1)) {
-        ADDLOG_WARN(LOG_FEATURE_ENERGYMETER,
-                    "Skipping packet with bad checksum %02X wanted %02X\n",
-                    UART_GetByteEx(auartindex, BL0942_UART_PACKET_LEN - 1), checksum);
-        UART_ConsumeBytesEx(auartindex, BL0942_UART_PACKET_LEN);
+	UART_ReadBytesEx(auartindex, packet, BL0942_UART_PACKET_LEN);
+	if (!BL0942_UART_ParsePacket(packet, &data)) {
 		return 1;
 	}
-
-    bl0942_data_t data;
-    data.i_rms =
-        (UART_GetByteEx(auartindex, 3) << 16) | (UART_GetByteEx(auartindex, 2) << 8) | UART_GetByteEx(auartindex, 1);
-    data.v_rms =
-        (UART_GetByteEx(auartindex, 6) << 16) | (UART_GetByteEx(auartindex, 5) << 8) | UART_GetByteEx(auartindex, 4);
-    data.watt = Int24ToInt32((UART_GetByteEx(auartindex, 12) << 16) |
-                             (UART_GetByteEx(auartindex, 11) << 8) | UART_GetByteEx(auartindex, 10));
-    data.cf_cnt =
-        (UART_GetByteEx(auartindex, 15) << 16) | (UART_GetByteEx(auartindex, 14) << 8) | UART_GetByteEx(auartindex, 13);
-    data.freq = (UART_GetByteEx(auartindex, 17) << 8) | UART_GetByteEx(auartindex, 16);
     ScaleAndUpdate(adeviceindex, &data);
-    UART_ConsumeBytesEx(auartindex, BL0942_UART_PACKET_LEN);
 	return BL0942_UART_PACKET_LEN;
 }
 #endif
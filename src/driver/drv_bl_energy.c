@@ -0,0 +1,103 @@
+#include "drv_bl_energy.h"
+
+#if ENABLE_BL_SHARED
+
+static int64_t Energy_ToMWh(int64_t total) {
+	return total / ENERGY_UJ_PER_MWH;
+}
+
+void EnergyAccum_Set(energyAccum_t *acc, double wh, uint32_t tick) {
+	acc->total = (int64_t)(wh * (double)ENERGY_UJ_PER_WH + (wh < 0 ? -0.5 : 0.5));
+	acc->stamp = tick;
+}
+
+int64_t EnergyAccum_AddPower(energyAccum_t *acc, float watts, uint32_t tick) {
+	uint32_t passed;
+	int32_t mW;
+	int64_t added;
+
+	passed = tick - acc->stamp;
+	acc->stamp = tick;
+	if (watts <= 0.0f) {
+		return 0;
+	}
+	mW = (int32_t)(watts * 1000.0f + 0.5f);
+	added = (int64_t)mW * passed * portTICK_PERIOD_MS;
+	acc->total += added;
+	return added;
+}
+
+int64_t EnergyAccum_AddEnergy(energyAccum_t *acc, float wh, uint32_t tick) {
+	int64_t added;
+
+	acc->stamp = tick;
+	if (wh <= 0.0f) {
+		return 0;
+	}
+	added = (int64_t)((double)wh * (double)ENERGY_UJ_PER_WH + 0.5);
+	acc->total += added;
+	return added;
+}
+
+double EnergyAccum_GetWh(const energyAccum_t *acc) {
+	return (double)acc->total / (double)ENERGY_UJ_PER_WH;
+}
+
+void EnergyRing_Init(energyRing_t *ring, uint32_t *buckets, int count, int64_t total) {
+	ring->buckets = buckets;
+	ring->count = count;
+	ring->head = 0;
+	ring->start = total;
+	if (buckets) {
+		memset(buckets, 0, count * sizeof(uint32_t));
+	}
+}
+
+void EnergyRing_Update(energyRing_t *ring, int64_t total) {
+	if (ring->buckets == 0) {
+		return;
+	}
+	ring->buckets[ring->head] = (uint32_t)(Energy_ToMWh(total) - Energy_ToMWh(ring->start));
+}
+
+void EnergyRing_Next(energyRing_t *ring, int64_t total) {
+	if (ring->buckets == 0) {
+		return;
+	}
+	EnergyRing_Update(ring, total);
+	ring->head++;
+	if (ring->head >= ring->count) {
+		ring->head = 0;
+	}
+	ring->buckets[ring->head] = 0;
+	ring->start = total;
+}
+
+uint32_t EnergyRing_Get(const energyRing_t *ring, int age) {
+	int i;
+
+	if (ring->buckets == 0 || age < 0 || age >= ring->count) {
+		return 0;
+	}
+	i = ring->head - age;
+	if (i < 0) {
+		i += ring->count;
+	}
+	return ring->buckets[i];
+}
+
+uint32_t EnergyRing_Sum(const energyRing_t *ring) {
+	uint32_t sum;
+	int i;
+
+	sum = 0;
+	if (ring->buckets == 0) {
+		return 0;
+	}
+	for (i = 0; i < ring->count; i++) {
+		sum += ring->buckets[i];
+	}
+	return sum;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../new_common.h"
+#include "../obk_config.h"
+
+#if ENABLE_BL_SHARED
+
+// Energy is integrated in 64-bit fixed point with microjoule resolution.
+// 1 mW for 1 ms is exactly 1 uJ, so integrating power over ticks never rounds,
+// and 2^63 uJ is still more than 2.5 TWh.
+#define ENERGY_UJ_PER_MWH	3600000LL
+#define ENERGY_UJ_PER_WH	3600000000LL
+
+#define ENERGY_HOURS_COUNT	24
+
+typedef struct energyAccum_s {
+	int64_t total;
+	// tick of previous sample, only the difference is used so wrap is harmless
+	uint32_t stamp;
+} energyAccum_t;
+
+// Ring of consumption buckets in mWh, head is the bucket being filled.
+// Buckets are differences of the truncated running total, so summing
+// any range of them gives the same value as the total for that range.
+typedef struct energyRing_s {
+	uint32_t *buckets;
+	int count;
+	int head;
+	int64_t start;
+} energyRing_t;
+
+void EnergyAccum_Set(energyAccum_t *acc, double wh, uint32_t tick);
+// both return the energy added, in uJ; negative readings add nothing
+int64_t EnergyAccum_AddPower(energyAccum_t *acc, float watts, uint32_t tick);
+int64_t EnergyAccum_AddEnergy(energyAccum_t *acc, float wh, uint32_t tick);
+double EnergyAccum_GetWh(const energyAccum_t *acc);
+
+void EnergyRing_Init(energyRing_t *ring, uint32_t *buckets, int count, int64_t total);
+void EnergyRing_Update(energyRing_t *ring, int64_t total);
+void EnergyRing_Next(energyRing_t *ring, int64_t total);
+// age 0 is the current bucket, 1 the previous one and so on
+uint32_t EnergyRing_Get(const energyRing_t *ring, int age);
+uint32_t EnergyRing_Sum(const energyRing_t *ring);
+
+#endif
@@ -1,11 +1,11 @@
 #include "drv_bl_shared.h"
+#include "drv_bl_energy.h"
 #include "../obk_config.h"
 
 #if ENABLE_BL_SHARED
 
 #include "../new_cfg.h"
 #include "../new_pins.h"
-#include "../cJSON/cJSON.h"
 #include "../hal/hal_flashVars.h"
 #include "../logging/logging.h"
 #include "../mqtt/new_mqtt.h"
@@ -17,6 +17,7 @@
 #include "drv_uart.h"
 #include "../cmnds/cmd_public.h" //for enum EventCode
 #include <math.h>
+#include <stdarg.h>
 //#include <time.h>
 #include "../libraries/obktime/obktime.h"	// for time functions
 
@@ -112,15 +113,24 @@ energysensdataset_t datasetlist[BL_SENSDATASETS_COUNT] = {
 };
 
 
-//static double energyCounter = 0.0;
-portTickType energyCounterStamp[BL_SENSDATASETS_COUNT];
+energyAccum_t energyAccum[BL_SENSDATASETS_COUNT];
 bool energyCounterStatsEnable = false;
 int energyCounterSampleCount = 60;
 int energyCounterSampleInterval = 60;
-float *energyCounterMinutes = NULL;
+// per sample interval history, mWh
+uint32_t *energyCounterMinutes = NULL;
+energyRing_t energyCounterSamples;
 portTickType energyCounterMinutesStamp;
 long energyCounterMinutesIndex;
 bool energyCounterStatsJSONEnable = false;
+// per hour history, mWh
+static uint32_t energyCounterHours[ENERGY_HOURS_COUNT];
+energyRing_t energyCounterHourRing;
+portTickType energyCounterHoursStamp;
+// consumption_stats is printed here, allocated together with sample history
+static char *energyCounterStatsJSON = NULL;
+static int energyCounterStatsJSONSize = 0;
+#define BL_STATS_JSON_SIZE(sampleCount) (512 + ((sampleCount) + ENERGY_HOURS_COUNT) * 12)
 
 float changeSavedThresholdEnergy = 10.0f;
 long ConsumptionSaveCounter = 0;
@@ -130,6 +140,43 @@ time_t ConsumptionResetTime = 0;
 int changeSendAlwaysFrames = 60;
 int changeDoNotSendMinFrames = 5;
 
+static void BL_FreeEnergyStats() {
+  if (energyCounterMinutes != NULL)
+    os_free(energyCounterMinutes);
+  energyCounterMinutes = NULL;
+  if (energyCounterStatsJSON != NULL)
+    os_free(energyCounterStatsJSON);
+  energyCounterStatsJSON = NULL;
+  energyCounterStatsJSONSize = 0;
+}
+
+static void BL_AllocStatsJSON() {
+  if (energyCounterStatsJSONEnable && energyCounterStatsJSON == NULL) {
+    energyCounterStatsJSON = (char*)os_malloc(BL_STATS_JSON_SIZE(energyCounterSampleCount));
+    if (energyCounterStatsJSON != NULL)
+      energyCounterStatsJSONSize = BL_STATS_JSON_SIZE(energyCounterSampleCount);
+  }
+  if (!energyCounterStatsJSONEnable && energyCounterStatsJSON != NULL) {
+    os_free(energyCounterStatsJSON);
+    energyCounterStatsJSON = NULL;
+    energyCounterStatsJSONSize = 0;
+  }
+}
+
+// (re)allocates history and starts it over from the current total
+static void BL_ResetEnergyStats() {
+  int64_t total = energyAccum[BL_SENSORS_IX_0].total;
+
+  if (energyCounterMinutes == NULL)
+    energyCounterMinutes = (uint32_t*)os_malloc(energyCounterSampleCount * sizeof(uint32_t));
+  EnergyRing_Init(&energyCounterSamples, energyCounterMinutes, energyCounterSampleCount, total);
+  EnergyRing_Init(&energyCounterHourRing, energyCounterHours, ENERGY_HOURS_COUNT, total);
+  BL_AllocStatsJSON();
+  energyCounterMinutesStamp = xTaskGetTickCount();
+  energyCounterHoursStamp = energyCounterMinutesStamp;
+  energyCounterMinutesIndex = 0;
+}
+
 void BL_ResetRecivedDataBool() {
   for (int i = 0; i < BL_SENSDATASETS_COUNT; i++) sensors_reciveddata[i] = 0;
 }
@@ -229,9 +276,9 @@ void BL09XX_AppendInformationToHTTPIndexPage(http_request_t * request, int bPreS
           {
             if ((i%20)==0)
             {
-              hprintf255(request, "%1.1f", energyCounterMinutes[i]);
+              hprintf255(request, "%1.1f", EnergyRing_Get(&energyCounterSamples, i) * 0.001f);
             } else {
-              hprintf255(request, ", %1.1f", energyCounterMinutes[i]);
+              hprintf255(request, ", %1.1f", EnergyRing_Get(&energyCounterSamples, i) * 0.001f);
             }
             if ((i%20)==19)
             {
@@ -305,19 +352,11 @@ commandResult_t BL09XX_ResetEnergyCounterEx(int asensdatasetix, float* pvalue)
     if (!pvalue) {
     //addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER, "ResEC %i", asensdatasetix);
       lastSavedEnergyCounterValue[asensdatasetix] = 0.0; //20250203 reset lastSavedEnergyCounterValue, otherwise the values will not be saved until restart BL
+      EnergyAccum_Set(&energyAccum[asensdatasetix], 0, xTaskGetTickCount());
       sensdataset->sensors[OBK_CONSUMPTION_TOTAL].lastReading = 0.0;
-      energyCounterStamp[asensdatasetix] = xTaskGetTickCount();
-        if (energyCounterStatsEnable == true)
+        if ((energyCounterStatsEnable == true) && (asensdatasetix == BL_SENSORS_IX_0))
         {
-            if (energyCounterMinutes != NULL)
-            {
-                for(i = 0; i < energyCounterSampleCount; i++)
-                {
-                    energyCounterMinutes[i] = 0.0;
-                }
-            }
-            energyCounterMinutesStamp = xTaskGetTickCount();
-            energyCounterMinutesIndex = 0;
+            BL_ResetEnergyStats();
         }
         for(i = OBK_CONSUMPTION__DAILY_FIRST; i <= OBK_CONSUMPTION__DAILY_LAST; i++)
         {
@@ -325,8 +364,13 @@ commandResult_t BL09XX_ResetEnergyCounterEx(int asensdatasetix, float* pvalue)
         }
     } else {
       //addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER, "ResEC %i t=%f", asensdatasetix,avalue);
-      sensdataset->sensors[OBK_CONSUMPTION_TOTAL].lastReading = *pvalue;
-      energyCounterStamp[asensdatasetix] = xTaskGetTickCount();
+      EnergyAccum_Set(&energyAccum[asensdatasetix], *pvalue, xTaskGetTickCount());
+      sensdataset->sensors[OBK_CONSUMPTION_TOTAL].lastReading = EnergyAccum_GetWh(&energyAccum[asensdatasetix]);
+      // history buckets are relative to the total, so they start over too
+      if ((energyCounterStatsEnable == true) && (asensdatasetix == BL_SENSORS_IX_0))
+      {
+          BL_ResetEnergyStats();
+      }
     }
     ConsumptionResetTime = (time_t)TIME_GetCurrentTime();
     if (OTA_GetProgress()==-1)
@@ -401,28 +445,17 @@ commandResult_t BL09XX_SetupEnergyStatistic(const void *context, const char *cmd
         if (energyCounterSampleCount != sample_count)
         {
             /* upgrade sample count, free memory */
-            if (energyCounterMinutes != NULL)
-                os_free(energyCounterMinutes);
-            energyCounterMinutes = NULL;
+            BL_FreeEnergyStats();
             energyCounterSampleCount = sample_count;
         }
+        energyCounterStatsJSONEnable = (json_enable != 0) ? true : false; 
+        BL_AllocStatsJSON();
         addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER, "Sample Count:    %d", energyCounterSampleCount);
-        if (energyCounterSampleInterval != sample_time)
+        if ((energyCounterSampleInterval != sample_time) || (energyCounterMinutes == NULL))
         {
-            /* change sample time */            
+            /* change sample time or allocate new memory, history starts over */
             energyCounterSampleInterval = sample_time;
-            if (energyCounterMinutes != NULL)
-                memset(energyCounterMinutes, 0, energyCounterSampleCount*sizeof(float));
-        }
-        
-        if (energyCounterMinutes == NULL)
-        {
-            /* allocate new memeory */
-            energyCounterMinutes = (float*)os_malloc(sample_count*sizeof(float));
-            if (energyCounterMinutes != NULL)
-            {
-                memset(energyCounterMinutes, 0, energyCounterSampleCount*sizeof(float));
-            }
+            BL_ResetEnergyStats();
         }
         addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER, "Sample Interval: %d", energyCounterSampleInterval);
 
@@ -432,17 +465,12 @@ commandResult_t BL09XX_SetupEnergyStatistic(const void *context, const char *cmd
         /* Disable Consimption Nistory */
         addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER, "Consumption History disabled");
         energyCounterStatsEnable = false;
-        if (energyCounterMinutes != NULL)
-        {
-            os_free(energyCounterMinutes);
-            energyCounterMinutes = NULL;
-        }
+        BL_FreeEnergyStats();
         energyCounterSampleCount = sample_count;
         energyCounterSampleInterval = sample_time;
+        energyCounterStatsJSONEnable = (json_enable != 0) ? true : false; 
     }
 
-    energyCounterStatsJSONEnable = (json_enable != 0) ? true : false; 
-
     return CMD_RES_OK;
 }
 
@@ -617,6 +645,94 @@ float BL_ChangeEnergyUnitIfNeeded(float Wh) {
 	return Wh;
 }
 
+// appends to consumption_stats buffer, on overflow len becomes -1
+static void BL_StatsPrintf(int *len, const char *fmt, ...) {
+  va_list argList;
+  int n;
+
+  if (*len < 0)
+    return;
+  va_start(argList, fmt);
+  n = vsnprintf(energyCounterStatsJSON + *len, energyCounterStatsJSONSize - *len, fmt, argList);
+  va_end(argList);
+  if (n < 0 || n >= energyCounterStatsJSONSize - *len) {
+    *len = -1;
+    return;
+  }
+  *len += n;
+}
+
+static void BL_StatsPrintEnergy(int *len, const char *key, float Wh) {
+  if (CFG_HasFlag(OBK_FLAG_MQTT_ENERGY_IN_KWH)) {
+    BL_StatsPrintf(len, "\"%s\":%.6f,", key, Wh * 0.001f);
+  } else {
+    BL_StatsPrintf(len, "\"%s\":%.3f,", key, Wh);
+  }
+}
+
+static void BL_StatsPrintRing(int *len, const char *key, const energyRing_t *ring) {
+  uint32_t mWh;
+  int i;
+
+  BL_StatsPrintf(len, "\"%s\":[", key);
+  for (i = 0; i < ring->count; i++) {
+    mWh = EnergyRing_Get(ring, i);
+    BL_StatsPrintf(len, "%s%u.%03u", i ? "," : "", (unsigned int)(mWh / 1000), (unsigned int)(mWh % 1000));
+  }
+  BL_StatsPrintf(len, "],");
+}
+
+// prints consumption_stats JSON into preallocated buffer, NULL if disabled or it did not fit
+const char *BL09XX_PrintConsumptionStats() {
+  char datetime[64];
+  int len;
+  int i;
+
+  if (energyCounterStatsJSON == NULL)
+    return NULL;
+  len = 0;
+  BL_StatsPrintf(&len, "{\"uptime\":%i,", g_secondsElapsed);
+  BL_StatsPrintEnergy(&len, "consumption_total", DRV_GetReading(OBK_CONSUMPTION_TOTAL));
+  BL_StatsPrintEnergy(&len, "consumption_last_hour", DRV_GetReading(OBK_CONSUMPTION_LAST_HOUR));
+  BL_StatsPrintf(&len, "\"consumption_stat_index\":%ld,\"consumption_sample_count\":%i,\"consumption_sampling_period\":%i,",
+    energyCounterMinutesIndex, energyCounterSampleCount, energyCounterSampleInterval);
+  if (TIME_IsTimeSynced() == true)
+  {
+    BL_StatsPrintEnergy(&len, "consumption_today", DRV_GetReading(OBK_CONSUMPTION_TODAY));
+    BL_StatsPrintEnergy(&len, "consumption_yesterday", DRV_GetReading(OBK_CONSUMPTION_YESTERDAY));
+    // since we can be sure, a negative offset is minumum 1 hour,
+    // the sign for the hour will be "-" for "negative" timezones
+    snprintf(datetime, sizeof(datetime), "%.16s%+03i:%02i", TS2STR(ConsumptionResetTime, TIME_FORMAT_ISO_8601),
+      TIME_GetTimesZoneOfsSeconds() / 3600, (abs(TIME_GetTimesZoneOfsSeconds()) / 60) % 60);
+    BL_StatsPrintf(&len, "\"consumption_clear_date\":\"%s\",", datetime);
+  }
+  if (energyCounterMinutes != NULL)
+  {
+    // WARNING - it causes HA problems?
+    // See: https://github.com/openshwprojects/OpenBK7231T_App/issues/870
+    // Basically HA has 256 chars state limit?
+    // Wait, no, it's over 256 even without samples?
+    BL_StatsPrintRing(&len, "consumption_samples", &energyCounterSamples);
+    BL_StatsPrintRing(&len, "consumption_hourly", &energyCounterHourRing);
+  }
+  if (NTP_IsTimeSynced() == true)
+  {
+    BL_StatsPrintf(&len, "\"consumption_daily\":[");
+    for (i = OBK_CONSUMPTION__DAILY_FIRST; i <= OBK_CONSUMPTION__DAILY_LAST; i++)
+    {
+      BL_StatsPrintf(&len, "%s%.3f", i == OBK_CONSUMPTION__DAILY_FIRST ? "" : ",", DRV_GetReading(i));
+    }
+    BL_StatsPrintf(&len, "],");
+  }
+  if (len <= 0) {
+    addLogAdv(LOG_ERROR, LOG_FEATURE_ENERGYMETER, "consumption_stats does not fit in %i bytes", energyCounterStatsJSONSize);
+    return NULL;
+  }
+  // replace trailing comma
+  energyCounterStatsJSON[len - 1] = '}';
+  return energyCounterStatsJSON;
+}
+
 #if ENABLE_BL_TWIN
 void BL_ProcessUpdateEx(int asensdatasetix, float voltage, float current, float power,
   float frequency, float energyWh) {
@@ -629,10 +745,7 @@ void BL_ProcessUpdate(float voltage, float current, float power,
   energysensdataset_t* sensdataset = &datasetlist[asensdatasetix];
 
   int i;
-  int xPassedTicks;
-  cJSON* root;
-  cJSON* stats;
-  char *msg;
+  const char *msg;
   portTickType interval;
   time_t deviceTime;
 //  struct tm *ltm;
@@ -670,29 +783,23 @@ void BL_ProcessUpdate(float voltage, float current, float power,
   sensdataset->sensors[OBK_POWER_APPARENT].lastReading = sensdataset->sensors[OBK_VOLTAGE].lastReading * sensdataset->sensors[OBK_CURRENT].lastReading;
   sensdataset->sensors[OBK_POWER_REACTIVE].lastReading = (sensdataset->sensors[OBK_POWER_APPARENT].lastReading <= fabsf((float)sensdataset->sensors[OBK_POWER].lastReading)
     ? 0
-    : sqrtf(powf((float)sensdataset->sensors[OBK_POWER_APPARENT].lastReading, 2) -
-      powf((float)sensdataset->sensors[OBK_POWER].lastReading, 2)));
+    : sqrtf((float)(sensdataset->sensors[OBK_POWER_APPARENT].lastReading * sensdataset->sensors[OBK_POWER_APPARENT].lastReading -
+      sensdataset->sensors[OBK_POWER].lastReading * sensdataset->sensors[OBK_POWER].lastReading)));
   sensdataset->sensors[OBK_POWER_FACTOR].lastReading =
     (sensdataset->sensors[OBK_POWER_APPARENT].lastReading == 0 ? 1 : sensdataset->sensors[OBK_POWER].lastReading / sensdataset->sensors[OBK_POWER_APPARENT].lastReading);
 
 
   sensors_reciveddata[asensdatasetix] = 1;
   {
-    float energy = 0;
-    if (isnan(energyWh)) {
-      xPassedTicks = (int)(xTaskGetTickCount() - energyCounterStamp[asensdatasetix]);
-      // FIXME: Wrong calculation if tick count overflows
-      if (xPassedTicks <= 0)
-        xPassedTicks = 1;
-      energy = xPassedTicks * power / (3600000.0f / portTICK_PERIOD_MS);
-    } else
-      energy = energyWh;
-
-    if (energy < 0)
-      energy = 0.0;
-
-    sensdataset->sensors[OBK_CONSUMPTION_TOTAL].lastReading += (double)energy;
-    energyCounterStamp[asensdatasetix] = xTaskGetTickCount();
+    int64_t added;
+    double energy;
+    if (isnan(energyWh))
+      added = EnergyAccum_AddPower(&energyAccum[asensdatasetix], power, (uint32_t)xTaskGetTickCount());
+    else
+      added = EnergyAccum_AddEnergy(&energyAccum[asensdatasetix], energyWh, (uint32_t)xTaskGetTickCount());
+    energy = (double)added / (double)ENERGY_UJ_PER_WH;
+
+    sensdataset->sensors[OBK_CONSUMPTION_TOTAL].lastReading = EnergyAccum_GetWh(&energyAccum[asensdatasetix]);
     #if ENABLE_BL_TWIN
     if (asensdatasetix == BL_SENSORS_IX_0) {
       //update only IX0, IX1 will be saved later in BL09XX_SaveEmeteringStatistics()
@@ -739,112 +846,37 @@ void BL_ProcessUpdate(float voltage, float current, float power,
 
     if ((energyCounterStatsEnable == true) && (asensdatasetix==BL_SENSORS_IX_0))
     {
+      int64_t total = energyAccum[BL_SENSORS_IX_0].total;
+
+      EnergyRing_Update(&energyCounterSamples, total);
+      EnergyRing_Update(&energyCounterHourRing, total);
       interval = energyCounterSampleInterval;
       interval *= (1000 / portTICK_PERIOD_MS);
       if ((xTaskGetTickCount() - energyCounterMinutesStamp) >= interval)
       {
         if (energyCounterMinutes != NULL) {
-          sensdataset->sensors[OBK_CONSUMPTION_LAST_HOUR].lastReading = 0;
-          for (int i = 0; i < energyCounterSampleCount; i++) {
-            sensdataset->sensors[OBK_CONSUMPTION_LAST_HOUR].lastReading += energyCounterMinutes[i];
-          }
+          sensdataset->sensors[OBK_CONSUMPTION_LAST_HOUR].lastReading = EnergyRing_Sum(&energyCounterSamples) * 0.001;
         }
 #if ENABLE_MQTT
         if ((energyCounterStatsJSONEnable == true) && (MQTT_IsReady() == true))
         {
-          root = cJSON_CreateObject();
-          cJSON_AddNumberToObject(root, "uptime", g_secondsElapsed);
-          cJSON_AddNumberToObject(root, "consumption_total", BL_ChangeEnergyUnitIfNeeded(DRV_GetReading(OBK_CONSUMPTION_TOTAL)));
-          cJSON_AddNumberToObject(root, "consumption_last_hour", BL_ChangeEnergyUnitIfNeeded(DRV_GetReading(OBK_CONSUMPTION_LAST_HOUR)));
-          cJSON_AddNumberToObject(root, "consumption_stat_index", energyCounterMinutesIndex);
-          cJSON_AddNumberToObject(root, "consumption_sample_count", energyCounterSampleCount);
-          cJSON_AddNumberToObject(root, "consumption_sampling_period", energyCounterSampleInterval);
-          if(TIME_IsTimeSynced() == true)
-          {
-            cJSON_AddNumberToObject(root, "consumption_today", BL_ChangeEnergyUnitIfNeeded(DRV_GetReading(OBK_CONSUMPTION_TODAY)));
-            cJSON_AddNumberToObject(root, "consumption_yesterday", BL_ChangeEnergyUnitIfNeeded(DRV_GetReading(OBK_CONSUMPTION_YESTERDAY)));
-//            ltm = gmtime(&ConsumptionResetTime);
-/*
-            if (TIME_GetTimesZoneOfsSeconds()>0)
-            {
-              snprintf(datetime,sizeof(datetime), "%04i-%02i-%02iT%02i:%02i+%02i:%02i",
-                ltm->tm_year+1900, ltm->tm_mon+1, ltm->tm_mday, ltm->tm_hour, ltm->tm_min,
-                TIME_GetTimesZoneOfsSeconds()/3600, (TIME_GetTimesZoneOfsSeconds()/60) % 60);
-            } else {
-              snprintf(datetime, sizeof(datetime), "%04i-%02i-%02iT%02i:%02i-%02i:%02i",
-                ltm->tm_year+1900, ltm->tm_mon+1, ltm->tm_mday, ltm->tm_hour, ltm->tm_min,
-                abs(TIME_GetTimesZoneOfsSeconds()/3600), (abs(TIME_GetTimesZoneOfsSeconds())/60) % 60);
-            }
-*/
-            // optimized output: since we can be sure, a negative offset is minumum 1 hour, 
-            // the sign for the hour will be "-" for "negative" timezones 
-            //    this wouldn't work if a negative offset less than one hour would be possible
-/*
-            snprintf(datetime, sizeof(datetime), "%04i-%02i-%02iT%02i:%02i%+03i:%02i",
-                ltm->tm_year+1900, ltm->tm_mon+1, ltm->tm_mday, ltm->tm_hour, ltm->tm_min,
-                TIME_GetTimesZoneOfsSeconds()/3600, (abs(TIME_GetTimesZoneOfsSeconds())/60) % 60);
-*/            
-            snprintf(datetime, sizeof(datetime), "%.16s%+03i:%02i",TS2STR(ConsumptionResetTime, TIME_FORMAT_ISO_8601),
-                TIME_GetTimesZoneOfsSeconds()/3600, (abs(TIME_GetTimesZoneOfsSeconds())/60) % 60);
-
-            cJSON_AddStringToObject(root, "consumption_clear_date", datetime);
-          }
-
-          if (energyCounterMinutes != NULL)
-          {
-            stats = cJSON_CreateArray();
-            // WARNING - it causes HA problems?
-            // See: https://github.com/openshwprojects/OpenBK7231T_App/issues/870
-            // Basically HA has 256 chars state limit?
-            // Wait, no, it's over 256 even without samples?
-            for(i = 0; i < energyCounterSampleCount; i++)
-            {
-              cJSON_AddItemToArray(stats, cJSON_CreateNumber(energyCounterMinutes[i]));
-            }
-            cJSON_AddItemToObject(root, "consumption_samples", stats);
-          }
-
-          if(NTP_IsTimeSynced() == true)
+          msg = BL09XX_PrintConsumptionStats();
+          if (msg != NULL)
           {
-            stats = cJSON_CreateArray();
-            for(i = OBK_CONSUMPTION__DAILY_FIRST; i <= OBK_CONSUMPTION__DAILY_LAST; i++)
-            {
-              cJSON_AddItemToArray(stats, cJSON_CreateNumber(DRV_GetReading(i)));
-            }
-            cJSON_AddItemToObject(root, "consumption_daily", stats);
+            MQTT_PublishMain_StringString("consumption_stats", msg, 0);
+            stat_updatesSent[asensdatasetix]++;
           }
-
-          msg = cJSON_PrintUnformatted(root);
-          cJSON_Delete(root);
-
-          // addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER, "JSON Printed: %d bytes", strlen(msg));
-
-          MQTT_PublishMain_StringString("consumption_stats", msg, 0);
-          stat_updatesSent[asensdatasetix]++;
-          os_free(msg);
         }
 #endif
-
-        if (energyCounterMinutes != NULL)
-        {
-          for (i=energyCounterSampleCount-1;i>0;i--)
-          {
-            if (energyCounterMinutes[i-1]>0.0)
-            {
-              energyCounterMinutes[i] = energyCounterMinutes[i-1];
-            } else {
-              energyCounterMinutes[i] = 0.0;
-            }
-          }
-          energyCounterMinutes[0] = 0.0;
-        }
+        EnergyRing_Next(&energyCounterSamples, total);
         energyCounterMinutesStamp = xTaskGetTickCount();
         energyCounterMinutesIndex++;
-
       }
-
-      if (energyCounterMinutes != NULL)
-        energyCounterMinutes[0] += energy;
+      if ((xTaskGetTickCount() - energyCounterHoursStamp) >= (3600 * 1000 / portTICK_PERIOD_MS))
+      {
+        EnergyRing_Next(&energyCounterHourRing, total);
+        energyCounterHoursStamp = xTaskGetTickCount();
+      }
     }
   }
   for (i = OBK__FIRST; i <= OBK__LAST; i++)
@@ -980,24 +1012,6 @@ void BL_Shared_Init(void) {
       sensdataset->sensors[i].lastReading = 0;
     }
     {
-
-      if (energyCounterStatsEnable == true)
-      {
-        if (energyCounterMinutes == NULL)
-        {
-          energyCounterMinutes = (float*)os_malloc(energyCounterSampleCount*sizeof(float));
-        }
-        if (energyCounterMinutes != NULL)
-        {
-          for(i = 0; i < energyCounterSampleCount; i++)
-          {
-            energyCounterMinutes[i] = 0.0;
-          }
-        }
-        energyCounterMinutesStamp = xTaskGetTickCount();
-        energyCounterMinutesIndex = 0;
-      }
-
       addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER, "Read ENERGYMETER values sz=%d\n", sizeof(ENERGY_METERING_DATA));
 
       HAL_GetEnergyMeterStatus(&data);
@@ -1010,19 +1024,24 @@ void BL_Shared_Init(void) {
       sensdataset1->sensors[OBK_CONSUMPTION_TODAY].lastReading = data.TodayConsumpion_b;
       lastSavedEnergyCounterValue[BL_SENSORS_IX_0] = data.TotalConsumption;
       lastSavedEnergyCounterValue[BL_SENSORS_IX_1] = data.TotalConsumption_b;
-      energyCounterStamp[BL_SENSORS_IX_0] = xTaskGetTickCount();
-      energyCounterStamp[BL_SENSORS_IX_1] = xTaskGetTickCount();
+      EnergyAccum_Set(&energyAccum[BL_SENSORS_IX_0], data.TotalConsumption, xTaskGetTickCount());
+      EnergyAccum_Set(&energyAccum[BL_SENSORS_IX_1], data.TotalConsumption_b, xTaskGetTickCount());
       actual_mday[BL_SENSORS_IX_1] = data.actual_mday;//one in flashvars is enough, I assume that both channels are synchronized
 #else
       lastSavedEnergyCounterValue[BL_SENSORS_IX_0] = data.TotalConsumption;
       sensdataset->sensors[OBK_CONSUMPTION_2_DAYS_AGO].lastReading = data.ConsumptionHistory[0];
       sensdataset->sensors[OBK_CONSUMPTION_3_DAYS_AGO].lastReading = data.ConsumptionHistory[1];
-      energyCounterStamp[BL_SENSORS_IX_0] = xTaskGetTickCount();
+      EnergyAccum_Set(&energyAccum[BL_SENSORS_IX_0], data.TotalConsumption, xTaskGetTickCount());
 #endif
       ConsumptionResetTime = data.ConsumptionResetTime;
       ConsumptionSaveCounter = data.save_counter;
       lastConsumptionSaveStamp = xTaskGetTickCount();
 
+      if (energyCounterStatsEnable == true)
+      {
+        BL_ResetEnergyStats();
+      }
+
       //int HAL_SetEnergyMeterStatus(ENERGY_METERING_DATA *data);
     }
 
@@ -10,6 +10,7 @@ void BL_ProcessUpdate(float voltage, float current, float power,
                       float frequency, float energyWh);
 void BL09XX_AppendInformationToHTTPIndexPage(http_request_t *request, int bPreState);
 void BL09XX_SaveEmeteringStatistics();
+const char *BL09XX_PrintConsumptionStats();
 
 #define BL_SENSORS_IX_0 0
 #if ENABLE_BL_TWIN
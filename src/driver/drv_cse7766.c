@@ -19,13 +19,16 @@
 
 #define CSE7766_BAUD_RATE 4800
 
+#define CSE7766_PACKET_LEN 24
+
+static const byte g_cse7766Header[2] = { 0x55, 0x5A };
+
 int CSE7766_TryToGetNextCSE7766Packet() {
 	int cs;
 	int i;
-	int c_garbage_consumed = 0;
-	//byte a;
+	int c_garbage_consumed;
 	byte checksum;
-	int CSE7766_PACKET_LEN = 24;
+	byte packet[CSE7766_PACKET_LEN];
 	byte header;
 
 	cs = UART_GetDataSize();
@@ -34,32 +37,25 @@ int CSE7766_TryToGetNextCSE7766Packet() {
 	if(cs < CSE7766_PACKET_LEN) {
 		return 0;
 	}
-    header = UART_GetByte(0);
     // skip garbage data (should not happen)
-	while(cs > 0) {
-        //a = UART_GetByte(1);
-        if(UART_GetByte(0) != 0x55 || UART_GetByte(1) != 0x5A) {
-			UART_ConsumeBytes(1);
-			c_garbage_consumed++;
-			cs--;
-		} else {
-			break;
-		}
+	c_garbage_consumed = UART_FindHeader(g_cse7766Header, sizeof(g_cse7766Header));
+	if (c_garbage_consumed < 0) {
+		c_garbage_consumed = cs;
 	}
 	if(c_garbage_consumed > 0){
+		UART_ConsumeBytes(c_garbage_consumed);
+		cs -= c_garbage_consumed;
 		addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER,"Consumed %i unwanted non-header byte in CSE7766 buffer\n", c_garbage_consumed);
 	}
 	if(cs < CSE7766_PACKET_LEN) {
 		return 0;
 	}
-    //a = UART_GetByte(1);
-    if(UART_GetByte(0) != 0x55 || UART_GetByte(1) != 0x5A) {
-		return 0;
-	}
+	UART_ReadBytes(packet, CSE7766_PACKET_LEN);
+	header = packet[0];
 	checksum = 0;
 
 	for(i = 2; i < CSE7766_PACKET_LEN-1; i++) {
-        checksum += UART_GetByte(i);
+        checksum += packet[i];
     }
 
 #if 1
@@ -68,17 +64,16 @@ int CSE7766_TryToGetNextCSE7766Packet() {
 		char buffer2[32];
 		buffer_for_log[0] = 0;
 		for(i = 0; i < CSE7766_PACKET_LEN; i++) {
-            snprintf(buffer2, sizeof(buffer2), "%02X ", UART_GetByte(i));
+            snprintf(buffer2, sizeof(buffer2), "%02X ", packet[i]);
             strcat_safe(buffer_for_log,buffer2,sizeof(buffer_for_log));
 		}
 		addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER,"CSE7766 received: %s\n", buffer_for_log);
 	}
 #endif
-	if(checksum != UART_GetByte(CSE7766_PACKET_LEN-1)) {
+	if(checksum != packet[CSE7766_PACKET_LEN-1]) {
         ADDLOG_INFO(LOG_FEATURE_ENERGYMETER,
                     "Skipping packet with bad checksum %02X wanted %02X\n",
-                    checksum, UART_GetByte(CSE7766_PACKET_LEN - 1));
-        UART_ConsumeBytes(CSE7766_PACKET_LEN);
+                    checksum, packet[CSE7766_PACKET_LEN - 1]);
 		return 1;
 	}
 	//addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER,"CSE checksum ok");
@@ -137,9 +132,9 @@ int CSE7766_TryToGetNextCSE7766Packet() {
 		backlog startDriver CSE7766; uartFakeHex 555A02FCD800062F00413200D7F2537B18023E9F7171FEEC
 		*/
 
-#define CSC_GetByte(x) ((unsigned long)UART_GetByte(x))
+#define CSC_GetByte(x) ((unsigned long)packet[x])
 
-        adjustement = UART_GetByte(20);
+        adjustement = packet[20];
         int vol_par =
 			CSC_GetByte(2) << 16 | CSC_GetByte(3) << 8 | CSC_GetByte(4);
         int cur_par =
@@ -147,7 +142,7 @@ int CSE7766_TryToGetNextCSE7766Packet() {
         int pow_par =
 			CSC_GetByte(14) << 16 | CSC_GetByte(15) << 8 | CSC_GetByte(16);
         float raw_unscaled_voltage =
-			CSC_GetByte(5) << 16 | CSC_GetByte(6) << 8 | UART_GetByte(7);
+			CSC_GetByte(5) << 16 | CSC_GetByte(6) << 8 | CSC_GetByte(7);
         float raw_unscaled_current =
 			CSC_GetByte(11) << 16 | CSC_GetByte(12) << 8 | CSC_GetByte(13);
         float raw_unscaled_power =
@@ -201,8 +196,6 @@ int CSE7766_TryToGetNextCSE7766Packet() {
 	}
 #endif
 
-	UART_ConsumeBytes(CSE7766_PACKET_LEN);
-
 	return CSE7766_PACKET_LEN;
 }
 
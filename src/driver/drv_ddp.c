@@ -23,6 +23,15 @@ static int g_ddp_socket_receive = -1;
 static int g_retry_delay = 5;
 int stat_ddpPacketsReceived = 0;
 static int stat_ddpBytesReceived = 0;
+static int stat_ddpFrames = 0;
+static int stat_ddpFps = 0;
+static int stat_ddpLatePackets = 0;
+static int stat_ddpTruncatedPackets = 0;
+static int g_ddp_framesThisSecond = 0;
+static int g_ddp_lastSeq = 0;
+static int g_ddp_lateInRow = 0;
+// set on first packet with PUSH flag, until then every packet is shown
+static bool g_ddp_pushSeen = false;
 static char *g_ddp_buffer = 0;
 static int g_ddp_bufferSize = 512;
 
@@ -120,41 +129,123 @@ void DRV_DDP_CreateSocket_Receive() {
 
 	addLogAdv(LOG_INFO, LOG_FEATURE_DDP,"Waiting for packets\n");
 }
+// header byte 0
+#define DDP_FLAGS1_PUSH		0x01
+#define DDP_FLAGS1_QUERY	0x02
+#define DDP_FLAGS1_TIMECODE	0x10
+// sequence number is 1..15, 0 means sender does not use it
+#define DDP_SEQ_MASK		0x0F
+#define DDP_SEQ_COUNT		15
+// consecutive late packets after which we assume the sender restarted
+#define DDP_MAX_LATE_IN_ROW	4
+
+// returns true if packet is older than the last accepted one
+static bool DDP_IsLatePacket(int seq) {
+	int ahead;
+
+	if (seq == 0 || g_ddp_lastSeq == 0) {
+		g_ddp_lastSeq = seq;
+		return false;
+	}
+	ahead = (seq - g_ddp_lastSeq + DDP_SEQ_COUNT) % DDP_SEQ_COUNT;
+	if (ahead > DDP_SEQ_COUNT / 2) {
+		stat_ddpLatePackets++;
+		g_ddp_lateInRow++;
+		if (g_ddp_lateInRow < DDP_MAX_LATE_IN_ROW) {
+			return true;
+		}
+	}
+	g_ddp_lateInRow = 0;
+	g_ddp_lastSeq = seq;
+	return false;
+}
 void DDP_Parse(byte *data, int len) {
-	if(len > 12) {
-		byte r, g, b;
+	int headerLen;
+	int dataLen;
+	uint32_t offset;
+	bool bPush;
+	int bytesPerPixel;
+	int seq;
+	byte r, g, b;
 
-		// This is done by WLED, but not checked in Tasmota
-		// data type 0x1B (formerly 0x1A) is RGBW (type 3, 8 bit/channel)
-		byte bytesPerPixel = ((data[2] & 0b00111000) >> 3 == 0b011) ? 4 : 3;
+	headerLen = (data[0] & DDP_FLAGS1_TIMECODE) ? 14 : 10;
+	if (len < headerLen) {
+		return;
+	}
+	// we don't answer queries
+	if (data[0] & DDP_FLAGS1_QUERY) {
+		return;
+	}
+	offset = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) | (data[6] << 8) | data[7];
+	dataLen = (data[8] << 8) | data[9];
+	if (dataLen > len - headerLen) {
+		// receive buffer smaller than the packet, see DDP driver argument
+		stat_ddpTruncatedPackets++;
+		dataLen = len - headerLen;
+	}
+	bPush = (data[0] & DDP_FLAGS1_PUSH) != 0;
+	if (bPush) {
+		g_ddp_pushSeen = true;
+	}
+	seq = data[1] & DDP_SEQ_MASK;
+	// This is done by WLED, but not checked in Tasmota
+	// data type 0x1B (formerly 0x1A) is RGBW (type 3, 8 bit/channel)
+	bytesPerPixel = ((data[2] & 0b00111000) >> 3 == 0b011) ? 4 : 3;
+	data += headerLen;
 
 #if ENABLE_DRIVER_SM16703P
-		if (Strip_IsActive()) {
-			// Note that this is limited by DDP msgbuf size
-			uint32_t numPixels = (len - 10) / 3;
-			// debug
-			//addLogAdv(LOG_INFO, LOG_FEATURE_DDP, "DDP_Parse: STRIP path: %i pixels", numPixels);
-			// This immediately activates the pixels, maybe we should read the PUSH flag
-			Strip_setMultiplePixel(numPixels, &data[10], true);
-		} else
-#endif
-		{
-			r = data[10];
-			g = data[11];
-			b = data[12];
+	if (Strip_IsActive()) {
+		uint32_t first = offset / bytesPerPixel;
+		int skip = offset % bytesPerPixel;
 
-			//addLogAdv(LOG_INFO, LOG_FEATURE_DDP, "DDP_Parse: bulb path");
+		// stale data from a frame that was already shown would overwrite
+		// the frame being assembled now
+		if (DDP_IsLatePacket(seq)) {
+			return;
+		}
+		// Data is written to the strip buffer and, once the sender has used
+		// PUSH, only sent out on PUSH, so frames split over many packets are
+		// shown at once. Senders which never set PUSH get every packet shown.
+		// There is no separate back buffer: the encoded SPI buffer is written
+		// in place. On BK SPIDMA_StartTX waits until DMA has read the whole
+		// buffer, so writes from this thread can't reach a running transfer,
+		// but on ports where StartTX returns early (LN882H) a packet arriving
+		// during transfer may still tear the frame being sent.
+		if (skip) {
+			skip = bytesPerPixel - skip;
+			first++;
+		}
+		if (dataLen > skip) {
+			Strip_setPixelSpan(first, data + skip, (dataLen - skip) / bytesPerPixel, bytesPerPixel);
+		}
+		if (bPush || !g_ddp_pushSeen) {
+			Strip_Apply();
+			stat_ddpFrames++;
+			g_ddp_framesThisSecond++;
+		}
+		return;
+	}
+#endif
+	// bulb takes the first pixel only
+	if (offset != 0 || dataLen < 3) {
+		return;
+	}
+	r = data[0];
+	g = data[1];
+	b = data[2];
 
 #if ENABLE_LED_BASIC
-			LED_SetDimmerIfChanged(100);
-			if (data[9] == 4) {
-				LED_SetFinalRGBW(r, g, b, data[13]);
-			}
-			else {
-				LED_SetFinalRGB(r, g, b);
-			}
+	LED_SetDimmerIfChanged(100);
+	if (dataLen == 4 || (bytesPerPixel == 4 && dataLen >= 4)) {
+		LED_SetFinalRGBW(r, g, b, data[3]);
+	}
+	else {
+		LED_SetFinalRGB(r, g, b);
+	}
 #endif
-		}
+	if (bPush || !g_ddp_pushSeen) {
+		stat_ddpFrames++;
+		g_ddp_framesThisSecond++;
 	}
 }
 void DRV_DDP_RunFrame() {
@@ -211,6 +302,13 @@ void DRV_DDP_AppendInformationToHTTPIndexPage(http_request_t* request, int bPreS
 		return;
 	}
 	hprintf255(request, "<h2>DDP received: %i packets, %i bytes</h2>", stat_ddpPacketsReceived, stat_ddpBytesReceived);
+	hprintf255(request, "<h5>DDP frames: %i (%i fps), late packets: %i, truncated packets: %i</h5>",
+		stat_ddpFrames, stat_ddpFps, stat_ddpLatePackets, stat_ddpTruncatedPackets);
+}
+void DRV_DDP_OnEverySecond()
+{
+	stat_ddpFps = g_ddp_framesThisSecond;
+	g_ddp_framesThisSecond = 0;
 }
 void DRV_DDP_Init()
 {
@@ -219,6 +317,13 @@ void DRV_DDP_Init()
 		free(g_ddp_buffer);
 	}
 	g_ddp_buffer = malloc(g_ddp_bufferSize);
+	g_ddp_lastSeq = 0;
+	g_ddp_lateInRow = 0;
+	g_ddp_pushSeen = false;
+	stat_ddpFrames = 0;
+	stat_ddpFps = 0;
+	stat_ddpLatePackets = 0;
+	stat_ddpTruncatedPackets = 0;
 	DRV_DDP_CreateSocket_Receive();
 }
 
@@ -142,11 +142,16 @@ void DRV_DDPSend_AppendInformationToHTTPIndexPage(http_request_t* request, int b
 #define DDP_TYPE_RGB24  0x0B // 00 001 011 (RGB , 8 bits per channel, 3 channels)
 #define DDP_TYPE_RGBW32 0x1B // 00 011 011 (RGBW, 8 bits per channel, 4 channels)
 #define DDP_FLAGS1_VER1 0x40 // version=1
+#define DDP_FLAGS1_PUSH 0x01
 
 // https://github.com/wled/WLED/blob/main/wled00/udp.cpp
-void DDP_SetHeader(byte *data, int pixelSize, int bytesCount) {
+void DDP_SetHeader(byte *data, int pixelSize, int bytesCount, uint32_t offset, int bPush) {
+	memset(data, 0, 10);
 	// set ident
 	data[0] = DDP_FLAGS1_VER1;
+	if (bPush) {
+		data[0] |= DDP_FLAGS1_PUSH;
+	}
 
 	// set pixel size
 	if (pixelSize == 4) {
@@ -156,12 +161,20 @@ void DDP_SetHeader(byte *data, int pixelSize, int bytesCount) {
 		data[2] = DDP_TYPE_RGB24;
 	}
 
+	// set data offset in bytes
+	data[4] = (byte)((offset >> 24) & 0xFF);
+	data[5] = (byte)((offset >> 16) & 0xFF);
+	data[6] = (byte)((offset >> 8) & 0xFF);
+	data[7] = (byte)(offset & 0xFF);
+
 	// set bytes count
 	data[8] = (byte)((bytesCount >> 8) & 0xFF); // MSB
 	data[9] = (byte)(bytesCount & 0xFF);        // LSB
 }
 // startDriver DDPSend
 // DDP_Send 192.168.0.226 3 0 FF000000
+// send second part of frame without showing it yet:
+// DDP_Send 192.168.0.226 3 0 FF000000 3 0
 commandResult_t DDP_Send(const void* context, const char* cmd, const char* args, int cmdFlags) {
 	Tokenizer_TokenizeString(args, TOKENIZER_ALLOW_QUOTES | TOKENIZER_DONT_EXPAND);
 	if (Tokenizer_GetArgsCount() < 1) {
@@ -172,6 +185,8 @@ commandResult_t DDP_Send(const void* context, const char* cmd, const char* args,
 	int pixelSize = Tokenizer_GetArgInteger(1);
 	int delay = Tokenizer_GetArgInteger(2);
 	const char *pData = Tokenizer_GetArg(3);
+	uint32_t offset = Tokenizer_GetArgIntegerDefault(4, 0);
+	int bPush = Tokenizer_GetArgIntegerDefault(5, 1);
 	int numBytes = strlen(pData) / 2;
 	int headerSize = 10;
 	byte *data = malloc(headerSize+numBytes);
@@ -180,7 +195,7 @@ commandResult_t DDP_Send(const void* context, const char* cmd, const char* args,
 		data[cur] = CMD_ParseOrExpandHexByte(&pData);
 		cur++;
 	}
-	DDP_SetHeader(data, pixelSize, (cur- headerSize));
+	DDP_SetHeader(data, pixelSize, (cur- headerSize), offset, bPush);
 	DRV_DDPSend_Send(ip, port, data, cur, delay);
 	free(data);
 	return CMD_RES_OK;
@@ -195,8 +210,8 @@ void DRV_DDPSend_Init()
 		addLogAdv(LOG_ERROR, LOG_FEATURE_HTTP, "DRV_DDPSend_Init: failed to do socket\n");
 		return;
 	}
-	//cmddetail:{"name":"DDP_Send","args":"IP host pixelsize delay pData",
-	//cmddetail:"descr":"",
+	//cmddetail:{"name":"DDP_Send","args":"IP host pixelsize delay pData [byteOffset] [bPush]",
+	//cmddetail:"descr":"Sends DDP packet with given pixel data. Optional byte offset places data further in the strip, bPush 0 leaves frame unfinished so receiver does not show it yet.",
 	//cmddetail:"fn":"DDP_Send","file":"driver/drv_ddpSend.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("DDP_Send", DDP_Send, NULL);
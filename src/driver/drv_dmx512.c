@@ -92,6 +92,22 @@ void DMX_setByte(int idx, byte color) {
 	g_dmxBuffer[1 + idx] = color;
 }
 
+void DMX_setBytes(uint32_t idx, const byte *data, int count) {
+	if (idx >= DMX_CHANNELS_SIZE)
+		return;
+	if (idx + count > DMX_CHANNELS_SIZE)
+		count = DMX_CHANNELS_SIZE - idx;
+	memcpy(g_dmxBuffer + 1 + idx, data, count);
+}
+void DMX_getBytes(uint32_t idx, byte *data, int count) {
+	memset(data, 0, count);
+	if (idx >= DMX_CHANNELS_SIZE)
+		return;
+	if (idx + count > DMX_CHANNELS_SIZE)
+		count = DMX_CHANNELS_SIZE - idx;
+	memcpy(data, g_dmxBuffer + 1 + idx, count);
+}
+
 void DMX_SetLEDCount(int pixel_count, int pixel_size) {
 	dmx_pixelCount = pixel_count;
 	dmx_pixelSize = pixel_size;
@@ -107,6 +123,8 @@ void DMX_Init() {
 	ws_export.getByte = DMX_GetByte;
 	ws_export.setByte = DMX_setByte;
 	ws_export.setLEDCount = DMX_SetLEDCount;
+	ws_export.setBytes = DMX_setBytes;
+	ws_export.getBytes = DMX_getBytes;
 
 	LEDS_InitShared(&ws_export);
 
@@ -13,6 +13,9 @@
 
 static ledStrip_t led_backend;
 
+// longer strips are possible, but SPI buffer takes 4 bytes per color byte
+#define STRIP_MAX_PIXELS 2048
+
 #define DEFAULT_PIXEL_SIZE 3
 const enum ColorChannel default_color_channel_order[3] = {
 	COLOR_CHANNEL_RED,
@@ -25,6 +28,57 @@ int pixel_size = DEFAULT_PIXEL_SIZE; // default is RGB -> 3 bytes per pixel
 // Number of pixels that can be addressed
 uint32_t pixel_count;
 
+// For every byte of pixel in strip order, index of its color in source
+// pixel, or STRIP_NO_COLOR. Rebuilt whenever color order changes, so pixel
+// spans don't have to look at color_channel_order for every byte.
+#define STRIP_NO_COLOR 0xFF
+// source is r,g,b,c,w
+static byte swizzle_rgbcw[5] = { 0, 1, 2 };
+// source is r,g,b
+static byte swizzle_rgb[5] = { 0, 1, 2 };
+// source is r,g,b,w
+static byte swizzle_rgbw[5] = { 0, 1, 2 };
+// pixels are processed in batches of this size
+#define STRIP_BATCH_PIXELS 64
+
+static void Strip_UpdateSwizzle() {
+	int i;
+
+	for (i = 0; i < pixel_size; i++) {
+		enum ColorChannel ch = color_channel_order[i];
+		swizzle_rgbcw[i] = ch;
+		swizzle_rgb[i] = ch <= COLOR_CHANNEL_BLUE ? ch : STRIP_NO_COLOR;
+		if (ch <= COLOR_CHANNEL_BLUE) {
+			swizzle_rgbw[i] = ch;
+		}
+		else if (ch == COLOR_CHANNEL_WARM_WHITE) {
+			swizzle_rgbw[i] = 3;
+		}
+		else {
+			swizzle_rgbw[i] = STRIP_NO_COLOR;
+		}
+	}
+}
+
+static void Strip_SetBytes(uint32_t idx, const byte *data, int count) {
+	if (led_backend.setBytes) {
+		led_backend.setBytes(idx, data, count);
+		return;
+	}
+	while (count--) {
+		led_backend.setByte(idx++, *data++);
+	}
+}
+static void Strip_GetBytes(uint32_t idx, byte *data, int count) {
+	if (led_backend.getBytes) {
+		led_backend.getBytes(idx, data, count);
+		return;
+	}
+	while (count--) {
+		*data++ = led_backend.getByte(idx++);
+	}
+}
+
 bool Strip_HasChannel(ColorChannel_t ch) {
 	for (int i = 0; i < pixel_size; i++) {
 		if (color_channel_order[i] == ch) {
@@ -35,11 +89,7 @@ bool Strip_HasChannel(ColorChannel_t ch) {
 }
 
 void Strip_GetPixel(uint32_t pixel, byte *dst) {
-	int i;
-
-	for (i = 0; i < pixel_size; i++) {
-		dst[i] = led_backend.getByte(pixel * pixel_size + i);
-	}
+	Strip_GetBytes(pixel * pixel_size, dst, pixel_size);
 }
 
 bool Strip_VerifyPixel(uint32_t pixel, byte r, byte g, byte b) {
@@ -83,53 +133,73 @@ bool Strip_VerifyPixel4(uint32_t pixel, byte r, byte g, byte b, byte w) {
 }
 
 
+// put color bytes in strip order
+static void Strip_ToStripOrder(byte *dst, int r, int g, int b, int c, int w) {
+	byte src[5];
+	int i;
+
+	src[0] = r;
+	src[1] = g;
+	src[2] = b;
+	src[3] = c;
+	src[4] = w;
+	for (i = 0; i < pixel_size; i++) {
+		dst[i] = src[swizzle_rgbcw[i]];
+	}
+}
 void Strip_setPixel(int pixel, int r, int g, int b, int c, int w) {
+	byte dst[5];
+
 	if (pixel < 0 || pixel >= pixel_count) {
 		return; // out of range - would crash
 	}
+	Strip_ToStripOrder(dst, r, g, b, c, w);
+	Strip_SetBytes(pixel * pixel_size, dst, pixel_size);
+}
+// Sets count pixels starting at first from RGB (srcPixelSize 3)
+// or RGBW (srcPixelSize 4) data.
+void Strip_setPixelSpan(uint32_t first, const byte *data, int count, int srcPixelSize) {
+	byte batch[STRIP_BATCH_PIXELS * 5];
+	const byte *swizzle;
+	byte *out;
+	int inBatch;
 	int i;
-	for (i = 0; i < pixel_size; i++)
-	{
-		byte pcolor;
-		switch (color_channel_order[i])
-		{
-		case COLOR_CHANNEL_RED:
-			pcolor = r;
-			break;
-		case COLOR_CHANNEL_GREEN:
-			pcolor = g;
-			break;
-		case COLOR_CHANNEL_BLUE:
-			pcolor = b;
-			break;
-		case COLOR_CHANNEL_COLD_WHITE:
-			pcolor = c;
-			break;
-		case COLOR_CHANNEL_WARM_WHITE:
-			pcolor = w;
-			break;
-		default:
-			ADDLOG_ERROR(LOG_FEATURE_CMD, "Unknown color channel %d at index %d", color_channel_order[i], i);
+
+	if (first >= pixel_count || count <= 0) {
+		return;
+	}
+	if (count > pixel_count - first) {
+		count = pixel_count - first;
+	}
+	swizzle = srcPixelSize == 4 ? swizzle_rgbw : swizzle_rgb;
+	// data is already in strip order, copy as it is
+	if (srcPixelSize == pixel_size) {
+		for (i = 0; i < pixel_size; i++) {
+			if (swizzle[i] != i)
+				break;
+		}
+		if (i == pixel_size) {
+			Strip_SetBytes(first * pixel_size, data, count * pixel_size);
 			return;
 		}
-		led_backend.setByte(i + (pixel * pixel_size), pcolor);
-
+	}
+	while (count > 0) {
+		inBatch = count < STRIP_BATCH_PIXELS ? count : STRIP_BATCH_PIXELS;
+		out = batch;
+		for (int p = 0; p < inBatch; p++) {
+			for (i = 0; i < pixel_size; i++) {
+				*out++ = swizzle[i] == STRIP_NO_COLOR ? 0 : data[swizzle[i]];
+			}
+			data += srcPixelSize;
+		}
+		Strip_SetBytes(first * pixel_size, batch, inBatch * pixel_size);
+		first += inBatch;
+		count -= inBatch;
 	}
 }
 void Strip_setMultiplePixel(uint32_t pixel, uint8_t *data, bool push) {
-	// Check max pixel
-	if (pixel > pixel_count)
-		pixel = pixel_count;
-
-	// Iterate over pixel
-	for (uint32_t i = 0; i < pixel; i++) {
-		uint8_t r, g, b;
-		r = *data++;
-		g = *data++;
-		b = *data++;
-		// TODO: Not sure how this works. Should we add Cold and Warm white here as well?
-		Strip_setPixel((int)i, (int)r, (int)g, (int)b, 0, 0);
-	}
+	// TODO: Not sure how this works. Should we add Cold and Warm white here as well?
+	Strip_setPixelSpan(0, data, pixel, 3);
 	if (push) {
 		Strip_Apply();
 	}
@@ -149,25 +219,37 @@ void Strip_setPixelWithBrig(int pixel, int r, int g, int b, int c, int w) {
 #define SCALE8_PIXEL(x, scale) (uint8_t)(((uint32_t)x * (uint32_t)scale) / 256)
 
 void Strip_scaleAllPixels(int scale) {
-	int pixel;
-	byte b;
-	int ofs;
-	byte *data, *input;
-
-	for (pixel = 0; pixel < pixel_count; pixel++) {
-		for (ofs = 0; ofs < pixel_size; ofs++) {
-			int byteIndex = pixel * pixel_size + ofs;
-			byte b = led_backend.getByte(byteIndex);
-			b = SCALE8_PIXEL(b, scale);
-			led_backend.setByte(byteIndex, b);
+	byte batch[STRIP_BATCH_PIXELS * 5];
+	int total = pixel_count * pixel_size;
+	int ofs, count, i;
+
+	for (ofs = 0; ofs < total; ofs += count) {
+		count = total - ofs;
+		if (count > (int)sizeof(batch)) {
+			count = sizeof(batch);
 		}
+		Strip_GetBytes(ofs, batch, count);
+		for (i = 0; i < count; i++) {
+			batch[i] = SCALE8_PIXEL(batch[i], scale);
+		}
+		Strip_SetBytes(ofs, batch, count);
 	}
 }
 void Strip_setAllPixels(int r, int g, int b, int c, int w) {
+	byte batch[STRIP_BATCH_PIXELS * 5];
+	int inBatch;
 	int pixel;
 
-	for (pixel = 0; pixel < pixel_count; pixel++) {
-		Strip_setPixel(pixel, r, g, b, c, w);
+	Strip_ToStripOrder(batch, r, g, b, c, w);
+	for (pixel = 1; pixel < STRIP_BATCH_PIXELS; pixel++) {
+		memcpy(batch + pixel * pixel_size, batch, pixel_size);
+	}
+	for (pixel = 0; pixel < pixel_count; pixel += inBatch) {
+		inBatch = pixel_count - pixel;
+		if (inBatch > STRIP_BATCH_PIXELS) {
+			inBatch = STRIP_BATCH_PIXELS;
+		}
+		Strip_SetBytes(pixel * pixel_size, batch, inBatch * pixel_size);
 	}
 }
 
@@ -193,7 +275,7 @@ commandResult_t Strip_CMD_setRaw(const void *context, const char *cmd, const cha
 	return CMD_RES_OK;
 }
 commandResult_t Strip_CMD_setPixel(const void *context, const char *cmd, const char *args, int flags) {
-	int i, r, g, b, c, w;
+	int r, g, b, c, w;
 	int pixel = 0;
 	const char *all = 0;
 	Tokenizer_TokenizeString(args, 0);
@@ -235,9 +317,7 @@ commandResult_t Strip_CMD_setPixel(const void *context, const char *cmd, const c
 	ADDLOG_INFO(LOG_FEATURE_CMD, "Set Pixel %i to R %i G %i B %i C %i W %i", pixel, r, g, b, c, w);
 
 	if (all) {
-		for (i = 0; i < pixel_count; i++) {
-			Strip_setPixel(i, r, g, b, c, w);
-		}
+		Strip_setAllPixels(r, g, b, c, w);
 	}
 	else {
 		Strip_setPixel(pixel, r, g, b, c, w);
@@ -259,7 +339,7 @@ commandResult_t Strip_CMD_InitForLEDCount(const void *context, const char *cmd,
 	//SM16703P_Shutdown();
 
 	// First arg: number of pixel to address
-	pixel_count = Tokenizer_GetArgIntegerRange(0, 0, 255);
+	pixel_count = Tokenizer_GetArgIntegerRange(0, 0, STRIP_MAX_PIXELS);
 	// Second arg (optional, default "RGB"): pixel format of "RGB" or "GRB"
 	if (Tokenizer_GetArgsCount() > 1) {
 		const char *format = Tokenizer_GetArg(1);
@@ -298,6 +378,7 @@ commandResult_t Strip_CMD_InitForLEDCount(const void *context, const char *cmd,
 			os_free(color_channel_order);
 		}
 		color_channel_order = new_channel_order;
+		Strip_UpdateSwizzle();
 	}
 	led_backend.setLEDCount(pixel_count, pixel_size);
 
@@ -362,5 +443,6 @@ void LEDS_ShutdownShared() {
 	}
 	pixel_size = DEFAULT_PIXEL_SIZE;
 	pixel_count = 0;
+	Strip_UpdateSwizzle();
 	memset(&led_backend, 0, sizeof(led_backend));
 }
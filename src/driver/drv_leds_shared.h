@@ -10,6 +10,9 @@ typedef struct ledStrip_s {
 	void (*setByte)(uint32_t idx, byte val);
 	void (*apply)();
 	void (*setLEDCount)(int pixel_count, int pixel_size);
+	// optional, copy span of bytes (already in strip color order) to/from backend
+	void (*setBytes)(uint32_t idx, const byte *data, int count);
+	void (*getBytes)(uint32_t idx, byte *data, int count);
 } ledStrip_t;
 
 typedef enum ColorChannel {
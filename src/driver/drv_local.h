@@ -14,6 +14,8 @@ void DRV_DDP_Init();
 void DRV_DDP_RunFrame();
 void DRV_DDP_Shutdown();
 void DRV_DDP_AppendInformationToHTTPIndexPage(http_request_t *request, int bPreState);
+void DRV_DDP_OnEverySecond();
+void DDP_Parse(byte *data, int len);
 
 void BMP280_Init();
 void BMP280_OnEverySecond();
@@ -75,6 +77,7 @@ void Strip_setPixelWithBrig(int pixel, int r, int g, int b, int c, int w);
 void Strip_setAllPixels(int r, int g, int b, int c, int w);
 void Strip_scaleAllPixels(int scale);
 void Strip_setMultiplePixel(uint32_t pixel, uint8_t* data, bool push);
+void Strip_setPixelSpan(uint32_t first, const byte *data, int count, int srcPixelSize);
 void SM16703P_Show();
 void SM15155E_Init();
 void SM15155E_Write(float *rgbcw);
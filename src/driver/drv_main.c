@@ -796,7 +796,7 @@ static driver_t g_drivers[] = {
 	//drvdetail:"requires":""}
 	{ "DDP",                                 // Driver Name
 	DRV_DDP_Init,                            // Init
-	NULL,                                    // onEverySecond
+	DRV_DDP_OnEverySecond,                   // onEverySecond
 	DRV_DDP_AppendInformationToHTTPIndexPage, // appendInformationToHTTPIndexPage
 	DRV_DDP_RunFrame,                        // runQuickTick
 	DRV_DDP_Shutdown,                        // stopFunction
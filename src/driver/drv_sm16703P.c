@@ -37,6 +37,21 @@ void SM16703P_setByte(int index, byte color) {
 	translate_byte(color, spiLED.buf + (spiLED.ofs + index * 4));
 }
 
+void SM16703P_setBytes(uint32_t idx, const byte *data, int count) {
+	if (spiLED.buf == 0)
+		return;
+	if (spiLED.ready == 0)
+		return;
+	SPILED_SetBytes(idx, data, count);
+}
+void SM16703P_getBytes(uint32_t idx, byte *data, int count) {
+	if (spiLED.buf == 0 || spiLED.ready == 0) {
+		memset(data, 0, count);
+		return;
+	}
+	SPILED_GetBytes(idx, data, count);
+}
+
 void SM16703P_SetLEDCount(int pixel_count, int pixel_size) {
 	// Third arg (optional, default "0"): spiLED.ofs to prepend to each transmission
 	if (Tokenizer_GetArgsCount() > 2) {
@@ -63,6 +78,8 @@ void SM16703P_Init() {
 	ws_export.getByte = SM16703P_GetByte;
 	ws_export.setByte = SM16703P_setByte;
 	ws_export.setLEDCount = SM16703P_SetLEDCount;
+	ws_export.setBytes = SM16703P_setBytes;
+	ws_export.getBytes = SM16703P_getBytes;
 
 	LEDS_InitShared(&ws_export);
 }
@@ -31,6 +31,20 @@ void SPIDMA_Deinit(void) {
 #endif
 static uint8_t data_translate[4] = { 0b10001000, 0b10001110, 0b11101000, 0b11101110 };
 
+// Every color bit pair becomes one SPI byte, so color byte is 4 SPI bytes.
+// Whole table is built at compile time and lives in flash.
+#define SPILED_ENC2(x) ((x) == 0 ? 0b10001000 : (x) == 1 ? 0b10001110 : (x) == 2 ? 0b11101000 : 0b11101110)
+#define SPILED_ENC(b) { SPILED_ENC2(((b) >> 6) & 3), SPILED_ENC2(((b) >> 4) & 3), SPILED_ENC2(((b) >> 2) & 3), SPILED_ENC2((b) & 3) }
+#define SPILED_ENC4(b) SPILED_ENC(b), SPILED_ENC((b) + 1), SPILED_ENC((b) + 2), SPILED_ENC((b) + 3)
+#define SPILED_ENC16(b) SPILED_ENC4(b), SPILED_ENC4((b) + 4), SPILED_ENC4((b) + 8), SPILED_ENC4((b) + 12)
+#define SPILED_ENC64(b) SPILED_ENC16(b), SPILED_ENC16((b) + 16), SPILED_ENC16((b) + 32), SPILED_ENC16((b) + 48)
+
+static const uint8_t spiLED_encode[256][4] = {
+	SPILED_ENC64(0), SPILED_ENC64(64), SPILED_ENC64(128), SPILED_ENC64(192)
+};
+
+// bit 5 of SPI byte is high bit of pair, bit 1 is low bit
+#define SPILED_DEC2(x) ((((x) >> 4) & 2) | (((x) >> 1) & 1))
 
 uint8_t translate_2bit(uint8_t input) {
 	//ADDLOG_INFO(LOG_FEATURE_CMD, "Translate 0x%02x to 0x%02x", (input & 0b00000011), data_translate[(input & 0b00000011)]);
@@ -38,40 +52,15 @@ uint8_t translate_2bit(uint8_t input) {
 }
 
 uint8_t reverse_translate_2bit(uint8_t input) {
-	uint8_t i;
-	for (i = 0; i < 4; ++i) {
-		if (data_translate[i] == input) {
-			return i;
-		}
-	}
-	return 0;
+	return SPILED_DEC2(input);
 }
 
 byte reverse_translate_byte(uint8_t *input) {
-	byte dst;
-	dst = (reverse_translate_2bit(*input++) << 6);
-	dst |= (reverse_translate_2bit(*input++) << 4);
-	dst |= (reverse_translate_2bit(*input++) << 2);
-	dst |= (reverse_translate_2bit(*input++) << 0);
-	return dst;
+	return (SPILED_DEC2(input[0]) << 6) | (SPILED_DEC2(input[1]) << 4)
+		| (SPILED_DEC2(input[2]) << 2) | SPILED_DEC2(input[3]);
 }
 void translate_byte(uint8_t input, uint8_t *dst) {
-	// return 0x00000000 |
-	// 	   translate_2bit((input >> 6)) |
-	// 	   translate_2bit((input >> 4)) |
-	// 	   translate_2bit((input >> 2)) |
-	// 	   translate_2bit(input);
-	*dst++ = translate_2bit((input >> 6));
-	*dst++ = translate_2bit((input >> 4));
-	*dst++ = translate_2bit((input >> 2));
-	*dst++ = translate_2bit(input);
-
-#if WINDOWS
-	byte test = reverse_translate_byte(dst - 4);
-	if (input != test) {
-		printf("reverse_translate_byte is brken");
-	}
-#endif
+	memcpy(dst, spiLED_encode[input], 4);
 }
 
 spiLED_t spiLED;
@@ -132,19 +121,28 @@ void SPILED_InitDMA(int numBytes) {
 
 
 void SPILED_SetRawBytes(int start_offset, byte *bytes, int numBytes, int push) {
+	SPILED_SetBytes(start_offset, bytes, numBytes);
+	if (push) {
+		SPIDMA_StartTX(spiLED.msg);
+	}
+}
+
+void SPILED_SetBytes(int start_offset, const byte *bytes, int numBytes) {
 	// start offset is in bytes, and we do 2 bits per dst byte, so *4
 	uint8_t *dst = spiLED.buf + spiLED.ofs + start_offset * 4;
 
-	// parse hex string like FFAABB0011 byte by byte
-	for (int i = 0; i < numBytes; i++) {
-		byte b = bytes[i];
-		*dst++ = translate_2bit((b >> 6));
-		*dst++ = translate_2bit((b >> 4));
-		*dst++ = translate_2bit((b >> 2));
-		*dst++ = translate_2bit(b);
+	while (numBytes--) {
+		memcpy(dst, spiLED_encode[*bytes++], 4);
+		dst += 4;
 	}
-	if (push) {
-		SPIDMA_StartTX(spiLED.msg);
+}
+
+void SPILED_GetBytes(int start_offset, byte *bytes, int numBytes) {
+	const uint8_t *src = spiLED.buf + spiLED.ofs + start_offset * 4;
+
+	while (numBytes--) {
+		*bytes++ = reverse_translate_byte((uint8_t*)src);
+		src += 4;
 	}
 }
 
@@ -23,5 +23,8 @@ void SPILED_InitDMA(int numBytes);
 
 void SPILED_SetRawHexString(int start_offset, const char *s, int push);
 void SPILED_SetRawBytes(int start_offset, byte *bytes, int numBytes, int push);
+// encode/decode span of color bytes, offset and count are in color bytes
+void SPILED_SetBytes(int start_offset, const byte *bytes, int numBytes);
+void SPILED_GetBytes(int start_offset, byte *bytes, int numBytes);
 void SPILED_Init(int pin);
 void SPILED_Shutdown();
\ No newline at end of file
@@ -831,19 +831,19 @@ void TCL_DoDiscovery(const char *topic) {
 		vertical_swing_options,sizeof(vertical_swing_options) / sizeof(vertical_swing_options[0]),
 		horizontal_swing_options, sizeof(horizontal_swing_options) / sizeof(horizontal_swing_options[0])
 		);
-	MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+	hass_queue_discovery(topic, dev_info);
 	hass_free_device_info(dev_info);
 
 	//dev_info = hass_createFanWithModes("Fan Speed", "~/FANMode/get", "FANMode", fanOptions, 4);
-	//MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+	//hass_queue_discovery(topic, dev_info);
 	//hass_free_device_info(dev_info);
 
 	dev_info = hass_createToggle("Buzzer","~/Buzzer/get","Buzzer");
-	MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+	hass_queue_discovery(topic, dev_info);
 	hass_free_device_info(dev_info);
 
 	dev_info = hass_createToggle("Display", "~/Display/get", "Display");
-	MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+	hass_queue_discovery(topic, dev_info);
 	hass_free_device_info(dev_info);
 
 
@@ -858,7 +858,7 @@ void TCL_DoDiscovery(const char *topic) {
 		//	vertical_swing_options,                 // fanOptions array
 		//	"Vertical Swing Mode"                   // title
 		//);
-		//MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		//hass_queue_discovery(topic, dev_info);
 		//hass_free_device_info(dev_info);
 
 		//// Horizontal Swing Entity
@@ -870,7 +870,7 @@ void TCL_DoDiscovery(const char *topic) {
 		//	horizontal_swing_options,               // fanOptions array
 		//	"Horizontal Swing Mode"                 // title
 		//);
-	//	MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+	//	hass_queue_discovery(topic, dev_info);
 		//hass_free_device_info(dev_info);
 
 }
@@ -185,6 +185,10 @@ typedef struct tuyaMCUMapping_s {
 } tuyaMCUMapping_t;
 
 tuyaMCUMapping_t* g_tuyaMappings = 0;
+// direct lookup by dpId and by channel, rebuilt from g_tuyaMappings when a mapping changes.
+// If several mappings share a channel, the first one on the list wins, same as walking it.
+static tuyaMCUMapping_t* g_tuyaMappingByDpId[256];
+static tuyaMCUMapping_t* g_tuyaMappingByChannel[CHANNEL_MAX];
 
 /**
  * Dimmer range
@@ -240,6 +244,11 @@ static short g_tuyaMCUled_id_cw_temperature = -1;
 static byte *g_tuyaMCUpayloadBuffer = 0;
 static int g_tuyaMCUpayloadBufferSize = 0;
 
+// DP updates collected during one frame and sent as a single SET_DP packet,
+// enabled with tuyaMcu_batchDPs for MCUs that accept several DPs per packet
+static byte *g_tuyaMCUbatchBuffer = 0;
+static int g_tuyaMCUbatchLen = 0;
+
 // battery powered device state
 enum TuyaMCUV0State {
 	TM0_STATE_AWAITING_INFO,
@@ -260,6 +269,7 @@ typedef struct tuyaMCUPacket_s {
 
 tuyaMCUPacket_t *tm_emptyPackets = 0;
 tuyaMCUPacket_t *tm_sendPackets = 0;
+tuyaMCUPacket_t *tm_sendPacketsTail = 0;
 
 tuyaMCUPacket_t *TUYAMCU_AddToQueue(int len) {
 	tuyaMCUPacket_t *toUse;
@@ -285,49 +295,62 @@ tuyaMCUPacket_t *TUYAMCU_AddToQueue(int len) {
 		tm_sendPackets = toUse;
 	}
 	else {
-		tuyaMCUPacket_t *p = tm_sendPackets;
-		while (p->next) {
-			p = p->next;
-		}
-		p->next = toUse;
+		tm_sendPacketsTail->next = toUse;
 	}
+	tm_sendPacketsTail = toUse;
 	toUse->next = 0;
 	return toUse;
 }
 bool TUYAMCU_SendFromQueue() {
+	static const byte header[3] = { 0x55, 0xAA, 0x00 };
 	tuyaMCUPacket_t *toUse;
 	if (tm_sendPackets == 0)
 		return false;
 	toUse = tm_sendPackets;
 	tm_sendPackets = toUse->next;
-
-	UART_SendByte(0x55);
-	UART_SendByte(0xAA);
-	UART_SendByte(0x00);
-	for (int i = 0; i < toUse->size; i++) {
-		UART_SendByte(toUse->data[i]);
+	if (tm_sendPackets == 0) {
+		tm_sendPacketsTail = 0;
 	}
 
+	UART_SendBytes(header, sizeof(header));
+	UART_SendBytes(toUse->data, toUse->size);
+
 	toUse->next = tm_emptyPackets;
 	tm_emptyPackets = toUse;
 	return true;
 }
 
-tuyaMCUMapping_t* TuyaMCU_FindDefForID(int dpId) {
+static void TuyaMCU_RebuildMappingIndex() {
 	tuyaMCUMapping_t* cur;
 
+	memset(g_tuyaMappingByDpId, 0, sizeof(g_tuyaMappingByDpId));
+	memset(g_tuyaMappingByChannel, 0, sizeof(g_tuyaMappingByChannel));
 	cur = g_tuyaMappings;
 	while (cur) {
-		if (cur->dpId == dpId)
-			return cur;
+		if (g_tuyaMappingByDpId[cur->dpId] == 0) {
+			g_tuyaMappingByDpId[cur->dpId] = cur;
+		}
+		if (cur->channel >= 0 && cur->channel < CHANNEL_MAX && g_tuyaMappingByChannel[cur->channel] == 0) {
+			g_tuyaMappingByChannel[cur->channel] = cur;
+		}
 		cur = cur->next;
 	}
-	return 0;
+}
+
+tuyaMCUMapping_t* TuyaMCU_FindDefForID(int dpId) {
+	if (dpId < 0 || dpId >= 256) {
+		return 0;
+	}
+	return g_tuyaMappingByDpId[dpId];
 }
 
 tuyaMCUMapping_t* TuyaMCU_FindDefForChannel(int channel) {
 	tuyaMCUMapping_t* cur;
 
+	if (channel >= 0 && channel < CHANNEL_MAX) {
+		return g_tuyaMappingByChannel[channel];
+	}
+	// channels outside of the table, like -1 for unlinked dpIds
 	cur = g_tuyaMappings;
 	while (cur) {
 		if (cur->channel == channel)
@@ -360,6 +383,7 @@ tuyaMCUMapping_t* TuyaMCU_MapIDToChannel(int dpId, int dpType, int channel, int
 	cur->inv = inv;
 	cur->prevValue = 0;
 	cur->channel = channel;
+	TuyaMCU_RebuildMappingIndex();
 	return cur;
 }
 
@@ -374,64 +398,58 @@ void TuyaMCU_SetHeartbeatCounter(int v) {
 // 55AA     00      00      0000   xx   00
 
 #define MIN_TUYAMCU_PACKET_SIZE (2+1+1+2+1)
+static const byte g_tuyaHeader[2] = { 0x55, 0xAA };
+
 int UART_TryToGetNextTuyaPacket(byte* out, int maxSize) {
 	int cs;
 	int len, i;
-	int c_garbage_consumed = 0;
-	byte a, b, version, command, lena, lenb;
+	int c_garbage_consumed;
+	byte hdr[6];
+	byte skipped[80];
 	char printfSkipDebug[256];
 	char buffer2[8];
 
-	printfSkipDebug[0] = 0;
-
 	cs = UART_GetDataSize();
 
 	if (cs < MIN_TUYAMCU_PACKET_SIZE) {
 		return 0;
 	}
 	// skip garbage data (should not happen)
-	while (cs > 0) {
-		a = UART_GetByte(0);
-		b = UART_GetByte(1);
-		if (a != 0x55 || b != 0xAA) {
-			UART_ConsumeBytes(1);
-			if (c_garbage_consumed + 2 < sizeof(printfSkipDebug)) {
-				snprintf(buffer2, sizeof(buffer2), "%02X ", a);
-				strcat_safe(printfSkipDebug, buffer2, sizeof(printfSkipDebug));
-			}
-			c_garbage_consumed++;
-			cs--;
-		}
-		else {
-			break;
-		}
+	c_garbage_consumed = UART_FindHeader(g_tuyaHeader, sizeof(g_tuyaHeader));
+	if (c_garbage_consumed < 0) {
+		c_garbage_consumed = cs;
 	}
 	if (c_garbage_consumed > 0) {
+		printfSkipDebug[0] = 0;
+		len = UART_PeekBytes(0, skipped, sizeof(skipped));
+		for (i = 0; i < len && i < c_garbage_consumed; i++) {
+			snprintf(buffer2, sizeof(buffer2), "%02X ", skipped[i]);
+			strcat_safe(printfSkipDebug, buffer2, sizeof(printfSkipDebug));
+		}
+		UART_ConsumeBytes(c_garbage_consumed);
+		cs -= c_garbage_consumed;
 		addLogAdv(LOG_INFO, LOG_FEATURE_TUYAMCU, "Consumed %i unwanted non-header byte in Tuya MCU buffer\n", c_garbage_consumed);
 		addLogAdv(LOG_INFO, LOG_FEATURE_TUYAMCU, "Skipped data (part) %s\n", printfSkipDebug);
 	}
 	if (cs < MIN_TUYAMCU_PACKET_SIZE) {
 		return 0;
 	}
-	a = UART_GetByte(0);
-	b = UART_GetByte(1);
-	if (a != 0x55 || b != 0xAA) {
-		return 0;
-	}
-	version = UART_GetByte(2);
-	command = UART_GetByte(3);
-	lena = UART_GetByte(4); // hi
-	lenb = UART_GetByte(5); // lo
-	len = lenb | lena >> 8;
+	// header 2 bytes, version, command, length hi, length lo
+	UART_PeekBytes(0, hdr, sizeof(hdr));
+	len = hdr[5] | hdr[4] << 8;
 	// now check if we have received whole packet
 	len += 2 + 1 + 1 + 2 + 1; // header 2 bytes, version, command, lenght, chekcusm
+	// a false header can claim more than the ring will ever hold, drop it and resync
+	if (len > UART_GetReceiveRingBufferSize() - 1) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_TUYAMCU, "TuyaMCU packet length %i exceeds UART buffer, resyncing\n", len);
+		UART_ConsumeBytes(1);
+		return 0;
+	}
 	if (cs >= len) {
 		int ret;
 		// can packet fit into the buffer?
 		if (len <= maxSize) {
-			for (i = 0; i < len; i++) {
-				out[i] = UART_GetByte(i);
-			}
+			UART_PeekBytes(0, out, len);
 			ret = len;
 		}
 		else {
@@ -467,17 +485,19 @@ void TuyaMCU_SendCommandWithData(byte cmdType, byte* data, int payload_len) {
 		p->data[3+payload_len] = check_sum;
 	}
 	else {
-		UART_SendByte(0x55);
-		UART_SendByte(0xAA);
-		UART_SendByte(0x00);         // version 00
-		UART_SendByte(cmdType);         // version 00
-		UART_SendByte(payload_len >> 8);      // following data length (Hi)
-		UART_SendByte(payload_len & 0xFF);    // following data length (Lo)
+		byte header[6];
+
+		header[0] = 0x55;
+		header[1] = 0xAA;
+		header[2] = 0x00;         // version 00
+		header[3] = cmdType;
+		header[4] = payload_len >> 8;      // following data length (Hi)
+		header[5] = payload_len & 0xFF;    // following data length (Lo)
 		for (i = 0; i < payload_len; i++) {
-			byte b = data[i];
-			check_sum += b;
-			UART_SendByte(b);
+			check_sum += data[i];
 		}
+		UART_SendBytes(header, sizeof(header));
+		UART_SendBytes(data, payload_len);
 		UART_SendByte(check_sum);
 	}
 }
@@ -493,10 +513,37 @@ int TuyaMCU_AppendStateInternal(byte *buffer, int bufferMax, int currentLen, uin
 	memcpy(buffer + (currentLen + 4), value, dataLen);
 	return currentLen + 4 + dataLen;
 }
+static bool TuyaMCU_IsDPBatched(uint8_t id) {
+	int ofs = 0;
+
+	while (ofs + 4 <= g_tuyaMCUbatchLen) {
+		if (g_tuyaMCUbatchBuffer[ofs] == id) {
+			return true;
+		}
+		ofs += 4 + (g_tuyaMCUbatchBuffer[ofs + 2] << 8 | g_tuyaMCUbatchBuffer[ofs + 3]);
+	}
+	return false;
+}
+void TuyaMCU_FlushBatchedDPs() {
+	if (g_tuyaMCUbatchLen == 0) {
+		return;
+	}
+	TuyaMCU_SendCommandWithData(TUYA_CMD_SET_DP, g_tuyaMCUbatchBuffer, g_tuyaMCUbatchLen);
+	g_tuyaMCUbatchLen = 0;
+}
 void TuyaMCU_SendStateInternal(uint8_t id, uint8_t type, void* value, int dataLen)
 {
 	uint16_t payload_len = 0;
 	
+	if (g_tuyaMCUbatchBuffer && 4 + dataLen < TUYAMCU_BUFFER_SIZE) {
+		// newer value for the same dpId must not be reordered with the old one
+		if (TuyaMCU_IsDPBatched(id) || g_tuyaMCUbatchLen + 4 + dataLen >= TUYAMCU_BUFFER_SIZE) {
+			TuyaMCU_FlushBatchedDPs();
+		}
+		g_tuyaMCUbatchLen = TuyaMCU_AppendStateInternal(g_tuyaMCUbatchBuffer, TUYAMCU_BUFFER_SIZE,
+			g_tuyaMCUbatchLen, id, type, value, dataLen);
+		return;
+	}
 	payload_len = TuyaMCU_AppendStateInternal(g_tuyaMCUpayloadBuffer, g_tuyaMCUpayloadBufferSize,
 		payload_len, id, type, value, dataLen);
 
@@ -793,11 +840,7 @@ struct tm* TuyaMCU_Get_NTP_Time() {
 	return ptm;
 }
 void TuyaMCU_Send_RawBuffer(byte* data, int len) {
-	int i;
-
-	for (i = 0; i < len; i++) {
-		UART_SendByte(data[i]);
-	}
+	UART_SendBytes(data, len);
 }
 //battery-powered water sensor with TyuaMCU request to get somo response
 // uartSendHex 55AA0001000000 - this will get reply:
@@ -939,10 +982,9 @@ void TuyaMCU_Send(byte* data, int size) {
 
 	check_sum = 0;
 	for (i = 0; i < size; i++) {
-		byte b = data[i];
-		check_sum += b;
-		UART_SendByte(b);
+		check_sum += data[i];
 	}
+	UART_SendBytes(data, size);
 	UART_SendByte(check_sum);
 
 	addLogAdv(LOG_INFO, LOG_FEATURE_TUYAMCU, "\nWe sent %i bytes to Tuya MCU\n", size + 1);
@@ -1613,6 +1655,10 @@ void TuyaMCU_ParseStateMessage(const byte* data, int len) {
 
 	ofs = 0;
 
+#if ENABLE_OBK_BERRY
+	// one frame often carries several dpIDs
+	Berry_BeginEventBatch();
+#endif
 	while (ofs + 4 < len) {
 		sectorLen = data[ofs + 2] << 8 | data[ofs + 3];
 		dpId = data[ofs];
@@ -1840,6 +1886,9 @@ void TuyaMCU_ParseStateMessage(const byte* data, int len) {
 		// size of header (type, datatype, len 2 bytes) + data sector size
 		ofs += (4 + sectorLen);
 	}
+#if ENABLE_OBK_BERRY
+	Berry_EndEventBatch();
+#endif
 
 }
 
@@ -2226,6 +2275,28 @@ commandResult_t Cmd_TuyaMCU_SetBatteryAckDelay(const void* context, const char*
 	return CMD_RES_OK;
 }
 
+commandResult_t Cmd_TuyaMCU_BatchDPs(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_CheckArgsCountAndPrintWarning(cmd, 1)) {
+		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
+	}
+
+	if (Tokenizer_GetArgInteger(0)) {
+		if (g_tuyaMCUbatchBuffer == 0) {
+			g_tuyaMCUbatchBuffer = (byte*)malloc(TUYAMCU_BUFFER_SIZE);
+			g_tuyaMCUbatchLen = 0;
+		}
+	}
+	else if (g_tuyaMCUbatchBuffer) {
+		TuyaMCU_FlushBatchedDPs();
+		free(g_tuyaMCUbatchBuffer);
+		g_tuyaMCUbatchBuffer = 0;
+	}
+	addLogAdv(LOG_INFO, LOG_FEATURE_TUYAMCU, "TuyaMCU DP batching %s\n", g_tuyaMCUbatchBuffer ? "enabled" : "disabled");
+
+	return CMD_RES_OK;
+}
+
 commandResult_t Cmd_TuyaMCU_EnableAutoSend(const void* context, const char* cmd, const char* args, int cmdFlags) {
 	int enable;
 
@@ -2479,6 +2550,7 @@ void TuyaMCU_RunStateMachine_BatteryPowered() {
 int timer_send = 0;
 void TuyaMCU_RunFrame() {
 	TuyaMCU_RunReceive();
+	TuyaMCU_FlushBatchedDPs();
 
 
 	if (timer_send > 0) {
@@ -2605,6 +2677,7 @@ void TuyaMCU_Shutdown() {
 		tmp = nxt;
 	}
 	g_tuyaMappings = NULL;
+	TuyaMCU_RebuildMappingIndex();
 
 	// free the tuyaMCUpayloadBuffer
 	if (g_tuyaMCUpayloadBuffer) {
@@ -2613,6 +2686,12 @@ void TuyaMCU_Shutdown() {
 		g_tuyaMCUpayloadBufferSize = 0;
 	}
 
+	if (g_tuyaMCUbatchBuffer) {
+		free(g_tuyaMCUbatchBuffer);
+		g_tuyaMCUbatchBuffer = NULL;
+		g_tuyaMCUbatchLen = 0;
+	}
+
 	// free the tm_emptyPackets queue
 	packet = tm_emptyPackets;
 	while (packet) {
@@ -2642,6 +2721,7 @@ void TuyaMCU_Shutdown() {
 		packet = next_packet;
 	}
 	tm_sendPackets = NULL;
+	tm_sendPacketsTail = NULL;
 
 	// free the mutex
 	if (g_mutex) {
@@ -2758,6 +2838,12 @@ void TuyaMCU_Init()
 	//cmddetail:"fn":"Cmd_TuyaMCU_EnableAutoSend","file":"driver/drv_tuyaMCU.c","requires":"",
 	//cmddetail:"examples":"tuyaMcu_enableAutoSend 0"}
 	CMD_RegisterCommand("tuyaMcu_enableAutoSend", Cmd_TuyaMCU_EnableAutoSend, NULL);
+
+	//cmddetail:{"name":"tuyaMcu_batchDPs","args":"[0/1]",
+	//cmddetail:"descr":"When enabled, DP values set during one frame (for example by several channel changes) are packed into a single 0x06 packet. Only for MCUs that accept multiple DPs per packet.",
+	//cmddetail:"fn":"Cmd_TuyaMCU_BatchDPs","file":"driver/drv_tuyaMCU.c","requires":"",
+	//cmddetail:"examples":"tuyaMcu_batchDPs 1"}
+	CMD_RegisterCommand("tuyaMcu_batchDPs", Cmd_TuyaMCU_BatchDPs, NULL);
 }
 
 
@@ -36,7 +36,9 @@ int UART_GetBufIndexFromPort(int aport) {
 
 typedef struct {
   byte* g_recvBuf;
+  // always power of two, so wrapping is a mask instead of modulo
   int g_recvBufSize;
+  int g_recvBufMask;
   int g_recvBufIn;
   int g_recvBufOut;
 // used to detect uart reinit
@@ -45,9 +47,9 @@ typedef struct {
   int g_uart_manualInitCounter;
 } uartbuf_t;
 
-static uartbuf_t uartbuf[UART_BUF_CNT] = { {0,0,0,0,0,-1}
+static uartbuf_t uartbuf[UART_BUF_CNT] = { {0,0,0,0,0,0,-1}
   #if UART_BUF_CNT == 2
-    , { 0,0,0,0,0,-1 } 
+    , { 0,0,0,0,0,0,-1 } 
   #endif
   };
 
@@ -62,13 +64,18 @@ int get_g_uart_init_counter() {
 
 void UART_InitReceiveRingBufferEx(int auartindex, int size){
   uartbuf_t* fuartbuf=UART_GetBufFromPort(auartindex);
+  int realSize = 16;
   //XJIKKA 20241122 - Note that the actual usable buffer size must be g_recvBufSize-1, 
     //otherwise there would be no difference between an empty and a full buffer.
+    while (realSize < size) {
+      realSize <<= 1;
+    }
 	  if(fuartbuf->g_recvBuf!=0)
         free(fuartbuf->g_recvBuf);
-	  fuartbuf->g_recvBuf = (byte*)malloc(size);
-	  memset(fuartbuf->g_recvBuf,0,size);
-    fuartbuf->g_recvBufSize = size;
+	  fuartbuf->g_recvBuf = (byte*)malloc(realSize);
+	  memset(fuartbuf->g_recvBuf,0,realSize);
+    fuartbuf->g_recvBufSize = realSize;
+    fuartbuf->g_recvBufMask = realSize - 1;
     fuartbuf->g_recvBufIn = 0;
     fuartbuf->g_recvBufOut = 0;
 }
@@ -90,9 +97,7 @@ int UART_GetReceiveRingBufferSize() {
 
 int UART_GetDataSizeEx(int auartindex) {
   uartbuf_t* fuartbuf = UART_GetBufFromPort(auartindex);
-  return (fuartbuf->g_recvBufIn >= fuartbuf->g_recvBufOut
-                ? fuartbuf->g_recvBufIn - fuartbuf->g_recvBufOut
-                : fuartbuf->g_recvBufIn + (fuartbuf->g_recvBufSize - fuartbuf->g_recvBufOut)); //XJIKKA 20241122 fixed buffer size calculation on ring bufferroverflow
+  return (fuartbuf->g_recvBufIn - fuartbuf->g_recvBufOut) & fuartbuf->g_recvBufMask;
 }
 
 int UART_GetDataSize() {
@@ -102,7 +107,7 @@ int UART_GetDataSize() {
 
 byte UART_GetByteEx(int auartindex, int idx) {
   uartbuf_t* fuartbuf = UART_GetBufFromPort(auartindex);
-  return fuartbuf->g_recvBuf[(fuartbuf->g_recvBufOut + idx) % fuartbuf->g_recvBufSize];
+  return fuartbuf->g_recvBuf[(fuartbuf->g_recvBufOut + idx) & fuartbuf->g_recvBufMask];
 }
 
 byte UART_GetByte(int idx) {
@@ -112,8 +117,10 @@ byte UART_GetByte(int idx) {
 
 void UART_ConsumeBytesEx(int auartindex, int idx) {
   uartbuf_t* fuartbuf = UART_GetBufFromPort(auartindex);
-  fuartbuf->g_recvBufOut += idx;
-  fuartbuf->g_recvBufOut %= fuartbuf->g_recvBufSize;
+  if (idx > UART_GetDataSizeEx(auartindex)) {
+    idx = UART_GetDataSizeEx(auartindex);
+  }
+  fuartbuf->g_recvBufOut = (fuartbuf->g_recvBufOut + idx) & fuartbuf->g_recvBufMask;
 }
 
 void UART_ConsumeBytes(int idx) {
@@ -136,8 +143,8 @@ void UART_AppendByteToReceiveRingBufferEx(int auartindex, int rc) {
     //20250119 new style, we have always last g_recvBufSize-1 bytes
     //if g_recvBufSize-1 is reached, first byte is overwritten
 #endif
-        fuartbuf->g_recvBuf[fuartbuf->g_recvBufIn++] = rc;
-        fuartbuf->g_recvBufIn %= fuartbuf->g_recvBufSize;
+        fuartbuf->g_recvBuf[fuartbuf->g_recvBufIn] = rc;
+        fuartbuf->g_recvBufIn = (fuartbuf->g_recvBufIn + 1) & fuartbuf->g_recvBufMask;
 #ifdef UART_ALWAYSFIRSTBYTES
     }
 #endif
@@ -145,8 +152,7 @@ void UART_AppendByteToReceiveRingBufferEx(int auartindex, int rc) {
     //the outbuffer pointer, otherwise UART_GetDataSize will return g_recvBufSize.
     //This way now we always have the last (g_recvBufSize - 1) bytes
     if (fuartbuf->g_recvBufIn == fuartbuf->g_recvBufOut) {
-      fuartbuf->g_recvBufOut++;
-      fuartbuf->g_recvBufOut %= fuartbuf->g_recvBufSize;
+      fuartbuf->g_recvBufOut = (fuartbuf->g_recvBufOut + 1) & fuartbuf->g_recvBufMask;
     }
 }
 
@@ -155,6 +161,146 @@ void UART_AppendByteToReceiveRingBuffer(int rc) {
   UART_AppendByteToReceiveRingBufferEx(fuartindex, rc);
 }
 
+// same as calling UART_AppendByteToReceiveRingBufferEx for every byte, 
+// but copies at most two blocks
+void UART_AppendBytesEx(int auartindex, const byte* data, int len) {
+  uartbuf_t* fuartbuf = UART_GetBufFromPort(auartindex);
+  int capacity, used, first;
+
+  if (len <= 0) {
+    return;
+  }
+  if (fuartbuf->g_recvBufSize <= 0) {
+    addLogAdv(LOG_ERROR, LOG_FEATURE_DRV, "UART %i not initialized\n", auartindex);
+    UART_InitReceiveRingBufferEx(auartindex, UART_DEFAULT_BUFIZE);
+  }
+  capacity = fuartbuf->g_recvBufSize - 1;
+  used = UART_GetDataSizeEx(auartindex);
+#ifdef UART_ALWAYSFIRSTBYTES
+  if (len > capacity - used) {
+    len = capacity - used;
+  }
+#else
+  // only last capacity bytes would survive anyway
+  if (len > capacity) {
+    data += len - capacity;
+    len = capacity;
+  }
+#endif
+  first = fuartbuf->g_recvBufSize - fuartbuf->g_recvBufIn;
+  if (first > len) {
+    first = len;
+  }
+  memcpy(fuartbuf->g_recvBuf + fuartbuf->g_recvBufIn, data, first);
+  memcpy(fuartbuf->g_recvBuf, data + first, len - first);
+  fuartbuf->g_recvBufIn = (fuartbuf->g_recvBufIn + len) & fuartbuf->g_recvBufMask;
+  if (used + len > capacity) {
+    // oldest bytes were overwritten
+    fuartbuf->g_recvBufOut = (fuartbuf->g_recvBufIn + 1) & fuartbuf->g_recvBufMask;
+  }
+}
+
+void UART_AppendBytes(const byte* data, int len) {
+  int fuartindex = UART_GetSelectedPortIndex();
+  UART_AppendBytesEx(fuartindex, data, len);
+}
+
+int UART_PeekSpanEx(int auartindex, int offset, int len, uartSpan_t* span) {
+  uartbuf_t* fuartbuf = UART_GetBufFromPort(auartindex);
+  int avail, start, first;
+
+  avail = UART_GetDataSizeEx(auartindex) - offset;
+  if (len > avail) {
+    len = avail;
+  }
+  if (len <= 0 || offset < 0) {
+    span->first = span->second = 0;
+    span->firstLen = span->secondLen = 0;
+    return 0;
+  }
+  start = (fuartbuf->g_recvBufOut + offset) & fuartbuf->g_recvBufMask;
+  first = fuartbuf->g_recvBufSize - start;
+  if (first > len) {
+    first = len;
+  }
+  span->first = fuartbuf->g_recvBuf + start;
+  span->firstLen = first;
+  span->second = fuartbuf->g_recvBuf;
+  span->secondLen = len - first;
+  return len;
+}
+
+int UART_PeekSpan(int offset, int len, uartSpan_t* span) {
+  int fuartindex = UART_GetSelectedPortIndex();
+  return UART_PeekSpanEx(fuartindex, offset, len, span);
+}
+
+int UART_PeekBytesEx(int auartindex, int offset, byte* out, int len) {
+  uartSpan_t span;
+
+  len = UART_PeekSpanEx(auartindex, offset, len, &span);
+  memcpy(out, span.first, span.firstLen);
+  memcpy(out + span.firstLen, span.second, span.secondLen);
+  return len;
+}
+
+int UART_PeekBytes(int offset, byte* out, int len) {
+  int fuartindex = UART_GetSelectedPortIndex();
+  return UART_PeekBytesEx(fuartindex, offset, out, len);
+}
+
+int UART_ReadBytesEx(int auartindex, byte* out, int len) {
+  len = UART_PeekBytesEx(auartindex, 0, out, len);
+  UART_ConsumeBytesEx(auartindex, len);
+  return len;
+}
+
+int UART_ReadBytes(byte* out, int len) {
+  int fuartindex = UART_GetSelectedPortIndex();
+  return UART_ReadBytesEx(fuartindex, out, len);
+}
+
+int UART_FindHeaderEx(int auartindex, const byte* header, int headerLen) {
+  uartSpan_t span;
+  const byte* part;
+  const byte* p;
+  int total, partLen, partOfs, pos, i;
+
+  total = UART_PeekSpanEx(auartindex, 0, UART_GetDataSizeEx(auartindex), &span);
+  part = span.first;
+  partLen = span.firstLen;
+  partOfs = 0;
+  while (partLen > 0) {
+    p = (const byte*)memchr(part, header[0], partLen);
+    while (p) {
+      pos = partOfs + (int)(p - part);
+      // compare the rest, missing bytes at the end still count as a match
+      for (i = 1; i < headerLen && pos + i < total; i++) {
+        if (UART_GetByteEx(auartindex, pos + i) != header[i]) {
+          break;
+        }
+      }
+      if (i == headerLen || pos + i == total) {
+        return pos;
+      }
+      p++;
+      p = (const byte*)memchr(p, header[0], partLen - (int)(p - part));
+    }
+    if (part == span.second) {
+      break;
+    }
+    partOfs = span.firstLen;
+    part = span.second;
+    partLen = span.secondLen;
+  }
+  return -1;
+}
+
+int UART_FindHeader(const byte* header, int headerLen) {
+  int fuartindex = UART_GetSelectedPortIndex();
+  return UART_FindHeaderEx(fuartindex, header, headerLen);
+}
+
 void UART_SendByteEx(int auartindex, byte b) {
 #ifdef UART_2_UARTS_CONCURRENT
   HAL_UART_SendByteEx(auartindex, b);
@@ -167,6 +313,19 @@ void UART_SendByte(byte b) {
   int fuartindex = UART_GetSelectedPortIndex();
   UART_SendByteEx(fuartindex, b);
 }
+void UART_SendBytesEx(int auartindex, const byte* data, int len) {
+#ifdef UART_2_UARTS_CONCURRENT
+  for (int i = 0; i < len; i++) {
+    HAL_UART_SendByteEx(auartindex, data[i]);
+  }
+#else
+  HAL_UART_SendBytes(data, len);
+#endif
+}
+void UART_SendBytes(const byte* data, int len) {
+  int fuartindex = UART_GetSelectedPortIndex();
+  UART_SendBytesEx(fuartindex, data, len);
+}
 
 commandResult_t CMD_UART_Send_Hex(const void *context, const char *cmd, const char *args, int cmdFlags) {
     if (!(*args)) {
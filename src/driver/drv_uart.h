@@ -1,5 +1,14 @@
 #pragma once
 
+// Up to two contiguous slices of data in receive ring,
+// second one is used when data wraps around end of the buffer.
+typedef struct uartSpan_s {
+	const byte* first;
+	int firstLen;
+	const byte* second;
+	int secondLen;
+} uartSpan_t;
+
 //---------------------------------------------------
 // Routines using UART port depending on config 
 // flag OBK_FLAG_USE_SECONDARY_UART
@@ -11,7 +20,13 @@ int UART_GetDataSize();
 byte UART_GetByte(int idx);
 void UART_ConsumeBytes(int idx);
 void UART_AppendByteToReceiveRingBuffer(int rc);
+void UART_AppendBytes(const byte* data, int len);
+int UART_PeekSpan(int offset, int len, uartSpan_t* span);
+int UART_PeekBytes(int offset, byte* out, int len);
+int UART_ReadBytes(byte* out, int len);
+int UART_FindHeader(const byte* header, int headerLen);
 void UART_SendByte(byte b);
+void UART_SendBytes(const byte* data, int len);
 int UART_InitUART(int baud, int parity, bool hwflowc);
 void UART_AddCommands();
 void UART_RunEverySecond();
@@ -35,11 +50,21 @@ int UART_GetSelectedPortIndex();
 int UART_GetBufIndexFromPort(int aport);
 void UART_InitReceiveRingBufferEx(int auartindex, int size);
 void UART_AppendByteToReceiveRingBufferEx(int auartindex, int rc);
+// appends whole block, oldest data is overwritten when full, like with single bytes
+void UART_AppendBytesEx(int auartindex, const byte* data, int len);
+// returns number of bytes available at offset (at most len), without consuming them
+int UART_PeekSpanEx(int auartindex, int offset, int len, uartSpan_t* span);
+int UART_PeekBytesEx(int auartindex, int offset, byte* out, int len);
+// copies and consumes up to len bytes
+int UART_ReadBytesEx(int auartindex, byte* out, int len);
+// returns offset of first header occurrence, header cut off by end of data counts too, -1 if not found
+int UART_FindHeaderEx(int auartindex, const byte* header, int headerLen);
 int UART_GetReceiveRingBufferSizeEx(int auartindex);
 int UART_GetDataSizeEx(int auartindex);
 byte UART_GetByteEx(int auartindex, int idx);
 void UART_ConsumeBytesEx(int auartindex, int idx);
 void UART_SendByteEx(int auartindex, byte b);
+void UART_SendBytesEx(int auartindex, const byte* data, int len);
 int UART_InitUARTEx(int auartindex, int baud, int parity, bool hwflowc);
 void UART_LogBufState(int auartindex);
 
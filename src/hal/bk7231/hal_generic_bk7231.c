@@ -1,5 +1,6 @@
 #include "../../new_common.h"
 #include "../hal_generic.h"
+#include "../hal_flashVars.h"
 #include <BkDriverWdg.h>
 
 #include "../../beken378/driver/include/arm_arch.h"
@@ -13,6 +14,7 @@ extern bool g_powersave;
 
 void HAL_RebootModule() 
 {
+	HAL_FlashVars_Flush();
 	bk_reboot();
 }
 
@@ -1,4 +1,6 @@
 #include "../hal_ota.h"
+#include "../hal_flashVars.h"
+#include "../hal_flashStats.h"
 
 #include "../../new_common.h"
 #include "../../new_cfg.h"
@@ -34,6 +36,8 @@ int HAL_FlashRead(char*buffer, int readlen, int startaddr) {
 }
 
 int init_ota(unsigned int startaddr){
+    // OTA keeps flash busy for long, store pending retained values first
+    HAL_FlashVars_Flush();
     flash_init();
 	  flash_protection_op(FLASH_XTX_16M_SR_WRITE_ENABLE, FLASH_PROTECT_NONE);
     if (startaddr > 0xff000){
@@ -110,6 +114,8 @@ static void store_sector(unsigned int addr, unsigned char *data){
     flash_ctrl(CMD_FLASH_ERASE_SECTOR, &addr);
     flash_ctrl(CMD_FLASH_WRITE_ENABLE, (void *)0);
     flash_write((char *)data , SECTOR_SIZE, addr);
+    HAL_FlashStats_Erase(FLASH_USER_OTA, addr);
+    HAL_FlashStats_Write(FLASH_USER_OTA, addr, SECTOR_SIZE);
     OTA_IncrementProgress(SECTOR_SIZE);
 }
 
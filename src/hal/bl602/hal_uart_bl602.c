@@ -38,7 +38,6 @@ static void console_cb_read(int fd, void* param)
 {
 	char buffer[64];  /* adapt to usb cdc since usb fifo is 64 bytes */
 	int ret;
-	int i;
 
 	ret = aos_read(fd, buffer, sizeof(buffer));
 	if(ret > 0)
@@ -48,10 +47,7 @@ static void console_cb_read(int fd, void* param)
 			fd_console = fd;
 			buffer[ret] = 0;
 			addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER, "BL602 received: %s\n", buffer);
-			for(i = 0; i < ret; i++)
-			{
-				UART_AppendByteToReceiveRingBuffer(buffer[i]);
-			}
+			UART_AppendBytes((const byte*)buffer, ret);
 		}
 		else
 		{
@@ -66,6 +62,11 @@ void HAL_UART_SendByte(byte b)
 	//bl_uart_data_send(g_id, b);
 }
 
+void HAL_UART_SendBytes(const byte* data, int len)
+{
+	aos_write(fd_console, data, len);
+}
+
 int HAL_UART_Init(int baud, int parity, bool hwflowc, int txOverride, int rxOverride)
 {
 	if(fd_console < 0)
@@ -0,0 +1,131 @@
+#include "../../new_common.h"
+#include "../hal_flashStats.h"
+
+static const char* g_flashUserNames[FLASH_USER_MAX] = {
+	"flashvars",
+	"lfs",
+	"config",
+	"ota",
+};
+static flashUserStats_t g_flashUsers[FLASH_USER_MAX];
+static flashSectorStats_t g_flashSectors[FLASH_STATS_MAX_SECTORS];
+static int g_flashSectorsCount = 0;
+static int g_flashStatsSeconds = 0;
+
+void HAL_FlashStats_Write(int user, unsigned int address, int bytes) {
+	flashUserStats_t* u;
+
+	// wear is tracked per sector on erase, writes are only counted per user
+	(void)(address);
+	if (user < 0 || user >= FLASH_USER_MAX) {
+		return;
+	}
+	u = &g_flashUsers[user];
+	u->writes++;
+	u->bytes += bytes;
+	u->writesThisMinute++;
+}
+
+void HAL_FlashStats_Erase(int user, unsigned int address) {
+	flashSectorStats_t tmp;
+	int i;
+
+	if (user < 0 || user >= FLASH_USER_MAX) {
+		return;
+	}
+	g_flashUsers[user].erases++;
+	if (address != FLASH_STATS_ADDR_UNKNOWN) {
+		address &= ~0xFFF;
+	}
+	for (i = 0; i < g_flashSectorsCount; i++) {
+		if (g_flashSectors[i].address == address && g_flashSectors[i].user == user) {
+			break;
+		}
+	}
+	if (i == g_flashSectorsCount) {
+		if (g_flashSectorsCount < FLASH_STATS_MAX_SECTORS) {
+			g_flashSectorsCount++;
+		}
+		else {
+			// table is sorted, replace least erased one
+			i = g_flashSectorsCount - 1;
+		}
+		g_flashSectors[i].address = address;
+		g_flashSectors[i].user = user;
+		g_flashSectors[i].erases = 0;
+	}
+	g_flashSectors[i].erases++;
+	// keep sorted by erases, most erased first
+	while (i > 0 && g_flashSectors[i - 1].erases < g_flashSectors[i].erases) {
+		tmp = g_flashSectors[i - 1];
+		g_flashSectors[i - 1] = g_flashSectors[i];
+		g_flashSectors[i] = tmp;
+		i--;
+	}
+}
+
+void HAL_FlashStats_RunEverySecond() {
+	flashUserStats_t* u;
+	int i;
+
+	g_flashStatsSeconds++;
+	if (g_flashStatsSeconds % 60) {
+		return;
+	}
+	for (i = 0; i < FLASH_USER_MAX; i++) {
+		u = &g_flashUsers[i];
+		u->writesLastMinute = u->writesThisMinute;
+		u->writesThisMinute = 0;
+		if (u->writesLastMinute > u->maxWritesPerMinute) {
+			u->maxWritesPerMinute = u->writesLastMinute;
+		}
+	}
+}
+
+void HAL_FlashStats_Reset() {
+	memset(g_flashUsers, 0, sizeof(g_flashUsers));
+	g_flashSectorsCount = 0;
+	g_flashStatsSeconds = 0;
+}
+
+const char* HAL_FlashStats_GetUserName(int user) {
+	if (user < 0 || user >= FLASH_USER_MAX) {
+		return "";
+	}
+	return g_flashUserNames[user];
+}
+
+const flashUserStats_t* HAL_FlashStats_GetUser(int user) {
+	if (user < 0 || user >= FLASH_USER_MAX) {
+		return 0;
+	}
+	return &g_flashUsers[user];
+}
+
+int HAL_FlashStats_GetSectors(const flashSectorStats_t** sectors) {
+	*sectors = g_flashSectors;
+	return g_flashSectorsCount;
+}
+
+int HAL_FlashStats_GetSeconds() {
+	return g_flashStatsSeconds;
+}
+
+int HAL_FlashStats_GetLifetimeDays() {
+	float days;
+	int seconds = g_flashStatsSeconds;
+
+	if (g_flashSectorsCount == 0) {
+		return -1;
+	}
+	// erases may happen before first second tick
+	if (seconds < 1) {
+		seconds = 1;
+	}
+	// rated cycles at rate of most erased sector
+	days = (float)FLASH_STATS_RATED_ERASES * seconds / g_flashSectors[0].erases / (24 * 60 * 60);
+	if (days > 1000000) {
+		return 1000000;
+	}
+	return (int)days;
+}
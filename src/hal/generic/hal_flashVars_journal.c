@@ -0,0 +1,254 @@
+/*
+	Write-coalescing journal for flash vars.
+
+	Layout of every sector:
+	header (magic, generation), then records until erased (FF) space.
+	Record: offset, len, seq, len bytes of data, crc8 of all previous bytes.
+	First record after compaction is the whole structure, so only the sector
+	with highest generation has to be replayed. A record with bad CRC or
+	sequence ends replay (torn write), next flush compacts into a fresh sector.
+*/
+#include "../../new_common.h"
+#include "../hal_flashVars.h"
+#include "../../logging/logging.h"
+
+#define FLASH_VARS_JOURNAL_MAGIC 0x4a564642
+
+typedef struct flashVarsSectorHeader_s {
+	unsigned int magic;
+	unsigned int generation;
+} flashVarsSectorHeader_t;
+
+typedef struct flashVarsRecord_s {
+	byte offset;
+	// 0xFF in erased flash
+	byte len;
+	unsigned short seq;
+} flashVarsRecord_t;
+
+// record header + crc
+#define FLASH_VARS_RECORD_OVERHEAD ((int)sizeof(flashVarsRecord_t) + 1)
+#define FLASH_VARS_RECORD_MAX (FLASH_VARS_RECORD_OVERHEAD + sizeof(FLASH_VARS_STRUCTURE))
+
+static const flashVarsJournalOps_t* fvj_ops = 0;
+// RAM copy modified by HAL
+static FLASH_VARS_STRUCTURE* fvj_data = 0;
+// what is currently stored in journal
+static FLASH_VARS_STRUCTURE fvj_flashed;
+static int fvj_sector;
+static unsigned int fvj_generation;
+static unsigned int fvj_offset;
+static unsigned short fvj_seq;
+// seconds since first unsaved change, -1 if nothing pending
+static int fvj_dirtySeconds = -1;
+static flashVarsJournalStats_t fvj_stats;
+
+static int FVJ_Write(unsigned int offset, const void* data, unsigned int size) {
+	fvj_stats.writes++;
+	fvj_stats.bytesWritten += size;
+	return fvj_ops->write(offset, data, size);
+}
+
+int FlashVarsJournal_Init(const flashVarsJournalOps_t* ops, FLASH_VARS_STRUCTURE* data) {
+	flashVarsSectorHeader_t hdr;
+	flashVarsRecord_t rec;
+	byte buffer[FLASH_VARS_RECORD_MAX];
+	unsigned int base;
+	unsigned int pos;
+	int best = -1;
+	int bFirst = 1;
+	int i;
+
+	fvj_ops = ops;
+	fvj_data = data;
+	fvj_dirtySeconds = -1;
+	memset(&fvj_flashed, 0, sizeof(fvj_flashed));
+
+	for (i = 0; i < (int)ops->sectorCount; i++) {
+		ops->read(i * ops->sectorSize, &hdr, sizeof(hdr));
+		if (hdr.magic != FLASH_VARS_JOURNAL_MAGIC) {
+			continue;
+		}
+		// generation can wrap, compare difference
+		if (best < 0 || (int)(hdr.generation - fvj_generation) > 0) {
+			best = i;
+			fvj_generation = hdr.generation;
+		}
+	}
+	if (best < 0) {
+		// nothing stored yet, first flush will format
+		fvj_sector = ops->sectorCount - 1;
+		fvj_generation = 0;
+		fvj_offset = ops->sectorSize;
+		fvj_seq = 0;
+		return 0;
+	}
+
+	fvj_sector = best;
+	base = best * ops->sectorSize;
+	pos = sizeof(hdr);
+	while (pos + FLASH_VARS_RECORD_OVERHEAD <= ops->sectorSize) {
+		ops->read(base + pos, &rec, sizeof(rec));
+		if (rec.offset == 0xFF && rec.len == 0xFF) {
+			break;
+		}
+		if (rec.len == 0 || rec.offset + rec.len > sizeof(FLASH_VARS_STRUCTURE)
+			|| pos + FLASH_VARS_RECORD_OVERHEAD + rec.len > ops->sectorSize) {
+			pos = ops->sectorSize;
+			break;
+		}
+		ops->read(base + pos, buffer, FLASH_VARS_RECORD_OVERHEAD + rec.len);
+		if ((byte)Tiny_CRC8((const char*)buffer, sizeof(rec) + rec.len) != buffer[sizeof(rec) + rec.len]
+			|| (!bFirst && rec.seq != (unsigned short)(fvj_seq + 1))) {
+			ADDLOG_ERROR(LOG_FEATURE_CFG, "flash vars journal: bad record at %i", pos);
+			pos = ops->sectorSize;
+			break;
+		}
+		memcpy((byte*)&fvj_flashed + rec.offset, buffer + sizeof(rec), rec.len);
+		fvj_seq = rec.seq;
+		bFirst = 0;
+		pos += FLASH_VARS_RECORD_OVERHEAD + rec.len;
+	}
+	fvj_offset = pos;
+	memcpy(data, &fvj_flashed, sizeof(fvj_flashed));
+	data->len = sizeof(*data);
+	ADDLOG_DEBUG(LOG_FEATURE_CFG, "flash vars journal: sector %i gen %u offset %u, boot_count %d",
+		fvj_sector, fvj_generation, fvj_offset, data->boot_count);
+	return 1;
+}
+
+// writes whole structure to next sector
+void FlashVarsJournal_Compact() {
+	flashVarsSectorHeader_t hdr;
+	flashVarsRecord_t rec;
+	byte buffer[FLASH_VARS_RECORD_MAX];
+	unsigned int base;
+	int next;
+
+	if (fvj_ops == 0) {
+		return;
+	}
+	next = (fvj_sector + 1) % fvj_ops->sectorCount;
+	base = next * fvj_ops->sectorSize;
+	fvj_stats.erases++;
+	fvj_ops->eraseSector(base);
+
+	fvj_seq++;
+	rec.offset = 0;
+	rec.len = sizeof(FLASH_VARS_STRUCTURE);
+	rec.seq = fvj_seq;
+	memcpy(buffer, &rec, sizeof(rec));
+	memcpy(buffer + sizeof(rec), fvj_data, sizeof(FLASH_VARS_STRUCTURE));
+	buffer[sizeof(rec) + rec.len] = Tiny_CRC8((const char*)buffer, sizeof(rec) + rec.len);
+	FVJ_Write(base + sizeof(hdr), buffer, FLASH_VARS_RECORD_MAX);
+	// header goes last, so sector becomes valid only with complete snapshot
+	hdr.magic = FLASH_VARS_JOURNAL_MAGIC;
+	hdr.generation = fvj_generation + 1;
+	FVJ_Write(base, &hdr, sizeof(hdr));
+
+	fvj_sector = next;
+	fvj_generation = hdr.generation;
+	fvj_offset = sizeof(hdr) + FLASH_VARS_RECORD_MAX;
+	memcpy(&fvj_flashed, fvj_data, sizeof(fvj_flashed));
+	fvj_stats.compactions++;
+	ADDLOG_DEBUG(LOG_FEATURE_CFG, "flash vars journal: compacted into sector %i gen %u", fvj_sector, fvj_generation);
+}
+
+// returns 1 if record was written, 0 if journal was compacted instead
+static int FVJ_AppendRecord(int start, int len) {
+	flashVarsRecord_t rec;
+	byte buffer[FLASH_VARS_RECORD_MAX];
+
+	if (fvj_offset + FLASH_VARS_RECORD_OVERHEAD + len > fvj_ops->sectorSize) {
+		FlashVarsJournal_Compact();
+		return 0;
+	}
+	fvj_seq++;
+	rec.offset = start;
+	rec.len = len;
+	rec.seq = fvj_seq;
+	memcpy(buffer, &rec, sizeof(rec));
+	memcpy(buffer + sizeof(rec), (byte*)fvj_data + start, len);
+	buffer[sizeof(rec) + len] = Tiny_CRC8((const char*)buffer, sizeof(rec) + len);
+	FVJ_Write(fvj_sector * fvj_ops->sectorSize + fvj_offset, buffer, FLASH_VARS_RECORD_OVERHEAD + len);
+	fvj_offset += FLASH_VARS_RECORD_OVERHEAD + len;
+	memcpy((byte*)&fvj_flashed + start, (byte*)fvj_data + start, len);
+	return 1;
+}
+
+// returns number of records written
+int FlashVarsJournal_Flush() {
+	const byte* cur;
+	const byte* old;
+	int size = sizeof(FLASH_VARS_STRUCTURE);
+	int start, end, j;
+	int records = 0;
+
+	if (fvj_ops == 0) {
+		return 0;
+	}
+	fvj_dirtySeconds = -1;
+	cur = (const byte*)fvj_data;
+	old = (const byte*)&fvj_flashed;
+	start = 0;
+	while (start < size) {
+		if (cur[start] == old[start]) {
+			start++;
+			continue;
+		}
+		// merge changes separated by less than record overhead
+		end = start + 1;
+		for (j = end; j < size && j - end < FLASH_VARS_RECORD_OVERHEAD; j++) {
+			if (cur[j] != old[j]) {
+				end = j + 1;
+			}
+		}
+		records++;
+		if (FVJ_AppendRecord(start, end - start) == 0) {
+			// compaction wrote everything
+			break;
+		}
+		start = end;
+	}
+	if (records) {
+		fvj_stats.flushes++;
+	}
+	return records;
+}
+
+void FlashVarsJournal_Save(int bNow) {
+	if (fvj_ops == 0) {
+		return;
+	}
+	fvj_stats.saves++;
+	if (bNow) {
+		FlashVarsJournal_Flush();
+	}
+	else if (fvj_dirtySeconds < 0) {
+		fvj_dirtySeconds = 0;
+	}
+}
+
+void FlashVarsJournal_GetStats(flashVarsJournalStats_t* stats) {
+	*stats = fvj_stats;
+}
+
+void FlashVarsJournal_ResetStats() {
+	memset(&fvj_stats, 0, sizeof(fvj_stats));
+}
+
+void HAL_FlashVars_Flush() {
+	if (fvj_dirtySeconds >= 0) {
+		FlashVarsJournal_Flush();
+	}
+}
+
+void HAL_FlashVars_RunEverySecond() {
+	if (fvj_dirtySeconds < 0) {
+		return;
+	}
+	fvj_dirtySeconds++;
+	if (fvj_dirtySeconds >= FLASH_VARS_JOURNAL_DELAY_SECONDS) {
+		FlashVarsJournal_Flush();
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef __HAL_FLASH_STATS_H__
+#define __HAL_FLASH_STATS_H__
+
+// Counts flash writes and erases, attributed to the code that caused them,
+// so we can see what wears the flash. Counters are in RAM, since boot or last reset.
+
+typedef enum {
+	FLASH_USER_FLASHVARS,
+	FLASH_USER_LFS,
+	FLASH_USER_CONFIG,
+	FLASH_USER_OTA,
+	FLASH_USER_MAX
+} flashUser_t;
+
+// for callers that don't know physical address (config is saved by platform SDK)
+#define FLASH_STATS_ADDR_UNKNOWN 0xFFFFFFFF
+// typical NOR flash endurance, erase cycles per sector
+#define FLASH_STATS_RATED_ERASES 100000
+// erase counts are kept only for this many most erased sectors
+#define FLASH_STATS_MAX_SECTORS 16
+
+typedef struct flashUserStats_s {
+	int writes;
+	int bytes;
+	int erases;
+	int writesThisMinute;
+	int writesLastMinute;
+	int maxWritesPerMinute;
+} flashUserStats_t;
+
+typedef struct flashSectorStats_s {
+	unsigned int address;
+	int user;
+	int erases;
+} flashSectorStats_t;
+
+void HAL_FlashStats_Write(int user, unsigned int address, int bytes);
+void HAL_FlashStats_Erase(int user, unsigned int address);
+void HAL_FlashStats_RunEverySecond();
+void HAL_FlashStats_Reset();
+const char* HAL_FlashStats_GetUserName(int user);
+const flashUserStats_t* HAL_FlashStats_GetUser(int user);
+// returns sector table, sorted by erase count
+int HAL_FlashStats_GetSectors(const flashSectorStats_t** sectors);
+// seconds since boot or reset
+int HAL_FlashStats_GetSeconds();
+// days until most erased sector reaches FLASH_STATS_RATED_ERASES at current rate,
+// -1 if nothing was erased yet
+int HAL_FlashStats_GetLifetimeDays();
+
+#endif // __HAL_FLASH_STATS_H__
@@ -73,6 +73,46 @@ void HAL_FlashVars_SaveTotalConsumption(float total_consumption);
 void HAL_FlashVars_SaveEnergyExport(float f);
 float HAL_FlashVars_GetEnergyExport();
 
+// write pending changes now, call before reboot, OTA or deep sleep
+void HAL_FlashVars_Flush();
+// called every second, writes debounced changes
+void HAL_FlashVars_RunEverySecond();
+
+// Journal keeps FLASH_VARS_STRUCTURE in RAM and appends only changed bytes
+// to flash, as small records with sequence number and CRC. When sector is full,
+// whole structure is written to next sector and journal continues there.
+// Platform provides raw access to its flash vars area, offsets are relative to its start.
+typedef struct flashVarsJournalOps_s {
+	int (*read)(unsigned int offset, void* data, unsigned int size);
+	int (*write)(unsigned int offset, const void* data, unsigned int size);
+	int (*eraseSector)(unsigned int offset);
+	unsigned int sectorSize;
+	unsigned int sectorCount;
+} flashVarsJournalOps_t;
+
+typedef struct flashVarsJournalStats_s {
+	int erases;
+	int writes;
+	int bytesWritten;
+	int flushes;
+	int compactions;
+	// number of saves requested by HAL, each one was a full write before
+	int saves;
+} flashVarsJournalStats_t;
+
+// after this many seconds changes are written to flash
+#ifndef FLASH_VARS_JOURNAL_DELAY_SECONDS
+#define FLASH_VARS_JOURNAL_DELAY_SECONDS 3
+#endif
+
+// returns 1 if journal was found, 0 if area is empty, data is left unchanged then
+int FlashVarsJournal_Init(const flashVarsJournalOps_t* ops, FLASH_VARS_STRUCTURE* data);
+void FlashVarsJournal_Save(int bNow);
+int FlashVarsJournal_Flush();
+void FlashVarsJournal_Compact();
+void FlashVarsJournal_GetStats(flashVarsJournalStats_t* stats);
+void FlashVarsJournal_ResetStats();
+
 #ifdef ENABLE_DRIVER_HLW8112SPI
 void HAL_FlashVars_SaveEnergy(ENERGY_DATA** data, int channel_count);
 void HAL_FlashVars_GetEnergy(ENERGY_DATA* data, ENERGY_CHANNEL channel);
@@ -11,6 +11,8 @@ void HAL_UART_SendByteEx(int auartindex, byte b);
 int HAL_UART_InitEx(int auartindex, int baud, int parity, bool hwflowc, int txOverride, int rxOverride);
 #else
 void HAL_UART_SendByte(byte b);
+// whole block at once where the SDK has a buffered write
+void HAL_UART_SendBytes(const byte* data, int len);
 
 int HAL_UART_Init(int baud, int parity, bool hwflowc, int txOverride, int rxOverride);
 #endif
\ No newline at end of file
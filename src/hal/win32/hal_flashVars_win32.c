@@ -1,33 +1,122 @@
 #ifdef WINDOWS
 
-#include "../hal_flashConfig.h"
 #include "../hal_flashVars.h"
+#include "../hal_flashStats.h"
 #include "../../logging/logging.h"
+#include "flash_pub.h"
+
+// same place as on BK7231T, two sectors in emulated flash
+#define WIN_FLASH_VARS_ADDR 0x1e3000
+#define WIN_FLASH_VARS_SECTOR 0x1000
+
+extern UINT32 flash_read(char *user_buf, UINT32 count, UINT32 address);
+extern UINT32 flash_write(char *user_buf, UINT32 count, UINT32 address);
+
+static FLASH_VARS_STRUCTURE flash_vars;
+static int flash_vars_initialised = 0;
+
+static int win_flash_vars_read(unsigned int offset, void* data, unsigned int size) {
+	flash_read((char*)data, size, WIN_FLASH_VARS_ADDR + offset);
+	return 0;
+}
+static int win_flash_vars_write(unsigned int offset, const void* data, unsigned int size) {
+	HAL_FlashStats_Write(FLASH_USER_FLASHVARS, WIN_FLASH_VARS_ADDR + offset, size);
+	flash_write((char*)data, size, WIN_FLASH_VARS_ADDR + offset);
+	return 0;
+}
+static int win_flash_vars_erase(unsigned int offset) {
+	char tmp[WIN_FLASH_VARS_SECTOR];
+	HAL_FlashStats_Erase(FLASH_USER_FLASHVARS, WIN_FLASH_VARS_ADDR + offset);
+	memset(tmp, 0xFF, sizeof(tmp));
+	flash_write(tmp, sizeof(tmp), WIN_FLASH_VARS_ADDR + offset);
+	return 0;
+}
+static const flashVarsJournalOps_t win_flash_vars_ops = {
+	win_flash_vars_read,
+	win_flash_vars_write,
+	win_flash_vars_erase,
+	WIN_FLASH_VARS_SECTOR,
+	2
+};
+
+static void flash_vars_init() {
+	if (flash_vars_initialised) {
+		return;
+	}
+	memset(&flash_vars, 0, sizeof(flash_vars));
+	flash_vars.len = sizeof(flash_vars);
+	FlashVarsJournal_Init(&win_flash_vars_ops, &flash_vars);
+	flash_vars_initialised = 1;
+}
+
+// simulates power cycle, pending changes are lost
+void SIM_FlashVars_Reload() {
+	flash_vars_initialised = 0;
+	flash_vars_init();
+}
+// wipes flash vars area
+void SIM_FlashVars_Clear() {
+	win_flash_vars_erase(0);
+	win_flash_vars_erase(WIN_FLASH_VARS_SECTOR);
+	SIM_FlashVars_Reload();
+}
 
 void HAL_FlashVars_SaveBootComplete(){
+	flash_vars_init();
+	flash_vars.boot_success_count = flash_vars.boot_count;
+	FlashVarsJournal_Save(1);
 }
 
 int HAL_FlashVars_GetBootCount(){
-	return 0;
+	flash_vars_init();
+	return flash_vars.boot_count;
 }
 int HAL_FlashVars_GetBootFailures(){
-    int diff = 0;
-	//diff = 10;
-    return diff;
+	flash_vars_init();
+	return flash_vars.boot_count - flash_vars.boot_success_count;
 }
 void HAL_FlashVars_IncreaseBootCount(){
+	// every start of simulated device is a boot
+	SIM_FlashVars_Reload();
+	flash_vars.boot_count++;
+	FlashVarsJournal_Save(1);
 }
 void HAL_FlashVars_SaveChannel(int index, int value) {
-
+	if (index < 0 || index >= MAX_RETAIN_CHANNELS) {
+		return;
+	}
+	flash_vars_init();
+	flash_vars.savedValues[index] = value;
+	FlashVarsJournal_Save(0);
 }
 int HAL_FlashVars_GetChannelValue(int ch) {
-	return 0;
+	if (ch < 0 || ch >= MAX_RETAIN_CHANNELS) {
+		return 0;
+	}
+	flash_vars_init();
+	return flash_vars.savedValues[ch];
 }
 void HAL_FlashVars_SaveLED(byte mode, short brightness, short temperature, byte r, byte g, byte b, byte bEnableAll) {
-
+	flash_vars_init();
+	flash_vars.savedValues[MAX_RETAIN_CHANNELS - 1] = brightness;
+	flash_vars.savedValues[MAX_RETAIN_CHANNELS - 2] = temperature;
+	flash_vars.savedValues[MAX_RETAIN_CHANNELS - 3] = mode;
+	flash_vars.savedValues[MAX_RETAIN_CHANNELS - 4] = bEnableAll;
+	flash_vars.rgb[0] = r;
+	flash_vars.rgb[1] = g;
+	flash_vars.rgb[2] = b;
+	// journal only stores what really changed
+	FlashVarsJournal_Save(0);
 }
 void HAL_FlashVars_ReadLED(byte *mode, short *brightness, short *temperature, byte *rgb, byte *bEnableAll) {
-
+	flash_vars_init();
+	*bEnableAll = flash_vars.savedValues[MAX_RETAIN_CHANNELS - 4];
+	*mode = flash_vars.savedValues[MAX_RETAIN_CHANNELS - 3];
+	*temperature = flash_vars.savedValues[MAX_RETAIN_CHANNELS - 2];
+	*brightness = flash_vars.savedValues[MAX_RETAIN_CHANNELS - 1];
+	rgb[0] = flash_vars.rgb[0];
+	rgb[1] = flash_vars.rgb[1];
+	rgb[2] = flash_vars.rgb[2];
 }
 
 int HAL_GetEnergyMeterStatus(ENERGY_METERING_DATA *data)
@@ -52,4 +141,3 @@ void HAL_FlashVars_SaveTotalConsumption(float total_consumption)
 
 #endif // WINDOWS
 
-
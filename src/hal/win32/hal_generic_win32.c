@@ -1,10 +1,11 @@
 #ifdef WINDOWS
 
 #include "../hal_generic.h"
+#include "../hal_flashVars.h"
 
 void HAL_RebootModule() 
 {
-
+	HAL_FlashVars_Flush();
 }
 
 void HAL_Delay_us(int delay)
@@ -13,6 +13,13 @@ void HAL_UART_SendByte(byte b)
 	//addLogAdv(LOG_INFO, LOG_FEATURE_TUYAMCU,"%02X", b);
 }
 
+void HAL_UART_SendBytes(const byte* data, int len)
+{
+	for (int i = 0; i < len; i++) {
+		HAL_UART_SendByte(data[i]);
+	}
+}
+
 int HAL_UART_Init(int baud, int parity, bool hwflowc, int txOverride, int rxOverride)
 {
 	return 1;
@@ -1160,6 +1160,116 @@ const char* hass_build_discovery_json(HassDeviceInfo* info) {
 	return info->json;
 }
 
+// Last published discovery payload per entity, as a pair of hashes.
+// Entities are identified by topic and channel, the payload by its printed JSON.
+typedef struct hassDiscoveryCacheEntry_s {
+	uint32_t key;
+	uint32_t payload;
+} hassDiscoveryCacheEntry_t;
+
+static hassDiscoveryCacheEntry_t g_hassDiscoveryCache[HASS_DISCOVERY_CACHE_SIZE];
+static int g_hassDiscoveryCacheUsed = 0;
+static int g_hassDiscoveryCacheNextEvict = 0;
+static bool g_hassDiscoveryForce = false;
+// retained messages may be gone after reconnect (other broker, no persistence)
+static int g_hassDiscoveryCacheConnection = -1;
+static hassDiscoveryStats_t g_hassDiscoveryStats;
+
+static uint32_t hass_hash(uint32_t hash, const char* s) {
+	// FNV-1a
+	while (*s) {
+		hash ^= (byte)*s;
+		hash *= 16777619u;
+		s++;
+	}
+	return hash;
+}
+
+void hass_clear_discovery_cache() {
+	g_hassDiscoveryCacheUsed = 0;
+	g_hassDiscoveryCacheNextEvict = 0;
+}
+
+void hass_begin_discovery(bool bForce) {
+	if (g_hassDiscoveryCacheConnection != MQTT_GetConnectEvents()) {
+		g_hassDiscoveryCacheConnection = MQTT_GetConnectEvents();
+		hass_clear_discovery_cache();
+	}
+	g_hassDiscoveryForce = bForce;
+	memset(&g_hassDiscoveryStats, 0, sizeof(g_hassDiscoveryStats));
+}
+
+void hass_end_discovery() {
+	addLogAdv(LOG_INFO, LOG_FEATURE_HASS, "HA discovery: %i published, %i unchanged skipped, %i bytes saved\r\n",
+		g_hassDiscoveryStats.published, g_hassDiscoveryStats.skipped, g_hassDiscoveryStats.bytesSaved);
+	if (g_hassDiscoveryStats.dropped) {
+		addLogAdv(LOG_WARN, LOG_FEATURE_HASS, "HA discovery: %i dropped by full publish queue, retrying in %i seconds\r\n",
+			g_hassDiscoveryStats.dropped, HASS_DISCOVERY_RETRY_SECONDS);
+	}
+	g_hassDiscoveryForce = false;
+}
+
+const hassDiscoveryStats_t* hass_get_discovery_stats() {
+	return &g_hassDiscoveryStats;
+}
+
+/// @brief Queues retained discovery message for the entity, unless the same payload
+/// was already published for it on this connection.
+/// @param topic discovery prefix
+/// @param info 
+void hass_queue_discovery(const char* topic, HassDeviceInfo* info) {
+	const char* json;
+	uint32_t key, payload;
+	int i, len, droppedBefore, droppedAfter, items, bytes, highWater;
+
+	if (info == NULL) {
+		return;
+	}
+	json = hass_build_discovery_json(info);
+	len = strlen(json);
+	key = hass_hash(hass_hash(2166136261u, topic), info->channel);
+	payload = hass_hash(2166136261u, json);
+
+	for (i = 0; i < g_hassDiscoveryCacheUsed; i++) {
+		if (g_hassDiscoveryCache[i].key == key) {
+			break;
+		}
+	}
+	if (i < g_hassDiscoveryCacheUsed && g_hassDiscoveryCache[i].payload == payload && !g_hassDiscoveryForce) {
+		g_hassDiscoveryStats.skipped++;
+		g_hassDiscoveryStats.bytesSaved += len;
+		return;
+	}
+
+	MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &droppedBefore);
+	MQTT_QueuePublish(topic, info->channel, json, OBK_PUBLISH_FLAG_RETAIN);
+	MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &droppedAfter);
+	if (droppedAfter != droppedBefore) {
+		// not queued, forget it and retry once the queue had time to drain
+		if (i < g_hassDiscoveryCacheUsed) {
+			g_hassDiscoveryCache[i].payload = 0;
+		}
+		g_hassDiscoveryStats.dropped++;
+		Main_ScheduleHomeAssistantDiscovery(HASS_DISCOVERY_RETRY_SECONDS);
+		return;
+	}
+	g_hassDiscoveryStats.published++;
+	g_hassDiscoveryStats.bytesPublished += len;
+
+	if (i == g_hassDiscoveryCacheUsed) {
+		if (g_hassDiscoveryCacheUsed < HASS_DISCOVERY_CACHE_SIZE) {
+			g_hassDiscoveryCacheUsed++;
+		}
+		else {
+			// more entities than slots, the evicted one will just be published again
+			i = g_hassDiscoveryCacheNextEvict;
+			g_hassDiscoveryCacheNextEvict = (g_hassDiscoveryCacheNextEvict + 1) % HASS_DISCOVERY_CACHE_SIZE;
+		}
+	}
+	g_hassDiscoveryCache[i].key = key;
+	g_hassDiscoveryCache[i].payload = payload;
+}
+
 /// @brief Release allocated memory.
 /// @param info 
 void hass_free_device_info(HassDeviceInfo* info) {
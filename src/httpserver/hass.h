@@ -122,6 +122,20 @@ typedef enum {
 //Size of JSON (1 less than MQTT queue holding)
 #define HASS_JSON_SIZE          (MQTT_PUBLISH_ITEM_VALUE_LENGTH - 1)
 
+//Number of entities remembered for skipping unchanged discovery payloads
+#define HASS_DISCOVERY_CACHE_SIZE	64
+
+//Delay before discovery runs again when the publish queue dropped an entity
+#define HASS_DISCOVERY_RETRY_SECONDS	5
+
+typedef struct hassDiscoveryStats_s {
+	int published;
+	int skipped;
+	int bytesPublished;
+	int bytesSaved;
+	int dropped;
+} hassDiscoveryStats_t;
+
 /// @brief HomeAssistant device discovery information
 typedef struct HassDeviceInfo_s {
 	char unique_id[HASS_UNIQUE_ID_SIZE];
@@ -157,6 +171,11 @@ HassDeviceInfo* hass_createGarageEntity(const char* state_topic, const char* com
 HassDeviceInfo* hass_createToggle(const char *label, const char *stateTopic, const char *commandTopic);
 HassDeviceInfo* hass_init_textField_info(int index);
 const char* hass_build_discovery_json(HassDeviceInfo* info);
+void hass_queue_discovery(const char* topic, HassDeviceInfo* info);
+void hass_begin_discovery(bool bForce);
+void hass_end_discovery();
+void hass_clear_discovery_cache();
+const hassDiscoveryStats_t* hass_get_discovery_stats();
 void hass_free_device_info(HassDeviceInfo* info); 
 char *hass_generate_multiplyAndRound_template(int decimalPlacesForRounding, int decimalPointOffset, int divider);
 HassDeviceInfo* hass_init_textField_info(int index);
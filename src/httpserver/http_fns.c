@@ -1916,7 +1916,7 @@ HassDeviceInfo *hass_createEnumChannelInfo(int i) {
 	os_free(options);
 	return dev_info;
 }
-void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
+void doHomeAssistantDiscovery(const char* topic, http_request_t* request, bool bForce) {
 	int i;
 	int relayCount;
 	int pwmCount;
@@ -1971,6 +1971,9 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 #endif
 	cJSON_InitHooks(&hooks);
 
+	// entities whose payload did not change since last time are skipped, unless forced
+	hass_begin_discovery(bForce);
+
 	DRV_OnHassDiscovery(topic);
 	EventHandlers_FireEvent(CMD_EVENT_ON_DISCOVERY, 0);
 
@@ -2023,7 +2026,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 			BIT_SET(flagsChannelPublished, toggle);
 			BIT_SET(flagsChannelPublished, dimmer);
 			dev_info = hass_init_light_singleColor_onChannels(toggle, dimmer, brightness_scale);
-			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+			hass_queue_discovery(topic, dev_info);
 			hass_free_device_info(dev_info);
 			discoveryQueued = true;
 		}
@@ -2040,7 +2043,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 			dev_info = hass_init_light_device_info(LIGHT_RGBCW);
 		}
 		// Enable + RGB control + CW control
-		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		hass_queue_discovery(topic, dev_info);
 		hass_free_device_info(dev_info);
 		dev_info = NULL;
 		discoveryQueued = true;
@@ -2062,7 +2065,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 		}
 
 		if (dev_info != NULL) {
-			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+			hass_queue_discovery(topic, dev_info);
 			hass_free_device_info(dev_info);
 			dev_info = NULL;
 			discoveryQueued = true;
@@ -2076,7 +2079,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 		{
 			dev_info = hass_init_energy_sensor_device_info(i, BL_SENSORS_IX_0);
 			if (dev_info) {
-				MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+				hass_queue_discovery(topic, dev_info);
 				hass_free_device_info(dev_info);
 				discoveryQueued = true;
 			}
@@ -2084,7 +2087,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 				//20250319 XJIKKA to simplify and save space in flash frequency together with voltage
 				dev_info = hass_init_sensor_device_info(FREQUENCY_SENSOR, SPECIAL_CHANNEL_OBK_FREQUENCY, -1, -1, -1);
 				if (dev_info) {
-					MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+					hass_queue_discovery(topic, dev_info);
 					hass_free_device_info(dev_info);
 					discoveryQueued = true;
 				}
@@ -2097,7 +2100,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 			{
 				dev_info = hass_init_energy_sensor_device_info(i, BL_SENSORS_IX_1);
 				if (dev_info) {
-					MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+					hass_queue_discovery(topic, dev_info);
 					hass_free_device_info(dev_info);
 					discoveryQueued = true;
 				}
@@ -2109,11 +2112,11 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 
 	if (measuringBattery == true) {
 		dev_info = hass_init_sensor_device_info(BATTERY_SENSOR, 0, -1, -1, 1);
-		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		hass_queue_discovery(topic, dev_info);
 		hass_free_device_info(dev_info);
 
 		dev_info = hass_init_sensor_device_info(BATTERY_VOLTAGE_SENSOR, 0, -1, -1, 1);
-		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		hass_queue_discovery(topic, dev_info);
 		hass_free_device_info(dev_info);
 
 		discoveryQueued = true;
@@ -2125,14 +2128,14 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 			// TODO: flags are 32 bit and there are 64 max channels
 			BIT_SET(flagsChannelPublished, ch);
 			dev_info = hass_init_sensor_device_info(TEMPERATURE_SENSOR, ch, 2, 1, 1);
-			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+			hass_queue_discovery(topic, dev_info);
 			hass_free_device_info(dev_info);
 
 			ch = PIN_GetPinChannel2ForPinIndex(i);
 			// TODO: flags are 32 bit and there are 64 max channels
 			BIT_SET(flagsChannelPublished, ch);
 			dev_info = hass_init_sensor_device_info(HUMIDITY_SENSOR, ch, -1, -1, 1);
-			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+			hass_queue_discovery(topic, dev_info);
 			hass_free_device_info(dev_info);
 
 			discoveryQueued = true;
@@ -2142,14 +2145,14 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 			// TODO: flags are 32 bit and there are 64 max channels
 			BIT_SET(flagsChannelPublished, ch);
 			dev_info = hass_init_sensor_device_info(CO2_SENSOR, ch, -1, -1, 1);
-			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+			hass_queue_discovery(topic, dev_info);
 			hass_free_device_info(dev_info);
 
 			ch = PIN_GetPinChannel2ForPinIndex(i);
 			// TODO: flags are 32 bit and there are 64 max channels
 			BIT_SET(flagsChannelPublished, ch);
 			dev_info = hass_init_sensor_device_info(TVOC_SENSOR, ch, -1, -1, 1);
-			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+			hass_queue_discovery(topic, dev_info);
 			hass_free_device_info(dev_info);
 
 			discoveryQueued = true;
@@ -2158,7 +2161,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 	//{
 	//	HassDeviceInfo*dev_info = hass_createGarageEntity("~/1/get", "~/1/set",
 	//	 "Main Door");
-	//	MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+	//	hass_queue_discovery(topic, dev_info);
 	//	hass_free_device_info(dev_info);
 	//	discoveryQueued = true;
 	//}
@@ -2410,7 +2413,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 			break;
 		}
 		if (dev_info) {
-			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+			hass_queue_discovery(topic, dev_info);
 			hass_free_device_info(dev_info);
 
 			BIT_SET(flagsChannelPublished, i);
@@ -2435,7 +2438,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 			else {
 				dev_info = hass_init_relay_device_info(i, RELAY, bToggleInv);
 			}
-			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+			hass_queue_discovery(topic, dev_info);
 			hass_free_device_info(dev_info);
 			dev_info = NULL;
 			discoveryQueued = true;
@@ -2451,7 +2454,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 				// TODO: flags are 32 bit and there are 64 max channels
 				BIT_SET(flagsChannelPublished, i);
 				dev_info = hass_init_binary_sensor_device_info(i, false);
-				MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+				hass_queue_discovery(topic, dev_info);
 				hass_free_device_info(dev_info);
 				dev_info = NULL;
 				discoveryQueued = true;
@@ -2462,29 +2465,33 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 		//use -1 for channel as these don't correspond to channels
 #ifndef NO_CHIP_TEMPERATURE
 		dev_info = hass_init_sensor_device_info(HASS_TEMP, -1, -1, -1, 1);
-		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		hass_queue_discovery(topic, dev_info);
 		hass_free_device_info(dev_info);
 #endif
 		dev_info = hass_init_sensor_device_info(HASS_RSSI, -1, -1, -1, 1);
-		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		hass_queue_discovery(topic, dev_info);
 		hass_free_device_info(dev_info);
 		dev_info = hass_init_sensor_device_info(HASS_UPTIME, -1, -1, -1, 1);
-		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		hass_queue_discovery(topic, dev_info);
 		hass_free_device_info(dev_info);
 		dev_info = hass_init_sensor_device_info(HASS_BUILD, -1, -1, -1, 1);
-		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		hass_queue_discovery(topic, dev_info);
 		hass_free_device_info(dev_info);
 		dev_info = hass_init_sensor_device_info(HASS_SSID, -1, -1, -1, 1);
-		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		hass_queue_discovery(topic, dev_info);
 		hass_free_device_info(dev_info);
 		dev_info = hass_init_sensor_device_info(HASS_IP, -1, -1, -1, 1);
-		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		hass_queue_discovery(topic, dev_info);
 		hass_free_device_info(dev_info);
 		discoveryQueued = true;
 
 	}
+	hass_end_discovery();
 	if (discoveryQueued) {
-		MQTT_InvokeCommandAtEnd(PublishChannels);
+		// nothing new was queued if all entities were unchanged
+		if (hass_get_discovery_stats()->published > 0) {
+			MQTT_InvokeCommandAtEnd(PublishChannels);
+		}
 	}
 	else {
 		const char* msg = "No relay, PWM, sensor or power driver running.";
@@ -2515,9 +2522,10 @@ int http_fn_ha_discovery(http_request_t* request) {
 	// even if it returns the empty HA topic,
 	// the function call below will set default
 	http_getArg(request->url, "prefix", topic, sizeof(topic));
-	doHomeAssistantDiscovery(topic, request);
+	// explicit request from the page always republishes everything
+	doHomeAssistantDiscovery(topic, request, true);
 
-	poststr(request, "MQTT discovery queued.");
+	hprintf255(request, "MQTT discovery queued, %i entities published.", hass_get_discovery_stats()->published);
 	poststr(request, NULL);
 	return 0;
 }
@@ -24,9 +24,60 @@
 
 #endif
 
+// Connections are served by a fixed pool of worker threads, each with
+// its own preallocated buffers. Server thread only accepts connections
+// and puts them into a queue, idle workers block on a semaphore until
+// there is something in it. A worker keeps connection open for next
+// request (HTTP/1.1 keep-alive) as long as nobody else waits in queue.
+// Number of workers is g_httpPoolSize, read once when server starts.
+#define HTTP_ACCEPT_QUEUE_SIZE		8
+// how long idle kept open connection waits for next request
+#define HTTP_KEEPALIVE_TIMEOUT_MS	5000
+#define HTTP_KEEPALIVE_MAX_REQUESTS	100
+
+// FreeRTOS provides xSemaphoreCreateBinary as a macro. Ports which only
+// map mutexes in new_common.h let idle workers poll queue instead.
+#ifdef xSemaphoreCreateBinary
+#define HTTP_QUEUE_SIGNAL			1
+#else
+#define HTTP_QUEUE_SIGNAL			0
+#define HTTP_WORKER_POLL_MS			10
+#endif
+
+#if PLATFORM_BL602
+// replies are sent directly by postany, don't keep connections
+#define HTTP_DISABLE_KEEPALIVE 1
+#endif
+
+// second reply buffer per worker, so a page can be built while
+// previous part of it is still being sent
+#ifndef HTTP_REPLY_DOUBLE_BUFFER
+#define HTTP_REPLY_DOUBLE_BUFFER	1
+#endif
+
+typedef struct httpWorker_s {
+	char* reply;
+	char* reply2;
+	char* received;
+	int receivedSize;
+} httpWorker_t;
+
+typedef struct httpQueuedClient_s {
+	int fd;
+	portTickType acceptTime;
+} httpQueuedClient_t;
+
 static void tcp_server_thread(beken_thread_arg_t arg);
 static void tcp_client_thread(beken_thread_arg_t arg);
 
+static httpWorker_t g_httpWorkers[HTTP_WORKER_POOL_MAX];
+static httpQueuedClient_t g_httpQueue[HTTP_ACCEPT_QUEUE_SIZE];
+static int g_httpQueueHead = 0;
+static SemaphoreHandle_t g_httpQueueMutex = 0;
+#if HTTP_QUEUE_SIGNAL
+// given when queue becomes non-empty, wakes one idle worker
+static SemaphoreHandle_t g_httpQueueReady = 0;
+#endif
 
 xTaskHandle g_http_thread = NULL;
 
@@ -49,35 +100,88 @@ int sendfn(int fd, char* data, int len) {
 	return -1;
 }
 
-static void tcp_client_thread(beken_thread_arg_t arg)
-{
-	OSStatus err = kNoErr;
-	int fd = (int)arg;
-	//fd_set readfds, errfds, readfds2;
-	char* buf = NULL;
-	char* reply = NULL;
-	int replyBufferSize = REPLY_BUFFER_SIZE;
-	//int res;
-	//char reply[8192];
+static int HTTP_QueuePush(int fd) {
+	int ok = 0;
 
-  //my_fd = fd;
-	rtos_delay_milliseconds(20);
+	xSemaphoreTake(g_httpQueueMutex, 100);
+	if (g_httpStats.queueDepth < HTTP_ACCEPT_QUEUE_SIZE) {
+		g_httpQueue[(g_httpQueueHead + g_httpStats.queueDepth) % HTTP_ACCEPT_QUEUE_SIZE].fd = fd;
+		g_httpQueue[(g_httpQueueHead + g_httpStats.queueDepth) % HTTP_ACCEPT_QUEUE_SIZE].acceptTime = xTaskGetTickCount();
+		g_httpStats.queueDepth++;
+		if (g_httpStats.queueDepth > g_httpStats.maxQueueDepth) {
+			g_httpStats.maxQueueDepth = g_httpStats.queueDepth;
+		}
+		ok = 1;
+	}
+	xSemaphoreGive(g_httpQueueMutex);
+#if HTTP_QUEUE_SIGNAL
+	if (ok) {
+		xSemaphoreGive(g_httpQueueReady);
+	}
+#endif
+	return ok;
+}
 
-	reply = (char*)os_malloc(replyBufferSize);
-	buf = (char*)os_malloc(INCOMING_BUFFER_SIZE);
+static int HTTP_QueuePop(httpQueuedClient_t* out) {
+	int ok = 0;
 
-	if (buf == 0 || reply == 0)
-	{
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP Client failed to malloc buffer");
-		goto exit;
+	xSemaphoreTake(g_httpQueueMutex, 100);
+	if (g_httpStats.queueDepth > 0) {
+		*out = g_httpQueue[g_httpQueueHead];
+		g_httpQueueHead = (g_httpQueueHead + 1) % HTTP_ACCEPT_QUEUE_SIZE;
+		g_httpStats.queueDepth--;
+		ok = 1;
+	}
+#if HTTP_QUEUE_SIGNAL
+	// semaphore is binary, so pass it on if more clients wait
+	if (g_httpStats.queueDepth > 0) {
+		xSemaphoreGive(g_httpQueueReady);
 	}
+#endif
+	xSemaphoreGive(g_httpQueueMutex);
+	return ok;
+}
+
+// wait until there is data on kept open connection. Gives up early
+// if other clients are waiting for a worker.
+static int HTTP_WaitForNextRequest(int fd) {
+	struct timeval tv;
+	fd_set readfds;
+	int waited = 0;
+
+	while (waited < HTTP_KEEPALIVE_TIMEOUT_MS) {
+		if (g_httpStats.queueDepth > 0) {
+			return 0;
+		}
+		FD_ZERO(&readfds);
+		FD_SET(fd, &readfds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 100 * 1000;
+		if (select(fd + 1, &readfds, NULL, NULL, &tv) > 0) {
+			return 1;
+		}
+		waited += 100;
+	}
+	return 0;
+}
+
+// serves one request, returns 1 if connection can be used again
+static int HTTP_ServeRequest(httpWorker_t* w, int fd, portTickType startTime)
+{
 	http_request_t request;
+	int keep;
+
 	memset(&request, 0, sizeof(request));
 
 	request.fd = fd;
-	request.received = buf;
-	request.receivedLenmax = INCOMING_BUFFER_SIZE - 2;
+	request.received = w->received;
+	request.receivedLenmax = w->receivedSize - 2;
 	request.responseCode = HTTP_RESPONSE_OK;
+#if HTTP_DISABLE_KEEPALIVE || DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
+	request.keepAlive = 0;
+#else
+	request.keepAlive = 1;
+#endif
 #if PLATFORM_BL602
 	request.receivedLen = recv(fd, request.received, request.receivedLenmax, 0);
 	request.received[request.receivedLen] = 0;
@@ -93,55 +197,126 @@ static void tcp_client_thread(beken_thread_arg_t arg)
 		if (received < remaining) {
 			break;
 		}
-		// grow by 1024
-		request.receivedLenmax += 1024;
-		request.received = (char*)realloc(request.received, request.receivedLenmax+2);
-		if (request.received == NULL) {
+		// grow by 1024, worker keeps larger buffer until connection is closed
+		char* grown = (char*)realloc(request.received, request.receivedLenmax + 1024 + 2);
+		if (grown == NULL) {
 			// no memory
-			return;
+			return 0;
 		}
+		request.received = w->received = grown;
+		request.receivedLenmax += 1024;
+		w->receivedSize = request.receivedLenmax + 2;
+	}
+	if (request.receivedLen < 0) {
+		request.receivedLen = 0;
 	}
 	request.received[request.receivedLen] = 0;
 #endif
 
-	request.reply = reply;
+	request.reply = w->reply;
+	request.reply2 = w->reply2;
 	request.replylen = 0;
-	reply[0] = '\0';
+	w->reply[0] = '\0';
 
-	request.replymaxlen = replyBufferSize - 1;
+	request.replymaxlen = REPLY_BUFFER_SIZE - 1;
 
 	if (request.receivedLen <= 0)
 	{
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP Client is disconnected, fd: %d", fd);
-		goto exit;
+		ADDLOG_DEBUG(LOG_FEATURE_HTTP, "TCP Client is disconnected, fd: %d", fd);
+		return 0;
 	}
 
 	//addLog( "TCP received string %s\n",buf );
-	// returns length to be sent if any
 	//ADDLOG_ERROR(LOG_FEATURE_HTTP,  "TCP will process packet of len %i\n", request.receivedLen );
-	int lenret = HTTP_ProcessPacket(&request);
-	if (lenret > 0) {
-		//ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP sending reply len %i\n", lenret);
-		send(fd, reply, lenret, 0);
-	}
-
-	//rtos_delay_milliseconds(10);
+	HTTP_ProcessPacket(&request);
+	keep = HTTP_FinishReply(&request);
 
-exit:
-	if (err != kNoErr)
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP client thread exit with err: %d", err);
+	HTTPServer_AddLatency((xTaskGetTickCount() - startTime) * portTICK_PERIOD_MS);
+	return keep;
+}
 
-	if (buf != NULL)
-		os_free(buf);
-	if (reply != NULL)
-		os_free(reply);
+static void HTTP_ServeConnection(httpWorker_t* w, int fd, portTickType acceptTime)
+{
+	int served = 0;
 
+	g_httpStats.connections++;
+	while (HTTP_ServeRequest(w, fd, acceptTime)) {
+		served++;
+		if (served >= HTTP_KEEPALIVE_MAX_REQUESTS) {
+			break;
+		}
+		if (HTTP_WaitForNextRequest(fd) == 0) {
+			break;
+		}
+		g_httpStats.keepAliveRequests++;
+		acceptTime = xTaskGetTickCount();
+	}
 	lwip_close(fd);
 
-#if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
+	// give back memory taken by big POST
+	if (w->receivedSize > INCOMING_BUFFER_SIZE) {
+		char* shrunk = (char*)realloc(w->received, INCOMING_BUFFER_SIZE);
+		if (shrunk) {
+			w->received = shrunk;
+			w->receivedSize = INCOMING_BUFFER_SIZE;
+		}
+	}
+}
+
+static int HTTP_InitWorker(httpWorker_t* w)
+{
+	w->reply = (char*)os_malloc(REPLY_BUFFER_SIZE);
+	w->received = (char*)os_malloc(INCOMING_BUFFER_SIZE);
+	w->receivedSize = INCOMING_BUFFER_SIZE;
+	if (w->reply == 0 || w->received == 0)
+	{
+		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP Client failed to malloc buffer");
+		return 0;
+	}
+#if HTTP_REPLY_DOUBLE_BUFFER
+	// optional, without it reply is sent from single buffer
+	w->reply2 = (char*)os_malloc(REPLY_BUFFER_SIZE);
+#endif
+	return 1;
+}
 
+static void tcp_client_thread(beken_thread_arg_t arg)
+{
+	httpWorker_t* w = (httpWorker_t*)arg;
+	httpQueuedClient_t client;
+
+	while (1) {
+#if HTTP_QUEUE_SIGNAL
+		xSemaphoreTake(g_httpQueueReady, portMAX_DELAY);
+#endif
+		if (HTTP_QueuePop(&client)) {
+			HTTP_ServeConnection(w, client.fd, client.acceptTime);
+		}
+#if !HTTP_QUEUE_SIGNAL
+		else {
+			rtos_delay_milliseconds(HTTP_WORKER_POLL_MS);
+		}
+#endif
+	}
+}
+
+static int HTTP_StartWorker(httpWorker_t* w)
+{
+#if PLATFORM_XR809
+	OS_Thread_t clientThreadUnused;
+
+	return kNoErr == OS_ThreadCreate(&clientThreadUnused,
+		"HTTP Client",
+		tcp_client_thread,
+		w,
+		OS_THREAD_PRIO_CONSOLE,
+		0x400);
 #else
-	rtos_delete_thread(NULL);
+	return kNoErr == rtos_create_thread(NULL, BEKEN_APPLICATION_PRIORITY,
+		"HTTP Client",
+		(beken_thread_function_t)tcp_client_thread,
+		HTTP_CLIENT_STACK_SIZE,
+		(beken_thread_arg_t)w);
 #endif
 }
 
@@ -155,6 +330,27 @@ static void tcp_server_thread(beken_thread_arg_t arg)
 	char client_ip_str[16];
 	int tcp_listen_fd = -1, client_fd = -1;
 	fd_set readfds;
+	int i;
+
+	g_httpQueueMutex = xSemaphoreCreateMutex();
+#if HTTP_QUEUE_SIGNAL
+	g_httpQueueReady = xSemaphoreCreateBinary();
+#endif
+#if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
+	// single worker, run by this thread
+	HTTP_InitWorker(&g_httpWorkers[0]);
+#else
+	for (i = 0; i < g_httpPoolSize; i++) {
+		if (HTTP_InitWorker(&g_httpWorkers[i]) == 0) {
+			break;
+		}
+		if (HTTP_StartWorker(&g_httpWorkers[i]) == 0)
+		{
+			ADDLOG_ERROR(LOG_FEATURE_HTTP, "HTTP worker %i thread creation failed!", i);
+			break;
+		}
+	}
+#endif
 
 	tcp_listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 
@@ -177,48 +373,18 @@ static void tcp_server_thread(beken_thread_arg_t arg)
 			client_fd = accept(tcp_listen_fd, (struct sockaddr*)&client_addr, &sockaddr_t_size);
 			if (client_fd >= 0)
 			{
-#if PLATFORM_XR809
-#if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
-
-#else
-				OS_Thread_t clientThreadUnused;
-#endif
-#endif
 				strcpy(client_ip_str, inet_ntoa(client_addr.sin_addr));
 #if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
 				//ADDLOG_ERROR(LOG_FEATURE_HTTP, "HTTP [single thread] Client %s:%d connected, fd: %d", client_ip_str, client_addr.sin_port, client_fd);
 				// Use main server thread (blocking all other clients)
 				// right now, I am getting OS_ThreadCreate everytime on XR809 platform
-				tcp_client_thread((beken_thread_arg_t)client_fd);
-#else
-				//ADDLOG_ERROR(LOG_FEATURE_HTTP, "HTTP [multi thread] Client %s:%d connected, fd: %d", client_ip_str, client_addr.sin_port, client_fd);
-				// delay each accept by 20ms
-				// this allows previous to finish if
-				// in a loop of sends from the browser, e.g. OTA
-				// and we MUST get some IDLE thread time, else
-				// thread resources are not deleted.
-				rtos_delay_milliseconds(20);
-				// Create separate thread for client
-				if (kNoErr !=
-#if PLATFORM_XR809
-					OS_ThreadCreate(&clientThreadUnused,
-						"HTTP Client",
-						tcp_client_thread,
-						client_fd,
-						OS_THREAD_PRIO_CONSOLE,
-						0x400)
-
+				HTTP_ServeConnection(&g_httpWorkers[0], client_fd, xTaskGetTickCount());
 #else
-					rtos_create_thread(NULL, BEKEN_APPLICATION_PRIORITY,
-						"HTTP Client",
-						(beken_thread_function_t)tcp_client_thread,
-						HTTP_CLIENT_STACK_SIZE,
-						(beken_thread_arg_t)client_fd)
-
-#endif
-					)
+				//ADDLOG_ERROR(LOG_FEATURE_HTTP, "HTTP [pool] Client %s:%d connected, fd: %d", client_ip_str, client_addr.sin_port, client_fd);
+				if (HTTP_QueuePush(client_fd) == 0)
 				{
-					ADDLOG_DEBUG(LOG_FEATURE_HTTP, "TCP Client %s:%d thread creation failed! fd: %d", client_ip_str, client_addr.sin_port, client_fd);
+					ADDLOG_DEBUG(LOG_FEATURE_HTTP, "TCP Client %s:%d rejected, queue full! fd: %d", client_ip_str, client_addr.sin_port, client_fd);
+					g_httpStats.rejected++;
 					lwip_close(client_fd);
 					client_fd = -1;
 				}
@@ -83,14 +83,32 @@ int HTTPServer_Start() {
 #define DEFAULT_BUFLEN 10000
 int g_prevHTTPResult;
 
-void HTTPServer_RunQuickTick() {
+// open connections, kept for next request (HTTP/1.1 keep-alive),
+// at most g_httpPoolSize of them
+#define HTTP_KEEPALIVE_TIMEOUT_MS	5000
+
+typedef struct httpSimClient_s {
+	SOCKET socket;
+	int lastActivity;
+	int served;
+} httpSimClient_t;
+
+static httpSimClient_t g_httpClients[HTTP_WORKER_POOL_MAX];
+static char recvbuf[DEFAULT_BUFLEN];
+static char outbuf[DEFAULT_BUFLEN];
+static char outbuf2[DEFAULT_BUFLEN];
+
+static void HTTP_CloseClient(httpSimClient_t *c) {
+	// shutdown the connection since we're done
+	shutdown(c->socket, SD_SEND);
+	closesocket(c->socket);
+	c->socket = INVALID_SOCKET;
+}
+static void HTTP_AcceptClient() {
+	SOCKET ClientSocket;
 	int iResult;
-	int err;
-    char recvbuf[DEFAULT_BUFLEN];
-    char outbuf[DEFAULT_BUFLEN];
-    int recvbuflen = DEFAULT_BUFLEN;
-    SOCKET ClientSocket = INVALID_SOCKET;
-	int len, iSendResult;
+	int i, oldest;
+	int argp;
 
 	// Accept a client socket
 	ClientSocket = accept(ListenSocket, NULL, NULL);
@@ -104,107 +122,133 @@ void HTTPServer_RunQuickTick() {
 		}
 		return;
 	}
+	// we check for data with select, sending is blocking
+	argp = 0;
+	ioctlsocket(ClientSocket, FIONBIO, &argp);
+	g_httpStats.connections++;
 
-	//argp = 0;
-	//if (ioctlsocket(ClientSocket,
-	//	FIONBIO,
-	//	&argp) == SOCKET_ERROR)
-	//{
-	//	printf("ioctlsocket() error %d\n", WSAGetLastError());
-	//	return 1;
-	//}
-		// Receive until the peer shuts down the connection
-		do {
+	oldest = 0;
+	for (i = 0; i < g_httpPoolSize; i++) {
+		if (g_httpClients[i].socket == INVALID_SOCKET) {
+			break;
+		}
+		if (g_httpClients[i].lastActivity < g_httpClients[oldest].lastActivity) {
+			oldest = i;
+		}
+	}
+	if (i == g_httpPoolSize) {
+		// all slots taken, drop the connection that was idle for longest time
+		g_httpStats.rejected++;
+		HTTP_CloseClient(&g_httpClients[oldest]);
+		i = oldest;
+	}
+	g_httpClients[i].socket = ClientSocket;
+	// idle timeout also applies to connection that never sends anything
+	g_httpClients[i].lastActivity = xTaskGetTickCount();
+	g_httpClients[i].served = 0;
+}
+static int HTTP_IsReadable(SOCKET s) {
+	fd_set readfds;
+	struct timeval tv;
 
-			iResult = recv(ClientSocket, recvbuf, recvbuflen-1, 0);
-			if (iResult > 0) {
-				http_request_t request;
-				memset(&request, 0, sizeof(request));
+	FD_ZERO(&readfds);
+	FD_SET(s, &readfds);
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	return select(s + 1, &readfds, NULL, NULL, &tv) > 0;
+}
+// returns 1 if connection can be used for next request
+static int HTTP_ServeClient(httpSimClient_t *c) {
+	http_request_t request;
+	int iResult;
+	int startTime;
+	int keep;
 
-				recvbuf[iResult] = 0;
+	startTime = xTaskGetTickCount();
+	iResult = recv(c->socket, recvbuf, sizeof(recvbuf) - 1, 0);
+	if (iResult == 0) {
+		printf("Connection closing...\n");
+		return 0;
+	}
+	if (iResult < 0) {
+		printf("recv failed with error: %d\n", WSAGetLastError());
+		return 0;
+	}
+	memset(&request, 0, sizeof(request));
+
+	recvbuf[iResult] = 0;
 
 #if 1
-				// debug test code, you can disable it but dont remove it
-				if (1) {
-					FILE *f;
-
-					f = fopen("lastHTTPPacket.txt", "wb");
-					fwrite(recvbuf, 1, recvbuflen, f);
-					fclose(f);
-				}
+	// debug test code, you can disable it but dont remove it
+	if (1) {
+		FILE *f;
+
+		f = fopen("lastHTTPPacket.txt", "wb");
+		fwrite(recvbuf, 1, iResult, f);
+		fclose(f);
+	}
 #endif
 
-				request.fd = ClientSocket;
-				request.received = recvbuf;
-				request.receivedLen = iResult;
-				outbuf[0] = '\0';
-				request.reply = outbuf;
-				request.replylen = 0;
-				request.responseCode = HTTP_RESPONSE_OK;
-				request.replymaxlen = DEFAULT_BUFLEN;
-				request.receivedLenmax = DEFAULT_BUFLEN;
-
-				//printf("HTTP Server for Windows: Bytes received: %d \n", iResult);
-				len = HTTP_ProcessPacket(&request);
-
-				if(len > 0) {
-					printf("Bytes rremaining tosend %d\n", len);
-					//printf("%s\n",outbuf);
-					// Echo the buffer back to the sender
-					//leen =  strlen(request.reply);
-					iSendResult = send( ClientSocket, outbuf,len, 0 );
-					if (iSendResult == SOCKET_ERROR) {
-						printf("send failed with error: %d\n", WSAGetLastError());
-						closesocket(ClientSocket);
-						return 1;
-					}
-					printf("HTTP Server for Windows: Bytes sent: %d\n", iSendResult);
-				}
-				break;
-			}
-			else if (iResult == 0) {
-				printf("Connection closing...\n");
-				break;
-			}
-			else {
-				err = WSAGetLastError();
-				if (err != WSAEWOULDBLOCK) {
-					printf("recv failed with error: %d\n", err);
-					closesocket(ClientSocket);
-					break;
-				}
+	request.fd = c->socket;
+	request.received = recvbuf;
+	request.receivedLen = iResult;
+	outbuf[0] = '\0';
+	request.reply = outbuf;
+	request.reply2 = outbuf2;
+	request.replylen = 0;
+	request.responseCode = HTTP_RESPONSE_OK;
+	request.replymaxlen = DEFAULT_BUFLEN;
+	request.receivedLenmax = DEFAULT_BUFLEN;
+	request.keepAlive = 1;
+
+	//printf("HTTP Server for Windows: Bytes received: %d \n", iResult);
+	HTTP_ProcessPacket(&request);
+	keep = HTTP_FinishReply(&request);
+
+	if (c->served) {
+		g_httpStats.keepAliveRequests++;
+	}
+	c->served++;
+	c->lastActivity = xTaskGetTickCount();
+	HTTPServer_AddLatency((c->lastActivity - startTime) * portTICK_PERIOD_MS);
+	return keep;
+}
+
+void HTTPServer_RunQuickTick() {
+	static int bInitialized = 0;
+	int i;
+	int waiting;
+	httpSimClient_t *c;
+
+	if (bInitialized == 0) {
+		for (i = 0; i < HTTP_WORKER_POOL_MAX; i++) {
+			g_httpClients[i].socket = INVALID_SOCKET;
+		}
+		bInitialized = 1;
+	}
+	HTTP_AcceptClient();
+
+	waiting = 0;
+	// pool may have been shrunk, serve and expire all open slots
+	for (i = 0; i < HTTP_WORKER_POOL_MAX; i++) {
+		c = &g_httpClients[i];
+		if (c->socket == INVALID_SOCKET) {
+			continue;
+		}
+		if (HTTP_IsReadable(c->socket)) {
+			waiting++;
+			if (HTTP_ServeClient(c) == 0) {
+				HTTP_CloseClient(c);
 			}
-			break;
-		} while (1);
-		//byte zero = 0;
-		//send(ClientSocket, &zero, 0, 0);
-		//Sleep(50);
-		// shutdown the connection since we're done
-		iResult = shutdown(ClientSocket, SD_SEND);
-		//long firstAttempt = timeGetTime();
-		//while (1) {
-		//	iResult = recv(ClientSocket, recvbuf, recvbuflen, 0);
-		//	if (iResult == 0)
-		//		break;
-		//	err = WSAGetLastError();
-		//	if (err != WSAEWOULDBLOCK) {
-		//		break;
-		//	}
-		//	long delta = timeGetTime() - firstAttempt;
-		//	if (delta > 2) {
-		//		printf("HTTP server would freeze to long!\n");
-		//		break; // too long freeze!
-
-		//	}
-		//}
-		//Sleep(50);
-		//iResult = closesocket(ClientSocket);
-		//if (iResult == SOCKET_ERROR) {
-		///	printf("shutdown failed with error: %d\n", WSAGetLastError());
-			closesocket(ClientSocket);
-			//WSACleanup();
-			//return 1;
-		//}
+		}
+		else if ((xTaskGetTickCount() - c->lastActivity) * portTICK_PERIOD_MS > HTTP_KEEPALIVE_TIMEOUT_MS) {
+			HTTP_CloseClient(c);
+		}
+	}
+	g_httpStats.queueDepth = waiting;
+	if (waiting > g_httpStats.maxQueueDepth) {
+		g_httpStats.maxQueueDepth = waiting;
+	}
 }
 
 #endif
@@ -16,7 +16,26 @@
 // define the feature ADDLOGF_XXX will use
 #define LOG_FEATURE LOG_FEATURE_HTTP
 
+#if PLATFORM_BL602 || PLATFORM_BEKEN_NEW || PLATFORM_RTL8720D
+// reply is not buffered, every postany goes straight to socket
+#define HTTP_DIRECT_SEND 1
+#else
+#define HTTP_DIRECT_SEND 0
+#endif
+// "%06X\r\n" before chunk data
+#define HTTP_CHUNK_HEADER_LEN 8
+// "\r\n" after chunk data and "0\r\n\r\n" of last chunk
+#define HTTP_CHUNK_TRAILER_LEN 7
+#ifdef MSG_DONTWAIT
+#define HTTP_SEND_NOWAIT MSG_DONTWAIT
+#else
+#define HTTP_SEND_NOWAIT 0
+#endif
+
 const char httpHeader[] = "HTTP/1.1 %d OK\nContent-type: %s";  // HTTP header
+
+httpServerStats_t g_httpStats;
+int g_httpPoolSize = HTTP_WORKER_POOL_SIZE;
 const char httpMimeTypeHTML[] = "text/html";              // HTML MIME type
 const char httpMimeTypeText[] = "text/plain";           // TEXT MIME type
 const char httpMimeTypeXML[] = "text/xml";           // TEXT MIME type
@@ -81,54 +100,6 @@ const char* methodNames[] = {
 
 void misc_formatUpTimeString(int totalSeconds, char* o);
 
-typedef struct http_callback_tag {
-	char* url;
-	int method;
-	http_callback_fn callback;
-	int auth_required;
-} http_callback_t;
-
-#define MAX_HTTP_CALLBACKS 32
-static http_callback_t* callbacks[MAX_HTTP_CALLBACKS];
-static int numCallbacks = 0;
-
-int HTTP_RegisterCallback(const char* url, int method, http_callback_fn callback, int auth_required) {
-	int i;
-
-	if (!url || !callback) {
-		return -1;
-	}
-	if (numCallbacks >= MAX_HTTP_CALLBACKS) {
-		return -4;
-	}
-	for (i = 0; i < MAX_HTTP_CALLBACKS; i++) {
-		if (callbacks[i]) {
-			if (callbacks[i]->callback == callback && !strcmp(callbacks[i]->url, url)
-				&& callbacks[i]->method == method) {
-				return i;
-			}
-		}
-	}
-	callbacks[numCallbacks] = (http_callback_t*)os_malloc(sizeof(http_callback_t));
-	if (!callbacks[numCallbacks]) {
-		return -2;
-	}
-	callbacks[numCallbacks]->url = (char*)os_malloc(strlen(url) + 1);
-	if (!callbacks[numCallbacks]->url) {
-		os_free(callbacks[numCallbacks]);
-		return -3;
-	}
-	strcpy(callbacks[numCallbacks]->url, url);
-	callbacks[numCallbacks]->callback = callback;
-	callbacks[numCallbacks]->method = method;
-	callbacks[numCallbacks]->auth_required = auth_required > 0 ? 1 : 0;
-
-	numCallbacks++;
-
-	// success
-	return 0;
-}
-
 int my_strnicmp(const char* a, const char* b, int len) {
 	int i;
 	for (i = 0; i < len; i++) {
@@ -273,6 +244,293 @@ bool http_checkUrlBase(const char* base, const char* fileName) {
 	return true;
 }
 
+// All pages, built-in and registered by drivers, live in one route table.
+// Routes are hashed by the first segment of their path, so lookup cost does
+// not grow with the number of pages. Registered routes match by prefix
+// (like "/api/" matching "/api/info"), built-in pages match the whole path.
+// A registered prefix without '/' may also match a longer first segment
+// ("/app" matches "/appX"), so such routes are kept in a separate list
+// which is always scanned.
+#define HTTP_ROUTE_PREFIX	1
+#define HTTP_ROUTE_BUILTIN	2
+
+typedef struct httpRoute_s {
+	const char* url; // without leading slash
+	short method;
+	unsigned char flags;
+	unsigned char auth_required;
+	http_callback_fn callback;
+	unsigned int hits;
+	unsigned int totalTimeMs;
+	unsigned int maxTimeMs;
+	// registration order, first registered route wins
+	int seq;
+	struct httpRoute_s* next;
+} httpRoute_t;
+
+#define HTTP_ROUTE_BUCKETS 16
+static httpRoute_t* g_routes[HTTP_ROUTE_BUCKETS];
+static httpRoute_t* g_segmentPrefixRoutes = 0;
+static int g_numRoutes = 0;
+static int g_numRegisteredRoutes = 0;
+
+#define MAX_HTTP_CALLBACKS 32
+
+// hash of the first path segment, stops at '/', '?', space or end of string
+static int HTTP_HashSegment(const char* s) {
+	unsigned int h = 5381;
+	while (*s && *s != '/' && *s != '?' && *s != ' ') {
+		h = (h * 33) ^ (unsigned char)*s;
+		s++;
+	}
+	return h % HTTP_ROUTE_BUCKETS;
+}
+
+static httpRoute_t** HTTP_RouteList(const char* url, int flags) {
+	if ((flags & HTTP_ROUTE_PREFIX) && strchr(url, '/') == 0) {
+		return &g_segmentPrefixRoutes;
+	}
+	return &g_routes[HTTP_HashSegment(url)];
+}
+
+static httpRoute_t* HTTP_AddRoute(const char* url, int method, http_callback_fn callback, int auth_required, int flags) {
+	httpRoute_t* r;
+	httpRoute_t** link;
+
+	r = (httpRoute_t*)os_malloc(sizeof(httpRoute_t));
+	if (r == 0) {
+		return 0;
+	}
+	memset(r, 0, sizeof(httpRoute_t));
+	r->url = url;
+	r->method = method;
+	r->flags = flags;
+	r->auth_required = auth_required;
+	r->callback = callback;
+	r->seq = g_numRoutes;
+
+	link = HTTP_RouteList(url, flags);
+	if (flags & HTTP_ROUTE_BUILTIN) {
+		// built-in pages come after all registered routes
+		while (*link) {
+			link = &(*link)->next;
+		}
+	}
+	else {
+		// registered routes are checked in registration order, before built-in pages
+		while (*link && ((*link)->flags & HTTP_ROUTE_BUILTIN) == 0) {
+			link = &(*link)->next;
+		}
+	}
+	r->next = *link;
+	*link = r;
+	g_numRoutes++;
+	return r;
+}
+
+#if (ENABLE_DRIVER_DS1820_FULL)
+// including "../driver/drv_ds1820_simple.h" will complain about typedefs not used here 
+// so lets declare it "extern"
+extern int http_fn_cfg_ds18b20(http_request_t* request);
+#endif
+
+static void HTTP_InitRoutes() {
+	static int bInitialized = 0;
+	if (bInitialized) {
+		return;
+	}
+	bInitialized = 1;
+
+#define HTTP_BUILTIN(url, fn) HTTP_AddRoute(url, HTTP_ANY, fn, 1, HTTP_ROUTE_BUILTIN)
+	HTTP_BUILTIN("", http_fn_empty_url);
+	HTTP_BUILTIN("testmsg", http_fn_testmsg);
+	HTTP_BUILTIN("index", http_fn_index);
+	HTTP_BUILTIN("about", http_fn_about);
+#if ENABLE_HTTP_MQTT
+	HTTP_BUILTIN("cfg_mqtt", http_fn_cfg_mqtt);
+	HTTP_BUILTIN("cfg_mqtt_set", http_fn_cfg_mqtt_set);
+#endif
+#if ENABLE_HTTP_IP
+	HTTP_BUILTIN("cfg_ip", http_fn_cfg_ip);
+#endif
+#if (ENABLE_DRIVER_DS1820_FULL)
+	HTTP_BUILTIN("cfg_ds18b20", http_fn_cfg_ds18b20);
+#endif
+#if ENABLE_HTTP_WEBAPP
+	HTTP_BUILTIN("cfg_webapp", http_fn_cfg_webapp);
+	HTTP_BUILTIN("cfg_webapp_set", http_fn_cfg_webapp_set);
+#endif
+	HTTP_BUILTIN("cfg_wifi", http_fn_cfg_wifi);
+#if ENABLE_HTTP_NAMES
+	HTTP_BUILTIN("cfg_name", http_fn_cfg_name);
+#endif
+	HTTP_BUILTIN("cfg_wifi_set", http_fn_cfg_wifi_set);
+	HTTP_BUILTIN("cfg_loglevel_set", http_fn_cfg_loglevel_set);
+#if ENABLE_HTTP_MAC
+	HTTP_BUILTIN("cfg_mac", http_fn_cfg_mac);
+#endif
+	HTTP_BUILTIN("cmd_tool", http_fn_cmd_tool);
+#if ENABLE_HTTP_STARTUP
+	HTTP_BUILTIN("startup_command", http_fn_startup_command);
+#endif
+#if ENABLE_HTTP_FLAGS
+	HTTP_BUILTIN("cfg_generic", http_fn_cfg_generic);
+#endif
+#if ENABLE_HTTP_STARTUP
+	HTTP_BUILTIN("cfg_startup", http_fn_cfg_startup);
+#endif
+#if ENABLE_HTTP_DGR
+	HTTP_BUILTIN("cfg_dgr", http_fn_cfg_dgr);
+#endif
+#if ENABLE_HA_DISCOVERY
+	HTTP_BUILTIN("ha_cfg", http_fn_ha_cfg);
+	HTTP_BUILTIN("ha_discovery", http_fn_ha_discovery);
+#endif
+	HTTP_BUILTIN("cfg", http_fn_cfg);
+	HTTP_BUILTIN("cfg_pins", http_fn_cfg_pins);
+#if ENABLE_HTTP_PING
+	HTTP_BUILTIN("cfg_ping", http_fn_cfg_ping);
+#endif
+	HTTP_BUILTIN("ota", http_fn_ota);
+	HTTP_BUILTIN("ota_exec", http_fn_ota_exec);
+	HTTP_BUILTIN("cm", http_fn_cm);
+#if ENABLE_TIME_PMNTP
+	HTTP_BUILTIN("pmntp", http_fn_pmntp); // poor mans NTP
+#endif
+#undef HTTP_BUILTIN
+}
+
+static bool HTTP_RouteMatches(httpRoute_t* r, const char* urlStr, int method) {
+	if (r->method != HTTP_ANY && r->method != method) {
+		return false;
+	}
+	if (r->flags & HTTP_ROUTE_PREFIX) {
+		return http_startsWith(urlStr, r->url);
+	}
+	return http_checkUrlBase(urlStr, r->url);
+}
+
+static httpRoute_t* HTTP_FindRoute(const char* urlStr, int method) {
+	httpRoute_t* r;
+	httpRoute_t* found = 0;
+
+	for (r = g_segmentPrefixRoutes; r; r = r->next) {
+		if (HTTP_RouteMatches(r, urlStr, method)) {
+			found = r;
+			break;
+		}
+	}
+	for (r = g_routes[HTTP_HashSegment(urlStr)]; r; r = r->next) {
+		if (found && ((r->flags & HTTP_ROUTE_BUILTIN) || r->seq > found->seq)) {
+			break;
+		}
+		if (HTTP_RouteMatches(r, urlStr, method)) {
+			return r;
+		}
+	}
+	return found;
+}
+
+static int HTTP_RunRoute(httpRoute_t* r, http_request_t* request) {
+	int ret;
+	unsigned int ms;
+	portTickType start = xTaskGetTickCount();
+
+	ret = r->callback(request);
+
+	ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+	r->hits++;
+	r->totalTimeMs += ms;
+	if (ms > r->maxTimeMs) {
+		r->maxTimeMs = ms;
+	}
+	return ret;
+}
+
+void HTTP_PrintRoutes(int bReset) {
+	static const char* methods[] = { "ANY", "GET", "PUT", "POST", "OPTIONS" };
+	httpRoute_t* r;
+	int i;
+
+	HTTP_InitRoutes();
+	// last index is the list of routes matching a longer first segment
+	for (i = 0; i <= HTTP_ROUTE_BUCKETS; i++) {
+		for (r = (i < HTTP_ROUTE_BUCKETS) ? g_routes[i] : g_segmentPrefixRoutes; r; r = r->next) {
+			if (bReset) {
+				r->hits = 0;
+				r->totalTimeMs = 0;
+				r->maxTimeMs = 0;
+				continue;
+			}
+			ADDLOGF_INFO("[%i] /%s%s %s%s - hits %u, avg %u ms, max %u ms", i, r->url,
+				(r->flags & HTTP_ROUTE_PREFIX) ? "*" : "", methods[r->method + 1],
+				r->auth_required ? " auth" : "", r->hits,
+				r->hits ? r->totalTimeMs / r->hits : 0, r->maxTimeMs);
+		}
+	}
+	if (!bReset) {
+		ADDLOGF_INFO("%i routes (%i registered) in %i buckets", g_numRoutes, g_numRegisteredRoutes, HTTP_ROUTE_BUCKETS);
+	}
+}
+
+int HTTP_RegisterCallback(const char* url, int method, http_callback_fn callback, int auth_required) {
+	httpRoute_t* r;
+	char* copy;
+
+	if (!url || !callback) {
+		return -1;
+	}
+	if (g_numRegisteredRoutes >= MAX_HTTP_CALLBACKS) {
+		return -4;
+	}
+	HTTP_InitRoutes();
+	if (*url == '/') {
+		url++;
+	}
+	for (r = *HTTP_RouteList(url, HTTP_ROUTE_PREFIX); r; r = r->next) {
+		if (r->callback == callback && !strcmp(r->url, url) && r->method == method) {
+			return 0;
+		}
+	}
+	copy = (char*)os_malloc(strlen(url) + 1);
+	if (!copy) {
+		return -3;
+	}
+	strcpy(copy, url);
+	if (HTTP_AddRoute(copy, method, callback, auth_required > 0 ? 1 : 0, HTTP_ROUTE_PREFIX) == 0) {
+		os_free(copy);
+		return -2;
+	}
+	g_numRegisteredRoutes++;
+
+	// success
+	return 0;
+}
+
+// Last headers. Length of a page is not known when we start sending it,
+// so on a kept open connection body is sent in chunks.
+static void http_setup_connection(http_request_t* request) {
+	if (request->keepAlive && request->chunked == 0) {
+		poststr(request, "Connection: keep-alive");
+		poststr(request, "\r\n");
+		poststr(request, "Transfer-Encoding: chunked");
+		poststr(request, "\r\n"); // end headers with double CRLF
+		poststr(request, "\r\n");
+#if !HTTP_DIRECT_SEND
+		if (request->replymaxlen - request->replylen <= HTTP_CHUNK_HEADER_LEN + HTTP_CHUNK_TRAILER_LEN) {
+			postany(request, NULL, 0);
+		}
+		// reserve place for size of first chunk
+		request->chunkStart = request->replylen;
+		request->replylen += HTTP_CHUNK_HEADER_LEN;
+#endif
+		request->chunked = 1;
+		return;
+	}
+	poststr(request, "Connection: close");
+	poststr(request, "\r\n"); // end headers with double CRLF
+	poststr(request, "\r\n");
+}
 void http_setup(http_request_t* request, const char* type) {
 	hprintf255(request, httpHeader, request->responseCode, type);
 	poststr(request, "\r\n"); // next header
@@ -291,9 +549,7 @@ void http_setup(http_request_t* request, const char* type) {
 	poststr(request, "Transfer-Encoding: chunked");
 #endif
 	poststr(request, "\r\n");
-	poststr(request, "Connection: close");
-	poststr(request, "\r\n"); // end headers with double CRLF
-	poststr(request, "\r\n");
+	http_setup_connection(request);
 }
 void http_setup_gz(http_request_t* request, const char* type) {
 	hprintf255(request, httpHeader, request->responseCode, type);
@@ -302,9 +558,7 @@ void http_setup_gz(http_request_t* request, const char* type) {
 	poststr(request, "\r\n");
 	poststr(request, "Content-Encoding: gzip");
 	poststr(request, "\r\n");
-	poststr(request, "Connection: close");
-	poststr(request, "\r\n"); // end headers with double CRLF
-	poststr(request, "\r\n");
+	http_setup_connection(request);
 }
 
 void http_html_start(http_request_t* request, const char* pagename) {
@@ -603,16 +857,211 @@ void setupAllWB2SPinsAsButtons() {
 	PIN_SetPinChannelForPinIndex(27, 1);
 }
 
+#if WINDOWS
+static char* g_simSocketBuffer;
+static int g_simSocketSize;
+static int g_simSocketLen;
+static int g_simSocketMaxPerSend;
+
+void HTTP_SimFakeSocket_Reset(char* buffer, int size, int maxPerSend) {
+	g_simSocketBuffer = buffer;
+	g_simSocketSize = size;
+	g_simSocketLen = 0;
+	g_simSocketMaxPerSend = maxPerSend;
+}
+int HTTP_SimFakeSocket_GetLength() {
+	return g_simSocketLen;
+}
+static int HTTP_SimFakeSocket_Send(const char* data, int len) {
+	if (g_simSocketMaxPerSend && len > g_simSocketMaxPerSend) {
+		len = g_simSocketMaxPerSend;
+	}
+	if (g_simSocketLen + len > g_simSocketSize) {
+		return -1;
+	}
+	memcpy(g_simSocketBuffer + g_simSocketLen, data, len);
+	g_simSocketLen += len;
+	return len;
+}
+#endif
+
+// send whole block, returns 0 if connection is broken
+static int http_send(http_request_t* request, const char* data, int len, int flags) {
+	int r;
+
+	if (request->sendCalls == 0) {
+		request->firstByteTime = xTaskGetTickCount();
+	}
+	request->sendCalls++;
+#if WINDOWS
+	if (request->fd == HTTP_SIM_FAKE_FD) {
+		r = HTTP_SimFakeSocket_Send(data, len);
+	}
+	else
+#endif
+	r = send(request->fd, data, len, flags);
+	if (r < 0) {
+		// would block, try again later
+		return (flags == 0) ? -1 : 0;
+	}
+	return r;
+}
+
+// blocking send of buffer that was given to socket earlier
+static void http_sendPending(http_request_t* request) {
+	int r;
+
+	while (request->pendingLen > 0) {
+		r = http_send(request, request->pending, request->pendingLen, 0);
+		if (r <= 0) {
+			// peer is gone, there is no point in keeping the connection
+			request->keepAlive = 0;
+			request->pendingLen = 0;
+			break;
+		}
+		request->pending += r;
+		request->pendingLen -= r;
+	}
+}
+
+#if !HTTP_DIRECT_SEND
+// Puts chunk framing around data collected in reply buffer. Chunk size
+// has fixed width (leading zeros are allowed), so its place can be
+// reserved before size is known and the whole buffer goes out with single send.
+static void http_frameChunk(http_request_t* request, int bLast) {
+	// room for any int, only first HTTP_CHUNK_HEADER_LEN bytes are used
+	char chunkHeader[16];
+	int dataLen;
+
+	if (request->chunked == 0) {
+		return;
+	}
+	dataLen = request->replylen - request->chunkStart - HTTP_CHUNK_HEADER_LEN;
+	if (dataLen > 0) {
+		sprintf(chunkHeader, "%06X\r\n", dataLen);
+		memcpy(request->reply + request->chunkStart, chunkHeader, HTTP_CHUNK_HEADER_LEN);
+		memcpy(request->reply + request->replylen, "\r\n", 2);
+		request->replylen += 2;
+	}
+	else {
+		// zero sized chunk would mean end of reply
+		request->replylen = request->chunkStart;
+	}
+	if (bLast) {
+		memcpy(request->reply + request->replylen, "0\r\n\r\n", 5);
+		request->replylen += 5;
+	}
+}
+
+// start filling reply buffer again
+static void http_resetReplyBuffer(http_request_t* request) {
+	request->reply[0] = 0;
+	request->replylen = 0;
+	if (request->chunked) {
+		request->chunkStart = 0;
+		request->replylen = HTTP_CHUNK_HEADER_LEN;
+	}
+}
+
+// Sends what is in reply buffer. With second buffer, socket gets as much
+// as it takes right now and the rest is sent while the other buffer is filled.
+static void http_sendReplyBuffer(http_request_t* request, int bLast) {
+	char* sent;
+	int r;
+
+	http_frameChunk(request, bLast);
+	if (request->replylen > 0) {
+		sent = request->reply;
+		// previous buffer must be gone before it can be reused
+		http_sendPending(request);
+		request->pending = request->reply;
+		request->pendingLen = request->replylen;
+		if (request->reply2 && !bLast) {
+			r = http_send(request, request->pending, request->pendingLen, HTTP_SEND_NOWAIT);
+			if (r > 0) {
+				request->pending += r;
+				request->pendingLen -= r;
+			}
+			request->reply = request->reply2;
+			request->reply2 = sent;
+		}
+		else {
+			http_sendPending(request);
+		}
+	}
+	http_resetReplyBuffer(request);
+}
+#endif
+
+int HTTP_FinishReply(http_request_t* request) {
+	// fd will be NULL for unit tests where HTTP packet is faked locally
+	if (request->fd == 0) {
+		return 0;
+	}
+#if HTTP_DIRECT_SEND
+	if (request->chunked) {
+		http_send(request, "0\r\n\r\n", 5, 0);
+	}
+#else
+	http_sendReplyBuffer(request, 1);
+	http_sendPending(request);
+#endif
+	if (request->sendCalls) {
+		HTTPServer_AddTTFB((request->firstByteTime - request->startTime) * portTICK_PERIOD_MS);
+	}
+	return request->keepAlive && request->chunked;
+}
+
+void HTTPServer_AddLatency(unsigned int ms) {
+	g_httpStats.requests++;
+	g_httpStats.latencyTotalMs += ms;
+	if (ms > g_httpStats.latencyMaxMs) {
+		g_httpStats.latencyMaxMs = ms;
+	}
+}
+
+void HTTPServer_AddTTFB(unsigned int ms) {
+	g_httpStats.replies++;
+	g_httpStats.ttfbTotalMs += ms;
+	if (ms > g_httpStats.ttfbMaxMs) {
+		g_httpStats.ttfbMaxMs = ms;
+	}
+}
+
 // add some more output safely, sending if necessary.
 // call with str == NULL to force send. - can be binary.
 // supply length
 int postany(http_request_t* request, const char* str, int len) {
-#if PLATFORM_BL602 || PLATFORM_BEKEN_NEW || PLATFORM_RTL8720D
-	send(request->fd, str, len, 0);
+#if HTTP_DIRECT_SEND
+	int headerLen;
+	int part;
+
+	// zero sized chunk would mean end of reply
+	if (str == NULL || len <= 0) {
+		return 0;
+	}
+	if (request->chunked) {
+		// reply buffer is not used for anything else here, frame
+		// each chunk in it so that it goes out with single send
+		while (len > 0) {
+			part = request->replymaxlen - HTTP_CHUNK_HEADER_LEN - 2;
+			if (part > len) {
+				part = len;
+			}
+			headerLen = sprintf(request->reply, "%X\r\n", part);
+			memcpy(request->reply + headerLen, str, part);
+			memcpy(request->reply + headerLen + part, "\r\n", 2);
+			http_send(request, request->reply, headerLen + part + 2, 0);
+			str += part;
+			len -= part;
+		}
+	}
+	else {
+		http_send(request, str, len, 0);
+	}
 	return 0;
 #else
-	int currentlen;
-	int addlen = len;
+	int room;
 
 	//ADDLOG_ERROR(LOG_FEATURE_HTTP, "postany: got %i", len);
 
@@ -621,40 +1070,31 @@ int postany(http_request_t* request, const char* str, int len) {
 		if (request->fd == 0) {
 			return request->replylen;
 		}
-		if (request->replylen > 0) {
-			//ADDLOG_ERROR(LOG_FEATURE_HTTP, "postany: send %i", request->replylen);
-			send(request->fd, request->reply, request->replylen, 0);
-		}
-		request->reply[0] = 0;
-		request->replylen = 0;
+		//ADDLOG_ERROR(LOG_FEATURE_HTTP, "postany: send %i", request->replylen);
+		http_sendReplyBuffer(request, 0);
 		return 0;
 	}
 
-	currentlen = request->replylen;
-	if (currentlen + addlen >= request->replymaxlen) {
-		//ADDLOG_ERROR(LOG_FEATURE_HTTP, "postany: send %i", request->replylen);
-		send(request->fd, request->reply, request->replylen, 0);
-		request->reply[0] = 0;
-		request->replylen = 0;
-		currentlen = 0;
-	}
-	while (addlen >= request->replymaxlen) {
-		if (request->replylen > 0) {
+	while (len > 0) {
+		// keep space for chunk end and for last chunk
+		room = request->replymaxlen - request->replylen;
+		if (request->chunked) {
+			room -= HTTP_CHUNK_TRAILER_LEN;
+		}
+		if (room <= 0) {
 			//ADDLOG_ERROR(LOG_FEATURE_HTTP, "postany: send %i", request->replylen);
-			send(request->fd, request->reply, request->replylen, 0);
-			request->replylen = 0;
+			http_sendReplyBuffer(request, 0);
+			continue;
 		}
-		//ADDLOG_ERROR(LOG_FEATURE_HTTP, "postany: send %i", (request->replymaxlen - 1));
-		send(request->fd, str, (request->replymaxlen - 1), 0);
-		addlen -= (request->replymaxlen - 1);
-		str += (request->replymaxlen - 1);
-
-		rtos_delay_milliseconds(1);
+		if (room > len) {
+			room = len;
+		}
+		memcpy(request->reply + request->replylen, str, room);
+		request->replylen += room;
+		str += room;
+		len -= room;
 	}
-
-	memcpy(request->reply + request->replylen, str, addlen);
-	request->replylen += addlen;
-	return (currentlen + addlen);
+	return request->replylen;
 #endif
 }
 
@@ -689,12 +1129,14 @@ int HTTP_ProcessPacket(http_request_t* request) {
 	//int bChanged = 0;
 	char* urlStr = "";
 	char* recvbuf;
+	httpRoute_t* route;
 
 	if (request->received == 0) {
 		ADDLOGF_ERROR("You gave request with NULL input");
 		return 0;
 	}
 	request->method = -1;
+	request->startTime = xTaskGetTickCount();
 	recvbuf = request->received;
 	for (i = 0; i < sizeof(methodNames) / sizeof(*methodNames); i++) {
 		if (http_startsWith(recvbuf, methodNames[i])) {
@@ -721,6 +1163,7 @@ int HTTP_ProcessPacket(http_request_t* request) {
 
 	// if OPTIONS, return now - for CORS
 	if (request->method == HTTP_OPTIONS) {
+		request->keepAlive = 0;
 		http_setup(request, httpMimeTypeHTML);
 		i = strlen(request->reply);
 		return i;
@@ -776,6 +1219,15 @@ int HTTP_ProcessPacket(http_request_t* request) {
 					if (!my_strnicmp(headers, "Content-Length:", 15)) {
 						request->contentLength = atoi(headers + 15);
 					}
+					else if (!my_strnicmp(headers, "Connection:", 11)) {
+						char* v = headers + 11;
+						while (*v == ' ') {
+							v++;
+						}
+						if (!my_strnicmp(v, "close", 5)) {
+							request->keepAlive = 0;
+						}
+					}
 
 					*p = 0;
 					p++; // past \r
@@ -804,6 +1256,11 @@ int HTTP_ProcessPacket(http_request_t* request) {
 		request->bodystart = p;
 		request->bodylen = request->receivedLen - (p - request->received);
 	}
+	// Chunked replies need HTTP/1.1. Also, if body was not received in whole,
+	// handler will read the rest from socket (OTA), so don't reuse connection
+	if (strcmp(protocol, "HTTP/1.1") || request->contentLength > request->bodylen) {
+		request->keepAlive = 0;
+	}
 #if 0
 	postany(request, "test", 4);
 	return 0;
@@ -817,18 +1274,13 @@ int HTTP_ProcessPacket(http_request_t* request) {
 	}
 #endif
 
-	// look for a callback with this URL and method, or HTTP_ANY
-	for (i = 0; i < numCallbacks; i++) {
-		char* url = callbacks[i]->url;
-		if (http_startsWith(urlStr, &url[1])) {
-			int method = callbacks[i]->method;
-			if (method == HTTP_ANY || method == request->method) {
-				if (callbacks[i]->auth_required > 0 && http_basic_auth_run(request) == HTTP_BASIC_AUTH_FAIL) {
-					return 0;
-				}
-				return callbacks[i]->callback(request);
-			}
+	HTTP_InitRoutes();
+	route = HTTP_FindRoute(urlStr, request->method);
+	if (route && (route->flags & HTTP_ROUTE_BUILTIN) == 0) {
+		if (route->auth_required > 0 && http_basic_auth_run(request) == HTTP_BASIC_AUTH_FAIL) {
+			return 0;
 		}
+		return HTTP_RunRoute(route, request);
 	}
 
 	if (http_basic_auth_run(request) == HTTP_BASIC_AUTH_FAIL) {
@@ -846,76 +1298,9 @@ int HTTP_ProcessPacket(http_request_t* request) {
 	}
 #endif
 
-	if (http_checkUrlBase(urlStr, "")) return http_fn_empty_url(request);
-
-	if (http_checkUrlBase(urlStr, "testmsg")) return http_fn_testmsg(request);
-	if (http_checkUrlBase(urlStr, "index")) return http_fn_index(request);
-
-	if (http_checkUrlBase(urlStr, "about")) return http_fn_about(request);
-	
-#if ENABLE_HTTP_MQTT
-	if (http_checkUrlBase(urlStr, "cfg_mqtt")) return http_fn_cfg_mqtt(request);
-	if (http_checkUrlBase(urlStr, "cfg_mqtt_set")) return http_fn_cfg_mqtt_set(request);
-#endif
-#if ENABLE_HTTP_IP
-	if (http_checkUrlBase(urlStr, "cfg_ip")) return http_fn_cfg_ip(request);
-#endif
-#if (ENABLE_DRIVER_DS1820_FULL)
-	// including "../driver/drv_ds1820_simple.h" will complain about typedefs not used here 
-	// so lets declare it "extern"
-	extern int http_fn_cfg_ds18b20(http_request_t* request);
-	if (http_checkUrlBase(urlStr, "cfg_ds18b20")) return http_fn_cfg_ds18b20(request);
-#endif
-
-#if ENABLE_HTTP_WEBAPP
-	if (http_checkUrlBase(urlStr, "cfg_webapp")) return http_fn_cfg_webapp(request);
-	if (http_checkUrlBase(urlStr, "cfg_webapp_set")) return http_fn_cfg_webapp_set(request);
-#endif
-
-	if (http_checkUrlBase(urlStr, "cfg_wifi")) return http_fn_cfg_wifi(request);
-#if ENABLE_HTTP_NAMES
-	if (http_checkUrlBase(urlStr, "cfg_name")) return http_fn_cfg_name(request);
-#endif
-	if (http_checkUrlBase(urlStr, "cfg_wifi_set")) return http_fn_cfg_wifi_set(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_loglevel_set")) return http_fn_cfg_loglevel_set(request);
-#if ENABLE_HTTP_MAC
-	if (http_checkUrlBase(urlStr, "cfg_mac")) return http_fn_cfg_mac(request);
-#endif
-	if (http_checkUrlBase(urlStr, "cmd_tool")) return http_fn_cmd_tool(request);
-
-#if ENABLE_HTTP_STARTUP
-	if (http_checkUrlBase(urlStr, "startup_command")) return http_fn_startup_command(request); 
-#endif
-#if ENABLE_HTTP_FLAGS
-	if (http_checkUrlBase(urlStr, "cfg_generic")) return http_fn_cfg_generic(request);
-#endif
-#if ENABLE_HTTP_STARTUP
-	if (http_checkUrlBase(urlStr, "cfg_startup")) return http_fn_cfg_startup(request);
-#endif
-#if ENABLE_HTTP_DGR
-	if (http_checkUrlBase(urlStr, "cfg_dgr")) return http_fn_cfg_dgr(request);
-#endif
-
-#if ENABLE_HA_DISCOVERY
-	if (http_checkUrlBase(urlStr, "ha_cfg")) return http_fn_ha_cfg(request);
-	if (http_checkUrlBase(urlStr, "ha_discovery")) return http_fn_ha_discovery(request);
-#endif
-	if (http_checkUrlBase(urlStr, "cfg")) return http_fn_cfg(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_pins")) return http_fn_cfg_pins(request);
-#if ENABLE_HTTP_PING
-	if (http_checkUrlBase(urlStr, "cfg_ping")) return http_fn_cfg_ping(request);
-#endif
-
-
-	if (http_checkUrlBase(urlStr, "ota")) return http_fn_ota(request);
-	if (http_checkUrlBase(urlStr, "ota_exec")) return http_fn_ota_exec(request);
-	if (http_checkUrlBase(urlStr, "cm")) return http_fn_cm(request);
-	
-#if ENABLE_TIME_PMNTP
-	if (http_checkUrlBase(urlStr, "pmntp")) return http_fn_pmntp(request); // poor mans NTP
-#endif
+	if (route) {
+		return HTTP_RunRoute(route, request);
+	}
 	return http_fn_other(request);
 }
 
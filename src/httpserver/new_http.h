@@ -59,10 +59,75 @@ typedef struct http_request_tag {
 
 	// user variables used to build JSON data
 	int userCounter;
+
+	// set by server if it can keep connection open, cleared
+	// by HTTP_ProcessPacket if this request does not allow it
+	int keepAlive;
+	// reply body is sent with chunked transfer encoding
+	int chunked;
+	// offset of place reserved for size of chunk being filled
+	int chunkStart;
+	// optional second reply buffer of the same size; when set, one buffer
+	// is being sent while the other one is filled
+	char* reply2;
+	// part of the previous buffer that socket did not take yet
+	const char* pending;
+	int pendingLen;
+
+	// timing of reply, in ticks
+	unsigned int startTime;
+	unsigned int firstByteTime;
+	// number of send() calls used for reply
+	int sendCalls;
 } http_request_t;
 
+#if WINDOWS
+// Selftest socket, reply sent to this fd is collected in given buffer.
+// Socket takes at most maxPerSend bytes per call (0 - no limit).
+#define HTTP_SIM_FAKE_FD	-2
+void HTTP_SimFakeSocket_Reset(char* buffer, int size, int maxPerSend);
+int HTTP_SimFakeSocket_GetLength();
+#endif
+
 
 int HTTP_ProcessPacket(http_request_t* request);
+// sends rest of the reply, returns 1 if connection can be used for next request
+int HTTP_FinishReply(http_request_t* request);
+
+typedef struct httpServerStats_s {
+	int connections;
+	int requests;
+	// requests served on already open connection
+	int keepAliveRequests;
+	// accepted connections waiting for a free worker
+	int queueDepth;
+	int maxQueueDepth;
+	// connections closed because queue was full
+	int rejected;
+	// from accept (or from request arrival on kept connection) until reply was sent
+	unsigned int latencyTotalMs;
+	unsigned int latencyMaxMs;
+	// from start of request processing until first byte of reply was sent
+	int replies;
+	unsigned int ttfbTotalMs;
+	unsigned int ttfbMaxMs;
+} httpServerStats_t;
+
+extern httpServerStats_t g_httpStats;
+
+// Number of HTTP workers (on simulator: connections kept open). Can be
+// changed with HTTPPoolSize in early.bat, before the server is started.
+#ifndef HTTP_WORKER_POOL_SIZE
+#if WINDOWS
+#define HTTP_WORKER_POOL_SIZE		4
+#else
+#define HTTP_WORKER_POOL_SIZE		2
+#endif
+#endif
+#define HTTP_WORKER_POOL_MAX		8
+extern int g_httpPoolSize;
+void HTTPServer_AddLatency(unsigned int ms);
+void HTTPServer_AddTTFB(unsigned int ms);
 void http_setup(http_request_t* request, const char* type);
 void http_setup_gz(http_request_t* request, const char* type);
 void http_html_start(http_request_t* request, const char* pagename);
@@ -94,6 +159,8 @@ typedef int (*http_callback_fn)(http_request_t* request);
 // url MUST start with '/'
 // urls must be unique (i.e. you can't have /about and /aboutme or /about/me)
 int HTTP_RegisterCallback(const char* url, int method, http_callback_fn callback, int auth_required);
+// logs route table with hit counts and handling times, or clears the counters
+void HTTP_PrintRoutes(int bReset);
 
 int my_strnicmp(const char* a, const char* b, int len);
 
@@ -8,6 +8,7 @@
 #include "../hal/hal_ota.h"
 #include "../hal/hal_wifi.h"
 #include "../hal/hal_flashVars.h"
+#include "../hal/hal_flashStats.h"
 #include "../littlefs/our_lfs.h"
 #include "lwip/sockets.h"
 
@@ -372,11 +373,17 @@ void BB_AddText(berryBuilder_t *b, const char *fname, const char *start, const c
 	BB_AddCode(b, "\")", 0);
 }
 void eval_berry_snippet(const char *s);
+void eval_berry_cached(const char *s, const char *cacheName);
 void Berry_SaveRequest(http_request_t *r);
-void BB_Run(berryBuilder_t *b)
+void BB_Run(berryBuilder_t *b, const char *cacheName)
 {
 	b->berry_buffer[b->berry_len] = 0;
-	eval_berry_snippet(b->berry_buffer);
+	if (cacheName) {
+		eval_berry_cached(b->berry_buffer, cacheName);
+	}
+	else {
+		eval_berry_snippet(b->berry_buffer);
+	}
 }
 int http_runBerryFile(http_request_t *request, const char *fname) {
 	Berry_SaveRequest(request);
@@ -387,11 +394,13 @@ int http_runBerryFile(http_request_t *request, const char *fname) {
 		return 0;
 	http_setup(request, httpMimeTypeHTML);
 	char *p = data;
+	int codeBlocks = 0;
 	while (*p) {
 		char *btag = strstr(p, "<?b");
 		if (!btag) {
 			break;
 		}
+		codeBlocks++;
 		BB_AddText(&bb, fname, p, btag);
 		char *etag = strstr(btag, "?>");
 
@@ -404,7 +413,8 @@ int http_runBerryFile(http_request_t *request, const char *fname) {
 		p++;
 	BB_AddText(&bb, fname, s, p);
 	free(data);
-	BB_Run(&bb);
+	// generated code only changes with the file, keep it compiled
+	BB_Run(&bb, codeBlocks ? fname : 0);
 	return 1;
 }
 static int http_rest_run_lfs_file(http_request_t* request) {
@@ -661,6 +671,9 @@ static int http_rest_get_lfs_delete(http_request_t* request) {
 
 	if (lfsres == LFS_ERR_OK) {
 		ADDLOG_DEBUG(LOG_FEATURE_API, "LFS delete of %s OK", fpath);
+#if ENABLE_OBK_BERRY
+		berryDropBytecode(fpath);
+#endif
 
 		poststr(request, "OK");
 	}
@@ -776,6 +789,10 @@ static int http_rest_post_lfs_file(http_request_t* request) {
 		//ADDLOG_DEBUG(LOG_FEATURE_API, "closing %s", fpath);
 		lfs_file_close(&lfs, file);
 		ADDLOG_DEBUG(LOG_FEATURE_API, "%d total bytes written", total);
+#if ENABLE_OBK_BERRY
+		// a compiled copy would now shadow the new source on import
+		berryDropBytecode(fpath);
+#endif
 		http_setup(request, httpMimeTypeJson);
 		hprintf255(request, "{\"fname\":\"%s\",\"size\":%d}", fpath, total);
 	}
@@ -1025,6 +1042,28 @@ static int http_rest_post_logconfig(http_request_t* request) {
 /////////////////////////////////////////////////
 
 
+// flash wear counters, see hal_flashStats.h
+static void http_rest_get_flashStats(http_request_t* request) {
+	const flashUserStats_t* u;
+	const flashSectorStats_t* sectors;
+	int count;
+	int i;
+
+	hprintf255(request, "\"flash\":{\"seconds\":%i,", HAL_FlashStats_GetSeconds());
+	for (i = 0; i < FLASH_USER_MAX; i++) {
+		u = HAL_FlashStats_GetUser(i);
+		hprintf255(request, "\"%s\":{\"writes\":%i,\"bytes\":%i,\"erases\":%i,\"wpm\":%i,\"wpmMax\":%i},",
+			HAL_FlashStats_GetUserName(i), u->writes, u->bytes, u->erases, u->writesLastMinute, u->maxWritesPerMinute);
+	}
+	count = HAL_FlashStats_GetSectors(&sectors);
+	poststr(request, "\"sectors\":[");
+	for (i = 0; i < count; i++) {
+		hprintf255(request, "%s{\"addr\":%i,\"user\":\"%s\",\"erases\":%i}", i ? "," : "",
+			sectors[i].address == FLASH_STATS_ADDR_UNKNOWN ? -1 : (int)sectors[i].address,
+			HAL_FlashStats_GetUserName(sectors[i].user), sectors[i].erases);
+	}
+	hprintf255(request, "],\"lifetime_days\":%i}", HAL_FlashStats_GetLifetimeDays());
+}
 static int http_rest_get_info(http_request_t* request) {
 	char macstr[3 * 6 + 1];
 	long int* pAllGenericFlags = (long int*)&g_cfg.genericFlags;
@@ -1050,7 +1089,9 @@ static int http_rest_get_info(http_request_t* request) {
 	hprintf255(request, "\"supportsSSDP\":0,");
 #endif
 
-	hprintf255(request, "\"supportsClientDeviceDB\":true}");
+	hprintf255(request, "\"supportsClientDeviceDB\":true,");
+	http_rest_get_flashStats(request);
+	poststr(request, "}");
 
 	poststr(request, NULL);
 	return 0;
@@ -13,6 +13,7 @@
 #include "../new_cfg.h"
 #include "../new_cfg.h"
 #include "../cmnds/cmd_public.h"
+#include "../hal/hal_flashStats.h"
 
 #if PLATFORM_BEKEN || WINDOWS
 
@@ -111,12 +112,29 @@ static int lfs_sync(const struct lfs_config *c);
 uint32_t LFS_Start = LFS_BLOCKS_END - LFS_BLOCKS_DEFAULT_LEN;
 uint32_t LFS_Size = LFS_BLOCKS_DEFAULT_LEN;
 
+#if ENABLE_LFS_SPI
+#define LFS_FLASH_ADDR(block) ((block) * LFS_BLOCK_SIZE)
+#else
+#define LFS_FLASH_ADDR(block) (LFS_Start + (block) * LFS_BLOCK_SIZE)
+#endif
+
+// platform independent wrappers, so flash wear statistics see every LFS access
+static int lfs_write_counted(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size){
+    HAL_FlashStats_Write(FLASH_USER_LFS, LFS_FLASH_ADDR(block) + off, size);
+    return lfs_write(c, block, off, buffer, size);
+}
+static int lfs_erase_counted(const struct lfs_config *c, lfs_block_t block){
+    HAL_FlashStats_Erase(FLASH_USER_LFS, LFS_FLASH_ADDR(block));
+    return lfs_erase(c, block);
+}
+
 // configuration of the filesystem is provided by this struct
 struct lfs_config cfg = {
     // block device operations
     .read  = lfs_read,
-    .prog  = lfs_write,
-    .erase = lfs_erase,
+    .prog  = lfs_write_counted,
+    .erase = lfs_erase_counted,
     .sync  = lfs_sync,
 
 #if PLATFORM_REALTEK_NEW
@@ -367,7 +385,9 @@ static commandResult_t CMD_LFS_Append_Internal(lcdPrintType_t type, bool bLine,
 		lfs_file_write(&lfs, &file, "\r\n", 2);
 	}
 	lfs_file_close(&lfs, &file);
-
+#if ENABLE_OBK_BERRY
+	berryDropBytecode(fileName);
+#endif
 
 	return CMD_RES_OK;
 }
@@ -415,6 +435,9 @@ static commandResult_t CMD_LFS_Remove(const void *context, const char *cmd, cons
 	fileName = Tokenizer_GetArg(0);
 
 	lfs_remove(&lfs, fileName);
+#if ENABLE_OBK_BERRY
+	berryDropBytecode(fileName);
+#endif
 
 	return CMD_RES_OK;
 }
@@ -116,17 +116,42 @@ static void log_serial_thread(beken_thread_arg_t arg);
 static void startSerialLog();
 static void startLogServer();
 
+// must be a power of two, positions in ring are free running counters
+// and are masked to get the index
 #define LOGSIZE 4096
+#define LOGSIZE_MASK (LOGSIZE - 1)
 #define LOGPORT 9000
 
 int logTcpPort = LOGPORT;
 
+// every reader of log memory has its own cursor
+enum {
+	LOG_CONSUMER_SERIAL,
+	LOG_CONSUMER_TCP,
+	LOG_CONSUMER_HTTP,
+	LOG_CONSUMER_COUNT
+};
+static const char *logConsumerNames[LOG_CONSUMER_COUNT] = {
+	"serial",
+	"tcp",
+	"http"
+};
+
+typedef struct logCursor_s {
+	// position of next byte to read
+	unsigned int tail;
+	// number of bytes overwritten before this consumer could read them
+	unsigned int dropped;
+	// slices given out and not yet released, writer must not overwrite them
+	int held;
+	// start of oldest held slice
+	unsigned int heldStart;
+} logCursor_t;
+
 static struct tag_logMemory {
 	char log[LOGSIZE];
-	int head;
-	int tailserial;
-	int tailtcp;
-	int tailhttp;
+	unsigned int head;
+	logCursor_t cursors[LOG_CONSUMER_COUNT];
 	SemaphoreHandle_t mutex;
 } logMemory;
 
@@ -134,6 +159,27 @@ static struct tag_logMemory {
 static int initialised = 0;
 static int tcpLogStarted = 0;
 
+// Deferred mode - instead of formatting the text in caller, addLogAdv stores
+// format pointer and argument values in a record, and text is created
+// later when one of log readers asks for data.
+// Format string is copied into the record, right after the header, because
+// some callers pass a buffer of their own as format (MQTT_OBK_Printf, BL0937
+// debug...). %s arguments are copied too, after the format.
+#define LOG_RECORDS_SIZE 1024
+
+typedef struct logRecord_s {
+	byte level;
+	byte feature;
+	// total size including format and argument values that follow
+	unsigned short size;
+} logRecord_t;
+
+static int g_logDeferred = 0;
+static byte g_logRecords[LOG_RECORDS_SIZE];
+static int g_logRecordsUsed = 0;
+static unsigned int g_logRecordsStored = 0;
+static unsigned int g_logRecordsFormatted = 0;
+
 commandResult_t log_command(const void* context, const char* cmd, const char* args, int cmdFlags);
 
 #if PLATFORM_BEKEN
@@ -185,7 +231,8 @@ logPort 1
 static void initLog(void)
 {
 	bk_printf("Entering initLog()...\r\n");
-	logMemory.head = logMemory.tailserial = logMemory.tailtcp = logMemory.tailhttp = 0;
+	memset(logMemory.cursors, 0, sizeof(logMemory.cursors));
+	logMemory.head = 0;
 	logMemory.mutex = xSemaphoreCreateMutex();
 	initialised = 1;
 	startSerialLog();
@@ -212,6 +259,16 @@ static void initLog(void)
 	//cmddetail:"fn":"log_command","file":"logging/logging.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("logdelay", log_command, NULL);
+	//cmddetail:{"name":"logstats","args":"[reset]",
+	//cmddetail:"descr":"Prints how many log bytes are waiting and how many were dropped (overwritten before being sent) for serial, TCP and HTTP log readers. Use 'logstats reset' to clear drop counters.",
+	//cmddetail:"fn":"log_command","file":"logging/logging.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("logstats", log_command, NULL);
+	//cmddetail:{"name":"logdeferred","args":"[0or1]",
+	//cmddetail:"descr":"When enabled, log calls only store the format and argument values, and text is created later by serial/TCP/HTTP log readers. This makes logging much cheaper for the calling code. Log lines are still formatted right away when logtype is direct or when a console or raw socket wants them.",
+	//cmddetail:"fn":"log_command","file":"logging/logging.c","requires":"",
+	//cmddetail:"examples":"logdeferred 1"}
+	CMD_RegisterCommand("logdeferred", log_command, NULL);
 #if PLATFORM_BEKEN
 	//cmddetail:{"name":"logport","args":"[Index]",
 	//cmddetail:"descr":"Allows you to change log output port. On Beken, the UART1 is used for flashing and for TuyaMCU/BL0942, while UART2 is for log. Sometimes it might be easier for you to have log on UART1, so now you can just use this command like backlog uartInit 115200; logport 1 to enable logging on UART1..",
@@ -277,8 +334,399 @@ void LOG_SetCommandHTTPRedirectReply(http_request_t* request) {
 	}
 #endif
 
+// copies data to log memory, must be called with mutex taken.
+// Consumers that are more than LOGSIZE behind are moved on,
+// and skipped bytes are counted as dropped.
+// If the data would overwrite a slice which is still being sent,
+// the whole line is dropped instead.
+static void LOG_WriteToRing(const char* data, int len) {
+	int ofs;
+	int first;
+	int i;
+	unsigned int oldest;
+	logCursor_t* c;
+
+	if (len > LOGSIZE) {
+		data += len - LOGSIZE;
+		len = LOGSIZE;
+	}
+	for (i = 0; i < LOG_CONSUMER_COUNT; i++) {
+		c = &logMemory.cursors[i];
+		if (c->held && (int)(logMemory.head + len - LOGSIZE - c->heldStart) > 0) {
+			for (i = 0; i < LOG_CONSUMER_COUNT; i++) {
+				logMemory.cursors[i].dropped += len;
+			}
+			return;
+		}
+	}
+	ofs = logMemory.head & LOGSIZE_MASK;
+	first = LOGSIZE - ofs;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(logMemory.log + ofs, data, first);
+	memcpy(logMemory.log, data + first, len - first);
+	logMemory.head += len;
+
+	oldest = logMemory.head - LOGSIZE;
+	for (i = 0; i < LOG_CONSUMER_COUNT; i++) {
+		c = &logMemory.cursors[i];
+		if (logMemory.head - c->tail > LOGSIZE) {
+			c->dropped += oldest - c->tail;
+			c->tail = oldest;
+		}
+	}
+}
+
+// writes level and feature prefix, returns pointer to where message goes
+static char* LOG_FormatPrefix(char* tmp, int level, int feature) {
+	char* t;
+
+	*tmp = 0;
+	t = tmp;
+	if (feature == LOG_FEATURE_RAW)
+	{
+		// raw means no prefixes
+	}
+	else {
+		strncpy(t, loglevelnames[level], (LOGGING_BUFFER_SIZE - (3 + t - tmp)));
+		t += strlen(t);
+		if (feature < (int)(sizeof(logfeaturenames) / sizeof(*logfeaturenames)))
+		{
+			strncpy(t, logfeaturenames[feature], (LOGGING_BUFFER_SIZE - (3 + t - tmp)));
+			t += strlen(t);
+		}
+	}
+	return t;
+}
+// replaces line ending with \r\n, returns total length
+static int LOG_FinishLine(char* tmp) {
+	int len;
+
+	len = strlen(tmp);
+	if (len > 0 && tmp[len - 1] == '\n') tmp[--len] = '\0';
+	if (len > 0 && tmp[len - 1] == '\r') tmp[--len] = '\0';
+
+	// save 3 bytes at end for /r/n/0
+	tmp[len++] = '\r';
+	tmp[len++] = '\n';
+	tmp[len] = '\0';
+	return len;
+}
+
+enum {
+	LOGARG_NONE,
+	LOGARG_INT,
+	LOGARG_LONG,
+	LOGARG_LONGLONG,
+	LOGARG_SIZE,
+	LOGARG_DOUBLE,
+	LOGARG_PTR,
+	LOGARG_STR,
+	LOGARG_UNSUPPORTED,
+};
+#define LOG_PRECISION_NONE -1
+#define LOG_PRECISION_STAR -2
+
+// parses printf conversion, f points to '%', returns pointer past conversion
+static const char* LOG_ParseConversion(const char* f, int* argType, int* stars, int* precision) {
+	int lengthMod = 0;
+
+	*stars = 0;
+	*precision = LOG_PRECISION_NONE;
+	f++;
+	while (*f == '-' || *f == '+' || *f == ' ' || *f == '#' || *f == '0') {
+		f++;
+	}
+	if (*f == '*') {
+		(*stars)++;
+		f++;
+	}
+	while (*f >= '0' && *f <= '9') {
+		f++;
+	}
+	if (*f == '.') {
+		f++;
+		if (*f == '*') {
+			(*stars)++;
+			*precision = LOG_PRECISION_STAR;
+			f++;
+		}
+		else {
+			*precision = 0;
+			while (*f >= '0' && *f <= '9') {
+				*precision = *precision * 10 + (*f - '0');
+				f++;
+			}
+		}
+	}
+	// h and hh are promoted to int anyway
+	while (*f == 'h') {
+		f++;
+	}
+	if (*f == 'l') {
+		lengthMod = LOGARG_LONG;
+		f++;
+		if (*f == 'l') {
+			lengthMod = LOGARG_LONGLONG;
+			f++;
+		}
+	}
+	else if (*f == 'z') {
+		lengthMod = LOGARG_SIZE;
+		f++;
+	}
+	else if (*f == 'j' || *f == 't' || *f == 'L') {
+		lengthMod = LOGARG_UNSUPPORTED;
+		f++;
+	}
+	switch (*f) {
+	case '%':
+		*argType = LOGARG_NONE;
+		break;
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+		*argType = lengthMod ? lengthMod : LOGARG_INT;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		*argType = (lengthMod == LOGARG_UNSUPPORTED) ? LOGARG_UNSUPPORTED : LOGARG_DOUBLE;
+		break;
+	case 's':
+		*argType = lengthMod ? LOGARG_UNSUPPORTED : LOGARG_STR;
+		break;
+	case 'p':
+		*argType = LOGARG_PTR;
+		break;
+	default:
+		// %n, wide chars, or broken format
+		*argType = LOGARG_UNSUPPORTED;
+		return f;
+	}
+	return f + 1;
+}
+
+#define LOG_PUT(type, value) { type v = value; \
+	if (at + sizeof(v) > end) return 0; \
+	memcpy(at, &v, sizeof(v)); at += sizeof(v); }
+#define LOG_GET(type, var) { memcpy(&var, at, sizeof(type)); at += sizeof(type); }
+
+// Stores a record with format pointer and argument values, must be called
+// with mutex taken. Returns 0 if format is not supported or there is no space,
+// caller then has to format text the usual way.
+static int LOG_StoreRecord(int level, int feature, const char* fmt, va_list argList) {
+	logRecord_t rec;
+	byte* start;
+	byte* at;
+	byte* end;
+	const char* f;
+	const char* str;
+	int argType, stars, precision;
+	int starValue;
+	int len;
+
+	start = g_logRecords + g_logRecordsUsed;
+	end = g_logRecords + LOG_RECORDS_SIZE;
+	at = start + sizeof(logRecord_t);
+	len = strlen(fmt);
+	if (at + len + 1 > end) {
+		return 0;
+	}
+	memcpy(at, fmt, len + 1);
+	at += len + 1;
+	for (f = fmt; *f; ) {
+		if (*f != '%') {
+			f++;
+			continue;
+		}
+		f = LOG_ParseConversion(f, &argType, &stars, &precision);
+		while (stars > 0) {
+			starValue = va_arg(argList, int);
+			LOG_PUT(int, starValue);
+			if (stars == 1 && precision == LOG_PRECISION_STAR) {
+				precision = starValue;
+			}
+			stars--;
+		}
+		switch (argType) {
+		case LOGARG_NONE:
+			break;
+		case LOGARG_INT:
+			LOG_PUT(int, va_arg(argList, int));
+			break;
+		case LOGARG_LONG:
+			LOG_PUT(long, va_arg(argList, long));
+			break;
+		case LOGARG_LONGLONG:
+			LOG_PUT(long long, va_arg(argList, long long));
+			break;
+		case LOGARG_SIZE:
+			LOG_PUT(size_t, va_arg(argList, size_t));
+			break;
+		case LOGARG_DOUBLE:
+			LOG_PUT(double, va_arg(argList, double));
+			break;
+		case LOGARG_PTR:
+			LOG_PUT(void*, va_arg(argList, void*));
+			break;
+		case LOGARG_STR:
+			str = va_arg(argList, const char*);
+			if (str == 0) {
+				str = "(null)";
+			}
+			// with precision, string does not have to be terminated
+			len = 0;
+			while (str[len] && (precision < 0 || len < precision)) {
+				len++;
+			}
+			if (at + len + 1 > end) {
+				return 0;
+			}
+			memcpy(at, str, len);
+			at[len] = 0;
+			at += len + 1;
+			break;
+		default:
+			return 0;
+		}
+	}
+	rec.level = level;
+	rec.feature = feature;
+	rec.size = at - start;
+	memcpy(start, &rec, sizeof(rec));
+	g_logRecordsUsed += rec.size;
+	g_logRecordsStored++;
+	return 1;
+}
+
+#define LOG_SNPRINTF(value) (stars == 0 ? snprintf(o, rem, spec, value) : \
+	stars == 1 ? snprintf(o, rem, spec, starValues[0], value) : \
+	snprintf(o, rem, spec, starValues[0], starValues[1], value))
+
+// Creates text from stored record, one conversion at a time, so the
+// result is the same as vsnprintf with original arguments would give.
+static void LOG_FormatRecord(char* out, int outLen, const char* fmt, const byte* at) {
+	char spec[24];
+	const char* f;
+	const char* convStart;
+	char* o;
+	int rem, written;
+	int argType, stars, precision, i;
+	int starValues[2];
+	int vInt;
+	long vLong;
+	long long vLongLong;
+	size_t vSize;
+	double vDouble;
+	void* vPtr;
+
+	o = out;
+	rem = outLen;
+	f = fmt;
+	while (*f && rem > 1) {
+		if (*f != '%') {
+			*o++ = *f++;
+			rem--;
+			continue;
+		}
+		convStart = f;
+		f = LOG_ParseConversion(f, &argType, &stars, &precision);
+		if (f - convStart >= (int)sizeof(spec)) {
+			break;
+		}
+		memcpy(spec, convStart, f - convStart);
+		spec[f - convStart] = 0;
+		for (i = 0; i < stars; i++) {
+			LOG_GET(int, starValues[i]);
+		}
+		switch (argType) {
+		case LOGARG_INT:
+			LOG_GET(int, vInt);
+			written = LOG_SNPRINTF(vInt);
+			break;
+		case LOGARG_LONG:
+			LOG_GET(long, vLong);
+			written = LOG_SNPRINTF(vLong);
+			break;
+		case LOGARG_LONGLONG:
+			LOG_GET(long long, vLongLong);
+			written = LOG_SNPRINTF(vLongLong);
+			break;
+		case LOGARG_SIZE:
+			LOG_GET(size_t, vSize);
+			written = LOG_SNPRINTF(vSize);
+			break;
+		case LOGARG_DOUBLE:
+			LOG_GET(double, vDouble);
+			written = LOG_SNPRINTF(vDouble);
+			break;
+		case LOGARG_PTR:
+			LOG_GET(void*, vPtr);
+			written = LOG_SNPRINTF(vPtr);
+			break;
+		case LOGARG_STR:
+			written = LOG_SNPRINTF((const char*)at);
+			at += strlen((const char*)at) + 1;
+			break;
+		default:
+			// %%
+			*o = '%';
+			written = 1;
+			break;
+		}
+		if (written < 0) {
+			break;
+		}
+		if (written > rem - 1) {
+			written = rem - 1;
+		}
+		o += written;
+		rem -= written;
+	}
+	*o = 0;
+}
+
+// formats all stored records into log memory, must be called with mutex taken
+static void LOG_FlushRecords() {
+	const byte* at;
+	const char* fmt;
+	logRecord_t rec;
+	char* tmp;
+	char* t;
+	int len;
+
+	at = g_logRecords;
+	while (at < g_logRecords + g_logRecordsUsed) {
+		memcpy(&rec, at, sizeof(rec));
+		tmp = g_loggingBuffer;
+		t = LOG_FormatPrefix(tmp, rec.level, rec.feature);
+		fmt = (const char*)(at + sizeof(rec));
+		LOG_FormatRecord(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, (const byte*)(fmt + strlen(fmt) + 1));
+		len = LOG_FinishLine(tmp);
+#if WINDOWS
+		printf(tmp);
+#endif
+		LOG_WriteToRing(tmp, len);
+		g_logRecordsFormatted++;
+		at += rec.size;
+	}
+	g_logRecordsUsed = 0;
+}
+
+static void LOG_Delay(int len) {
+	int timems = log_delay;
+	// is log_delay set -ve, then calculate delay
+	// required for the number of characters to TX
+	// plus 2ms to be sure.
+	if (log_delay < 0)
+	{
+		int cps = (115200 / 8);
+		timems = (((1000 / portTICK_RATE_MS) * len) / cps) + 2;
+		if (timems < 2)
+			timems = 2;
+	}
+	rtos_delay_milliseconds(timems);
+}
+
 // adds a log to the log memory
-// if head collides with either tail, move the tails on.
 void addLogAdv(int level, int feature, const char* fmt, ...)
 {
 	char* tmp;
@@ -286,7 +734,7 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 	int len;
 	va_list argList;
 	BaseType_t taken;
-	int i;
+	int stored;
 
 	if (fmt == 0)
 	{
@@ -309,36 +757,47 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 
 
 	taken = xSemaphoreTake(logMemory.mutex, 100);
-	tmp = g_loggingBuffer;
-	memset(tmp, 0, LOGGING_BUFFER_SIZE);
-	t = tmp;
 
-	if (feature == LOG_FEATURE_RAW)
-	{
-		// raw means no prefixes
-	}
-	else {
-		strncpy(t, loglevelnames[level], (LOGGING_BUFFER_SIZE - (3 + t - tmp)));
-		t += strlen(t);
-		if (feature < sizeof(logfeaturenames) / sizeof(*logfeaturenames))
-		{
-			strncpy(t, logfeaturenames[feature], (LOGGING_BUFFER_SIZE - (3 + t - tmp)));
-			t += strlen(t);
+	// in deferred mode, only store arguments - unless something wants the text right now
+	if (g_logDeferred && direct_serial_log != LOGTYPE_DIRECT
+		&& g_log_alsoPrintToHTTP == 0 && g_extraSocketToSendLOG == 0) {
+		va_start(argList, fmt);
+		stored = LOG_StoreRecord(level, feature, fmt, argList);
+		va_end(argList);
+		if (stored == 0 && g_logRecordsUsed) {
+			// out of space, make text from what we have and try again
+			LOG_FlushRecords();
+			va_start(argList, fmt);
+			stored = LOG_StoreRecord(level, feature, fmt, argList);
+			va_end(argList);
 		}
+		if (stored) {
+			if (taken == pdTRUE) {
+				xSemaphoreGive(logMemory.mutex);
+			}
+#ifdef PLATFORM_BEKEN
+			trigger_log_send();
+#endif
+			if (log_delay != 0) {
+				LOG_Delay(strlen(fmt));
+			}
+			return;
+		}
+	}
+	// keep the order of lines
+	if (g_logRecordsUsed) {
+		LOG_FlushRecords();
 	}
 
+	tmp = g_loggingBuffer;
+	t = LOG_FormatPrefix(tmp, level, feature);
+
 	va_start(argList, fmt);
 	//vsnprintf3(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
 	//vsnprintf2(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
 	vsnprintf(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
 	va_end(argList);
-	if (tmp[strlen(tmp) - 1] == '\n') tmp[strlen(tmp) - 1] = '\0';
-	if (tmp[strlen(tmp) - 1] == '\r') tmp[strlen(tmp) - 1] = '\0';
-
-	len = strlen(tmp); // save 3 bytes at end for /r/n/0
-	tmp[len++] = '\r';
-	tmp[len++] = '\n';
-	tmp[len] = '\0';
+	len = LOG_FinishLine(tmp);
 #if WINDOWS
 	printf(tmp);
 #endif
@@ -354,7 +813,7 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 	}
 	if (g_extraSocketToSendLOG)
 	{
-		send(g_extraSocketToSendLOG, tmp, strlen(tmp), 0);
+		send(g_extraSocketToSendLOG, tmp, len, 0);
 	}
 
 	if (direct_serial_log == LOGTYPE_DIRECT) {
@@ -374,23 +833,7 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 		return;
 	}
 
-	for ( i = 0; i < len; i++)
-	{
-		logMemory.log[logMemory.head] = tmp[i];
-		logMemory.head = (logMemory.head + 1) % LOGSIZE;
-		if (logMemory.tailserial == logMemory.head)
-		{
-			logMemory.tailserial = (logMemory.tailserial + 1) % LOGSIZE;
-		}
-		if (logMemory.tailtcp == logMemory.head)
-		{
-			logMemory.tailtcp = (logMemory.tailtcp + 1) % LOGSIZE;
-		}
-		if (logMemory.tailhttp == logMemory.head)
-		{
-			logMemory.tailhttp = (logMemory.tailhttp + 1) % LOGSIZE;
-		}
-	}
+	LOG_WriteToRing(tmp, len);
 
 	if (taken == pdTRUE) {
 		xSemaphoreGive(logMemory.mutex);
@@ -400,26 +843,21 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 #endif	
 	if (log_delay != 0) 
     {
-		int timems = log_delay;
-		// is log_delay set -ve, then calculate delay
-		// required for the number of characters to TX
-		// plus 2ms to be sure.
-		if (log_delay < 0) 
-        {
-			int cps = (115200 / 8);
-			timems = (((1000 / portTICK_RATE_MS) * len) / cps) + 2;
-            if (timems < 2)
-                timems = 2;
-		}
-		rtos_delay_milliseconds(timems);
+		LOG_Delay(len);
 	}
 }
 
 
-static int getData(char* buff, int buffsize, int* tail) {
+// Gives the next contiguous run of unread bytes for given consumer, without copying.
+// Data stays in log memory, call LOG_ReleaseSlice with returned position
+// once it has been sent, also when sending failed. Until then writer drops
+// new lines rather than overwriting the slice.
+static int LOG_GetSlice(int consumer, const char** data, unsigned int* pos) {
 	BaseType_t taken;
+	logCursor_t* c;
+	int ofs;
 	int count;
-	char* p;
+
 	if (!initialised)
 		return 0;
 	taken = xSemaphoreTake(logMemory.mutex, 100);
@@ -427,20 +865,24 @@ static int getData(char* buff, int buffsize, int* tail) {
 	{
 		return 0;
 	}
-
-	count = 0;
-	p = buff;
-	while (buffsize > 1) {
-		if (*tail == logMemory.head) {
-			break;
+	// deferred lines are turned into text here, in reader thread
+	if (g_logRecordsUsed) {
+		LOG_FlushRecords();
+	}
+	c = &logMemory.cursors[consumer];
+	ofs = c->tail & LOGSIZE_MASK;
+	count = logMemory.head - c->tail;
+	if (count > LOGSIZE - ofs) {
+		count = LOGSIZE - ofs;
+	}
+	*data = logMemory.log + ofs;
+	*pos = c->tail;
+	if (count > 0) {
+		if (c->held == 0) {
+			c->heldStart = c->tail;
 		}
-		*p = logMemory.log[*tail];
-		p++;
-		(*tail) = ((*tail) + 1) % LOGSIZE;
-		buffsize--;
-		count++;
+		c->held++;
 	}
-	*p = 0;
 
 	if (taken == pdTRUE) {
 		xSemaphoreGive(logMemory.mutex);
@@ -448,6 +890,51 @@ static int getData(char* buff, int buffsize, int* tail) {
 	return count;
 }
 
+static void LOG_ReleaseSlice(int consumer, unsigned int pos, int count) {
+	BaseType_t taken;
+	logCursor_t* c;
+
+	taken = xSemaphoreTake(logMemory.mutex, 100);
+	c = &logMemory.cursors[consumer];
+	if (c->held > 0) {
+		c->held--;
+	}
+	if (c->tail == pos) {
+		c->tail += count;
+	}
+	if (taken == pdTRUE) {
+		xSemaphoreGive(logMemory.mutex);
+	}
+}
+
+#ifndef PLATFORM_BEKEN
+// copying variant, for readers which need a zero terminated string
+static int getData(char* buff, int buffsize, int consumer) {
+	const char* data;
+	unsigned int pos;
+	int count;
+	int total;
+
+	total = 0;
+	// at most two slices, if data wraps around end of log memory
+	while (buffsize > 1) {
+		count = LOG_GetSlice(consumer, &data, &pos);
+		if (count == 0) {
+			break;
+		}
+		if (count > buffsize - 1) {
+			count = buffsize - 1;
+		}
+		memcpy(buff + total, data, count);
+		LOG_ReleaseSlice(consumer, pos, count);
+		total += count;
+		buffsize -= count;
+	}
+	buff[total] = 0;
+	return total;
+}
+#endif
+
 #if PLATFORM_BEKEN
 
 // for T & N, we can send bytes if TX fifo is not full,
@@ -456,42 +943,37 @@ static int getData(char* buff, int buffsize, int* tail) {
 // H/W TX fifo seems to be 256 bytes!!!
 static int getSerial2() {
 	if (!initialised) return 0;
-	int* tail = &logMemory.tailserial;
+	static unsigned int reportedDrops = 0;
+	const char* data;
+	unsigned int pos;
+	int count;
+	int sent = 0;
 	char c;
-	BaseType_t taken = xSemaphoreTake(logMemory.mutex, 100);
-	char overflow = 0;
-
-	// if we hit overflow
-	if (logMemory.tailserial == (logMemory.head + 1) % LOGSIZE) {
-		overflow = 1;
-	}
 
-	while ((*tail != logMemory.head) && !uart_is_tx_fifo_full(UART_PORT)) {
-		c = logMemory.log[*tail];
-		if (overflow) {
-			c = '^'; // replace the first char with ^ if we overflowed....
-			overflow = 0;
+	count = LOG_GetSlice(LOG_CONSUMER_SERIAL, &data, &pos);
+	while (sent < count && !uart_is_tx_fifo_full(UART_PORT)) {
+		c = data[sent];
+		// replace the first char with ^ if we overflowed....
+		if (reportedDrops != logMemory.cursors[LOG_CONSUMER_SERIAL].dropped) {
+			reportedDrops = logMemory.cursors[LOG_CONSUMER_SERIAL].dropped;
+			c = '^';
 		}
-
-		(*tail) = ((*tail) + 1) % LOGSIZE;
+		sent++;
 
 		if (direct_serial_log == LOGTYPE_THREAD) {
 			UART_WRITE_BYTE(UART_PORT_INDEX, c);
 		}
 	}
+	LOG_ReleaseSlice(LOG_CONSUMER_SERIAL, pos, sent);
 
-	int remains = (*tail != logMemory.head);
-
-	if (taken == pdTRUE) {
-		xSemaphoreGive(logMemory.mutex);
-	}
-	return remains;
+	// more data, either after wrap around or because fifo was full
+	return logMemory.head != logMemory.cursors[LOG_CONSUMER_SERIAL].tail;
 }
 
 #else
 
 static int getSerial(char* buff, int buffsize) {
-	int len = getData(buff, buffsize, &logMemory.tailserial);
+	int len = getData(buff, buffsize, LOG_CONSUMER_SERIAL);
 	//bk_printf("got serial: %d:%s\r\n", len, buff);
 	return len;
 }
@@ -499,18 +981,6 @@ static int getSerial(char* buff, int buffsize) {
 #endif
 
 
-static int getTcp(char* buff, int buffsize) {
-	int len = getData(buff, buffsize, &logMemory.tailtcp);
-	//bk_printf("got tcp: %d:%s\r\n", len,buff);
-	return len;
-}
-
-static int getHttp(char* buff, int buffsize) {
-	int len = getData(buff, buffsize, &logMemory.tailhttp);
-	//printf("got tcp: %d:%s\r\n", len,buff);
-	return len;
-}
-
 void startLogServer() {
 #if WINDOWS
 
@@ -625,9 +1095,6 @@ void log_server_thread(beken_thread_arg_t arg)
 	rtos_delete_thread(NULL);
 }
 
-#define TCPLOGBUFSIZE 128
-static char tcplogbuf[TCPLOGBUFSIZE];
-
 #ifdef PLATFORM_BEKEN
 static void send_to_tcp(){
 	int i;
@@ -641,12 +1108,15 @@ static void send_to_tcp(){
 		return;
 	}
 	int count;
+	const char* data;
+	unsigned int pos;
 	do {
-		count = getTcp(tcplogbuf, TCPLOGBUFSIZE);
+		// send straight from log memory
+		count = LOG_GetSlice(LOG_CONSUMER_TCP, &data, &pos);
 		if (count) {
 			for (i = 0; i < MAX_TCP_LOG_PORTS; i++){
 				if (tcp_log_ports[i] >= 0){
-					int len = send(tcp_log_ports[i], tcplogbuf, count, 0);
+					int len = send(tcp_log_ports[i], data, count, 0);
 					// if some error, close socket
 					if (len != count) {
 						// this is the only place this port can be closed.
@@ -655,6 +1125,7 @@ static void send_to_tcp(){
 					}
 				}
 			}
+			LOG_ReleaseSlice(LOG_CONSUMER_TCP, pos, count);
 		}
 	} while(count);
 }
@@ -667,14 +1138,21 @@ static void send_to_tcp(){
 static void log_client_thread(beken_thread_arg_t arg)
 {
 	int fd = (int)arg;
+	const char* data;
+	unsigned int pos;
 	while (1) {
-		int count = getTcp(tcplogbuf, TCPLOGBUFSIZE);
+		// send straight from log memory
+		int count = LOG_GetSlice(LOG_CONSUMER_TCP, &data, &pos);
 		if (count) {
-			int len = send(fd, tcplogbuf, count, 0);
+			int len = send(fd, data, count, 0);
 			// if some error, close socket
 			if (len != count) {
+				LOG_ReleaseSlice(LOG_CONSUMER_TCP, pos, 0);
 				break;
 			}
+			LOG_ReleaseSlice(LOG_CONSUMER_TCP, pos, count);
+			// there may be more after wrap around
+			continue;
 		}
 		rtos_delay_milliseconds(10);
 	}
@@ -706,15 +1184,16 @@ static void log_serial_thread(beken_thread_arg_t arg)
 
 static int http_getlograw(http_request_t* request) {
 	int len = 0;
+	const char* data;
+	unsigned int pos;
 	http_setup(request, httpMimeTypeHTML);
 
-	// get log in small chunks, posting on http
+	// post log straight from log memory, at most two slices
 	do {
-		char buf[128];
-		len = getHttp(buf, sizeof(buf) - 1);
-		buf[len] = '\0';
+		len = LOG_GetSlice(LOG_CONSUMER_HTTP, &data, &pos);
 		if (len) {
-			poststr(request, buf);
+			postany(request, data, len);
+			LOG_ReleaseSlice(LOG_CONSUMER_HTTP, pos, len);
 		}
 	} while (len);
 	poststr(request, NULL);
@@ -802,6 +1281,42 @@ commandResult_t log_command(const void* context, const char* cmd, const char* ar
 			result = CMD_RES_OK;
 			break;
 		}
+		if (!stricmp(cmd, "logstats")) {
+			int i;
+			if (!stricmp(args, "reset")) {
+				for (i = 0; i < LOG_CONSUMER_COUNT; i++) {
+					logMemory.cursors[i].dropped = 0;
+				}
+				result = CMD_RES_OK;
+				break;
+			}
+			for (i = 0; i < LOG_CONSUMER_COUNT; i++) {
+				ADDLOG_INFO(LOG_FEATURE_CMD, "log %s: pending %u, dropped %u", logConsumerNames[i],
+					logMemory.head - logMemory.cursors[i].tail, logMemory.cursors[i].dropped);
+			}
+			ADDLOG_INFO(LOG_FEATURE_CMD, "deferred %i: records stored %u, formatted %u", g_logDeferred,
+				g_logRecordsStored, g_logRecordsFormatted);
+			result = CMD_RES_OK;
+			break;
+		}
+		if (!stricmp(cmd, "logdeferred")) {
+			BaseType_t taken;
+			int res, enable;
+			res = sscanf(args, "%d", &enable);
+			if (res != 1) {
+				enable = 1;
+			}
+			taken = xSemaphoreTake(logMemory.mutex, 100);
+			if (enable == 0 && g_logRecordsUsed) {
+				LOG_FlushRecords();
+			}
+			g_logDeferred = enable;
+			if (taken == pdTRUE) {
+				xSemaphoreGive(logMemory.mutex);
+			}
+			result = CMD_RES_OK;
+			break;
+		}
 		if (!stricmp(cmd, "logdelay")) {
 			int res, delay;
 			res = sscanf(args, "%d", &delay);
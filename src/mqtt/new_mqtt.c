@@ -15,6 +15,7 @@
 #include "../driver/drv_ntp.h"
 #include "../driver/drv_deviceclock.h"
 #include "../driver/drv_tuyaMCU.h"
+#include "../quicktick.h"
 #include "../hal/hal_ota.h"
 #ifndef WINDOWS
 #include <lwip/dns.h>
@@ -95,59 +96,35 @@ static short g_teleSensor_interval = 3;
 // mqtt receive buffer, so we can action in our threads, not
 // in tcp_thread
 //
+// Every message is a record: header followed by NUL terminated topic and payload.
+// Records never wrap, so callbacks get pointers straight into the ring and
+// payload size is limited only by the ring size.
+#ifndef MQTT_RX_BUFFER_MAX
 #define MQTT_RX_BUFFER_MAX 4096
-unsigned char mqtt_rx_buffer[MQTT_RX_BUFFER_MAX];
-int mqtt_rx_buffer_head;
-int mqtt_rx_buffer_tail;
-int mqtt_rx_buffer_count;
-unsigned char temp_topic[128];
-unsigned char temp_data[2048];
-
-int addLenData(int len, const unsigned char *data){
-	mqtt_rx_buffer[mqtt_rx_buffer_head] = (len >> 8) & 0xff;
-	mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count++;
-	mqtt_rx_buffer[mqtt_rx_buffer_head] = (len) & 0xff;
-	mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count++;
-	for (int i = 0; i < len; i++){
-		mqtt_rx_buffer[mqtt_rx_buffer_head] = data[i];
-		mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-		mqtt_rx_buffer_count++;
-	}
-	return len + 2;
-}
-
-int getLenData(int *len, unsigned char *data, int maxlen){
-	int l;
-	l = mqtt_rx_buffer[mqtt_rx_buffer_tail];
-	mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count--;
-	l = l<<8;
-	l |= mqtt_rx_buffer[mqtt_rx_buffer_tail];
-	mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count--;
-
-	for (int i = 0; i < l; i++){
-		if (i < maxlen){
-			data[i] = mqtt_rx_buffer[mqtt_rx_buffer_tail];
-		}
-		mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-		mqtt_rx_buffer_count--;
-	}
-	if (mqtt_rx_buffer_count < 0){
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer underflow!!!");
-		mqtt_rx_buffer_count = 0;
-		mqtt_rx_buffer_tail = mqtt_rx_buffer_head = 0;
-	}
-
-	if (l > maxlen){
-		*len = maxlen;
-	} else {
-		*len = l;
-	}
-	return l + 2;
-}
+#endif
+
+typedef struct mqttRxRecord_s {
+	// whole record size with padding, 0 marks unused space at the end of ring
+	int size;
+	unsigned short topicLen;
+	// set when whole payload is stored, fragmented publishes are filled in parts
+	unsigned short bReady;
+	int dataLen;
+} mqttRxRecord_t;
+
+#define MQTT_RX_RECORD_TOPIC(x)		((char*)((x) + 1))
+#define MQTT_RX_RECORD_DATA(x)		((unsigned char*)(MQTT_RX_RECORD_TOPIC(x) + (x)->topicLen + 1))
+
+// int array keeps records aligned
+static int mqtt_rx_buffer[MQTT_RX_BUFFER_MAX / sizeof(int)];
+static int mqtt_rx_buffer_read;
+static int mqtt_rx_buffer_write;
+// bytes taken by records and skipped space at the end of ring
+static int mqtt_rx_buffer_used;
+static int mqtt_rx_dropped;
+// record of publish which is being received in parts by tcp thread
+static mqttRxRecord_t* mqtt_rx_pending;
+static int mqtt_rx_pendingOfs;
 
 static SemaphoreHandle_t g_mutex = 0;
 
@@ -170,6 +147,52 @@ static void MQTT_Mutex_Free()
 	xSemaphoreGive(g_mutex);
 }
 
+// reserves record for topic and payload, must be called with mutex taken
+static mqttRxRecord_t* MQTT_RxAlloc(const char* topic, int topiclen, int datalen) {
+	mqttRxRecord_t* rec;
+	byte* base = (byte*)mqtt_rx_buffer;
+	int size;
+	int pos;
+
+	size = (sizeof(mqttRxRecord_t) + topiclen + 1 + datalen + 1 + 3) & ~3;
+	if (size > MQTT_RX_BUFFER_MAX || topiclen > 0xFFFF) {
+		return NULL;
+	}
+	if (mqtt_rx_buffer_used == 0) {
+		mqtt_rx_buffer_read = mqtt_rx_buffer_write = 0;
+	}
+	pos = mqtt_rx_buffer_write;
+	if (mqtt_rx_buffer_used == 0 || pos > mqtt_rx_buffer_read) {
+		if (pos + size > MQTT_RX_BUFFER_MAX) {
+			if (size > mqtt_rx_buffer_read) {
+				return NULL;
+			}
+			// skip the rest of ring, reader will wrap on the zero size marker
+			((mqttRxRecord_t*)(base + pos))->size = 0;
+			mqtt_rx_buffer_used += MQTT_RX_BUFFER_MAX - pos;
+			pos = 0;
+		}
+	}
+	else if (pos + size > mqtt_rx_buffer_read) {
+		return NULL;
+	}
+	mqtt_rx_buffer_write = pos + size;
+	if (mqtt_rx_buffer_write == MQTT_RX_BUFFER_MAX) {
+		mqtt_rx_buffer_write = 0;
+	}
+	mqtt_rx_buffer_used += size;
+
+	rec = (mqttRxRecord_t*)(base + pos);
+	rec->size = size;
+	rec->topicLen = topiclen;
+	rec->dataLen = datalen;
+	rec->bReady = 0;
+	memcpy(MQTT_RX_RECORD_TOPIC(rec), topic, topiclen);
+	MQTT_RX_RECORD_TOPIC(rec)[topiclen] = 0;
+	MQTT_RX_RECORD_DATA(rec)[datalen] = 0;
+	return rec;
+}
+
 // this is called from tcp_thread context to queue received mqtt,
 // and then we'll retrieve them from our own thread for processing.
 //
@@ -177,12 +200,16 @@ static void MQTT_Mutex_Free()
 // system can use it to spoof MQTT packets to check if MQTT commands
 // are working...
 int MQTT_Post_Received(const char *topic, int topiclen, const unsigned char *data, int datalen){
+	mqttRxRecord_t* rec;
+
 	MQTT_Mutex_Take(100);
-	if ((MQTT_RX_BUFFER_MAX - 1 - mqtt_rx_buffer_count) < topiclen + datalen + 2 + 2){
+	rec = MQTT_RxAlloc(topic, topiclen, datalen);
+	if (rec == NULL) {
+		mqtt_rx_dropped++;
 		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer overflow for topic %s", topic);
 	} else {
-		addLenData(topiclen, (unsigned char *)topic);
-		addLenData(datalen, data);
+		memcpy(MQTT_RX_RECORD_DATA(rec), data, datalen);
+		rec->bReady = 1;
 	}
 	MQTT_Mutex_Free();
 
@@ -195,29 +222,70 @@ int MQTT_Post_Received(const char *topic, int topiclen, const unsigned char *dat
 int MQTT_Post_Received_Str(const char *topic, const char *data) {
 	return MQTT_Post_Received(topic, strlen(topic), (const unsigned char*)data, strlen(data));
 }
-int get_received(char **topic, int *topiclen, unsigned char **data, int *datalen){
-	int res = 0;
+// returns oldest complete record, it stays in ring until MQTT_RxPop
+static mqttRxRecord_t* MQTT_RxPeek() {
+	mqttRxRecord_t* rec = NULL;
+
+	MQTT_Mutex_Take(100);
+	if (mqtt_rx_buffer_used > 0) {
+		rec = (mqttRxRecord_t*)((byte*)mqtt_rx_buffer + mqtt_rx_buffer_read);
+		if (rec->size == 0) {
+			mqtt_rx_buffer_used -= MQTT_RX_BUFFER_MAX - mqtt_rx_buffer_read;
+			mqtt_rx_buffer_read = 0;
+			rec = (mqttRxRecord_t*)mqtt_rx_buffer;
+		}
+		if (mqtt_rx_buffer_used == 0 || rec->bReady == 0) {
+			rec = NULL;
+		}
+	}
+	MQTT_Mutex_Free();
+	return rec;
+}
+void MQTT_GetReceiveStats(int* outBytes, int* outDropped) {
+	*outBytes = mqtt_rx_buffer_used;
+	*outDropped = mqtt_rx_dropped;
+}
+static void MQTT_RxPop(mqttRxRecord_t* rec) {
 	MQTT_Mutex_Take(100);
-	if (mqtt_rx_buffer_tail != mqtt_rx_buffer_head){
-		getLenData(topiclen, temp_topic, sizeof(temp_topic)-1);
-		temp_topic[*topiclen] = 0;
-		getLenData(datalen, temp_data, sizeof(temp_data)-1);
-		temp_data[*datalen] = 0;
-		*topic = (char *)temp_topic;
-		*data = temp_data;
-		res = 1;
+	mqtt_rx_buffer_used -= rec->size;
+	mqtt_rx_buffer_read += rec->size;
+	if (mqtt_rx_buffer_read == MQTT_RX_BUFFER_MAX) {
+		mqtt_rx_buffer_read = 0;
 	}
 	MQTT_Mutex_Free();
-	return res;
 }
 //
 //////////////////////////////////////////////////////////////////////
 
-#define MQTT_QUEUE_ITEM_IS_REUSABLE(x)  (x->topic[0] == 0)
-#define MQTT_QUEUE_ITEM_SET_REUSABLE(x) (x->topic[0] = 0)
-
-MqttPublishItem_t* g_MqttPublishQueueHead = NULL;
-int g_MqttPublishItemsQueued = 0;   //Items in the queue waiting to be published. This is not the queue length.
+// records are kept aligned so the header can be accessed in place
+#define MQTT_QUEUE_ALIGN(x)		(((x) + 3) & ~3)
+
+// Queue is a chain of MQTT_PUBLISH_QUEUE_BYTES segments. Records are appended
+// to the last segment and read from the first one, a segment is freed as soon
+// as it has been read. Growing never copies records, so old and new memory
+// is never taken at the same time.
+typedef struct mqttQueueSegment_s {
+	struct mqttQueueSegment_s* next;
+	// offset of oldest unread record
+	int read;
+	// offset where next record goes
+	int write;
+} mqttQueueSegment_t;
+
+#define MQTT_QUEUE_SEGMENT_DATA(x)		((byte*)((x) + 1))
+#define MQTT_PUBLISH_QUEUE_MAX_SEGMENTS	((int)((MQTT_PUBLISH_QUEUE_MAX_BYTES + MQTT_PUBLISH_QUEUE_BYTES - 1) / MQTT_PUBLISH_QUEUE_BYTES))
+
+static mqttQueueSegment_t* g_mqttPublishQueueHead = NULL;
+static mqttQueueSegment_t* g_mqttPublishQueueTail = NULL;
+// allocated bytes, MQTT_PUBLISH_QUEUE_BYTES per segment
+static int g_mqttPublishQueueSize = 0;
+// bytes taken by records
+static int g_mqttPublishQueueUsed = 0;
+// last queued record, for MQTT_InvokeCommandAtEnd
+static MqttPublishItem_t* g_mqttPublishQueueLast = NULL;
+static int g_mqttPublishQueueHighWater = 0;
+static int g_mqttPublishQueueDropped = 0;
+int g_MqttPublishItemsQueued = 0;   //Items in the queue waiting to be published.
 
 // from mqtt.c
 extern void mqtt_disconnect(mqtt_client_t* client);
@@ -241,14 +309,50 @@ typedef struct mqtt_callback_tag {
 	char* topic;
 	char* subscriptionTopic;
 	int ID;
+	// registration order, matching callbacks are called in this order
+	int order;
+	int hits;
 	mqtt_callback_fn callback;
+	struct mqttTopicNode_s* node;
+	// list of all callbacks
+	struct mqtt_callback_tag* next;
+	// list of callbacks registered on the same trie node
+	struct mqtt_callback_tag* nextInNode;
 } mqtt_callback_t;
 
-#define MAX_MQTT_CALLBACKS 32
-static mqtt_callback_t* callbacks[MAX_MQTT_CALLBACKS];
-static int numCallbacks = 0;
+// Subscriptions are kept in a trie with one node per topic level,
+// so "dev/+/set" is root -> "dev" -> "+" -> "set".
+// Wildcard levels are stored as plain "+" and "#" nodes.
+typedef struct mqttTopicNode_s {
+	struct mqttTopicNode_s* parent;
+	struct mqttTopicNode_s* children;
+	struct mqttTopicNode_s* next;
+	mqtt_callback_t* callbacks;
+	// number of callbacks here with a broker subscription
+	int subscribers;
+	// SUBSCRIBE could not be sent, retried from MQTT_RunEverySecondUpdate
+	int subscribePending;
+	// level name, allocated together with node
+	char level[1];
+} mqttTopicNode_t;
+
+// max number of callbacks that can match single incoming topic
+#define MQTT_MAX_TOPIC_MATCHES 16
+
+static mqtt_callback_t* mqtt_callbacks = 0;
+static mqttTopicNode_t mqtt_topicRoot;
+static int mqtt_callbackOrder = 0;
+static int mqtt_topicLookups = 0;
+static int mqtt_topicNodesVisited = 0;
+static int mqtt_topicMisses = 0;
+static int mqtt_topicSubscribes = 0;
+// callbacks left out because too many matched single topic
+static int mqtt_topicMatchesTruncated = 0;
+// some topic has subscribePending set
+static int mqtt_subscribesPending = 0;
+// subscriptions were not walked on connect, all of them must be sent again
+static int mqtt_resubscribeAll = 0;
 // note: only one incomming can be processed at a time.
-static obk_mqtt_request_t g_mqtt_request;
 static obk_mqtt_request_t g_mqtt_request_cb;
 
 #define LOOPS_WITH_DISCONNECTED 15
@@ -398,136 +502,404 @@ char* MQTT_GetStatusMessage(void)
 	return mqtt_status_message;
 }
 
-void MQTT_ClearCallbacks() {
-	int i;
-	for (i = 0; i < MAX_MQTT_CALLBACKS; i++) {
-		if (callbacks[i]) {
-			free(callbacks[i]->topic);
-			free(callbacks[i]->subscriptionTopic);
-			free(callbacks[i]);
-			callbacks[i] = 0;
-		}
+static void mqtt_request_cb(void* arg, err_t err);
+
+// sends SUBSCRIBE/UNSUBSCRIBE on a live session, on connect all topics are subscribed anyway
+static err_t MQTT_SubscribeTopic(const char* topic, int bSubscribe) {
+	err_t err = ERR_OK;
+	int bConnected;
+
+	if (mqtt_client == 0) {
+		return ERR_OK;
 	}
-}
-// this can REPLACE callbacks, since we MAY wish to change the root topic....
-// in which case we would re-resigster all callbacks?
-int MQTT_RegisterCallback(const char* basetopic, const char* subscriptiontopic, int ID, mqtt_callback_fn callback) {
-	int index;
-	int i;
-	int subscribechange = 0;
-	if (!basetopic || !subscriptiontopic || !callback) {
-		return -1;
+	LOCK_TCPIP_CORE();
+	bConnected = mqtt_client_is_connected(mqtt_client);
+	if (bConnected) {
+		err = mqtt_sub_unsub(mqtt_client, topic, 1, mqtt_request_cb, LWIP_CONST_CAST(void*, &mqtt_client_info), bSubscribe);
 	}
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT_RegisterCallback called for bT %s subT %s", basetopic, subscriptiontopic);
+	UNLOCK_TCPIP_CORE();
+	if (!bConnected) {
+		return ERR_OK;
+	}
+	mqtt_topicSubscribes++;
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_%s %s return: %d\n", bSubscribe ? "subscribe" : "unsubscribe", topic, err);
+	return err;
+}
 
-	// find existing to replace
-	for (index = 0; index < numCallbacks; index++) {
-		if (callbacks[index]) {
-			if (callbacks[index]->ID == ID) {
+static mqttTopicNode_t* MQTT_TopicNodeGet(const char* topic) {
+	mqttTopicNode_t* node = &mqtt_topicRoot;
+	mqttTopicNode_t* child;
+	const char* end;
+	int len;
+
+	while (1) {
+		end = strchr(topic, '/');
+		len = end ? (int)(end - topic) : (int)strlen(topic);
+		for (child = node->children; child; child = child->next) {
+			if (!strncmp(child->level, topic, len) && child->level[len] == 0) {
 				break;
 			}
 		}
+		if (child == 0) {
+			child = (mqttTopicNode_t*)os_malloc(sizeof(mqttTopicNode_t) + len);
+			if (child == 0) {
+				return 0;
+			}
+			memset(child, 0, sizeof(mqttTopicNode_t));
+			memcpy(child->level, topic, len);
+			child->level[len] = 0;
+			child->parent = node;
+			child->next = node->children;
+			node->children = child;
+		}
+		node = child;
+		if (end == 0) {
+			return node;
+		}
+		topic = end + 1;
 	}
+}
 
-	// find empty if any (empty by MQTT_RemoveCallback)
-	if (index == numCallbacks) {
-		for (index = 0; index < numCallbacks; index++) {
-			if (!callbacks[index]) {
+// frees node and its parents, as long as they are not used
+static void MQTT_TopicNodePrune(mqttTopicNode_t* node) {
+	mqttTopicNode_t* parent;
+	mqttTopicNode_t** pp;
+
+	while (node != &mqtt_topicRoot && node->callbacks == 0 && node->children == 0) {
+		parent = node->parent;
+		for (pp = &parent->children; *pp; pp = &(*pp)->next) {
+			if (*pp == node) {
+				*pp = node->next;
 				break;
 			}
 		}
+		os_free(node);
+		node = parent;
 	}
+}
+
+static void MQTT_TopicNodeCollect(mqttTopicNode_t* node, mqtt_callback_t** out, int* count) {
+	mqtt_callback_t* cb;
 
-	if (index >= MAX_MQTT_CALLBACKS) {
-		return -4;
+	for (cb = node->callbacks; cb; cb = cb->nextInNode) {
+		if (*count < MQTT_MAX_TOPIC_MATCHES) {
+			out[(*count)++] = cb;
+		}
+		else {
+			mqtt_topicMatchesTruncated++;
+		}
 	}
-	if (!callbacks[index]) {
-		callbacks[index] = (mqtt_callback_t*)os_malloc(sizeof(mqtt_callback_t));
-		if (callbacks[index] != 0) {
-			memset(callbacks[index], 0, sizeof(mqtt_callback_t));
+}
+
+// level points to current topic level, NULL when all levels were consumed
+static void MQTT_TopicNodeMatch(mqttTopicNode_t* node, const char* level, mqtt_callback_t** out, int* count) {
+	mqttTopicNode_t* child;
+	const char* end;
+	const char* rest;
+	int len;
+	int bAllowWildcards;
+
+	mqtt_topicNodesVisited++;
+	if (level == 0) {
+		MQTT_TopicNodeCollect(node, out, count);
+		// "a/#" also matches "a"
+		for (child = node->children; child; child = child->next) {
+			if (!strcmp(child->level, "#")) {
+				mqtt_topicNodesVisited++;
+				MQTT_TopicNodeCollect(child, out, count);
+			}
 		}
+		return;
 	}
-	if (!callbacks[index]) {
-		return -2;
+	end = strchr(level, '/');
+	len = end ? (int)(end - level) : (int)strlen(level);
+	rest = end ? end + 1 : 0;
+	// topics like $SYS are not matched by wildcards on first level
+	bAllowWildcards = node != &mqtt_topicRoot || level[0] != '$';
+	for (child = node->children; child; child = child->next) {
+		if (bAllowWildcards && !strcmp(child->level, "#")) {
+			mqtt_topicNodesVisited++;
+			MQTT_TopicNodeCollect(child, out, count);
+		}
+		else if ((bAllowWildcards && !strcmp(child->level, "+")) ||
+			(!strncmp(child->level, level, len) && child->level[len] == 0)) {
+			MQTT_TopicNodeMatch(child, rest, out, count);
+		}
 	}
-	if (!callbacks[index]->topic || strcmp(callbacks[index]->topic, basetopic)) {
-		if (callbacks[index]->topic) {
-			os_free(callbacks[index]->topic);
+}
+
+// fills out with matching callback functions, in registration order
+static int MQTT_FindCallbacks(const char* topic, mqtt_callback_fn* out) {
+	mqtt_callback_t* found[MQTT_MAX_TOPIC_MATCHES];
+	mqtt_callback_t* tmp;
+	int truncated;
+	int count = 0;
+	int i, j;
+
+	MQTT_Mutex_Take(100);
+	mqtt_topicLookups++;
+	truncated = mqtt_topicMatchesTruncated;
+	MQTT_TopicNodeMatch(&mqtt_topicRoot, topic, found, &count);
+	truncated = mqtt_topicMatchesTruncated - truncated;
+	if (count == 0) {
+		mqtt_topicMisses++;
+	}
+	for (i = 1; i < count; i++) {
+		tmp = found[i];
+		for (j = i; j > 0 && found[j - 1]->order > tmp->order; j--) {
+			found[j] = found[j - 1];
 		}
-		callbacks[index]->topic = (char*)os_malloc(strlen(basetopic) + 1);
-		if (!callbacks[index]->topic) {
-			os_free(callbacks[index]);
-			return -3;
+		found[j] = tmp;
+	}
+	// hits are counted only when dispatching, not when filtering in tcp thread
+	if (out) {
+		for (i = 0; i < count; i++) {
+			found[i]->hits++;
+			out[i] = found[i]->callback;
 		}
-		strcpy(callbacks[index]->topic, basetopic);
 	}
+	MQTT_Mutex_Free();
+	if (truncated && out) {
+		addLogAdv(LOG_WARN, LOG_FEATURE_MQTT, "Topic %s matches more than %i callbacks, %i skipped",
+			topic, MQTT_MAX_TOPIC_MATCHES, truncated);
+	}
+	return count;
+}
+
+// marks topic to be subscribed again from MQTT_RunEverySecondUpdate
+static void MQTT_MarkSubscribePending(const char* topic) {
+	mqtt_callback_t* cb;
 
-	if (!callbacks[index]->subscriptionTopic || strcmp(callbacks[index]->subscriptionTopic, subscriptiontopic)) {
-		if (callbacks[index]->subscriptionTopic) {
-			os_free(callbacks[index]->subscriptionTopic);
+	if (MQTT_Mutex_Take(100) == 0) {
+		mqtt_resubscribeAll = 1;
+		mqtt_subscribesPending = 1;
+		return;
+	}
+	for (cb = mqtt_callbacks; cb; cb = cb->next) {
+		if (!strcmp(cb->subscriptionTopic, topic)) {
+			cb->node->subscribePending = 1;
+			mqtt_subscribesPending = 1;
 		}
-		callbacks[index]->subscriptionTopic = (char*)os_malloc(strlen(subscriptiontopic) + 1);
-		callbacks[index]->subscriptionTopic[0] = '\0';
-		if (!callbacks[index]->subscriptionTopic) {
-			os_free(callbacks[index]->topic);
-			os_free(callbacks[index]);
-			return -3;
+	}
+	MQTT_Mutex_Free();
+}
+
+// count of topics subscribed again at once
+#define MQTT_SUBSCRIBE_RETRIES_AT_ONCE	4
+
+static void MQTT_RetrySubscriptions() {
+	mqtt_callback_t* cb;
+	char* topics[MQTT_SUBSCRIBE_RETRIES_AT_ONCE];
+	int count = 0;
+	int i;
+
+	if (mqtt_subscribesPending == 0) {
+		return;
+	}
+	if (MQTT_Mutex_Take(100) == 0) {
+		return;
+	}
+	mqtt_subscribesPending = 0;
+	if (mqtt_resubscribeAll) {
+		mqtt_resubscribeAll = 0;
+		for (cb = mqtt_callbacks; cb; cb = cb->next) {
+			if (cb->subscriptionTopic[0]) {
+				cb->node->subscribePending = 1;
+			}
+		}
+	}
+	for (cb = mqtt_callbacks; cb; cb = cb->next) {
+		if (cb->subscriptionTopic[0] == 0 || cb->node->subscribePending == 0) {
+			continue;
+		}
+		if (count == MQTT_SUBSCRIBE_RETRIES_AT_ONCE) {
+			// rest of them next time
+			mqtt_subscribesPending = 1;
+			break;
+		}
+		topics[count] = (char*)os_malloc(strlen(cb->subscriptionTopic) + 1);
+		if (topics[count] == 0) {
+			mqtt_subscribesPending = 1;
+			break;
+		}
+		strcpy(topics[count], cb->subscriptionTopic);
+		cb->node->subscribePending = 0;
+		count++;
+	}
+	MQTT_Mutex_Free();
+	for (i = 0; i < count; i++) {
+		if (MQTT_SubscribeTopic(topics[i], 1) != ERR_OK) {
+			MQTT_MarkSubscribePending(topics[i]);
 		}
+		os_free(topics[i]);
+	}
+}
 
-		// find out if this subscription is new.
-		for (i = 0; i < numCallbacks; i++) {
-			if (callbacks[i]) {
-				if (callbacks[i]->subscriptionTopic &&
-					!strcmp(callbacks[i]->subscriptionTopic, subscriptiontopic)) {
-					break;
-				}
+void MQTT_GetTopicStats(int* outLookups, int* outNodesVisited, int* outMisses, int* outSubscribes) {
+	*outLookups = mqtt_topicLookups;
+	*outNodesVisited = mqtt_topicNodesVisited;
+	*outMisses = mqtt_topicMisses;
+	*outSubscribes = mqtt_topicSubscribes;
+}
+
+// unlinks callback from list and trie, must be called with mutex taken,
+// returns topic to unsubscribe from (caller frees it) or NULL
+static char* MQTT_UnlinkCallback(mqtt_callback_t* cb) {
+	mqtt_callback_t** pp;
+	mqttTopicNode_t* node = cb->node;
+	char* unsubscribe = 0;
+
+	for (pp = &mqtt_callbacks; *pp; pp = &(*pp)->next) {
+		if (*pp == cb) {
+			*pp = cb->next;
+			break;
+		}
+	}
+	if (node) {
+		for (pp = &node->callbacks; *pp; pp = &(*pp)->nextInNode) {
+			if (*pp == cb) {
+				*pp = cb->nextInNode;
+				break;
 			}
 		}
-		strcpy(callbacks[index]->subscriptionTopic, subscriptiontopic);
-		// if this subscription is new, must reconnect
-		if (i == numCallbacks) {
-			subscribechange++;
+		if (cb->subscriptionTopic[0]) {
+			node->subscribers--;
+			if (node->subscribers == 0) {
+				unsubscribe = cb->subscriptionTopic;
+				cb->subscriptionTopic = 0;
+			}
 		}
+		MQTT_TopicNodePrune(node);
+	}
+	return unsubscribe;
+}
+
+static void MQTT_FreeCallback(mqtt_callback_t* cb) {
+	if (cb->topic) {
+		os_free(cb->topic);
+	}
+	if (cb->subscriptionTopic) {
+		os_free(cb->subscriptionTopic);
+	}
+	os_free(cb);
+}
+
+void MQTT_ClearCallbacks() {
+	mqtt_callback_t* cb;
+	char* unsubscribe;
+
+	while (mqtt_callbacks) {
+		MQTT_Mutex_Take(100);
+		cb = mqtt_callbacks;
+		unsubscribe = MQTT_UnlinkCallback(cb);
+		MQTT_Mutex_Free();
+		if (unsubscribe) {
+			MQTT_SubscribeTopic(unsubscribe, 0);
+			os_free(unsubscribe);
+		}
+		MQTT_FreeCallback(cb);
+	}
+}
+// this can REPLACE callbacks, since we MAY wish to change the root topic....
+// Topic changes are sent to broker as SUBSCRIBE/UNSUBSCRIBE, no reconnect is needed.
+int MQTT_RegisterCallback(const char* basetopic, const char* subscriptiontopic, int ID, mqtt_callback_fn callback) {
+	mqtt_callback_t* cb;
+	mqttTopicNode_t* node;
+	char* key;
+	int bSubscribe = 0;
+
+	if (!basetopic || !subscriptiontopic || !callback) {
+		return -1;
 	}
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT_RegisterCallback called for bT %s subT %s", basetopic, subscriptiontopic);
 
-	callbacks[index]->callback = callback;
-	if (index == numCallbacks) {
-		numCallbacks++;
+	// replacing existing ID, simplest to start from scratch
+	MQTT_RemoveCallback(ID);
+
+	cb = (mqtt_callback_t*)os_malloc(sizeof(mqtt_callback_t));
+	if (!cb) {
+		return -2;
+	}
+	memset(cb, 0, sizeof(mqtt_callback_t));
+	cb->topic = (char*)os_malloc(strlen(basetopic) + 1);
+	cb->subscriptionTopic = (char*)os_malloc(strlen(subscriptiontopic) + 1);
+	if (!cb->topic || !cb->subscriptionTopic) {
+		MQTT_FreeCallback(cb);
+		return -3;
+	}
+	strcpy(cb->topic, basetopic);
+	strcpy(cb->subscriptionTopic, subscriptiontopic);
+	cb->ID = ID;
+	cb->callback = callback;
+
+	// without subscription topic, callback gets everything under base topic
+	if (subscriptiontopic[0]) {
+		key = cb->subscriptionTopic;
+	}
+	else {
+		key = (char*)os_malloc(strlen(basetopic) + 2);
+		if (!key) {
+			MQTT_FreeCallback(cb);
+			return -3;
+		}
+		strcpy(key, basetopic);
+		if (key[0] && key[strlen(key) - 1] != '/') {
+			strcat(key, "/");
+		}
+		strcat(key, "#");
 	}
 
-	if (subscribechange) {
-		if (mqtt_client) {
-			mqtt_reconnect = 8;
+	MQTT_Mutex_Take(100);
+	node = MQTT_TopicNodeGet(key);
+	if (node) {
+		cb->node = node;
+		cb->order = mqtt_callbackOrder++;
+		cb->nextInNode = node->callbacks;
+		node->callbacks = cb;
+		cb->next = mqtt_callbacks;
+		mqtt_callbacks = cb;
+		if (subscriptiontopic[0]) {
+			node->subscribers++;
+			bSubscribe = node->subscribers == 1;
 		}
 	}
+	MQTT_Mutex_Free();
+
+	if (key != cb->subscriptionTopic) {
+		os_free(key);
+	}
+	if (!node) {
+		MQTT_FreeCallback(cb);
+		return -3;
+	}
+	if (bSubscribe && MQTT_SubscribeTopic(subscriptiontopic, 1) != ERR_OK) {
+		MQTT_MarkSubscribePending(subscriptiontopic);
+	}
 	// success
 	return 0;
 }
 
 int MQTT_RemoveCallback(int ID) {
-	int index;
-
-	for (index = 0; index < numCallbacks; index++) {
-		if (callbacks[index]) {
-			if (callbacks[index]->ID == ID) {
-				if (callbacks[index]->topic) {
-					os_free(callbacks[index]->topic);
-					callbacks[index]->topic = NULL;
-				}
-				if (callbacks[index]->subscriptionTopic) {
-					os_free(callbacks[index]->subscriptionTopic);
-					callbacks[index]->subscriptionTopic = NULL;
-				}
-				os_free(callbacks[index]);
-				callbacks[index] = NULL;
-				if (mqtt_client) {
-					mqtt_reconnect = 8;
-				}
-				return 1;
-			}
+	mqtt_callback_t* cb;
+	char* unsubscribe = 0;
+
+	MQTT_Mutex_Take(100);
+	for (cb = mqtt_callbacks; cb; cb = cb->next) {
+		if (cb->ID == ID) {
+			unsubscribe = MQTT_UnlinkCallback(cb);
+			break;
 		}
 	}
-	return 0;
+	MQTT_Mutex_Free();
+	if (!cb) {
+		return 0;
+	}
+	if (unsubscribe) {
+		MQTT_SubscribeTopic(unsubscribe, 0);
+		os_free(unsubscribe);
+	}
+	MQTT_FreeCallback(cb);
+	return 1;
 }
 
 const char *skipExpected(const char *p, const char *tok) {
@@ -787,8 +1159,8 @@ int tasCmnd(obk_mqtt_request_t* request) {
 
 #if 1
 	args = (const char *)request->received;
-	// I think that our function get_received always ensured that
-	// there is a NULL terminating character after payload of MQTT
+	// receive ring always stores a NULL terminating character
+	// after payload of MQTT
 	// So we can feed it directly as command
 	CMD_ExecuteCommandArgs(p, args, COMMAND_FLAG_SOURCE_MQTT);
 #if ENABLE_TASMOTA_JSON
@@ -863,6 +1235,9 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 	}
 	u8_t retain = 0; /* No don't retain such crappy payload... */
 	size_t sVal_len;
+	// most topics fit here, so publish does not need the heap
+	char topicBuffer[96];
+	int topicLen;
 	char* pub_topic;
 
 	if (client == 0)
@@ -914,7 +1289,13 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 
 	g_timeSinceLastMQTTPublish = 0;
 
-	pub_topic = (char*)os_malloc(strlen(sTopic) + 1 + strlen(sChannel) + 5 + 1); //5 for /get
+	topicLen = strlen(sTopic) + 1 + strlen(sChannel) + 5 + 1; //5 for /get
+	if (topicLen <= (int)sizeof(topicBuffer)) {
+		pub_topic = topicBuffer;
+	}
+	else {
+		pub_topic = (char*)os_malloc(topicLen);
+	}
 	if ((pub_topic != NULL) && (sVal != NULL))
 	{
 		sVal_len = strlen(sVal);
@@ -938,7 +1319,9 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 		LOCK_TCPIP_CORE();
 		err = mqtt_publish(client, pub_topic, sVal, strlen(sVal), qos, retain, mqtt_pub_request_cb, 0);
 		UNLOCK_TCPIP_CORE();
-		os_free(pub_topic);
+		if (pub_topic != topicBuffer) {
+			os_free(pub_topic);
+		}
 
 		if (err != ERR_OK)
 		{
@@ -962,6 +1345,9 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 		return OBK_PUBLISH_OK;
 	}
 	else {
+		if (pub_topic != NULL && pub_topic != topicBuffer) {
+			os_free(pub_topic);
+		}
 		MQTT_Mutex_Free();
 		return OBK_PUBLISH_MEM_FAIL;
 	}
@@ -1004,76 +1390,71 @@ void MQTT_OBK_Printf(char* s) {
 ////////////////////////////////////////
 // called from tcp_thread context.
 // we should do callbacks from one of our threads?
+// makes record of publish received in parts visible to reader
+static void MQTT_RxFinishPending() {
+	if (mqtt_rx_pending == NULL) {
+		return;
+	}
+	MQTT_Mutex_Take(100);
+	// may be shorter than announced if connection was lost
+	mqtt_rx_pending->dataLen = mqtt_rx_pendingOfs;
+	MQTT_RX_RECORD_DATA(mqtt_rx_pending)[mqtt_rx_pendingOfs] = 0;
+	mqtt_rx_pending->bReady = 1;
+	MQTT_Mutex_Free();
+	mqtt_rx_pending = NULL;
+}
 static void mqtt_incoming_data_cb(void* arg, const u8_t* data, u16_t len, u8_t flags)
 {
-	int i;
 	// unused - left here as example
 	//const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
 
-	// if we stored a topic in g_mqtt_request, then we found a matching callback, so use it.
-	if (g_mqtt_request.topic[0])
-	{
-		// note: data is NOT terminated (it may be binary...).
-		g_mqtt_request.received = data;
-		g_mqtt_request.receivedLen = len;
-
-		//addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT in topic %s", g_mqtt_request.topic);
+	// record was reserved in mqtt_incoming_publish_cb if anyone is interested in this topic,
+	// large payloads come in several parts
+	if (mqtt_rx_pending == NULL) {
+		return;
+	}
+	if (len > mqtt_rx_pending->dataLen - mqtt_rx_pendingOfs) {
+		len = mqtt_rx_pending->dataLen - mqtt_rx_pendingOfs;
+	}
+	memcpy(MQTT_RX_RECORD_DATA(mqtt_rx_pending) + mqtt_rx_pendingOfs, data, len);
+	mqtt_rx_pendingOfs += len;
+	if (flags & MQTT_DATA_FLAG_LAST) {
+		MQTT_RxFinishPending();
 		mqtt_received_events++;
-
-		for (i = 0; i < numCallbacks; i++)
-		{
-			if (callbacks[i] == 0)
-				continue;
-			char* cbtopic = callbacks[i]->topic;
-			if (!strncmp(g_mqtt_request.topic, cbtopic, strlen(cbtopic)))
-			{
-				MQTT_Post_Received(g_mqtt_request.topic, strlen(g_mqtt_request.topic), data, len);
-				// if ANYONE is interested, store it.
-				break;
-				// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
-				// i.e. multiple people can get each topic if required.
-				//if (callbacks[i]->callback(&g_mqtt_request))
-				//{
-				//	return;
-				//}
-			}
-		}
-		//addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT topic not handled: %s", g_mqtt_request.topic);
+#ifdef PLATFORM_BEKEN
+		MQTT_TriggerRead();
+#endif
 	}
 }
 
 
 // run from userland (quicktick or wakeable thread)
 int MQTT_process_received(){
-	char *topic;
-	int topiclen;
-	unsigned char *data;
-	int datalen;
-	int found = 0;
+	mqttRxRecord_t* rec;
+	mqtt_callback_fn fns[MQTT_MAX_TOPIC_MATCHES];
 	int count = 0;
-	do{
-		found = get_received(&topic, &topiclen, &data, &datalen);
-		if (found){
-			count++;
-			strncpy(g_mqtt_request_cb.topic, topic, sizeof(g_mqtt_request_cb.topic));
-			g_mqtt_request_cb.received = data;
-			g_mqtt_request_cb.receivedLen = datalen;
-			for (int i = 0; i < numCallbacks; i++)
+	int matches;
+	int i;
+
+	while ((rec = MQTT_RxPeek()) != NULL) {
+		count++;
+		// callbacks get pointers into the ring, record is released after they are done
+		g_mqtt_request_cb.topic = MQTT_RX_RECORD_TOPIC(rec);
+		g_mqtt_request_cb.received = MQTT_RX_RECORD_DATA(rec);
+		g_mqtt_request_cb.receivedLen = rec->dataLen;
+		matches = MQTT_FindCallbacks(g_mqtt_request_cb.topic, fns);
+		for (i = 0; i < matches; i++)
+		{
+			// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
+			// i.e. multiple people can get each topic if required.
+			if (fns[i](&g_mqtt_request_cb))
 			{
-				char* cbtopic = callbacks[i]->topic;
-				if (!strncmp(topic, cbtopic, strlen(cbtopic)))
-				{
-					// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
-					// i.e. multiple people can get each topic if required.
-					if (callbacks[i]->callback(&g_mqtt_request_cb))
-					{
-						// if no further processing, then break this loop.
-						break;
-					}
-				}
+				// if no further processing, then break this loop.
+				break;
 			}
 		}
-	} while (found);
+		MQTT_RxPop(rec);
+	}
 
 	return count;
 }
@@ -1083,21 +1464,20 @@ int MQTT_process_received(){
 // called from tcp_thread context
 static void mqtt_incoming_publish_cb(void* arg, const char* topic, u32_t tot_len)
 {
-	//const char *p;
-	int i;
 	// unused - left here as example
 	//const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
 
-	// look for a callback with this URL and method, or HTTP_ANY
-	g_mqtt_request.topic[0] = '\0';
-	for (i = 0; i < numCallbacks; i++)
-	{
-		char* cbtopic = callbacks[i]->topic;
-		if (strncmp(topic, cbtopic, strlen(cbtopic)))
-		{
-			strncpy(g_mqtt_request.topic, topic, sizeof(g_mqtt_request.topic) - 1);
-			g_mqtt_request.topic[sizeof(g_mqtt_request.topic) - 1] = 0;
-			break;
+	// previous publish was not finished, pass on what we have
+	MQTT_RxFinishPending();
+	// store only topics that someone is interested in
+	if (MQTT_FindCallbacks(topic, 0)) {
+		MQTT_Mutex_Take(100);
+		mqtt_rx_pending = MQTT_RxAlloc(topic, strlen(topic), tot_len);
+		MQTT_Mutex_Free();
+		mqtt_rx_pendingOfs = 0;
+		if (mqtt_rx_pending == NULL) {
+			mqtt_rx_dropped++;
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer overflow for topic %s (%i bytes)", topic, (int)tot_len);
 		}
 	}
 	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT client in mqtt_incoming_publish_cb topic %s\n", topic);
@@ -1115,7 +1495,8 @@ static void mqtt_request_cb(void* arg, err_t err)
 // should be called in tcp_thread context.
 static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection_status_t status)
 {
-	int i;
+	mqtt_callback_t* cb;
+	mqtt_callback_t* other;
 	char tmp[CGF_MQTT_CLIENT_ID_SIZE + 16];
 	const char* clientId;
 	err_t err = ERR_OK;
@@ -1145,24 +1526,41 @@ static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection
 			LWIP_CONST_CAST(void*, &mqtt_client_info));
 		//UNLOCK_TCPIP_CORE();
 
-		// subscribe to all callback subscription topics
-		// this makes a BIG assumption that we can subscribe multiple times to the same one?
-		// TODO - check that subscribing multiple times to the same topic is not BAD
-		for (i = 0; i < numCallbacks; i++) {
-			if (callbacks[i]) {
-				if (callbacks[i]->subscriptionTopic && callbacks[i]->subscriptionTopic[0]) {
-					err = mqtt_sub_unsub(client,
-						callbacks[i]->subscriptionTopic, 1,
-						mqtt_request_cb, LWIP_CONST_CAST(void*, client_info),
-						1);
-					if (err != ERR_OK) {
-						addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_subscribe to %s return: %d\n", callbacks[i]->subscriptionTopic, err);
-					}
-					else {
-						addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_subscribed to %s\n", callbacks[i]->subscriptionTopic);
+		// subscribe to all callback subscription topics, once per trie node
+		if (MQTT_Mutex_Take(100) == 0) {
+			// callbacks can't be walked safely now, let the timer do it
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "mqtt_connection_cb: mutex busy, will subscribe later\n");
+			mqtt_resubscribeAll = 1;
+			mqtt_subscribesPending = 1;
+		}
+		else {
+			for (cb = mqtt_callbacks; cb; cb = cb->next) {
+				if (cb->subscriptionTopic[0] == 0) {
+					continue;
+				}
+				for (other = cb->node->callbacks; other; other = other->nextInNode) {
+					if (other->subscriptionTopic[0]) {
+						break;
 					}
 				}
+				if (other != cb) {
+					continue;
+				}
+				err = mqtt_sub_unsub(client,
+					cb->subscriptionTopic, 1,
+					mqtt_request_cb, LWIP_CONST_CAST(void*, client_info),
+					1);
+				cb->node->subscribePending = err != ERR_OK;
+				if (err != ERR_OK) {
+					addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_subscribe to %s return: %d\n", cb->subscriptionTopic, err);
+					mqtt_subscribesPending = 1;
+				}
+				else {
+					addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_subscribed to %s\n", cb->subscriptionTopic);
+				}
 			}
+			mqtt_resubscribeAll = 0;
+			MQTT_Mutex_Free();
 		}
 
 		clientId = CFG_GetMQTTClientId();
@@ -1191,6 +1589,8 @@ static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection
 	}
 	else {
 		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_connection_cb: Disconnected, reason: %d(%s)\n", status, get_callback_error(status));
+		// don't block the receive ring with a publish that will never be completed
+		MQTT_RxFinishPending();
 	}
 }
 
@@ -1431,11 +1831,194 @@ static int MQTT_do_connect(mqtt_client_t* client)
 	return 0;
 }
 
+// Batched publish mode. Instead of a separate publish for every changed channel
+// and driver value, changes are collected and sent as one JSON object
+// to obk0696FB33/batch/get, like {"1":1,"2":50,"voltage":230.1}
+#define MQTT_BATCH_MAX_VALUES		16
+#define MQTT_BATCH_NAME_LENGTH		24
+#define MQTT_BATCH_VALUE_LENGTH		24
+#define MQTT_BATCH_JSON_LENGTH		512
+
+typedef struct mqttBatchValue_s {
+	char name[MQTT_BATCH_NAME_LENGTH];
+	char value[MQTT_BATCH_VALUE_LENGTH];
+	bool bQuote;
+} mqttBatchValue_t;
+
+// 0 means batching is off, otherwise how long changes are collected
+static int g_mqttBatchIntervalMs = 0;
+static int g_mqttBatchElapsedMs = 0;
+static unsigned int g_mqttBatchChannels[(CHANNEL_MAX + 31) / 32];
+static bool g_mqttBatchHasChannels = false;
+static mqttBatchValue_t g_mqttBatchValues[MQTT_BATCH_MAX_VALUES];
+static int g_mqttBatchValuesCount = 0;
+static int stat_mqttBatchPublishes = 0;
+static int stat_mqttBatchItems = 0;
+
+// copies string for use inside JSON quotes, returns its length.
+// With out == NULL, only returns length.
+static int MQTT_BatchEscape(char* out, const char* s) {
+	int len = 0;
+
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			if (out) {
+				out[len] = '\\';
+				out[len + 1] = *s;
+			}
+			len += 2;
+		}
+		else if ((byte)*s < 0x20) {
+			if (out) {
+				sprintf(out + len, "\\u%04x", (byte)*s);
+			}
+			len += 6;
+		}
+		else {
+			if (out) {
+				out[len] = *s;
+			}
+			len++;
+		}
+	}
+	return len;
+}
+static void MQTT_BatchAppend(char* json, int* len, const char* name, const char* value, bool bQuote) {
+	int need;
+
+	// name, value, quotes, colon, comma and closing brace
+	need = MQTT_BatchEscape(NULL, name) + (bQuote ? MQTT_BatchEscape(NULL, value) : (int)strlen(value)) + 7;
+	if (*len > 1 && *len + need >= MQTT_BATCH_JSON_LENGTH) {
+		strcpy(json + *len, "}");
+		MQTT_PublishMain(mqtt_client, "batch", json, 0, true);
+		stat_mqttBatchPublishes++;
+		*len = 1;
+	}
+	if (*len > 1) {
+		json[(*len)++] = ',';
+	}
+	json[(*len)++] = '"';
+	*len += MQTT_BatchEscape(json + *len, name);
+	json[(*len)++] = '"';
+	json[(*len)++] = ':';
+	if (bQuote) {
+		json[(*len)++] = '"';
+		*len += MQTT_BatchEscape(json + *len, value);
+		json[(*len)++] = '"';
+	}
+	else {
+		*len += sprintf(json + *len, "%s", value);
+	}
+	stat_mqttBatchItems++;
+}
+void MQTT_FlushBatch() {
+	char json[MQTT_BATCH_JSON_LENGTH];
+	char name[8];
+	char value[32];
+	bool bChannels;
+	int len;
+	int i;
+
+	g_mqttBatchElapsedMs = 0;
+	if (g_mqttBatchHasChannels == false && g_mqttBatchValuesCount == 0) {
+		return;
+	}
+	json[0] = '{';
+	len = 1;
+	for (i = 0; i < CHANNEL_MAX; i++) {
+		if ((g_mqttBatchChannels[i / 32] & (1U << (i % 32))) == 0) {
+			continue;
+		}
+		if (CFG_HasFlag(OBK_FLAG_PUBLISH_MULTIPLIED_VALUES)) {
+			snprintf(value, sizeof(value), "%f", CHANNEL_GetFinalValue(i));
+		}
+		else {
+			snprintf(value, sizeof(value), "%i", CHANNEL_Get(i));
+		}
+		sprintf(name, "%i", i);
+		MQTT_BatchAppend(json, &len, name, value, false);
+	}
+	for (i = 0; i < g_mqttBatchValuesCount; i++) {
+		MQTT_BatchAppend(json, &len, g_mqttBatchValues[i].name, g_mqttBatchValues[i].value, g_mqttBatchValues[i].bQuote);
+	}
+	bChannels = g_mqttBatchHasChannels;
+	memset(g_mqttBatchChannels, 0, sizeof(g_mqttBatchChannels));
+	g_mqttBatchHasChannels = false;
+	g_mqttBatchValuesCount = 0;
+	if (len > 1) {
+		strcpy(json + len, "}");
+		MQTT_PublishMain(mqtt_client, "batch", json, 0, true);
+		stat_mqttBatchPublishes++;
+	}
+	if (bChannels) {
+		MQTT_BroadcastTasmotaTeleSTATE();
+		MQTT_BroadcastTasmotaTeleSENSOR();
+	}
+}
+// returns true if value was taken into batch and should not be published now
+static bool MQTT_BatchValue(const char* sChannel, const char* valueStr, bool bQuote, int flags) {
+	int i;
+
+	if (g_mqttBatchIntervalMs <= 0) {
+		return false;
+	}
+	// retained and raw topic publishes must keep their own topic
+	if (flags & ~(OBK_PUBLISH_FLAG_MUTEX_SILENT | OBK_PUBLISH_FLAG_QOS_ZERO)) {
+		return false;
+	}
+	if (strlen(sChannel) >= MQTT_BATCH_NAME_LENGTH || strlen(valueStr) >= MQTT_BATCH_VALUE_LENGTH) {
+		return false;
+	}
+	for (i = 0; i < g_mqttBatchValuesCount; i++) {
+		if (!strcmp(g_mqttBatchValues[i].name, sChannel)) {
+			break;
+		}
+	}
+	if (i == MQTT_BATCH_MAX_VALUES) {
+		MQTT_FlushBatch();
+		i = 0;
+	}
+	if (i == g_mqttBatchValuesCount) {
+		strcpy(g_mqttBatchValues[i].name, sChannel);
+		g_mqttBatchValuesCount++;
+	}
+	strcpy(g_mqttBatchValues[i].value, valueStr);
+	g_mqttBatchValues[i].bQuote = bQuote;
+	return true;
+}
+// called when channel value has changed, publishes now or marks channel for batch
+void MQTT_ChannelChanged(int channel) {
+	if (g_mqttBatchIntervalMs <= 0 || channel < 0 || channel >= CHANNEL_MAX
+		|| CHANNEL_HasNeverPublishFlag(channel)
+		|| (CFG_HasFlag(OBK_FLAG_MQTT_RETAIN_POWER_CHANNELS) && CHANNEL_IsPowerRelayChannel(channel))) {
+		MQTT_ChannelPublish(channel, 0);
+		return;
+	}
+	g_mqttBatchChannels[channel / 32] |= 1U << (channel % 32);
+	g_mqttBatchHasChannels = true;
+}
+// mqtt_batchPublish [intervalMs]
+static commandResult_t MQTT_SetBatchPublish(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() >= 1) {
+		g_mqttBatchIntervalMs = Tokenizer_GetArgInteger(0);
+		if (g_mqttBatchIntervalMs <= 0) {
+			// send what was collected so far
+			MQTT_FlushBatch();
+		}
+	}
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "Batch publish interval %i ms, %i batch publishes with %i values",
+		g_mqttBatchIntervalMs, stat_mqttBatchPublishes, stat_mqttBatchItems);
+	return CMD_RES_OK;
+}
 OBK_Publish_Result MQTT_PublishMain_StringInt(const char* sChannel, int iv, int flags)
 {
 	char valueStr[16];
 
 	sprintf(valueStr, "%i", iv);
+	if (MQTT_BatchValue(sChannel, valueStr, false, flags)) {
+		return OBK_PUBLISH_OK;
+	}
 
 	return MQTT_PublishMain(mqtt_client, sChannel, valueStr, flags, true);
 
@@ -1449,12 +2032,18 @@ OBK_Publish_Result MQTT_PublishMain_StringFloat(const char* sChannel, float f, i
 	if (maxDecimalPlaces >= 0) {
 		stripDecimalPlaces(valueStr, maxDecimalPlaces);
 	}
+	if (MQTT_BatchValue(sChannel, valueStr, false, flags)) {
+		return OBK_PUBLISH_OK;
+	}
 
 	return MQTT_PublishMain(mqtt_client, sChannel, valueStr, flags, true);
 
 }
 OBK_Publish_Result MQTT_PublishMain_StringString(const char* sChannel, const char* valueStr, int flags)
 {
+	if (MQTT_BatchValue(sChannel, valueStr, true, flags)) {
+		return OBK_PUBLISH_OK;
+	}
 
 	return MQTT_PublishMain(mqtt_client, sChannel, valueStr, flags, true);
 
@@ -1925,6 +2514,44 @@ void MQTT_InitCallbacks() {
 }
  // initialise things MQTT
  // called from user_main
+static commandResult_t MQTT_QueueStats(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	Tokenizer_TokenizeString(args, 0);
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "Publish queue: %i items, %i/%i bytes, high water %i bytes, dropped %i",
+		g_MqttPublishItemsQueued, g_mqttPublishQueueUsed, g_mqttPublishQueueSize,
+		g_mqttPublishQueueHighWater, g_mqttPublishQueueDropped);
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "Receive ring: %i/%i bytes, dropped %i",
+		mqtt_rx_buffer_used, MQTT_RX_BUFFER_MAX, mqtt_rx_dropped);
+	if (Tokenizer_GetArgIntegerDefault(0, 0)) {
+		g_mqttPublishQueueHighWater = g_mqttPublishQueueUsed;
+		g_mqttPublishQueueDropped = 0;
+		mqtt_rx_dropped = 0;
+	}
+	return CMD_RES_OK;
+}
+static commandResult_t MQTT_TopicStats(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	mqtt_callback_t* cb;
+
+	Tokenizer_TokenizeString(args, 0);
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "Topic lookups: %i, nodes visited: %i, misses: %i, sub/unsub sent: %i, skipped matches: %i",
+		mqtt_topicLookups, mqtt_topicNodesVisited, mqtt_topicMisses, mqtt_topicSubscribes, mqtt_topicMatchesTruncated);
+	MQTT_Mutex_Take(100);
+	for (cb = mqtt_callbacks; cb; cb = cb->next) {
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "Callback %i: %s (%s) hits %i",
+			cb->ID, cb->subscriptionTopic, cb->topic, cb->hits);
+		if (Tokenizer_GetArgIntegerDefault(0, 0)) {
+			cb->hits = 0;
+		}
+	}
+	MQTT_Mutex_Free();
+	if (Tokenizer_GetArgIntegerDefault(0, 0)) {
+		mqtt_topicLookups = 0;
+		mqtt_topicNodesVisited = 0;
+		mqtt_topicMisses = 0;
+		mqtt_topicSubscribes = 0;
+		mqtt_topicMatchesTruncated = 0;
+	}
+	return CMD_RES_OK;
+}
 void MQTT_init()
 {
 	// WINDOWS must support reinit
@@ -1935,6 +2562,10 @@ void MQTT_init()
 	MQTT_InitCallbacks();
 
 	mqtt_initialised = 1;
+	g_mqttBatchIntervalMs = 0;
+	g_mqttBatchValuesCount = 0;
+	g_mqttBatchHasChannels = false;
+	memset(g_mqttBatchChannels, 0, sizeof(g_mqttBatchChannels));
 
 	//cmddetail:{"name":"publish","args":"[Topic][Value][bOptionalSkipPrefixAndSuffix]",
 	//cmddetail:"descr":"Publishes data by MQTT. The final topic will be obk0696FB33/[Topic]/get, but you can also publish under raw topic, by adding third argument - '1'. You can use argument expansion here, so $CH11 will change to value of the channel 11",
@@ -1986,6 +2617,11 @@ void MQTT_init()
 	//cmddetail:"fn":"MQTT_SetTasTeleIntervals","file":"mqtt/new_mqtt.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("TasTeleInterval", MQTT_SetTasTeleIntervals, NULL);
+	//cmddetail:{"name":"mqtt_batchPublish","args":"[IntervalMs]",
+	//cmddetail:"descr":"Enables batched publish mode. Channel changes and driver values are collected for given time and sent as one JSON object to obk0696FB33/batch/get instead of one publish per value. Retained publishes are still sent separately. 0 disables batching and goes back to per topic publishes. Without argument, prints statistics. This value is not saved, you must use autoexec.bat or short startup command to execute it on every reboot.",
+	//cmddetail:"fn":"MQTT_SetBatchPublish","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_batchPublish 50"}
+	CMD_RegisterCommand("mqtt_batchPublish", MQTT_SetBatchPublish, NULL);
 
 #if ENABLE_LITTLEFS
 	//cmddetail:{"name":"publishFile","args":"[Topic][Value][bOptionalSkipPrefixAndSuffix]",
@@ -2001,6 +2637,16 @@ void MQTT_init()
 	//cmddetail:"fn":"MQTT_PublishCommandDriver","file":"mqtt/new_mqtt.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("publishDriver", MQTT_PublishCommandDriver, NULL);
+	//cmddetail:{"name":"mqtt_queueStats","args":"[bReset]",
+	//cmddetail:"descr":"Prints MQTT publish queue usage: queued items, bytes used, high water mark and number of dropped publishes, and receive ring usage with number of dropped incoming messages. Pass 1 to reset high water mark and drop counters.",
+	//cmddetail:"fn":"MQTT_QueueStats","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_queueStats"}
+	CMD_RegisterCommand("mqtt_queueStats", MQTT_QueueStats, NULL);
+	//cmddetail:{"name":"mqtt_topicStats","args":"[bReset]",
+	//cmddetail:"descr":"Prints MQTT topic matcher statistics: number of lookups, trie nodes visited, lookups without any callback and SUBSCRIBE/UNSUBSCRIBE requests sent, followed by every registered callback with its hit count. Pass 1 to reset counters.",
+	//cmddetail:"fn":"MQTT_TopicStats","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_topicStats"}
+	CMD_RegisterCommand("mqtt_topicStats", MQTT_TopicStats, NULL);
 }
 static float getInternalTemperature() {
 	return g_wifi_temperature;
@@ -2146,6 +2792,12 @@ int MQTT_RunQuickTick(){
 	// on Beken, we use a one-shot timer for this.
 	MQTT_process_received();
 #endif
+	if (g_mqttBatchIntervalMs > 0 && (g_mqttBatchHasChannels || g_mqttBatchValuesCount)) {
+		g_mqttBatchElapsedMs += g_deltaTimeMS;
+		if (g_mqttBatchElapsedMs >= g_mqttBatchIntervalMs) {
+			MQTT_FlushBatch();
+		}
+	}
 	return 0;
 }
 
@@ -2192,17 +2844,19 @@ int MQTT_RunEverySecondUpdate()
 		return 0;
 	}
 
-	// take mutex for connect and disconnect operations
-	if (MQTT_Mutex_Take(100) == 0)
-	{
-		return 0;
-	}
+	// callbacks take the mutex themselves, so reinit them first
 	if (g_mqtt_bBaseTopicDirty) {
 		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT base topic is dirty, will reinit callbacks and reconnect\n");
 		MQTT_InitCallbacks();
 		mqtt_reconnect = 5;
 	}
 
+	// take mutex for connect and disconnect operations
+	if (MQTT_Mutex_Take(100) == 0)
+	{
+		return 0;
+	}
+
 	// reconnect if went into MQTT library ERR_MEM forever loop
 	if (g_memoryErrorsThisSession >= 5)
 	{
@@ -2286,6 +2940,8 @@ int MQTT_RunEverySecondUpdate()
 		MQTT_Mutex_Free();
 		// below mutex is not required any more
 
+		MQTT_RetrySubscriptions();
+
 		// it is connected publish TELE
 		if (g_wantTasmotaTeleSend) {
 			MQTT_BroadcastTasmotaTeleSTATE();
@@ -2391,23 +3047,97 @@ int MQTT_RunEverySecondUpdate()
 	return 1;
 }
 
-MqttPublishItem_t* get_queue_tail(MqttPublishItem_t* head) {
-	if (head == NULL) { return NULL; }
+// adds an empty segment at the end of the queue
+static int MQTT_QueueAddSegment() {
+	mqttQueueSegment_t* seg;
+
+	if (g_mqttPublishQueueSize >= MQTT_PUBLISH_QUEUE_MAX_SEGMENTS * MQTT_PUBLISH_QUEUE_BYTES) {
+		return 0;
+	}
+	seg = (mqttQueueSegment_t*)os_malloc(sizeof(mqttQueueSegment_t) + MQTT_PUBLISH_QUEUE_BYTES);
+	if (seg == NULL) {
+		return 0;
+	}
+	seg->next = NULL;
+	seg->read = seg->write = 0;
+	if (g_mqttPublishQueueTail) {
+		g_mqttPublishQueueTail->next = seg;
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publish queue grown to %i bytes",
+			g_mqttPublishQueueSize + MQTT_PUBLISH_QUEUE_BYTES);
+	}
+	else {
+		g_mqttPublishQueueHead = seg;
+	}
+	g_mqttPublishQueueTail = seg;
+	g_mqttPublishQueueSize += MQTT_PUBLISH_QUEUE_BYTES;
+	return 1;
+}
+
+// returns space for a record of given size, or NULL if queue is full
+static MqttPublishItem_t* MQTT_QueueAlloc(int size) {
+	mqttQueueSegment_t* seg;
+	MqttPublishItem_t* item;
 
-	while (head->next != NULL) {
-		head = head->next;
+	if (size > MQTT_PUBLISH_QUEUE_BYTES) {
+		return NULL;
+	}
+	seg = g_mqttPublishQueueTail;
+	if (seg == NULL || seg->write + size > MQTT_PUBLISH_QUEUE_BYTES) {
+		if (MQTT_QueueAddSegment() == 0) {
+			return NULL;
+		}
+		seg = g_mqttPublishQueueTail;
+	}
+	item = (MqttPublishItem_t*)(MQTT_QUEUE_SEGMENT_DATA(seg) + seg->write);
+	seg->write += size;
+	g_mqttPublishQueueUsed += size;
+	if (g_mqttPublishQueueUsed > g_mqttPublishQueueHighWater) {
+		g_mqttPublishQueueHighWater = g_mqttPublishQueueUsed;
 	}
-	return head;
+	g_mqttPublishQueueLast = item;
+	return item;
 }
 
-MqttPublishItem_t* find_queue_reusable_item(MqttPublishItem_t* head) {
-	while (head != NULL) {
-		if (MQTT_QUEUE_ITEM_IS_REUSABLE(head)) {
-			return head;
+// returns oldest record or NULL if queue is empty
+static MqttPublishItem_t* MQTT_QueuePeek() {
+	mqttQueueSegment_t* seg;
+
+	if (g_MqttPublishItemsQueued == 0) {
+		return NULL;
+	}
+	seg = g_mqttPublishQueueHead;
+	return (MqttPublishItem_t*)(MQTT_QUEUE_SEGMENT_DATA(seg) + seg->read);
+}
+
+static void MQTT_QueuePop(MqttPublishItem_t* item) {
+	mqttQueueSegment_t* seg;
+
+	seg = g_mqttPublishQueueHead;
+	g_mqttPublishQueueUsed -= item->size;
+	seg->read += item->size;
+	g_MqttPublishItemsQueued--;
+	if (seg->read == seg->write) {
+		if (seg->next) {
+			// give back memory taken by a burst
+			g_mqttPublishQueueHead = seg->next;
+			g_mqttPublishQueueSize -= MQTT_PUBLISH_QUEUE_BYTES;
+			os_free(seg);
+		}
+		else {
+			// queue is empty, keep the only segment for next publish
+			seg->read = seg->write = 0;
 		}
-		head = head->next;
 	}
-	return head;
+	if (g_MqttPublishItemsQueued == 0) {
+		g_mqttPublishQueueLast = NULL;
+	}
+}
+
+void MQTT_GetPublishQueueStats(int* outItems, int* outBytes, int* outHighWater, int* outDropped) {
+	*outItems = g_MqttPublishItemsQueued;
+	*outBytes = g_mqttPublishQueueUsed;
+	*outHighWater = g_mqttPublishQueueHighWater;
+	*outDropped = g_mqttPublishQueueDropped;
 }
 
 /// @brief Queue an entry for publish and execute a command after the publish.
@@ -2418,56 +3148,49 @@ MqttPublishItem_t* find_queue_reusable_item(MqttPublishItem_t* head) {
 /// @param command Command to execute after the publish
 void MQTT_QueuePublishWithCommand(const char* topic, const char* channel, const char* value, int flags, PostPublishCommands command) {
 	MqttPublishItem_t* newItem;
-	if (g_MqttPublishItemsQueued >= MQTT_MAX_QUEUE_SIZE) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! %i items already present\r\n", g_MqttPublishItemsQueued);
-		return;
-	}
-
-	if ((strlen(topic) > MQTT_PUBLISH_ITEM_TOPIC_LENGTH) ||
-		(strlen(channel) > MQTT_PUBLISH_ITEM_CHANNEL_LENGTH) ||
-		(strlen(value) > MQTT_PUBLISH_ITEM_VALUE_LENGTH)) {
+	int topicLen, channelLen, valueLen;
+
+	topicLen = strlen(topic) + 1;
+	channelLen = strlen(channel) + 1;
+	valueLen = strlen(value) + 1;
+	if ((topicLen > MQTT_PUBLISH_ITEM_TOPIC_LENGTH) ||
+		(channelLen > MQTT_PUBLISH_ITEM_CHANNEL_LENGTH) ||
+		(valueLen > MQTT_PUBLISH_ITEM_VALUE_LENGTH)) {
+		g_mqttPublishQueueDropped++;
 		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! Topic (%i), channel (%i) or value (%i) exceeds size limit\r\n",
-			strlen(topic), strlen(channel), strlen(value));
+			topicLen - 1, channelLen - 1, valueLen - 1);
 		return;
 	}
 
-	//Queue data for publish. This might be a new item in the queue or an existing item. This is done to prevent
-	//memory fragmentation. The total queue length is limited to MQTT_MAX_QUEUE_SIZE.
-
-	if (g_MqttPublishQueueHead == NULL) {
-		g_MqttPublishQueueHead = newItem = os_malloc(sizeof(MqttPublishItem_t));
-		newItem->next = NULL;
-	}
-	else {
-		newItem = find_queue_reusable_item(g_MqttPublishQueueHead);
-
-		if (newItem == NULL) {
-			newItem = os_malloc(sizeof(MqttPublishItem_t));
-			newItem->next = NULL;
-			get_queue_tail(g_MqttPublishQueueHead)->next = newItem; //Append new item
-		}
+	//Queue data for publish. Records are packed one after another in a single arena,
+	//so short payloads don't take more memory than they need and nothing is allocated per item.
+	newItem = MQTT_QueueAlloc(MQTT_QUEUE_ALIGN(sizeof(MqttPublishItem_t) + topicLen + channelLen + valueLen));
+	if (newItem == NULL) {
+		g_mqttPublishQueueDropped++;
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! %i items already present\r\n", g_MqttPublishItemsQueued);
+		return;
 	}
-
-	//strcpy does copy ending null character.
-	strcpy(newItem->topic, topic);
-	strcpy(newItem->channel, channel);
-	strcpy(newItem->value, value);
+	newItem->size = MQTT_QUEUE_ALIGN(sizeof(MqttPublishItem_t) + topicLen + channelLen + valueLen);
+	newItem->channelOfs = topicLen;
+	newItem->valueOfs = topicLen + channelLen;
 	newItem->command = command;
 	newItem->flags = flags;
+	memcpy(MQTT_PUBLISH_ITEM_TOPIC(newItem), topic, topicLen);
+	memcpy(MQTT_PUBLISH_ITEM_CHANNEL(newItem), channel, channelLen);
+	memcpy(MQTT_PUBLISH_ITEM_VALUE(newItem), value, valueLen);
 
 	g_MqttPublishItemsQueued++;
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Queued topic=%s/%s, %i items in queue", newItem->topic, newItem->channel, g_MqttPublishItemsQueued);
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Queued topic=%s/%s, %i items in queue", topic, channel, g_MqttPublishItemsQueued);
 }
 
 /// @brief Add the specified command to the last entry in the queue.
 /// @param command 
 void MQTT_InvokeCommandAtEnd(PostPublishCommands command) {
-	MqttPublishItem_t* tail = get_queue_tail(g_MqttPublishQueueHead);
-	if (tail == NULL){
+	if (g_mqttPublishQueueLast == NULL){
 		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "InvokeCommandAtEnd invoked but queue is empty");
 	}
 	else {
-		tail->command = command;
+		g_mqttPublishQueueLast->command = command;
 	}
 }
 
@@ -2485,45 +3208,38 @@ void MQTT_QueuePublish(const char* topic, const char* channel, const char* value
 /// @return 
 OBK_Publish_Result PublishQueuedItems() {
 	OBK_Publish_Result result = OBK_PUBLISH_WAS_NOT_REQUIRED;
-
+	MqttPublishItem_t* head;
+	PostPublishCommands command;
 	int count = 0;
-	MqttPublishItem_t* head = g_MqttPublishQueueHead;
-
-	//The next actionable item might not be at the front. The queue size is limited to MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE
-	//so this traversal is fast.
-	//addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"PublishQueuedItems g_MqttPublishItemsQueued=%i",g_MqttPublishItemsQueued );
-	while ((head != NULL) && (count < MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE) && (g_MqttPublishItemsQueued > 0)) {
-		if (!MQTT_QUEUE_ITEM_IS_REUSABLE(head)) {  //Skip reusable entries
-			count++;
-			result = MQTT_PublishTopicToClient(mqtt_client, head->topic, head->channel, head->value, head->flags, false);
-			MQTT_QUEUE_ITEM_SET_REUSABLE(head); //Flag item as reusable
-			g_MqttPublishItemsQueued--;   //decrement queued count
-
-			//Stop if last publish failed
-			if (result != OBK_PUBLISH_OK) break;
-
-			switch (head->command) {
-			case None:
-				break;
-			case PublishAll:
-				MQTT_PublishWholeDeviceState_Internal(true);
-				break;
-			case PublishChannels:
-				MQTT_PublishOnlyDeviceChannelsIfPossible();
-				break;
-			}
-		}
-		else {
-			//addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"PublishQueuedItems item skipped reusable");
-		}
 
-		head = head->next;
+	while ((count < MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE) && ((head = MQTT_QueuePeek()) != NULL)) {
+		count++;
+		result = MQTT_PublishTopicToClient(mqtt_client, MQTT_PUBLISH_ITEM_TOPIC(head),
+			MQTT_PUBLISH_ITEM_CHANNEL(head), MQTT_PUBLISH_ITEM_VALUE(head), head->flags, false);
+		command = (PostPublishCommands)head->command;
+		// item is removed even if publish failed
+		MQTT_QueuePop(head);
+
+		//Stop if last publish failed
+		if (result != OBK_PUBLISH_OK) break;
+
+		switch (command) {
+		case None:
+			break;
+		case PublishAll:
+			MQTT_PublishWholeDeviceState_Internal(true);
+			break;
+		case PublishChannels:
+			MQTT_PublishOnlyDeviceChannelsIfPossible();
+			break;
+		}
 	}
 
 	return result;
 }
 
 
+
 /// @brief Is MQTT sub system ready and connected?
 /// @return 
 bool MQTT_IsReady() {
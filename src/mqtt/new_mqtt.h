@@ -79,9 +79,9 @@ enum OBK_Publish_Result_e {
 
 // ability to register callbacks for MQTT data
 typedef struct obk_mqtt_request_tag {
-	const unsigned char* received; // note: NOT terminated, may be binary
+	const unsigned char* received; // note: may be binary, but always followed by NUL
 	int receivedLen;
-	char topic[128];
+	const char* topic;
 } obk_mqtt_request_t;
 
 #define MQTT_PUBLISH_ITEM_TOPIC_LENGTH    64
@@ -95,35 +95,46 @@ typedef enum PostPublishCommands_e {
 } PostPublishCommands;
 
 
-/// @brief Publish queue item
+/// @brief Publish queue record header, followed by topic, channel and value strings
 typedef struct MqttPublishItem
 {
-	char topic[MQTT_PUBLISH_ITEM_TOPIC_LENGTH];
-	char channel[MQTT_PUBLISH_ITEM_CHANNEL_LENGTH];
-	char value[MQTT_PUBLISH_ITEM_VALUE_LENGTH];
+	// whole record size with strings and padding
+	unsigned short size;
+	// offsets of channel and value strings from the topic string
+	unsigned short channelOfs;
+	unsigned short valueOfs;
+	unsigned short command;
 	int flags;
-	struct MqttPublishItem* next;
-	PostPublishCommands command;
 } MqttPublishItem_t;
 
+#define MQTT_PUBLISH_ITEM_TOPIC(x)		((char*)((x) + 1))
+#define MQTT_PUBLISH_ITEM_CHANNEL(x)	(MQTT_PUBLISH_ITEM_TOPIC(x) + (x)->channelOfs)
+#define MQTT_PUBLISH_ITEM_VALUE(x)		(MQTT_PUBLISH_ITEM_TOPIC(x) + (x)->valueOfs)
+
 
 // Maximum length to log data parameters
 #define MQTT_MAX_DATA_LOG_LENGTH					12
 
 // Count of queued items published at once.
 #define MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE	3
-// When using Hass discovery, when we have, for example,
-// 16 relays, every relay will be a separate publish,
-// so I bumped MAX to 32
-#define MQTT_MAX_QUEUE_SIZE	                32
+// Queued publishes are stored as variable length records in segments of
+// MQTT_PUBLISH_QUEUE_BYTES, allocated on first use. When using Hass discovery,
+// when we have, for example, 16 relays, every relay will be a separate publish,
+// each up to about 1 KB. Segments are added while such burst does not fit,
+// up to about room for 32 biggest records, and freed once they are read.
+#ifndef MQTT_PUBLISH_QUEUE_BYTES
+#define MQTT_PUBLISH_QUEUE_BYTES			8192
+#endif
+#define MQTT_PUBLISH_QUEUE_MAX_BYTES		(32 * (sizeof(MqttPublishItem_t) + MQTT_PUBLISH_ITEM_TOPIC_LENGTH + \
+	MQTT_PUBLISH_ITEM_CHANNEL_LENGTH + MQTT_PUBLISH_ITEM_VALUE_LENGTH + 4))
 
 // callback function for mqtt.
 // return 0 to allow the incoming topic/data to be processed by others/channel set.
 // return 1 to 'eat the packet and terminate further processing.
 typedef int (*mqtt_callback_fn)(obk_mqtt_request_t* request);
 
-// topics must be unique (i.e. you can't have /about and /aboutme or /about/me)
-// ALL topics currently must start with main device topic root.
+// callbacks are matched by subscription topic, which can use MQTT '+' and '#' wildcards.
+// If subscription topic is empty, callback gets everything under base topic, but nothing is subscribed.
 // ID is unique and non-zero - so that callbacks can be replaced....
 int MQTT_GetConnectEvents(void);
 const char* get_error_name(int err);
@@ -135,6 +146,8 @@ int MQTT_GetReceivedEventCounter(void);
 
 OBK_Publish_Result PublishQueuedItems();
 OBK_Publish_Result MQTT_ChannelPublish(int channel, int flags);
+void MQTT_ChannelChanged(int channel);
+void MQTT_FlushBatch();
 void MQTT_ClearCallbacks();
 int MQTT_RegisterCallback(const char* basetopic, const char* subscriptiontopic, int ID, mqtt_callback_fn callback);
 int MQTT_RemoveCallback(int ID);
@@ -150,6 +163,9 @@ int MQTT_Post_Received(const char *topic, int topiclen, const unsigned char *dat
 int MQTT_Post_Received_Str(const char *topic, const char *data);
 
 void MQTT_GetStats(int* outUsed, int* outMax, int* outFreeMem);
+void MQTT_GetPublishQueueStats(int* outItems, int* outBytes, int* outHighWater, int* outDropped);
+void MQTT_GetReceiveStats(int* outBytes, int* outDropped);
+void MQTT_GetTopicStats(int* outLookups, int* outNodesVisited, int* outMisses, int* outSubscribes);
 
 OBK_Publish_Result MQTT_DoItemPublish(int idx);
 OBK_Publish_Result MQTT_PublishMain_StringFloat(const char* sChannel, float f, 
@@ -7,6 +7,7 @@
 #include "mqtt/new_mqtt.h"
 #include "hal/hal_wifi.h"
 #include "hal/hal_flashConfig.h"
+#include "hal/hal_flashStats.h"
 #include "cmnds/cmd_public.h"
 #if ENABLE_LITTLEFS
 #include "littlefs/our_lfs.h"
@@ -553,6 +554,9 @@ void CFG_Save_IfThereArePendingChanges() {
 		g_cfg.changeCounter++;
 		g_cfg.crc = CFG_CalcChecksum(&g_cfg);
 		HAL_Configuration_SaveConfigMemory(&g_cfg,sizeof(g_cfg));
+		// platforms save config in their own way, assume sector is erased and rewritten
+		HAL_FlashStats_Erase(FLASH_USER_CONFIG, FLASH_STATS_ADDR_UNKNOWN);
+		HAL_FlashStats_Write(FLASH_USER_CONFIG, FLASH_STATS_ADDR_UNKNOWN, sizeof(g_cfg));
 		g_cfg_pendingChanges = 0;
 	}
 }
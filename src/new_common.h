@@ -357,6 +357,7 @@ typedef int OSStatus;
 
 int rtos_delay_milliseconds(int sec);
 int delay_ms(int sec);
+int xTaskGetTickCount();
 
 enum {
 	kNoErr = 0,
@@ -1018,6 +1019,7 @@ void RESET_ScheduleModuleReset(int delSeconds);
 void MAIN_ScheduleUnsafeInit(int delSeconds);
 #if ENABLE_HA_DISCOVERY
 void Main_ScheduleHomeAssistantDiscovery(int seconds);
+void Main_ScheduleForcedHomeAssistantDiscovery(int seconds);
 #endif
 int Main_IsConnectedToWiFi();
 int Main_IsOpenAccessPointMode();
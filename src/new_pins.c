@@ -262,6 +262,8 @@ void PINS_BeginDeepSleepWithPinWakeUp(unsigned int wakeUpTime) {
 		}
 	}
 	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Index map: %i, edge: %i", g_gpio_index_map[0], g_gpio_edge_map[0]);
+	// RAM copy of flash vars is lost in deep sleep, write pending changes now
+	HAL_FlashVars_Flush();
 #ifdef PLATFORM_BEKEN_NEW
 	PS_DEEP_CTRL_PARAM params;
 	params.gpio_index_map = g_gpio_index_map[0];
@@ -1320,7 +1322,7 @@ static void Channel_OnChanged(int ch, int prevValue, int iFlags) {
 #if ENABLE_MQTT
 	if ((iFlags & CHANNEL_SET_FLAG_SKIP_MQTT) == 0) {
 		if (CHANNEL_ShouldBePublished(ch)) {
-			MQTT_ChannelPublish(ch, 0);
+			MQTT_ChannelChanged(ch);
 		}
 	}
 #endif
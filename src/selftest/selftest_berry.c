@@ -1,6 +1,7 @@
 #ifdef WINDOWS
 
 #include "selftest_local.h"
+#include "../littlefs/our_lfs.h"
 
 
 void Test_Berry_VarLifeSpan() {
@@ -1523,6 +1524,274 @@ void Test_Berry_OpenWeatherMap() {
 	SELFTEST_ASSERT_CHANNEL(11, 180);
 }
 
+void berryGetBytecodeStats(int *hits, int *compiles, int *failures);
+static bool Test_Berry_FileExists(const char *fname) {
+	byte *data;
+
+	data = LFS_ReadFile(fname);
+	if (data == 0) {
+		return false;
+	}
+	free(data);
+	return true;
+}
+// flips one byte, negative offsets count from the end
+static void Test_Berry_FlipByte(const char *fname, int offset) {
+	lfs_file_t f;
+	byte b;
+	int size;
+
+	memset(&f, 0, sizeof(f));
+	SELFTEST_ASSERT(lfs_file_open(&lfs, &f, fname, LFS_O_RDWR) >= 0);
+	size = lfs_file_size(&lfs, &f);
+	if (offset < 0) {
+		offset += size;
+	}
+	lfs_file_seek(&lfs, &f, offset, LFS_SEEK_SET);
+	lfs_file_read(&lfs, &f, &b, 1);
+	b ^= 0xFF;
+	lfs_file_seek(&lfs, &f, offset, LFS_SEEK_SET);
+	lfs_file_write(&lfs, &f, &b, 1);
+	lfs_file_close(&lfs, &f);
+}
+void Test_Berry_BytecodeCache() {
+	int hits, compiles, failures;
+	int hits0, compiles0, failures0;
+
+	// reset whole device
+	SIM_ClearOBK(0);
+	CMD_ExecuteCommand("lfs_format", 0);
+	berryGetBytecodeStats(&hits0, &compiles0, &failures0);
+
+	Test_FakeHTTPClientPacket_POST("api/lfs/cached.be",
+		"setChannel(5, 111)\n");
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec") == false);
+
+	// first start compiles and saves bytecode next to the source
+	CMD_ExecuteCommand("setChannel 5 0", 0);
+	CMD_ExecuteCommand("startScript cached.be", 0);
+	SELFTEST_ASSERT_CHANNEL(5, 111);
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec"));
+	berryGetBytecodeStats(&hits, &compiles, &failures);
+	SELFTEST_ASSERT(compiles == compiles0 + 1);
+	SELFTEST_ASSERT(hits == hits0);
+
+	// second start uses it as it is
+	CMD_ExecuteCommand("setChannel 5 0", 0);
+	// imported modules are cached by the VM, so start a fresh one like after reboot
+	CMD_ExecuteCommand("stopBerry", 0);
+	CMD_ExecuteCommand("startScript cached.be", 0);
+	SELFTEST_ASSERT_CHANNEL(5, 111);
+	berryGetBytecodeStats(&hits, &compiles, &failures);
+	SELFTEST_ASSERT(compiles == compiles0 + 1);
+	SELFTEST_ASSERT(hits == hits0 + 1);
+
+	// uploading new source drops the stale bytecode at once
+	Test_FakeHTTPClientPacket_POST("api/lfs/cached.be",
+		"setChannel(5, 222)\n");
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec") == false);
+	CMD_ExecuteCommand("stopBerry", 0);
+	CMD_ExecuteCommand("startScript cached.be", 0);
+	SELFTEST_ASSERT_CHANNEL(5, 222);
+	berryGetBytecodeStats(&hits, &compiles, &failures);
+	SELFTEST_ASSERT(compiles == compiles0 + 2);
+
+	// writing the source from a script drops the bytecode too
+	LFS_WriteFile("cached.be", (const byte*)"setChannel(5, 333)\n", strlen("setChannel(5, 333)\n"), false);
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec") == false);
+	CMD_ExecuteCommand("stopBerry", 0);
+	CMD_ExecuteCommand("startScript cached.be", 0);
+	SELFTEST_ASSERT_CHANNEL(5, 333);
+	berryGetBytecodeStats(&hits, &compiles, &failures);
+	SELFTEST_ASSERT(compiles == compiles0 + 3);
+
+	// plain import also loads the bytecode
+	CMD_ExecuteCommand("setChannel 5 0", 0);
+	CMD_ExecuteCommand("stopBerry", 0);
+	CMD_ExecuteCommand("berry import cached", 0);
+	SELFTEST_ASSERT_CHANNEL(5, 333);
+
+	// lfs_* commands drop it
+	CMD_ExecuteCommand("lfs_writeLine cached.be setChannel(5, 444)", 0);
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec") == false);
+	CMD_ExecuteCommand("startScript cached.be", 0);
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec"));
+	CMD_ExecuteCommand("lfs_appendLine cached.be setChannel(6, 1)", 0);
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec") == false);
+	CMD_ExecuteCommand("startScript cached.be", 0);
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec"));
+	CMD_ExecuteCommand("lfs_remove cached.be", 0);
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec") == false);
+	Test_FakeHTTPClientPacket_POST("api/lfs/cached.be",
+		"setChannel(5, 333)\n");
+
+	// plain import of a copy built from another source falls back to the source
+	CMD_ExecuteCommand("startScript cached.be", 0);
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec"));
+	// trailer hash
+	Test_Berry_FlipByte("cached.bec", -12);
+	CMD_ExecuteCommand("setChannel 5 0", 0);
+	CMD_ExecuteCommand("stopBerry", 0);
+	CMD_ExecuteCommand("berry import cached", 0);
+	SELFTEST_ASSERT_CHANNEL(5, 333);
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec") == false);
+
+	// or by another firmware, like after an OTA
+	CMD_ExecuteCommand("startScript cached.be", 0);
+	// trailer version
+	Test_Berry_FlipByte("cached.bec", -4);
+	CMD_ExecuteCommand("setChannel 5 0", 0);
+	CMD_ExecuteCommand("stopBerry", 0);
+	CMD_ExecuteCommand("berry import cached", 0);
+	SELFTEST_ASSERT_CHANNEL(5, 333);
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec") == false);
+
+	// start checks only the trailer, bytecode the loader rejects
+	// fails the import until it is rebuilt with berryCompile
+	CMD_ExecuteCommand("startScript cached.be", 0);
+	// Berry bytecode header
+	Test_Berry_FlipByte("cached.bec", 0);
+	berryGetBytecodeStats(&hits0, &compiles0, &failures0);
+	CMD_ExecuteCommand("setChannel 5 0", 0);
+	CMD_ExecuteCommand("stopBerry", 0);
+	CMD_ExecuteCommand("startScript cached.be", 0);
+	SELFTEST_ASSERT_CHANNEL(5, 0);
+	berryGetBytecodeStats(&hits, &compiles, &failures);
+	SELFTEST_ASSERT(compiles == compiles0);
+	SELFTEST_ASSERT(hits == hits0 + 1);
+	CMD_ExecuteCommand("berryCompile cached.be", 0);
+	CMD_ExecuteCommand("stopBerry", 0);
+	CMD_ExecuteCommand("startScript cached.be", 0);
+	SELFTEST_ASSERT_CHANNEL(5, 333);
+
+	// explicit compile always rebuilds
+	berryGetBytecodeStats(&hits0, &compiles0, &failures0);
+	CMD_ExecuteCommand("berryCompile cached.be", 0);
+	berryGetBytecodeStats(&hits, &compiles, &failures);
+	SELFTEST_ASSERT(compiles == compiles0 + 1);
+	SELFTEST_ASSERT(CMD_ExecuteCommand("berryCompile missing.be", 0) == CMD_RES_BAD_ARGUMENT);
+
+	// broken source must not be hidden by an old bytecode
+	LFS_WriteFile("cached.be", (const byte*)"setChannel(5, \n", strlen("setChannel(5, \n"), false);
+	SELFTEST_ASSERT(CMD_ExecuteCommand("berryCompile cached.be", 0) == CMD_RES_ERROR);
+	SELFTEST_ASSERT(Test_Berry_FileExists("cached.bec") == false);
+	berryGetBytecodeStats(&hits, &compiles, &failures);
+	SELFTEST_ASSERT(failures == failures0 + 1);
+
+	// Berry pages keep their generated code compiled too
+	Test_FakeHTTPClientPacket_POST("api/lfs/page.html",
+		"<h1>Hello <?b echo(2+2)?></h1>");
+	Test_FakeHTTPClientPacket_GET("api/run/page.html");
+	SELFTEST_ASSERT_HTML_REPLY("<h1>Hello 4</h1>");
+	SELFTEST_ASSERT(Test_Berry_FileExists("page.html.bec"));
+	berryGetBytecodeStats(&hits0, &compiles0, &failures0);
+	Test_FakeHTTPClientPacket_GET("api/run/page.html");
+	SELFTEST_ASSERT_HTML_REPLY("<h1>Hello 4</h1>");
+	berryGetBytecodeStats(&hits, &compiles, &failures);
+	SELFTEST_ASSERT(hits == hits0 + 1);
+	SELFTEST_ASSERT(compiles == compiles0);
+	Test_FakeHTTPClientPacket_POST("api/lfs/page.html",
+		"<h1>Hello <?b echo(3+3)?></h1>");
+	Test_FakeHTTPClientPacket_GET("api/run/page.html");
+	SELFTEST_ASSERT_HTML_REPLY("<h1>Hello 6</h1>");
+	// pages without code are not compiled at all
+	Test_FakeHTTPClientPacket_POST("api/lfs/plain.html", "<h1>Hello</h1>");
+	Test_FakeHTTPClientPacket_GET("api/run/plain.html");
+	SELFTEST_ASSERT_HTML_REPLY("<h1>Hello</h1>");
+	SELFTEST_ASSERT(Test_Berry_FileExists("plain.html.bec") == false);
+}
+
+void berryGetDispatchStats(int *events, int *batches, int *gcRuns, int *seconds);
+void Test_Berry_BatchedDispatch() {
+	int events, batches, gcRuns, seconds;
+	int events0, batches0;
+	int i;
+
+	// reset whole device
+	SIM_ClearOBK(0);
+	CMD_ExecuteCommand("lfs_format", 0);
+	CMD_ExecuteCommand("setChannel 1 0", 0);
+	CMD_ExecuteCommand("setChannel 2 0", 0);
+	CMD_ExecuteCommand("setChannel 3 0", 0);
+
+	int startStackSize = Berry_GetStackSizeCurrent();
+	// two handlers of one event share the payload
+	CMD_ExecuteCommand("berry addEventHandler(\"OnDP\", 2, def(value)\n"
+		"  addChannel(1, value[0])\n"
+		"end)", 0);
+	CMD_ExecuteCommand("berry addEventHandler(\"OnDP\", 2, def(value)\n"
+		"  addChannel(2, value.size())\n"
+		"end)", 0);
+	CMD_ExecuteCommand("berry addEventHandler(\"OnDP\", def(id, value)\n"
+		"  addChannel(3, id)\n"
+		"end)", 0);
+	CMD_ExecuteCommand("berry addEventHandler(\"OnMQTT\", def(topic, value)\n"
+		"  setChannel(4, int(value))\n"
+		"end)", 0);
+	SELFTEST_ASSERT(Berry_GetStackSizeCurrent() == startStackSize);
+
+	berryGetDispatchStats(&events0, &batches0, &gcRuns, &seconds);
+	{
+		byte bytes[] = { 5, 6, 7 };
+		CMD_Berry_RunEventHandlers_IntBytes(CMD_EVENT_ON_DP, 2, bytes, sizeof(bytes));
+	}
+	SELFTEST_ASSERT_CHANNEL(1, 5);
+	SELFTEST_ASSERT_CHANNEL(2, 3);
+	SELFTEST_ASSERT_CHANNEL(3, 2);
+	SELFTEST_ASSERT(Berry_GetStackSizeCurrent() == startStackSize);
+	berryGetDispatchStats(&events, &batches, &gcRuns, &seconds);
+	SELFTEST_ASSERT(events == events0 + 3);
+	SELFTEST_ASSERT(batches == batches0 + 1);
+
+	// many events of one frame, as TuyaMCU sends them, make one batch
+	Berry_BeginEventBatch();
+	for (i = 0; i < 100; i++) {
+		byte bytes[] = { 1, 2 };
+		CMD_Berry_RunEventHandlers_IntBytes(CMD_EVENT_ON_DP, 2, bytes, sizeof(bytes));
+	}
+	Berry_EndEventBatch();
+	SELFTEST_ASSERT_CHANNEL(1, 5 + 100);
+	SELFTEST_ASSERT_CHANNEL(2, 3 + 200);
+	SELFTEST_ASSERT_CHANNEL(3, 2 + 200);
+	SELFTEST_ASSERT(Berry_GetStackSizeCurrent() == startStackSize);
+	berryGetDispatchStats(&events, &batches, &gcRuns, &seconds);
+	SELFTEST_ASSERT(events == events0 + 3 + 300);
+	SELFTEST_ASSERT(batches == batches0 + 2);
+
+	// code that allocates a lot inside a batch is still collected,
+	// the heap peaks at most BERRY_BATCH_GC_SLACK (4) times higher than without a batch
+	CMD_ExecuteCommand("berry import gc\n"
+		"def _alloc_peak()\n"
+		"  var peak = 0\n"
+		"  for i: 0 .. 10000\n"
+		"    var l = [i, i, i, i, i, i, i, i]\n"
+		"    if gc.allocated() > peak peak = gc.allocated() end\n"
+		"  end\n"
+		"  return peak\n"
+		"end\n"
+		"_peak0 = _alloc_peak()", 0);
+	CMD_ExecuteCommand("setChannel 7 0", 0);
+	Berry_BeginEventBatch();
+	CMD_ExecuteCommand("berry setChannel(7, _alloc_peak() / _peak0)", 0);
+	Berry_EndEventBatch();
+	SELFTEST_ASSERT(CHANNEL_Get(7) <= 4);
+
+	// strings are still passed as strings
+	CMD_Berry_RunEventHandlers_Str(CMD_EVENT_ON_MQTT, "abc", "4321");
+	SELFTEST_ASSERT_CHANNEL(4, 4321);
+	SELFTEST_ASSERT(Berry_GetStackSizeCurrent() == startStackSize);
+
+	// events with no handlers don't count
+	CMD_Berry_RunEventHandlers_IntInt(CMD_EVENT_PIN_ONCLICK, 5, 0);
+	berryGetDispatchStats(&events, &batches, &gcRuns, &seconds);
+	SELFTEST_ASSERT(batches == batches0 + 3);
+
+	CMD_ExecuteCommand("berryDispatchStats 1", 0);
+	berryGetDispatchStats(&events, &batches, &gcRuns, &seconds);
+	SELFTEST_ASSERT(events == 0);
+	SELFTEST_ASSERT(batches == 0);
+}
+
 void Test_Berry() {
 
 	Test_Berry_Click_And_Timeout();
@@ -1538,6 +1807,8 @@ void Test_Berry() {
 	Test_Berry_SetInterval();
 	Test_Berry_SetTimeout();
     Test_Berry_Import();
+	Test_Berry_BytecodeCache();
+	Test_Berry_BatchedDispatch();
     Test_Berry_ThreadCleanup();
     Test_Berry_AutoloadModule();
 	Test_Berry_StartScriptShortcut();
@@ -241,11 +241,70 @@ void Test_Commands_Alias_Chain2() {
 	SELFTEST_ASSERT_CHANNEL(6, 666);
 	SELFTEST_ASSERT_CHANNEL(10, 4*111);
 }
+void Test_Commands_Prepared() {
+	int i;
+	int loops = 20;
+	int runs0, fallbacks0;
+	int runs, fallbacks;
+	const char *text = "backlog addChannel 1 1; addChannel 2 $CH3; setChannel 4 $CH1";
+	cmdPrepared_t *p;
+
+	// reset whole device
+	SIM_ClearOBK(0);
+
+	// channel variables are expanded when command runs, not when it is prepared
+	p = CMD_PrepareCommand(text);
+	SELFTEST_ASSERT(p != 0);
+	SELFTEST_ASSERT_STRING(CMD_GetPreparedCommandText(p), text);
+	CMD_ExecuteCommand("setChannel 3 5", 0);
+	CMD_ExecutePreparedCommand(p, 0);
+	SELFTEST_ASSERT_CHANNEL(1, 1);
+	SELFTEST_ASSERT_CHANNEL(2, 5);
+	SELFTEST_ASSERT_CHANNEL(4, 1);
+	CMD_ExecuteCommand("setChannel 3 7", 0);
+	CMD_ExecutePreparedCommand(p, 0);
+	SELFTEST_ASSERT_CHANNEL(1, 2);
+	SELFTEST_ASSERT_CHANNEL(2, 12);
+	SELFTEST_ASSERT_CHANNEL(4, 2);
+	CMD_FreePreparedCommand(p);
+
+	// alias can refer to another alias created later
+	CMD_ExecuteCommand("alias later1 backlog addChannel 5 10;; later2", 0);
+	CMD_ExecuteCommand("alias later2 addChannel 6 20", 0);
+	CMD_ExecuteCommand("later1", 0);
+	SELFTEST_ASSERT_CHANNEL(5, 10);
+	SELFTEST_ASSERT_CHANNEL(6, 20);
+
+	// same result as executing the text
+	SIM_ClearOBK(0);
+	CMD_ExecuteCommand("setChannel 3 5", 0);
+	for (i = 0; i < loops; i++) {
+		CMD_ExecuteCommand(text, 0);
+	}
+	SELFTEST_ASSERT_CHANNEL(1, loops);
+	SELFTEST_ASSERT_CHANNEL(2, loops * 5);
+	SELFTEST_ASSERT_CHANNEL(4, loops);
+
+	// every part resolved up front, nothing goes through the text path
+	CMD_GetPreparedCommandStats(&runs0, &fallbacks0);
+	p = CMD_PrepareCommand(text);
+	for (i = 0; i < loops; i++) {
+		CMD_ExecutePreparedCommand(p, 0);
+	}
+	SELFTEST_ASSERT_CHANNEL(1, loops * 2);
+	SELFTEST_ASSERT_CHANNEL(2, loops * 10);
+	SELFTEST_ASSERT_CHANNEL(4, loops * 2);
+	CMD_FreePreparedCommand(p);
+	CMD_GetPreparedCommandStats(&runs, &fallbacks);
+	SELFTEST_ASSERT(runs == runs0 + loops);
+	SELFTEST_ASSERT(fallbacks == fallbacks0);
+}
 
 void Test_Commands_Alias() {
 	Test_Commands_Alias_Generic();
 	Test_Commands_Alias_Chain();
 	Test_Commands_Alias_Chain2();
+	Test_Commands_Prepared();
 }
 
 #endif
@@ -1,6 +1,7 @@
 #ifdef WINDOWS
 
 #include "selftest_local.h"
+#include "../driver/drv_uart.h"
 
 void Test_Events() {
 	// reset whole device
@@ -45,6 +46,39 @@ void Test_Events() {
 	EventHandlers_FireEvent3(123, 1, 2, 3);
 	SELFTEST_ASSERT_CHANNEL(10, 222);
 
+	// many handlers for the same event, each with other argument
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+	for (int i = 0; i < 64; i++) {
+		CMD_ExecuteCommand(va("addEventHandler 123 %i setChannel 11 %i", i, i + 1000), 0);
+	}
+	CMD_ExecuteCommand("addEventHandler 124 40 setChannel 12 40", 0);
+	CMD_ExecuteCommand("addChangeHandler Channel11 == 1040 setChannel 13 1", 0);
+	SELFTEST_ASSERT(EventHandlers_GetActiveCount() == 66);
+	EventHandlers_FireEvent(123, 40);
+	SELFTEST_ASSERT_CHANNEL(11, 1040);
+	SELFTEST_ASSERT_CHANNEL(12, 0);
+	SELFTEST_ASSERT_CHANNEL(13, 1);
+	EventHandlers_FireEvent(123, 7);
+	SELFTEST_ASSERT_CHANNEL(11, 1007);
+	EventHandlers_FireEvent(124, 40);
+	SELFTEST_ASSERT_CHANNEL(12, 40);
+	EventHandlers_FireEvent(123, 64);
+	SELFTEST_ASSERT_CHANNEL(11, 1007);
+	CMD_ExecuteCommand("eventHandlerStats", 0);
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+	SELFTEST_ASSERT(EventHandlers_GetActiveCount() == 0);
+
+	// handlers from different buckets still run newest first, as with one list;
+	// each one appends its digit to channel 14
+	CMD_ExecuteCommand("setChannel 14 0", 0);
+	CMD_ExecuteCommand("addEventHandler 123 0 setChannel 14 $CH14*10+1", 0);
+	CMD_ExecuteCommand("addEventHandler 123 abc setChannel 14 $CH14*10+2", 0);
+	CMD_ExecuteCommand("addEventHandler 123 0 setChannel 14 $CH14*10+3", 0);
+	CMD_ExecuteCommand("addEventHandler 123 def setChannel 14 $CH14*10+4", 0);
+	EventHandlers_FireEvent(123, 0);
+	SELFTEST_ASSERT_CHANNEL(14, 4321);
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+
 	// test events parse
 	SELFTEST_ASSERT(EVENT_ParseEventName("channel1") == CMD_EVENT_CHANGE_CHANNEL0 + 1);
 	SELFTEST_ASSERT(EVENT_ParseEventName("channel6") == CMD_EVENT_CHANGE_CHANNEL0 + 6);
@@ -130,9 +164,86 @@ void Test_Events() {
 	SELFTEST_ASSERT_CHANNEL(10, 4);
 }
 
+static void Test_UART_Bulk() {
+	byte data[300];
+	byte out[300];
+	uartSpan_t span;
+	int i;
+	static const byte header[2] = { 0x55, 0xAA };
+
+	for (i = 0; i < (int)sizeof(data); i++) {
+		data[i] = i * 7 + 3;
+	}
+	UART_InitReceiveRingBuffer(64);
+	SELFTEST_ASSERT(UART_GetReceiveRingBufferSize() == 64);
+	// move pointers close to the end, so next block wraps
+	UART_AppendBytes(data, 60);
+	SELFTEST_ASSERT(UART_GetDataSize() == 60);
+	SELFTEST_ASSERT(UART_ReadBytes(out, 60) == 60);
+	SELFTEST_ASSERT(memcmp(out, data, 60) == 0);
+	SELFTEST_ASSERT(UART_GetDataSize() == 0);
+	UART_AppendBytes(data, 10);
+	SELFTEST_ASSERT(UART_GetDataSize() == 10);
+	for (i = 0; i < 10; i++) {
+		SELFTEST_ASSERT(UART_GetByte(i) == data[i]);
+	}
+	// wrapped data is returned as two slices
+	SELFTEST_ASSERT(UART_PeekSpan(0, 10, &span) == 10);
+	SELFTEST_ASSERT(span.firstLen == 4);
+	SELFTEST_ASSERT(span.secondLen == 6);
+	SELFTEST_ASSERT(memcmp(span.first, data, 4) == 0);
+	SELFTEST_ASSERT(memcmp(span.second, data + 4, 6) == 0);
+	SELFTEST_ASSERT(UART_PeekSpan(5, 100, &span) == 5);
+	SELFTEST_ASSERT(span.firstLen == 0 || span.first[0] == data[5]);
+	SELFTEST_ASSERT(UART_PeekBytes(2, out, 6) == 6);
+	SELFTEST_ASSERT(memcmp(out, data + 2, 6) == 0);
+	// peek does not consume
+	SELFTEST_ASSERT(UART_GetDataSize() == 10);
+	SELFTEST_ASSERT(UART_ReadBytes(out, 100) == 10);
+	SELFTEST_ASSERT(memcmp(out, data, 10) == 0);
+	SELFTEST_ASSERT(UART_GetDataSize() == 0);
+
+	// overflow keeps the last capacity bytes, same as byte by byte append
+	UART_AppendBytes(data, 40);
+	UART_AppendBytes(data + 40, 40);
+	SELFTEST_ASSERT(UART_GetDataSize() == 63);
+	SELFTEST_ASSERT(UART_ReadBytes(out, 63) == 63);
+	SELFTEST_ASSERT(memcmp(out, data + 80 - 63, 63) == 0);
+	UART_AppendBytes(data, 300);
+	SELFTEST_ASSERT(UART_GetDataSize() == 63);
+	SELFTEST_ASSERT(UART_ReadBytes(out, 63) == 63);
+	SELFTEST_ASSERT(memcmp(out, data + 300 - 63, 63) == 0);
+
+	// header search, across the wrap point and cut at the end
+	UART_InitReceiveRingBuffer(64);
+	UART_AppendBytes(data, 62);
+	UART_ConsumeBytes(62);
+	memset(out, 0x11, sizeof(out));
+	out[0] = 0x55;
+	out[1] = 0x00;
+	out[2] = 0xAA;
+	out[3] = 0x55;
+	out[4] = 0xAA;
+	UART_AppendBytes(out, 8);
+	SELFTEST_ASSERT(UART_FindHeader(header, 2) == 3);
+	UART_ConsumeBytes(8);
+	UART_AppendBytes(out, 2);
+	SELFTEST_ASSERT(UART_FindHeader(header, 2) == -1);
+	out[5] = 0x55;
+	UART_AppendBytes(out + 5, 1);
+	// only first byte of header present yet
+	SELFTEST_ASSERT(UART_FindHeader(header, 2) == 2);
+	UART_ConsumeBytes(100);
+	SELFTEST_ASSERT(UART_GetDataSize() == 0);
+	SELFTEST_ASSERT(UART_FindHeader(header, 2) == -1);
+}
+
 void Test_UART() {
 	int USED_BUFFER_SIZE = 123;
 	UART_InitReceiveRingBuffer(USED_BUFFER_SIZE);
+	// size is rounded up to power of two
+	SELFTEST_ASSERT(UART_GetReceiveRingBufferSize() == 128);
+	USED_BUFFER_SIZE = UART_GetReceiveRingBufferSize();
 	byte next = 0;
 	for (int i = 0; i < 512; i++) {
 		SELFTEST_ASSERT(UART_GetDataSize() == 0);
@@ -176,6 +287,7 @@ void Test_UART() {
 		SELFTEST_ASSERT(realSize == reportedSize);
 		next++;
 	}
+	Test_UART_Bulk();
 }
 
 void Test_PinMutex() {
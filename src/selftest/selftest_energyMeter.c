@@ -4,6 +4,10 @@
 
 #if ENABLE_BL_SHARED
 
+#include "../cJSON/cJSON.h"
+#include "../driver/drv_bl_shared.h"
+#include "../driver/drv_bl_energy.h"
+
 
 void Test_EnergyMeter_Basic() {
 	SIM_ClearOBK(0);
@@ -493,6 +497,100 @@ void Test_EnergyMeter_Limits() {
 	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_FLOAT("powerDevice/power_apparent/get", 696.0f, false);
 
 }
+// 30 days of BL0942 packets, about one per second, with tick count wrapping on the way
+void Test_EnergyMeter_Accuracy() {
+	energyAccum_t fromPower, fromEnergy;
+	double reference, errPower, errEnergy;
+	uint32_t tick, passed;
+	bool bWrapped;
+	float power, energyWh;
+	int i;
+
+	tick = 0xFFFFFFFF - 5000;
+	bWrapped = false;
+	EnergyAccum_Set(&fromPower, 0, tick);
+	EnergyAccum_Set(&fromEnergy, 0, tick);
+	reference = 0;
+	srand(1234);
+	for (i = 0; i < 30 * 24 * 3600; i++) {
+		passed = 900 + rand() % 200;
+		tick += passed;
+		if (tick < passed) {
+			bWrapped = true;
+		}
+		// base load at night, more during the day, with some noise
+		power = 40.0f + ((i % 86400) < 28800 ? 0 : 150.0f) + (rand() % 1000) * 0.01f;
+		// what BL0942 reports from CF pulse count
+		energyWh = power * passed / 3600000.0f;
+		reference += (double)power * passed / 3600000.0;
+		EnergyAccum_AddPower(&fromPower, power, tick);
+		EnergyAccum_AddEnergy(&fromEnergy, energyWh, tick);
+	}
+	SELFTEST_ASSERT(bWrapped);
+	errPower = fabs(EnergyAccum_GetWh(&fromPower) - reference);
+	errEnergy = fabs(EnergyAccum_GetWh(&fromEnergy) - reference);
+	SELFTEST_ASSERT(reference > 100000);
+	SELFTEST_ASSERT(errPower < 0.01);
+	SELFTEST_ASSERT(errEnergy < 0.01);
+}
+
+void Test_EnergyMeter_History() {
+	energyAccum_t acc;
+	energyRing_t ring;
+	uint32_t buckets[10];
+	uint32_t tick;
+	uint32_t sum;
+	int i, j;
+
+	tick = 0;
+	EnergyAccum_Set(&acc, 0, tick);
+	EnergyRing_Init(&ring, buckets, 10, acc.total);
+	// 10.01W is 166.83 mWh per minute
+	for (i = 0; i < 25; i++) {
+		for (j = 0; j < 60; j++) {
+			tick += 1000;
+			EnergyAccum_AddPower(&acc, 10.01f, tick);
+			EnergyRing_Update(&ring, acc.total);
+		}
+		EnergyRing_Next(&ring, acc.total);
+	}
+	SELFTEST_ASSERT(EnergyRing_Get(&ring, 0) == 0);
+	for (i = 1; i < 10; i++) {
+		SELFTEST_ASSERT(EnergyRing_Get(&ring, i) == 166 || EnergyRing_Get(&ring, i) == 167);
+	}
+	// truncation does not add up, last 9 minutes are exactly 4170 - 2669 mWh
+	sum = EnergyRing_Sum(&ring);
+	SELFTEST_ASSERT(sum == 1501);
+
+	SIM_ClearOBK(0);
+	SIM_ClearAndPrepareForMQTTTesting("miscDevice", "bekens");
+
+	CMD_ExecuteCommand("startDriver TESTPOWER", 0);
+	CMD_ExecuteCommand("SetupEnergyStats 1 10 12 1", 0);
+	CMD_ExecuteCommand("SetupTestPower 230 0.26 60 50 0", 0);
+	Sim_RunSeconds(3, false);
+	CMD_ExecuteCommand("EnergyCntReset 1234.5", 0);
+	SELFTEST_ASSERT_EXPRESSION("$energy", 1234.5f);
+	{
+		const char *msg;
+		cJSON *json, *samples;
+
+		msg = BL09XX_PrintConsumptionStats();
+		SELFTEST_ASSERT(msg != 0);
+		json = cJSON_Parse(msg);
+		SELFTEST_ASSERT(json != 0);
+		SELFTEST_ASSERT(Float_Equals(cJSON_GetObjectItem(json, "consumption_total")->valuedouble, 1234.5f));
+		SELFTEST_ASSERT(cJSON_GetObjectItem(json, "consumption_sample_count")->valueint == 12);
+		SELFTEST_ASSERT(cJSON_GetObjectItem(json, "consumption_sampling_period")->valueint == 10);
+		samples = cJSON_GetObjectItem(json, "consumption_samples");
+		SELFTEST_ASSERT(cJSON_GetArraySize(samples) == 12);
+		samples = cJSON_GetObjectItem(json, "consumption_hourly");
+		SELFTEST_ASSERT(cJSON_GetArraySize(samples) == ENERGY_HOURS_COUNT);
+		cJSON_Delete(json);
+	}
+	CMD_ExecuteCommand("SetupEnergyStats 0 10 12 0", 0);
+	SELFTEST_ASSERT(BL09XX_PrintConsumptionStats() == 0);
+}
 void Test_EnergyMeter() {
 	Test_EnergyMeter_CSE7766();
 #ifndef LINUX
@@ -504,6 +602,8 @@ void Test_EnergyMeter() {
 	Test_EnergyMeter_Events();
 	Test_EnergyMeter_TurnOffScript();
 	Test_EnergyMeter_Limits();
+	Test_EnergyMeter_Accuracy();
+	Test_EnergyMeter_History();
 }
 
 #endif
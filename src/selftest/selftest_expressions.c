@@ -312,4 +312,90 @@ void Test_Expressions_RunTests_Braces() {
 
 }
 
+static const char *g_benchExpressions[] = {
+	"$CH1*10.0",
+	"$CH5 > 2",
+	"1000*$CH1+100*$CH1-10*$CH1+$CH1*1",
+	"(($CH2+$CH1)*(5+6))+((2.0*$CH2)+$CH1)",
+	"-1+2 >= 10-10 || 5 >= 3+4",
+	"!$CH1\n\r",
+	"$CH1&&$CH5 || $CH2 % 2",
+	"$FLAG10+$uptime*0",
+};
+static int g_numBenchExpressions = sizeof(g_benchExpressions) / sizeof(g_benchExpressions[0]);
+
+void Test_Expressions_Compiled() {
+	int i;
+	int runs0, compiles0;
+	int runs, compiles;
+	char tmp[64];
+	expProgram_t *p;
+
+	// reset whole device
+	SIM_ClearOBK(0);
+
+	CHANNEL_Set(1, 2, 0);
+	CHANNEL_Set(2, 3, 0);
+	CHANNEL_Set(5, 7, 0);
+
+	// compiled program must give exactly the same results as the old evaluator
+	for (i = 0; i < g_numBenchExpressions; i++) {
+		p = CMD_CompileExpression(g_benchExpressions[i], 0);
+		SELFTEST_ASSERT(p != 0);
+		SELFTEST_ASSERT(Float_Equals(CMD_RunExpression(p), CMD_EvaluateExpression_Interpreted(g_benchExpressions[i], 0)));
+		SELFTEST_ASSERT(Float_Equals(CMD_EvaluateExpression(g_benchExpressions[i], 0), CMD_EvaluateExpression_Interpreted(g_benchExpressions[i], 0)));
+		CMD_FreeExpression(p);
+	}
+	// channel values are read at run time, not at compile time
+	SELFTEST_ASSERT_EXPRESSION("$CH5 > 2", 1);
+	CHANNEL_Set(5, 1, 0);
+	SELFTEST_ASSERT_EXPRESSION("$CH5 > 2", 0);
+	// subexpression without constants is folded
+	SELFTEST_ASSERT_EXPRESSION("(3 - 6) % (4 + 2)", -3);
+
+	// plain commands are not compiled at all
+	CMD_GetExpressionStats(&runs0, &compiles0);
+	CMD_ExecuteCommand("setChannel 3 $CH1*10+$CH2", 0);
+	SELFTEST_ASSERT_CHANNEL(3, 23);
+	CMD_GetExpressionStats(&runs, &compiles);
+	SELFTEST_ASSERT(compiles == compiles0);
+
+	// prepared command (alias) compiles once and keeps it
+	CMD_ExecuteCommand("alias calc setChannel 3 $CH1*10+$CH2", 0);
+	for (i = 0; i < 5; i++) {
+		CHANNEL_Set(1, i, 0);
+		CMD_ExecuteCommand("calc", 0);
+		SELFTEST_ASSERT_CHANNEL(3, i * 10 + 3);
+	}
+	CMD_GetExpressionStats(&runs, &compiles);
+	SELFTEST_ASSERT(compiles == compiles0 + 1);
+	SELFTEST_ASSERT(runs == runs0 + 5);
+
+	// many distinct expressions don't evict each other, each handler has its own
+	for (i = 0; i < 24; i++) {
+		sprintf(tmp, "alias calc%i setChannel 4 $CH2*%i+1", i, i);
+		CMD_ExecuteCommand(tmp, 0);
+	}
+	CMD_GetExpressionStats(&runs0, &compiles0);
+	for (i = 0; i < 24 * 3; i++) {
+		sprintf(tmp, "calc%i", i % 24);
+		CMD_ExecuteCommand(tmp, 0);
+		SELFTEST_ASSERT_CHANNEL(4, 3 * (i % 24) + 1);
+	}
+	CMD_GetExpressionStats(&runs, &compiles);
+	SELFTEST_ASSERT(compiles == compiles0 + 24);
+	SELFTEST_ASSERT(runs == runs0 + 24 * 3);
+
+	// if/else branches of one handler keep separate slots
+	CMD_ExecuteCommand("alias branch if $CH5>2 then \"setChannel 6 $CH5+1\" else \"setChannel 6 $CH5+2\"", 0);
+	CMD_GetExpressionStats(&runs0, &compiles0);
+	for (i = 0; i < 10; i++) {
+		CHANNEL_Set(5, i, 0);
+		CMD_ExecuteCommand("branch", 0);
+		SELFTEST_ASSERT_CHANNEL(6, (i > 2 ? i + 1 : i + 2));
+	}
+	CMD_GetExpressionStats(&runs, &compiles);
+	SELFTEST_ASSERT(compiles == compiles0 + 3);
+}
+
 #endif
@@ -0,0 +1,170 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+#include "../hal/hal_flashVars.h"
+#include "../hal/hal_flashStats.h"
+
+// same area as in hal_flashVars_win32.c
+#define TEST_FLASH_VARS_ADDR 0x1e3000
+
+void SIM_FlashVars_Reload();
+void SIM_FlashVars_Clear();
+// emulated flash, win_flash_stub.c
+extern byte *g_flash;
+
+void Test_FlashVars() {
+	flashVarsJournalStats_t st;
+	int legacyBytes;
+	int i;
+
+	SIM_ClearOBK(0);
+	SIM_ClearAndPrepareForMQTTTesting("flashDevice", "bekens");
+	FlashVarsJournal_ResetStats();
+
+	// dimmer slide on a retained channel
+	CMD_ExecuteCommand("SetStartValue 1 -1", 0);
+	for (i = 0; i <= 100; i++) {
+		CMD_ExecuteCommand(va("setChannel 1 %i", i), 0);
+	}
+	FlashVarsJournal_GetStats(&st);
+	SELFTEST_ASSERT(st.saves >= 100);
+	// nothing written yet, waiting for debounce
+	SELFTEST_ASSERT(st.writes == 0);
+	Sim_RunSeconds(FLASH_VARS_JOURNAL_DELAY_SECONDS + 1, false);
+	FlashVarsJournal_GetStats(&st);
+	// boot count is already there, so only the final value is appended
+	SELFTEST_ASSERT(st.erases == 0);
+	SELFTEST_ASSERT(st.writes == 1);
+	SELFTEST_ASSERT(st.flushes == 1);
+	// previously every save was a full structure write
+	legacyBytes = st.saves * sizeof(FLASH_VARS_STRUCTURE);
+	SELFTEST_ASSERT(st.bytesWritten * 10 < legacyBytes);
+
+	// next change is a small delta record
+	FlashVarsJournal_ResetStats();
+	CMD_ExecuteCommand("setChannel 1 55", 0);
+	HAL_FlashVars_Flush();
+	FlashVarsJournal_GetStats(&st);
+	SELFTEST_ASSERT(st.writes == 1);
+	SELFTEST_ASSERT(st.erases == 0);
+	SELFTEST_ASSERT(st.bytesWritten < 10);
+	// flush with nothing pending does nothing
+	HAL_FlashVars_Flush();
+	FlashVarsJournal_GetStats(&st);
+	SELFTEST_ASSERT(st.writes == 1);
+
+	// power cycle
+	SIM_FlashVars_Reload();
+	SELFTEST_ASSERT(HAL_FlashVars_GetChannelValue(1) == 55);
+
+	// pending change is written before deep sleep, RAM copy would be lost there
+	FlashVarsJournal_ResetStats();
+	CMD_ExecuteCommand("setChannel 1 66", 0);
+	FlashVarsJournal_GetStats(&st);
+	SELFTEST_ASSERT(st.writes == 0);
+	CMD_ExecuteCommand("DeepSleep 10", 0);
+	FlashVarsJournal_GetStats(&st);
+	SELFTEST_ASSERT(st.writes == 1);
+	SIM_FlashVars_Reload();
+	SELFTEST_ASSERT(HAL_FlashVars_GetChannelValue(1) == 66);
+	CMD_ExecuteCommand("setChannel 1 55", 0);
+	HAL_FlashVars_Flush();
+
+	// filling sector moves journal to the other one
+	FlashVarsJournal_ResetStats();
+	for (i = 0; i < 1000; i++) {
+		HAL_FlashVars_SaveChannel(2, i);
+		HAL_FlashVars_Flush();
+	}
+	FlashVarsJournal_GetStats(&st);
+	SELFTEST_ASSERT(st.compactions > 0);
+	SELFTEST_ASSERT(st.erases == st.compactions);
+	// two byte changes per record, so about 0x1000 / 8 records per sector
+	SELFTEST_ASSERT(st.erases < 1000 / 400);
+	SIM_FlashVars_Reload();
+	SELFTEST_ASSERT(HAL_FlashVars_GetChannelValue(1) == 55);
+	SELFTEST_ASSERT(HAL_FlashVars_GetChannelValue(2) == 999);
+
+	// torn last record is ignored
+	SIM_FlashVars_Clear();
+	HAL_FlashVars_SaveChannel(3, 11);
+	HAL_FlashVars_Flush();
+	HAL_FlashVars_SaveChannel(3, 22);
+	HAL_FlashVars_Flush();
+	for (i = 0x1000 - 1; i > 0; i--) {
+		if (g_flash[TEST_FLASH_VARS_ADDR + i] != 0xFF) {
+			break;
+		}
+	}
+	g_flash[TEST_FLASH_VARS_ADDR + i] ^= 0x5A;
+	SIM_FlashVars_Reload();
+	SELFTEST_ASSERT(HAL_FlashVars_GetChannelValue(3) == 11);
+	// and next write goes to a fresh sector
+	FlashVarsJournal_ResetStats();
+	HAL_FlashVars_SaveChannel(3, 33);
+	HAL_FlashVars_Flush();
+	FlashVarsJournal_GetStats(&st);
+	SELFTEST_ASSERT(st.compactions == 1);
+	SIM_FlashVars_Reload();
+	SELFTEST_ASSERT(HAL_FlashVars_GetChannelValue(3) == 33);
+}
+
+void Test_FlashStats() {
+	const flashUserStats_t* u;
+	const flashSectorStats_t* sectors;
+	int count;
+	int i;
+
+	SIM_ClearOBK(0);
+	CMD_ExecuteCommand("lfs_format", 0);
+	HAL_FlashStats_Reset();
+
+	// flash vars
+	for (i = 1; i <= 5; i++) {
+		HAL_FlashVars_SaveChannel(1, i);
+		HAL_FlashVars_Flush();
+	}
+	u = HAL_FlashStats_GetUser(FLASH_USER_FLASHVARS);
+	SELFTEST_ASSERT(u->writes == 5);
+	SELFTEST_ASSERT(u->erases == 0);
+
+	// config
+	CFG_SetShortDeviceName("flashStatsTest");
+	CFG_Save_IfThereArePendingChanges();
+	u = HAL_FlashStats_GetUser(FLASH_USER_CONFIG);
+	SELFTEST_ASSERT(u->writes == 1);
+	SELFTEST_ASSERT(u->erases == 1);
+	SELFTEST_ASSERT(u->bytes == sizeof(mainConfig_t));
+
+	// LFS
+	Test_FakeHTTPClientPacket_POST("api/lfs/flashStats.txt", "some file content");
+	u = HAL_FlashStats_GetUser(FLASH_USER_LFS);
+	SELFTEST_ASSERT(u->writes > 0);
+	SELFTEST_ASSERT(u->bytes > 0);
+
+	// writes per minute are taken at the end of a minute
+	SELFTEST_ASSERT(HAL_FlashStats_GetUser(FLASH_USER_FLASHVARS)->writesLastMinute == 0);
+	Sim_RunSeconds(61, false);
+	u = HAL_FlashStats_GetUser(FLASH_USER_FLASHVARS);
+	SELFTEST_ASSERT(u->writesLastMinute == 5);
+	SELFTEST_ASSERT(u->maxWritesPerMinute == 5);
+
+	// config sector was erased once during this minute
+	count = HAL_FlashStats_GetSectors(&sectors);
+	SELFTEST_ASSERT(count > 0);
+	SELFTEST_ASSERT(sectors[0].erases >= 1);
+	SELFTEST_ASSERT(HAL_FlashStats_GetLifetimeDays() > 0);
+
+	Test_FakeHTTPClientPacket_JSON("api/info");
+	SELFTEST_ASSERT_JSON_VALUE_INTEGER_NESTED2("flash", "flashvars", "writes", 5);
+	SELFTEST_ASSERT_JSON_VALUE_INTEGER_NESTED2("flash", "flashvars", "wpm", 5);
+	SELFTEST_ASSERT_JSON_VALUE_INTEGER_NESTED2("flash", "config", "erases", 1);
+	SELFTEST_ASSERT_JSON_VALUE_INTEGER_NESTED2("flash", "ota", "writes", 0);
+
+	CMD_ExecuteCommand("flashStats 1", 0);
+	SELFTEST_ASSERT(HAL_FlashStats_GetUser(FLASH_USER_FLASHVARS)->writes == 0);
+	SELFTEST_ASSERT(HAL_FlashStats_GetSectors(&sectors) == 0);
+	SELFTEST_ASSERT(HAL_FlashStats_GetLifetimeDays() == -1);
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifdef WINDOWS
 
 #include "selftest_local.h"
+#include "../httpserver/hass.h"
+#include "../httpserver/http_fns.h"
 
 void CheckForCommonVars() {
 
@@ -484,6 +486,104 @@ void Test_HassDiscovery_digitalInputNoAVTY() {
 
 }
 
+void Test_HassDiscovery_Incremental() {
+	const char *shortName = "WinRelTestInc";
+	const char *fullName = "Windows Relay Test Incremental";
+	const hassDiscoveryStats_t *stats;
+	int entities;
+	char filler[1400];
+	int items, bytes, highWater, dropped;
+
+	SIM_ClearOBK(shortName);
+	SIM_ClearAndPrepareForMQTTTesting("testDeviceIncremental", "bekens");
+
+	CFG_SetShortDeviceName(shortName);
+	CFG_SetDeviceName(fullName);
+
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+	PIN_SetPinRoleForPinIndex(10, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(10, 4);
+
+	stats = hass_get_discovery_stats();
+
+	// first discovery publishes everything
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("scheduleHADiscovery 1", 0);
+	Sim_RunSeconds(5, false);
+	// two relays and the self state sensors
+	entities = stats->published;
+	SELFTEST_ASSERT(entities >= 2);
+	SELFTEST_ASSERT(stats->skipped == 0);
+	SELFTEST_ASSERT(stats->bytesSaved == 0);
+	SELFTEST_ASSERT_HAS_MQTT_JSON_SENT_ANY("homeassistant", true, 0, 0, "stat_t", "~/1/get");
+	SELFTEST_ASSERT_HAS_MQTT_JSON_SENT_ANY("homeassistant", true, 0, 0, "stat_t", "~/4/get");
+
+	// nothing changed, nothing is sent again
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("scheduleHADiscovery 1", 0);
+	Sim_RunSeconds(5, false);
+	SELFTEST_ASSERT(stats->published == 0);
+	SELFTEST_ASSERT(stats->skipped == entities);
+	SELFTEST_ASSERT(stats->bytesSaved > 200);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("homeassistant", true) == 0);
+
+	// only the relabeled relay is sent
+	CMD_ExecuteCommand("setChannelLabel 4 Kitchen", 0);
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("scheduleHADiscovery 1", 0);
+	Sim_RunSeconds(5, false);
+	SELFTEST_ASSERT(stats->published == 1);
+	SELFTEST_ASSERT(stats->skipped == entities - 1);
+	SELFTEST_ASSERT_HAS_MQTT_JSON_SENT_ANY_TWOKEY("homeassistant", true, 0, 0, "name", "Kitchen", "stat_t", "~/4/get");
+	SELFTEST_ASSERT_HAS_NOT_MQTT_JSON_SENT_ANY("homeassistant", true, 0, 0, "stat_t", "~/1/get");
+
+	// a new entity is sent alone
+	PIN_SetPinRoleForPinIndex(11, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(11, 6);
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("scheduleHADiscovery 1", 0);
+	Sim_RunSeconds(5, false);
+	SELFTEST_ASSERT(stats->published == 1);
+	SELFTEST_ASSERT(stats->skipped == entities);
+	SELFTEST_ASSERT_HAS_MQTT_JSON_SENT_ANY("homeassistant", true, 0, 0, "stat_t", "~/6/get");
+
+	// forced discovery sends everything
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("scheduleHADiscovery 1 1", 0);
+	Sim_RunSeconds(5, false);
+	SELFTEST_ASSERT(stats->published == entities + 1);
+	SELFTEST_ASSERT(stats->skipped == 0);
+	SELFTEST_ASSERT_HAS_MQTT_JSON_SENT_ANY("homeassistant", true, 0, 0, "stat_t", "~/1/get");
+	SELFTEST_ASSERT_HAS_MQTT_JSON_SENT_ANY("homeassistant", true, 0, 0, "stat_t", "~/4/get");
+	SELFTEST_ASSERT_HAS_MQTT_JSON_SENT_ANY("homeassistant", true, 0, 0, "stat_t", "~/6/get");
+
+	// entity dropped by a full publish queue is sent by a scheduled retry
+	CMD_ExecuteCommand("setChannelLabel 1 Hall", 0);
+	memset(filler, 'x', sizeof(filler) - 1);
+	filler[sizeof(filler) - 1] = 0;
+	// big items first, then small ones to fill what is left
+	do {
+		MQTT_QueuePublish("fillerDevice", "big", filler, 0);
+		MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &dropped);
+	} while (dropped == 0);
+	filler[64] = 0;
+	do {
+		MQTT_QueuePublish("fillerDevice", "small", filler, 0);
+		MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &dropped);
+	} while (dropped == 1);
+	SIM_ClearMQTTHistory();
+	doHomeAssistantDiscovery(0, 0, false);
+	SELFTEST_ASSERT(stats->dropped == 1);
+	SELFTEST_ASSERT(stats->published == 0);
+	// retries until the queue has drained enough
+	Sim_RunSeconds(60, false);
+	MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &dropped);
+	SELFTEST_ASSERT(items == 0);
+	SELFTEST_ASSERT_HAS_MQTT_JSON_SENT_ANY_TWOKEY("homeassistant", true, 0, 0, "name", "Hall", "stat_t", "~/1/get");
+	CMD_ExecuteCommand("mqtt_queueStats 1", 0);
+}
+
 void Test_HassDiscovery() {
 	Test_HassDiscovery_SHTSensor();
 #if ENABLE_DRIVER_BL0942
@@ -495,6 +595,7 @@ void Test_HassDiscovery() {
 	Test_HassDiscovery_Battery();
 	Test_HassDiscovery_Relay_1x();
 	Test_HassDiscovery_Relay_2x();
+	Test_HassDiscovery_Incremental();
 #if ENABLE_LED_BASIC
 	Test_HassDiscovery_LED_CW();
 	Test_HassDiscovery_LED_RGB();
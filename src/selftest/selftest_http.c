@@ -914,12 +914,148 @@ void Test_Http_Commands() {
 	SELFTEST_ASSERT_CHANNEL(1, 567);
 	SELFTEST_ASSERT_JSON_VALUE_INTEGER(0, "success", 200);
 }
+static int Test_Http_RouteHandler(http_request_t* request) {
+	http_setup(request, httpMimeTypeText);
+	poststr(request, "route ok");
+	poststr(request, NULL);
+	return 0;
+}
+void Test_Http_Routes() {
+	// reset whole device
+	SIM_ClearOBK(0);
+
+	HTTP_RegisterCallback("/rt_test/", HTTP_GET, Test_Http_RouteHandler, 0);
+	// registering same route twice is not an error
+	SELFTEST_ASSERT(HTTP_RegisterCallback("/rt_test/", HTTP_GET, Test_Http_RouteHandler, 0) == 0);
+
+	// registered routes match by prefix
+	Test_FakeHTTPClientPacket_GET("rt_test/abc?x=1");
+	SELFTEST_ASSERT(strstr(replyAt, "route ok") != 0);
+	// but not a different first segment
+	Test_FakeHTTPClientPacket_GET("rt_testabc");
+	SELFTEST_ASSERT(strstr(replyAt, "route ok") == 0);
+	SELFTEST_ASSERT(strstr(replyAt, "Not found") != 0);
+	// and only with given method
+	Test_FakeHTTPClientPacket_POST("rt_test/abc", "x");
+	SELFTEST_ASSERT(strstr(replyAt, "route ok") == 0);
+	SELFTEST_ASSERT(strstr(replyAt, "Not found") != 0);
+	// prefix without slash also matches longer first segment, like "/app" did
+	HTTP_RegisterCallback("/rt_seg", HTTP_GET, Test_Http_RouteHandler, 0);
+	Test_FakeHTTPClientPacket_GET("rt_segX");
+	SELFTEST_ASSERT(strstr(replyAt, "route ok") != 0);
+	Test_FakeHTTPClientPacket_GET("rt_seg/abc");
+	SELFTEST_ASSERT(strstr(replyAt, "route ok") != 0);
+
+	// built-in pages match whole path, 'cfg' must not catch 'cfg_pins'
+	Test_FakeHTTPClientPacket_GET("cfg_pins");
+	SELFTEST_ASSERT(strstr(replyAt, "Not found") == 0);
+	SELFTEST_ASSERT(strstr(replyAt, "cfg_pins") != 0);
+	Test_FakeHTTPClientPacket_GET("index?tgl=1");
+	SELFTEST_ASSERT(strstr(replyAt, "Not found") == 0);
+	Test_FakeHTTPClientPacket_GET("indexx");
+	SELFTEST_ASSERT(strstr(replyAt, "Not found") != 0);
+
+	CMD_ExecuteCommand("HTTPRoutes", 0);
+	CMD_ExecuteCommand("HTTPRoutes reset", 0);
+}
+// decodes chunked body, returns its length or -1 if framing is broken
+static int Test_Http_DecodeChunked(const char *at, const char *end, char *out) {
+	char *next;
+	int outLen = 0;
+	int size;
+
+	while (at < end) {
+		size = strtol(at, &next, 16);
+		if (next == at || strncmp(next, "\r\n", 2)) {
+			return -1;
+		}
+		at = next + 2;
+		if (size == 0) {
+			// last chunk must end the reply
+			if (at + 2 != end || strncmp(at, "\r\n", 2)) {
+				return -1;
+			}
+			return outLen;
+		}
+		if (at + size + 2 > end || strncmp(at + size, "\r\n", 2)) {
+			return -1;
+		}
+		memcpy(out + outLen, at, size);
+		outLen += size;
+		at += size + 2;
+	}
+	return -1;
+}
+// serves page to selftest socket like on kept open connection and checks
+// that chunked reply carries the same page as the plain one
+static void Test_Http_StreamingPage(const char *page, int bDoubleBuffer, int maxPerSend) {
+	static char reply[2048];
+	static char reply2[2048];
+	static char sent[65536];
+	static char body[65536];
+	http_request_t request;
+	const char *plainBody;
+	const char *chunks;
+	int sentLen;
+	int bodyLen;
+
+	// reply built in memory, without chunks
+	Test_FakeHTTPClientPacket_GET(page);
+	plainBody = replyAt;
+	SELFTEST_ASSERT(plainBody != 0);
+
+	sprintf(buffer, http_get_template1, page);
+	memset(&request, 0, sizeof(request));
+	request.fd = HTTP_SIM_FAKE_FD;
+	request.received = buffer;
+	request.receivedLen = strlen(buffer);
+	request.reply = reply;
+	request.replymaxlen = sizeof(reply) - 1;
+	request.keepAlive = 1;
+	if (bDoubleBuffer) {
+		request.reply2 = reply2;
+	}
+	HTTP_SimFakeSocket_Reset(sent, sizeof(sent) - 1, maxPerSend);
+	HTTP_ProcessPacket(&request);
+	SELFTEST_ASSERT(HTTP_FinishReply(&request) == 1);
+	sentLen = HTTP_SimFakeSocket_GetLength();
+	sent[sentLen] = 0;
+
+	SELFTEST_ASSERT(strstr(sent, "Connection: keep-alive\r\nTransfer-Encoding: chunked\r\n") != 0);
+	chunks = Helper_GetPastHTTPHeader(sent);
+	SELFTEST_ASSERT(chunks != 0);
+	bodyLen = Test_Http_DecodeChunked(chunks, sent + sentLen, body);
+	SELFTEST_ASSERT(bodyLen == (int)strlen(plainBody));
+	body[bodyLen > 0 ? bodyLen : 0] = 0;
+	SELFTEST_ASSERT(!strcmp(body, plainBody));
+	SELFTEST_ASSERT(strstr(body, "</html>") != 0);
+	if (maxPerSend == 0) {
+		// page is bigger than reply buffer, but each full buffer goes out with
+		// one send; besides the last part, page may flush its start early
+		SELFTEST_ASSERT(request.sendCalls > 1);
+		SELFTEST_ASSERT(request.sendCalls <= sentLen / (int)(sizeof(reply) - 16) + 2);
+	}
+}
+void Test_Http_Streaming() {
+	// reset whole device
+	SIM_ClearOBK(0);
+
+	Test_Http_StreamingPage("index", 0, 0);
+	Test_Http_StreamingPage("index", 1, 0);
+	Test_Http_StreamingPage("cfg_pins", 0, 0);
+	Test_Http_StreamingPage("cfg_pins", 1, 0);
+	// socket takes only part of the buffer, rest must follow in order
+	Test_Http_StreamingPage("cfg_pins", 1, 100);
+	Test_Http_StreamingPage("cfg_generic", 1, 37);
+}
 void Test_Http() {
 	Test_Http_SingleRelayOnChannel1();
 	Test_Http_TwoRelays();
 	Test_Http_FourRelays();
 	Test_Http_WiFi();
 	Test_Http_Commands();
+	Test_Http_Routes();
+	Test_Http_Streaming();
 }
 
 
@@ -91,16 +91,20 @@ void Test_TuyaMCU_Basic();
 void Test_TuyaMCU_Calib();
 void Test_TuyaMCU_Boolean();
 void Test_TuyaMCU_DP22();
+void Test_TuyaMCU_Batch();
 void Test_TuyaMCU_Mult();
 void Test_TuyaMCU_RawAccess();
+void Test_TuyaMCU_UARTRing();
 void Test_Command_If();
 void Test_Command_If_Else();
 void Test_LFS();
+void Test_Logging_Deferred();
 void Test_Tokenizer();
 void Test_Commands_Alias();
 void Test_ExpandConstant();
 void Test_Scripting();
 void Test_RepeatingEvents();
+void Test_TimerQueue();
 void Test_HTTP_Client();
 void Test_DeviceGroups();
 void Test_NTP();
@@ -146,6 +150,7 @@ void Test_DoorSensor();
 void Test_Enums();
 void Test_Expressions_RunTests_Basic();
 void Test_Expressions_RunTests_Braces();
+void Test_Expressions_Compiled();
 void Test_ButtonEvents();
 void Test_Http();
 void Test_Demo_ConditionalRelay();
@@ -153,6 +158,8 @@ void Test_PIR();
 void Test_Driver_TCL_AC();
 void Test_MAX72XX();
 void Test_OpenWeatherMap();
+void Test_FlashVars();
+void Test_FlashStats();
 
 void Test_GetJSONValue_Setup(const char *text);
 void Test_FakeHTTPClientPacket_GET(const char *tg);
@@ -188,6 +195,7 @@ void SIM_SendFakeMQTTAndRunSimFrame_CMND(const char *command, const char *argume
 void SIM_SendFakeMQTTAndRunSimFrame_CMND_ViaGroupTopic(const char *command, const char *arguments);
 void SIM_SendFakeMQTTRawChannelSet(int channelIndex, const char *arguments);
 void SIM_SendFakeMQTTRawChannelSet_ViaGroupTopic(int channelIndex, const char *arguments);
+void SIM_ClearAndPrepareForMQTTTesting(const char *clientName, const char *groupName);
 void SIM_ClearMQTTHistory();
 void SIM_DumpMQTTHistory();
 bool SIM_CheckMQTTHistoryForString(const char *topic, const char *value, bool bRetain);
@@ -0,0 +1,67 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+#include "../logging/logging.h"
+
+static void Test_Logging_AddSampleLines() {
+	char notTerminated[4] = { 'a', 'b', 'c', 'd' };
+	char longText[1500];
+
+	memset(longText, 'x', sizeof(longText) - 1);
+	longText[sizeof(longText) - 1] = 0;
+
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "plain line");
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "int %i %d %u %x %X %5i|%-5i|%05i", -5, 123, 4000000000u, 0xbeef, 0xbeef, 7, 8, 9);
+	ADDLOG_INFO(LOG_FEATURE_CMD, "float %f %.2f %8.3f %g", 1.5f, 3.14159f, -2.5, 0.0001);
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "str [%s] [%10s] [%-6s] [%.2s] [%.*s]", "hello", "right", "left", "cut", 3, notTerminated);
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "width [%*i] [%-*s] [%*.*f]", 6, 42, 4, "ab", 8, 2, 12.345);
+	ADDLOG_INFO(LOG_FEATURE_HTTP, "long %li %lu %lld %llu %zu", -70000L, 70000UL, -5000000000LL, 9000000000ULL, sizeof(longText));
+	ADDLOG_INFO(LOG_FEATURE_HTTP, "char %c%c, percent 100%%, null %s", 'O', 'K', (const char*)0);
+	ADDLOG_INFO(LOG_FEATURE_RAW, "raw line without prefix\n");
+	// too big for deferred record, must be formatted in place and still keep order
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "big %s end", longText);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "after big %i", 1);
+	// filtered out by log level
+	ADDLOG_EXTRADEBUG(LOG_FEATURE_GENERAL, "should not be there %i", 2);
+}
+
+void Test_Logging_Deferred() {
+	char *syncText;
+	char stackFmt[32];
+
+	// reset whole device
+	SIM_ClearOBK(0);
+
+	CMD_ExecuteCommand("loglevel 3", 0);
+	CMD_ExecuteCommand("logdeferred 0", 0);
+	// read out everything that was logged so far
+	Test_FakeHTTPClientPacket_GET("lograw");
+
+	Test_Logging_AddSampleLines();
+	Test_FakeHTTPClientPacket_GET("lograw");
+	SELFTEST_ASSERT_HTML_REPLY_CONTAINS("Info:GEN:int -5 123 4000000000 beef BEEF     7|8    |00009\r\n");
+	SELFTEST_ASSERT_HTML_REPLY_CONTAINS("Info:MQTT:str [hello] [     right] [left  ] [cu] [abc]\r\n");
+	SELFTEST_ASSERT_HTML_REPLY_CONTAINS("\r\nraw line without prefix\r\n");
+	SELFTEST_ASSERT_HTML_REPLY_NOT_CONTAINS("should not be there");
+	syncText = strdup(Test_GetLastHTMLReply());
+
+	// same lines, but formatted later by the HTTP log reader
+	CMD_ExecuteCommand("logdeferred 1", 0);
+	Test_Logging_AddSampleLines();
+	Test_FakeHTTPClientPacket_GET("lograw");
+	SELFTEST_ASSERT_HTML_REPLY(syncText);
+
+	// format living in a caller buffer that is reused before the log is read
+	strcpy(stackFmt, "stack fmt %i %s");
+	addLogAdv(LOG_INFO, LOG_FEATURE_CMD, stackFmt, 123, "ok");
+	memset(stackFmt, 0, sizeof(stackFmt));
+	strcpy(stackFmt, "XXXX %s %s %s");
+	Test_FakeHTTPClientPacket_GET("lograw");
+	SELFTEST_ASSERT_HTML_REPLY_CONTAINS("Info:CMD:stack fmt 123 ok\r\n");
+	SELFTEST_ASSERT_HTML_REPLY_NOT_CONTAINS("XXXX");
+
+	CMD_ExecuteCommand("logdeferred 0", 0);
+	free(syncText);
+}
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "selftest_local.h"
 #include "../hal/hal_wifi.h"
+#include "../mqtt/new_mqtt.h"
 
 void SIM_ClearAndPrepareForMQTTTesting(const char *clientName, const char *groupName) {
 	SIM_ClearOBK(0);
@@ -828,6 +829,327 @@ void Test_MQTT_Average() {
 	SIM_ClearMQTTHistory();
 }
 
+static void Test_MQTT_DrainPublishQueue() {
+	int items, bytes, highWater, dropped;
+
+	MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &dropped);
+	while (items > 0) {
+		PublishQueuedItems();
+		MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &dropped);
+	}
+}
+void Test_MQTT_PublishQueue() {
+	char channel[16];
+	char value[1400];
+	int items, bytes, highWater, dropped;
+	int i;
+
+	SIM_ClearOBK(0);
+	SIM_ClearAndPrepareForMQTTTesting("queueDevice", "bekens");
+
+	Test_MQTT_DrainPublishQueue();
+	CMD_ExecuteCommand("mqtt_queueStats 1", 0);
+	SIM_ClearMQTTHistory();
+
+	// short publishes take only as much space as they need
+	for (i = 0; i < 40; i++) {
+		sprintf(channel, "short%i", i);
+		MQTT_QueuePublish("queueDevice", channel, "1", 0);
+	}
+	MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &dropped);
+	SELFTEST_ASSERT(items == 40);
+	SELFTEST_ASSERT(bytes < 40 * 64);
+	SELFTEST_ASSERT(dropped == 0);
+	Test_MQTT_DrainPublishQueue();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/short0", "1", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/short39", "1", false);
+	MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &dropped);
+	SELFTEST_ASSERT(bytes == 0);
+	SELFTEST_ASSERT(highWater >= 40 * 16);
+	SIM_ClearMQTTHistory();
+
+	// burst of big publishes (like Hass discovery) grows the queue instead of dropping
+	memset(value, 'x', sizeof(value) - 1);
+	value[sizeof(value) - 1] = 0;
+	for (i = 0; i < 8; i++) {
+		value[0] = 'A' + i;
+		MQTT_QueuePublish("queueDevice", "big", value, 0);
+	}
+	MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &dropped);
+	SELFTEST_ASSERT(items == 8);
+	SELFTEST_ASSERT(dropped == 0);
+	SELFTEST_ASSERT(bytes > MQTT_PUBLISH_QUEUE_BYTES);
+	SELFTEST_ASSERT(highWater == bytes);
+
+	// publish first three, then new records wrap to the start of the queue
+	PublishQueuedItems();
+	value[0] = 'A';
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/big", value, false);
+	for (i = 0; i < 6; i++) {
+		value[0] = 'a' + i;
+		MQTT_QueuePublish("queueDevice", "big", value, 0);
+	}
+	MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &dropped);
+	SELFTEST_ASSERT(items == 11);
+	SELFTEST_ASSERT(dropped == 0);
+	// order is kept across the wrap
+	SIM_ClearMQTTHistory();
+	PublishQueuedItems();
+	PublishQueuedItems();
+	value[0] = 'H';
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/big", value, false);
+	value[0] = 'a';
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/big", value, false);
+	value[0] = 'b';
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("queueDevice/big", value, false));
+	Test_MQTT_DrainPublishQueue();
+	value[0] = 'f';
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/big", value, false);
+	SIM_ClearMQTTHistory();
+
+	// only beyond room for 32 biggest records publishes are dropped and counted
+	for (i = 0; i < 48; i++) {
+		value[0] = 'A' + i;
+		MQTT_QueuePublish("queueDevice", "big", value, 0);
+	}
+	MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &dropped);
+	SELFTEST_ASSERT(items >= 32);
+	SELFTEST_ASSERT(dropped == 48 - items);
+	SELFTEST_ASSERT(bytes <= (int)MQTT_PUBLISH_QUEUE_MAX_BYTES);
+	Test_MQTT_DrainPublishQueue();
+	value[0] = 'A' + items - 1;
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/big", value, false);
+	MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &dropped);
+	SELFTEST_ASSERT(bytes == 0);
+
+	CMD_ExecuteCommand("mqtt_queueStats 1", 0);
+	MQTT_GetPublishQueueStats(&items, &bytes, &highWater, &dropped);
+	SELFTEST_ASSERT(items == 0);
+	SELFTEST_ASSERT(dropped == 0);
+	SIM_ClearMQTTHistory();
+}
+// sets 10 channels per scene, returns number of publishes
+static int Test_MQTT_SceneStorm(int scenes) {
+	int published;
+	int i, j;
+
+	published = MQTT_GetPublishEventCounter();
+	for (i = 0; i < scenes; i++) {
+		for (j = 1; j <= 10; j++) {
+			CHANNEL_Set(j, (i + j) % 100, 0);
+		}
+		Sim_RunFrames(1, false);
+	}
+	return MQTT_GetPublishEventCounter() - published;
+}
+void Test_MQTT_BatchPublish() {
+	char cmd[64];
+	int perTopic, batched;
+	int i;
+
+	SIM_ClearOBK(0);
+	SIM_ClearAndPrepareForMQTTTesting("batchDevice", "bekens");
+
+	for (i = 1; i <= 10; i++) {
+		sprintf(cmd, "setChannelType %i Dimmer", i);
+		CMD_ExecuteCommand(cmd, 0);
+	}
+	// by default, every channel change is a separate publish
+	perTopic = Test_MQTT_SceneStorm(50);
+	SELFTEST_ASSERT(perTopic >= 500);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDevice/10/get", "59", false);
+	SIM_ClearMQTTHistory();
+
+	// batched, one publish per scene
+	CMD_ExecuteCommand("mqtt_batchPublish 1", 0);
+	batched = Test_MQTT_SceneStorm(50);
+	SELFTEST_ASSERT(batched < perTopic / 5);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDevice/batch/get",
+		"{\"1\":50,\"2\":51,\"3\":52,\"4\":53,\"5\":54,\"6\":55,\"7\":56,\"8\":57,\"9\":58,\"10\":59}", false);
+	SIM_ClearMQTTHistory();
+
+	// driver values are batched too, last value wins
+	MQTT_PublishMain_StringFloat("voltage", 229.0f, 1, 0);
+	MQTT_PublishMain_StringFloat("voltage", 230.5f, 1, 0);
+	MQTT_PublishMain_StringString("state", "ON", 0);
+	// retained values keep their own topic and are sent at once
+	MQTT_PublishMain_StringString("retained", "yes", OBK_PUBLISH_FLAG_RETAIN);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDevice/retained/get", "yes", true);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDevice/batch/get", "{\"voltage\":230.5,\"state\":\"ON\"}", false);
+	SIM_ClearMQTTHistory();
+
+	// strings are escaped for JSON
+	MQTT_PublishMain_StringString("note", "say \"hi\" \\o/", 0);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDevice/batch/get", "{\"note\":\"say \\\"hi\\\" \\\\o/\"}", false);
+	SIM_ClearMQTTHistory();
+
+	// multiplied value longer than 16 characters
+	CFG_SetFlag(OBK_FLAG_PUBLISH_MULTIPLIED_VALUES, true);
+	CMD_ExecuteCommand("setChannelType 11 Custom", 0);
+	CHANNEL_Set(11, 2000000000, 0);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDevice/batch/get", "{\"11\":2000000000.000000}", false);
+	CFG_SetFlag(OBK_FLAG_PUBLISH_MULTIPLIED_VALUES, false);
+	SIM_ClearMQTTHistory();
+
+	// pending changes are sent when batching is turned off
+	CHANNEL_Set(1, 7, 0);
+	CMD_ExecuteCommand("mqtt_batchPublish 0", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDevice/batch/get", "{\"1\":7}", false);
+	SIM_ClearMQTTHistory();
+	CHANNEL_Set(1, 8, 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDevice/1/get", "8", false);
+	SIM_ClearMQTTHistory();
+}
+void Test_MQTT_LargePayload() {
+	char *payload;
+	int bytes, dropped;
+	int len;
+	int i;
+
+	SIM_ClearOBK(0);
+	SIM_ClearAndPrepareForMQTTTesting("bigDevice", "bekens");
+	CMD_ExecuteCommand("mqtt_queueStats 1", 0);
+
+	// 3 KB backlog, more than old 2 KB limit
+	payload = (char*)malloc(4096);
+	len = 0;
+	for (i = 0; i < 200; i++) {
+		len += sprintf(payload + len, "addChannel 1 1;");
+	}
+	SELFTEST_ASSERT(len > 2048);
+	SIM_SendFakeMQTT("cmnd/bigDevice/backlog", payload);
+	SELFTEST_ASSERT_CHANNEL(1, 200);
+	MQTT_GetReceiveStats(&bytes, &dropped);
+	SELFTEST_ASSERT(bytes == 0);
+	SELFTEST_ASSERT(dropped == 0);
+
+	// several messages waiting at once, records wrap around the end of ring
+	for (i = 0; i < 10; i++) {
+		len = sprintf(payload, "setChannel 2 %i", i + 1);
+		memset(payload + len, ' ', 1000);
+		payload[len + 1000] = 0;
+		MQTT_Post_Received_Str("cmnd/bigDevice/backlog", payload);
+		len = sprintf(payload, "addChannel 3 %i", i + 1);
+		memset(payload + len, ' ', 1000);
+		payload[len + 1000] = 0;
+		MQTT_Post_Received_Str("cmnd/bigDevice/backlog", payload);
+		Sim_RunFrames(1, false);
+		SELFTEST_ASSERT_CHANNEL(2, i + 1);
+	}
+	SELFTEST_ASSERT_CHANNEL(3, 55);
+
+	// payload that can never fit is dropped and counted, next one still works
+	memset(payload, ' ', 4095);
+	payload[4095] = 0;
+	MQTT_Post_Received_Str("cmnd/bigDevice/backlog", payload);
+	SIM_SendFakeMQTT("cmnd/bigDevice/setChannel", "4 12");
+	SELFTEST_ASSERT_CHANNEL(4, 12);
+	MQTT_GetReceiveStats(&bytes, &dropped);
+	SELFTEST_ASSERT(dropped == 1);
+
+	free(payload);
+}
+static int g_trieHits[4];
+static int Test_TrieCallback0(obk_mqtt_request_t* request) {
+	g_trieHits[0]++;
+	return 0;
+}
+static int Test_TrieCallback1(obk_mqtt_request_t* request) {
+	g_trieHits[1]++;
+	return 0;
+}
+static int Test_TrieCallback2(obk_mqtt_request_t* request) {
+	g_trieHits[2]++;
+	// eats the message, later callbacks are not called
+	return 1;
+}
+static int Test_TrieCallback3(obk_mqtt_request_t* request) {
+	g_trieHits[3]++;
+	return 0;
+}
+static void Test_MQTT_TopicTrie_Send(const char* topic) {
+	memset(g_trieHits, 0, sizeof(g_trieHits));
+	MQTT_Post_Received_Str(topic, "1");
+	Sim_RunFrames(1, false);
+}
+void Test_MQTT_TopicTrie() {
+	extern int mqtt_reconnect;
+	int lookups, visited, misses, subscribes;
+	int lookups2, visited2, misses2, subscribes2;
+
+	SIM_ClearOBK(0);
+	SIM_ClearAndPrepareForMQTTTesting("trieDevice", "bekens");
+	mqtt_reconnect = 0;
+	MQTT_GetTopicStats(&lookups, &visited, &misses, &subscribes);
+
+	MQTT_RegisterCallback("home/", "home/+/temp", 100, Test_TrieCallback0);
+	MQTT_RegisterCallback("home/", "home/#", 101, Test_TrieCallback1);
+	MQTT_RegisterCallback("home/kitchen/", "home/kitchen/temp", 102, Test_TrieCallback2);
+	MQTT_RegisterCallback("home/", "home/#", 103, Test_TrieCallback3);
+	// changing callbacks must not force a reconnect
+	SELFTEST_ASSERT(mqtt_reconnect == 0);
+
+	// '+' matches exactly one level
+	Test_MQTT_TopicTrie_Send("home/garage/temp");
+	SELFTEST_ASSERT(g_trieHits[0] == 1);
+	SELFTEST_ASSERT(g_trieHits[1] == 1);
+	SELFTEST_ASSERT(g_trieHits[2] == 0);
+	SELFTEST_ASSERT(g_trieHits[3] == 1);
+	Test_MQTT_TopicTrie_Send("home/garage/door/temp");
+	SELFTEST_ASSERT(g_trieHits[0] == 0);
+	SELFTEST_ASSERT(g_trieHits[1] == 1);
+	// '#' also matches parent level
+	Test_MQTT_TopicTrie_Send("home");
+	SELFTEST_ASSERT(g_trieHits[0] == 0);
+	SELFTEST_ASSERT(g_trieHits[1] == 1);
+	SELFTEST_ASSERT(g_trieHits[3] == 1);
+	// callbacks are called in registration order, until one returns 1
+	Test_MQTT_TopicTrie_Send("home/kitchen/temp");
+	SELFTEST_ASSERT(g_trieHits[0] == 1);
+	SELFTEST_ASSERT(g_trieHits[1] == 1);
+	SELFTEST_ASSERT(g_trieHits[2] == 1);
+	SELFTEST_ASSERT(g_trieHits[3] == 0);
+	// no prefix matching
+	Test_MQTT_TopicTrie_Send("homes/kitchen/temp");
+	SELFTEST_ASSERT(g_trieHits[0] + g_trieHits[1] + g_trieHits[2] + g_trieHits[3] == 0);
+
+	// removing one of two callbacks on same topic keeps the other one
+	SELFTEST_ASSERT(MQTT_RemoveCallback(101) == 1);
+	SELFTEST_ASSERT(MQTT_RemoveCallback(101) == 0);
+	Test_MQTT_TopicTrie_Send("home/attic/light");
+	SELFTEST_ASSERT(g_trieHits[1] == 0);
+	SELFTEST_ASSERT(g_trieHits[3] == 1);
+	SELFTEST_ASSERT(MQTT_RemoveCallback(103) == 1);
+	Test_MQTT_TopicTrie_Send("home/attic/light");
+	SELFTEST_ASSERT(g_trieHits[3] == 0);
+	// replacing callback by ID moves it to new topic
+	MQTT_RegisterCallback("garden/", "garden/+", 100, Test_TrieCallback0);
+	Test_MQTT_TopicTrie_Send("home/garage/temp");
+	SELFTEST_ASSERT(g_trieHits[0] == 0);
+	Test_MQTT_TopicTrie_Send("garden/pump");
+	SELFTEST_ASSERT(g_trieHits[0] == 1);
+	SELFTEST_ASSERT(mqtt_reconnect == 0);
+
+	// built-in callbacks still work
+	SIM_SendFakeMQTTAndRunSimFrame_CMND("setChannel", "5 33");
+	SELFTEST_ASSERT_CHANNEL(5, 33);
+
+	MQTT_GetTopicStats(&lookups2, &visited2, &misses2, &subscribes2);
+	SELFTEST_ASSERT(lookups2 - lookups == 10);
+	SELFTEST_ASSERT(misses2 - misses == 3);
+	// 4 topics subscribed, 2 unsubscribed, shared "home/#" only once
+	SELFTEST_ASSERT(subscribes2 - subscribes == 6);
+	SELFTEST_ASSERT(visited2 > lookups2);
+	CMD_ExecuteCommand("mqtt_topicStats 1", 0);
+	MQTT_GetTopicStats(&lookups2, &visited2, &misses2, &subscribes2);
+	SELFTEST_ASSERT(lookups2 == 0);
+
+	MQTT_RemoveCallback(100);
+	MQTT_RemoveCallback(102);
+}
 void Test_MQTT(){
 	Test_MQTT_Misc();
 	Test_MQTT_Get_And_Reply();
@@ -840,6 +1162,10 @@ void Test_MQTT(){
 	Test_MQTT_Topic_With_Slash();
 	Test_MQTT_Topic_With_Slashes();
 	Test_MQTT_Average();
+	Test_MQTT_PublishQueue();
+	Test_MQTT_BatchPublish();
+	Test_MQTT_LargePayload();
+	Test_MQTT_TopicTrie();
 }
 
 #endif
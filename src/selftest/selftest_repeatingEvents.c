@@ -22,5 +22,107 @@ void Test_RepeatingEvents() {
 	SELFTEST_ASSERT_CHANNEL(11, 2);
 }
 
+#define TEST_TIMERS 1000
+static timerQueue_t g_testTimers;
+static timerEntry_t g_testEntries[TEST_TIMERS];
+static int g_testDelays[TEST_TIMERS];
+
+void Test_TimerQueue() {
+	timerEntry_t *e;
+	unsigned int prevDue, seed;
+	int i, popped, now, d, prevIndex;
+	int fired[TEST_TIMERS];
+
+	// reset whole device
+	SIM_ClearOBK(0);
+	SELFTEST_ASSERT_INTEGER(Timers_GetNextDeadline(), -1);
+
+	// entries come out in due order, equal due times in FIFO order
+	seed = 1234;
+	for (i = 0; i < TEST_TIMERS; i++) {
+		seed = seed * 1103515245 + 12345;
+		g_testDelays[i] = 1 + (seed >> 16) % 5000;
+		TimerQueue_InitEntry(&g_testEntries[i], &g_testDelays[i]);
+		TimerQueue_Schedule(&g_testTimers, &g_testEntries[i], g_testDelays[i]);
+	}
+	// every second one is canceled
+	for (i = 0; i < TEST_TIMERS; i += 2) {
+		TimerQueue_Cancel(&g_testTimers, &g_testEntries[i]);
+		SELFTEST_ASSERT_INTEGER(TimerQueue_GetRemaining(&g_testTimers, &g_testEntries[i]), -1);
+	}
+	SELFTEST_ASSERT_INTEGER(TimerQueue_GetRemaining(&g_testTimers, &g_testEntries[1]), g_testDelays[1]);
+	SELFTEST_ASSERT(Timers_GetNextDeadline() >= 1);
+	popped = 0;
+	prevDue = 0;
+	now = 0;
+	while (popped < TEST_TIMERS / 2) {
+		TimerQueue_Advance(&g_testTimers, 25);
+		now += 25;
+		while ((e = TimerQueue_PopDue(&g_testTimers)) != 0) {
+			d = *(int*)e->owner;
+			SELFTEST_ASSERT(e->due >= prevDue);
+			SELFTEST_ASSERT(d <= now);
+			SELFTEST_ASSERT(d > now - 25);
+			SELFTEST_ASSERT(((int*)e->owner - g_testDelays) % 2 == 1);
+			prevDue = e->due;
+			popped++;
+		}
+	}
+	SELFTEST_ASSERT_INTEGER(TimerQueue_GetNextDelay(&g_testTimers), -1);
+
+	// 1000 sleepers over 10 minutes of ticks, only the rescheduled
+	// ones fire, each once and in due order
+	for (i = 0; i < TEST_TIMERS; i++) {
+		TimerQueue_Schedule(&g_testTimers, &g_testEntries[i], 3600 * 1000);
+		fired[i] = 0;
+	}
+	for (i = 0; i < TEST_TIMERS; i += 100) {
+		TimerQueue_Schedule(&g_testTimers, &g_testEntries[i], 1000 + (TEST_TIMERS - i) * 10);
+	}
+	SELFTEST_ASSERT_INTEGER(TimerQueue_GetNextDelay(&g_testTimers), 2000);
+	popped = 0;
+	prevIndex = TEST_TIMERS;
+	for (now = 0; now < 600 * 1000; now += 100) {
+		TimerQueue_Advance(&g_testTimers, 100);
+		while ((e = TimerQueue_PopDue(&g_testTimers)) != 0) {
+			i = (int)((int*)e->owner - g_testDelays);
+			SELFTEST_ASSERT(i % 100 == 0);
+			SELFTEST_ASSERT(i < prevIndex);
+			prevIndex = i;
+			fired[i]++;
+			popped++;
+		}
+	}
+	SELFTEST_ASSERT_INTEGER(popped, TEST_TIMERS / 100);
+	for (i = 0; i < TEST_TIMERS; i++) {
+		SELFTEST_ASSERT_INTEGER(fired[i], (i % 100 == 0) ? 1 : 0);
+	}
+	SELFTEST_ASSERT_INTEGER(TimerQueue_GetNextDelay(&g_testTimers), 3000 * 1000);
+	SELFTEST_ASSERT_INTEGER(TimerQueue_GetRemaining(&g_testTimers, &g_testEntries[1]), 3000 * 1000);
+	TimerQueue_CancelAll(&g_testTimers);
+
+	// script delays and repeating events report the next deadline
+	SIM_ClearOBK(0);
+	SELFTEST_ASSERT_INTEGER(Timers_GetNextDeadline(), -1);
+	CMD_ExecuteCommand("addRepeatingEventID 5 -1 123 addChannel 12 1", 0);
+	SELFTEST_ASSERT_INTEGER(Timers_GetNextDeadline(), 5000);
+	CMD_ExecuteCommand("backlog delay_s 2; setChannel 13 1", 0);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(Timers_GetNextDeadline() <= 2000);
+	SELFTEST_ASSERT(Timers_GetNextDeadline() > 1500);
+	Sim_RunSeconds(2.5f, false);
+	SELFTEST_ASSERT_CHANNEL(13, 1);
+	SELFTEST_ASSERT_CHANNEL(12, 0);
+	SELFTEST_ASSERT(Timers_GetNextDeadline() <= 3000);
+	Sim_RunSeconds(3.0f, false);
+	SELFTEST_ASSERT_CHANNEL(12, 1);
+	Sim_RunSeconds(5.0f, false);
+	SELFTEST_ASSERT_CHANNEL(12, 2);
+	CMD_ExecuteCommand("cancelRepeatingEvent 123", 0);
+	SELFTEST_ASSERT_INTEGER(Timers_GetNextDeadline(), -1);
+	Sim_RunSeconds(10.0f, false);
+	SELFTEST_ASSERT_CHANNEL(12, 2);
+}
+
 
 #endif
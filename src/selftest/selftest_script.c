@@ -66,6 +66,29 @@ const char *demo_waiting_for_smth =
 "    if $CH20==0 then goto again\r\n"
 "    setChannel 21 789\r\n";
 
+const char *demo_line_index =
+"// line numbers matter, see Test_Scripting_LineIndex\r\n"
+"setChannel 40 0\r\n"
+"\r\n"
+"loop:\r\n"
+"    addChannel 40 1\r\n"
+"    if $CH40<10 then goto loop\r\n"
+"goto skip\r\n"
+"setChannel 41 999\r\n"
+"skip:\r\n"
+"    // comment between label and code\r\n"
+"    setChannel 42 5\r\n"
+"goto no_such_label\r\n"
+"setChannel 43 1\r\n";
+
+const char *demo_reset_from_script =
+"setChannel 44 0\r\n"
+"again:\r\n"
+"    addChannel 44 1\r\n"
+"    if $CH44>=3 then resetSVM\r\n"
+"    if $CH44<10 then goto again\r\n"
+"setChannel 45 1\r\n";
+
 void Test_Scripting_Loop1() {
 	// reset whole device
 	SIM_ClearOBK(0);
@@ -272,6 +295,57 @@ void Test_Scripting_ClickEventAndBacklog() {
 	}
 
 }
+void Test_Scripting_LineIndex() {
+	int runs, fallbacks, runsBefore;
+
+	// reset whole device
+	SIM_ClearOBK(0);
+	CMD_ExecuteCommand("lfs_format", 0);
+
+	Test_FakeHTTPClientPacket_POST("api/lfs/demo_line_index.txt", demo_line_index);
+	CMD_GetPreparedCommandStats(&runsBefore, &fallbacks);
+	CMD_ExecuteCommand("startScript demo_line_index.txt", 0);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 1);
+	Sim_RunFrames(15, false);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+	SELFTEST_ASSERT_CHANNEL(40, 10);
+	SELFTEST_ASSERT_CHANNEL(41, 0);
+	SELFTEST_ASSERT_CHANNEL(42, 5);
+	// unknown label ends the script
+	SELFTEST_ASSERT_CHANNEL(43, 0);
+
+	// per-line execution counts
+	SELFTEST_ASSERT_INTEGER(SVM_GetScriptLineHits("demo_line_index.txt", 1), 0);
+	SELFTEST_ASSERT_INTEGER(SVM_GetScriptLineHits("demo_line_index.txt", 2), 1);
+	SELFTEST_ASSERT_INTEGER(SVM_GetScriptLineHits("demo_line_index.txt", 5), 10);
+	SELFTEST_ASSERT_INTEGER(SVM_GetScriptLineHits("demo_line_index.txt", 6), 10);
+	SELFTEST_ASSERT_INTEGER(SVM_GetScriptLineHits("demo_line_index.txt", 7), 1);
+	SELFTEST_ASSERT_INTEGER(SVM_GetScriptLineHits("demo_line_index.txt", 8), 0);
+	SELFTEST_ASSERT_INTEGER(SVM_GetScriptLineHits("demo_line_index.txt", 11), 1);
+	SELFTEST_ASSERT_INTEGER(SVM_GetScriptLineHits("demo_line_index.txt", 13), 0);
+	// lines in the loop are parsed once and then reused
+	CMD_GetPreparedCommandStats(&runs, &fallbacks);
+	SELFTEST_ASSERT(runs - runsBefore >= 18);
+
+	// start at label
+	CMD_ExecuteCommand("startScript demo_line_index.txt skip", 0);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_INTEGER(SVM_GetScriptLineHits("demo_line_index.txt", 11), 2);
+	SELFTEST_ASSERT_INTEGER(SVM_GetScriptLineHits("demo_line_index.txt", 5), 10);
+
+	CMD_ExecuteCommand("scriptProfile 1", 0);
+	SELFTEST_ASSERT_INTEGER(SVM_GetScriptLineHits("demo_line_index.txt", 5), 0);
+
+	// script frees itself from a prepared line, must not crash
+	Test_FakeHTTPClientPacket_POST("api/lfs/demo_reset.txt", demo_reset_from_script);
+	CMD_ExecuteCommand("startScript demo_reset.txt", 0);
+	Sim_RunFrames(15, false);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+	SELFTEST_ASSERT_CHANNEL(44, 3);
+	SELFTEST_ASSERT_CHANNEL(45, 0);
+	// file was dropped
+	SELFTEST_ASSERT_INTEGER(SVM_GetScriptLineHits("demo_reset.txt", 3), 0);
+}
 void Test_Scripting() {
 	Test_Scripting_Loop1();
 	Test_Scripting_Loop2();
@@ -280,6 +354,7 @@ void Test_Scripting() {
 	Test_Scripting_StartScript();
 	Test_Scripting_WaitingForSmth();
 	Test_Scripting_ClickEventAndBacklog();
+	Test_Scripting_LineIndex();
 }
 
 #endif
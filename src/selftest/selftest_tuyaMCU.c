@@ -2,6 +2,7 @@
 #ifdef WINDOWS
 
 #include "selftest_local.h"
+#include "../driver/drv_uart.h"
 
 void Test_TuyaMCU_RawAccess() {
 	// reset whole device
@@ -190,6 +191,54 @@ void Test_TuyaMCU_Boolean() {
 	//SELFTEST_ASSERT_HAS_UART_EMPTY();
 
 }
+void Test_TuyaMCU_Batch() {
+	SIM_ClearOBK(0);
+	SIM_UART_InitReceiveRingBuffer(2048);
+	CMD_ExecuteCommand("startDriver TuyaMCU", 0);
+	CMD_ExecuteCommand("linkTuyaMCUOutputToChannel 1 bool 1", 0);
+	CMD_ExecuteCommand("linkTuyaMCUOutputToChannel 2 val 2", 0);
+	CMD_ExecuteCommand("linkTuyaMCUOutputToChannel 3 bool 3", 0);
+
+	// relinked dpId must no longer react to old channel
+	CMD_ExecuteCommand("linkTuyaMCUOutputToChannel 5 val 10", 0);
+	CMD_ExecuteCommand("linkTuyaMCUOutputToChannel 5 val 11", 0);
+	CMD_ExecuteCommand("setChannel 10 7", 0);
+	SELFTEST_ASSERT_HAS_UART_EMPTY();
+	CMD_ExecuteCommand("setChannel 11 7", 0);
+	SELFTEST_ASSERT_HAS_SENT_UART_STRING("55AA0006000805020004000000071F");
+	SELFTEST_ASSERT_HAS_UART_EMPTY();
+	// two dpIds on one channel, last linked one is used
+	CMD_ExecuteCommand("linkTuyaMCUOutputToChannel 6 bool 12", 0);
+	CMD_ExecuteCommand("linkTuyaMCUOutputToChannel 7 bool 12", 0);
+	CMD_ExecuteCommand("setChannel 12 1", 0);
+	SELFTEST_ASSERT_HAS_SENT_UART_STRING("55AA00060005070100010114");
+	SELFTEST_ASSERT_HAS_UART_EMPTY();
+
+	CMD_ExecuteCommand("tuyaMcu_batchDPs 1", 0);
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	CMD_ExecuteCommand("setChannel 2 100", 0);
+	CMD_ExecuteCommand("setChannel 3 1", 0);
+	// nothing is sent until the end of frame
+	SELFTEST_ASSERT_HAS_UART_EMPTY();
+	Sim_RunFrames(1, false);
+	// dpId 1 bool 1, dpId 2 value 100, dpId 3 bool 1 in one packet
+	SELFTEST_ASSERT_HAS_SENT_UART_STRING("55AA000600120101000101020200040000006403010001018D");
+	SELFTEST_ASSERT_HAS_UART_EMPTY();
+
+	// same dpId again sends the older value first
+	CMD_ExecuteCommand("setChannel 2 50", 0);
+	CMD_ExecuteCommand("setChannel 2 60", 0);
+	SELFTEST_ASSERT_HAS_SENT_UART_STRING("55AA00060008020200040000003247");
+	SELFTEST_ASSERT_HAS_UART_EMPTY();
+	// disabling flushes the rest
+	CMD_ExecuteCommand("tuyaMcu_batchDPs 0", 0);
+	SELFTEST_ASSERT_HAS_SENT_UART_STRING("55AA00060008020200040000003C51");
+	SELFTEST_ASSERT_HAS_UART_EMPTY();
+
+	CMD_ExecuteCommand("setChannel 2 100", 0);
+	SELFTEST_ASSERT_HAS_SENT_UART_STRING("55AA00060008020200040000006479");
+	SELFTEST_ASSERT_HAS_UART_EMPTY();
+}
 void Test_TuyaMCU_DP22() {
 	SIM_ClearOBK(0);
 	SIM_UART_InitReceiveRingBuffer(2048);
@@ -720,4 +769,84 @@ void Test_TuyaMCU_Calib() {
 
 }
 
+int UART_TryToGetNextTuyaPacket(byte* out, int maxSize);
+
+void Test_TuyaMCU_UARTRing() {
+	static const char *captured[] = {
+		"55AA0307000802020004000000647D",
+		"55AA030700101200000C0101003F030100FA040100AA25",
+		"55AA03070008680200040000000180",
+		"55AA030700137100000F09290001B70003FC00000003E8C33265",
+	};
+	byte stream[256];
+	byte packet[256];
+	static const byte falseHeader[] = { 0x55, 0xAA, 0x03, 0x07, 0xFF, 0xFF, 0x00 };
+	int streamLen, packetsPerStream, i, j, k, rounds, found;
+	const char *p;
+
+	SIM_ClearOBK(0);
+	UART_InitReceiveRingBuffer(1024);
+
+	streamLen = 0;
+	packetsPerStream = sizeof(captured) / sizeof(captured[0]);
+	for (i = 0; i < packetsPerStream; i++) {
+		p = captured[i];
+		while (*p) {
+			stream[streamLen++] = hexbyte(p);
+			p += 2;
+		}
+	}
+	rounds = 100;
+
+	// garbage in front and a split header must still give the same packets
+	stream[streamLen] = 0x55;
+	UART_AppendBytes(stream + streamLen, 1);
+	UART_AppendBytes(stream, streamLen);
+	found = 0;
+	while (UART_TryToGetNextTuyaPacket(packet, sizeof(packet))) {
+		found++;
+	}
+	SELFTEST_ASSERT(found == packetsPerStream);
+	SELFTEST_ASSERT(UART_GetDataSize() == 0);
+	UART_AppendBytes(stream, 1);
+	SELFTEST_ASSERT(UART_TryToGetNextTuyaPacket(packet, sizeof(packet)) == 0);
+	UART_AppendBytes(stream + 1, streamLen - 1);
+	SELFTEST_ASSERT(UART_TryToGetNextTuyaPacket(packet, sizeof(packet)) == 15);
+	SELFTEST_ASSERT(memcmp(packet, stream, 15) == 0);
+	UART_ConsumeBytes(UART_GetDataSize());
+
+	// the same stream fed byte by byte and in blocks gives the same packets
+	for (i = 0; i < 2; i++) {
+		found = 0;
+		for (j = 0; j < rounds; j++) {
+			if (i == 0) {
+				for (k = 0; k < streamLen; k++) {
+					UART_AppendByteToReceiveRingBuffer(stream[k]);
+				}
+			}
+			else {
+				UART_AppendBytes(stream, streamLen);
+			}
+			while (UART_TryToGetNextTuyaPacket(packet, sizeof(packet))) {
+				SELFTEST_ASSERT(packet[0] == 0x55 && packet[1] == 0xAA);
+				found++;
+			}
+		}
+		SELFTEST_ASSERT(found == rounds * packetsPerStream);
+		SELFTEST_ASSERT(UART_GetDataSize() == 0);
+	}
+
+	// false header claiming 64k payload must not stall the parser
+	UART_AppendBytes(falseHeader, sizeof(falseHeader));
+	UART_AppendBytes(stream, streamLen);
+	found = 0;
+	for (i = 0; i < 16; i++) {
+		while (UART_TryToGetNextTuyaPacket(packet, sizeof(packet))) {
+			found++;
+		}
+	}
+	SELFTEST_ASSERT(found == packetsPerStream);
+	SELFTEST_ASSERT(UART_GetDataSize() == 0);
+}
+
 #endif
@@ -417,6 +417,143 @@ void Test_WaitFor_ChannelValue() {
 	SELFTEST_ASSERT_CHANNEL(1, 123);
 	SELFTEST_ASSERT_CHANNEL(2, 234);
 }
+void Test_WaitFor_ManyWaiters() {
+	int i;
+
+	// reset whole device
+	SIM_ClearOBK(0);
+
+	Test_FakeHTTPClientPacket_POST("api/lfs/waiters.txt",
+		"less:\n"
+		"waitFor NoPingTime < 10\n"
+		"addChannel 5 1\n"
+		"return\n"
+		"more:\n"
+		"waitFor NoPingTime > 100\n"
+		"addChannel 6 1\n"
+		"return\n"
+		"equal:\n"
+		"waitFor NoPingTime 50\n"
+		"addChannel 7 1\n"
+		"return\n"
+		"notEqual:\n"
+		"waitFor NoPingTime ! 0\n"
+		"addChannel 8 1\n"
+		"return\n"
+		"mqtt:\n"
+		"waitFor MQTTState 1\n"
+		"addChannel 9 1\n"
+		"return\n"
+		"chain:\n"
+		"waitFor NoPingTime 7\n"
+		"waitFor MQTTState 0\n"
+		"addChannel 10 1\n"
+		"return\n");
+
+	// a woken waiter leaves its event list and joins the next one
+	CMD_ExecuteCommand("startScript waiters.txt chain 6", 0);
+	for (i = 0; i < 10; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME), 1);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_MQTT_STATE), 0);
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME, 7);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME), 0);
+	for (i = 0; i < 10; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME), 0);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_MQTT_STATE), 1);
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_MQTT_STATE, 0);
+	for (i = 0; i < 10; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_MQTT_STATE), 0);
+	SELFTEST_ASSERT_CHANNEL(10, 1);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+
+	for (i = 0; i < 20; i++) {
+		CMD_ExecuteCommand("startScript waiters.txt less 1", 0);
+		CMD_ExecuteCommand("startScript waiters.txt more 2", 0);
+		CMD_ExecuteCommand("startScript waiters.txt equal 3", 0);
+		CMD_ExecuteCommand("startScript waiters.txt notEqual 4", 0);
+		CMD_ExecuteCommand("startScript waiters.txt mqtt 5", 0);
+	}
+	for (i = 0; i < 10; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 100);
+
+	// every thread is parked on the list of its own event only
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME), 80);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_MQTT_STATE), 20);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_CHANGE_CHANNEL0 + 20), 0);
+
+	// nobody waits for this one, nothing is woken
+	for (i = 0; i < 100; i++) {
+		CMD_Script_ProcessWaitersForEvent(CMD_EVENT_CHANGE_CHANNEL0 + 20, i);
+	}
+	for (i = 0; i < 10; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 100);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME), 80);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_MQTT_STATE), 20);
+
+	// matches nothing
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME, 0);
+	for (i = 0; i < 10; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(5, 20);
+	SELFTEST_ASSERT_CHANNEL(6, 0);
+	SELFTEST_ASSERT_CHANNEL(7, 0);
+	SELFTEST_ASSERT_CHANNEL(8, 0);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 80);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME), 60);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_MQTT_STATE), 20);
+
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME, 50);
+	for (i = 0; i < 10; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(5, 20);
+	SELFTEST_ASSERT_CHANNEL(6, 0);
+	SELFTEST_ASSERT_CHANNEL(7, 20);
+	SELFTEST_ASSERT_CHANNEL(8, 20);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 40);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME), 20);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_MQTT_STATE), 20);
+
+	// stopped waiters must leave the list
+	CMD_ExecuteCommand("stopScript 2", 0);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 20);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME), 0);
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME, 200);
+	for (i = 0; i < 10; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(6, 0);
+
+	// reused threads must not stay parked on old events
+	CMD_ExecuteCommand("startScript waiters.txt more 2", 0);
+	for (i = 0; i < 10; i++) {
+		SVM_RunThreads(5);
+	}
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME, 200);
+	for (i = 0; i < 10; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(6, 1);
+
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_MQTT_STATE, 1);
+	for (i = 0; i < 10; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(9, 20);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountScriptWaitersForEvent(CMD_EVENT_MQTT_STATE), 0);
+}
 void Test_WaitFor() {
 	Test_WaitFor_MQTTState();
 	Test_WaitFor_NoPingTime();
@@ -427,6 +564,7 @@ void Test_WaitFor() {
 	Test_WaitFor_OperatorLess2();
 	Test_WaitFor_OperatorNotEqual();
 	Test_WaitFor_ChannelValue();
+	Test_WaitFor_ManyWaiters();
 }
 
 #endif
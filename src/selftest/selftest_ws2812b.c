@@ -1,6 +1,7 @@
 #ifdef WINDOWS
 
 #include "selftest_local.h"
+#include "../driver/drv_local.h"
 
 
 bool Strip_VerifyPixel(uint32_t pixel, byte r, byte g, byte b);
@@ -70,6 +71,11 @@ void Test_DMX_RGB() {
 	{
 		byte ddpPacket[128];
 
+		// version 1 with PUSH flag, offset 0, 9 data bytes
+		memset(ddpPacket, 0, sizeof(ddpPacket));
+		ddpPacket[0] = 0x41;
+		ddpPacket[9] = 9;
+
 		// data starts at offset 10
 		// pixel 0
 		ddpPacket[10] = 0xFF;
@@ -238,6 +244,97 @@ void SIM_WaitForDDPPacket() {
 	}
 	
 }
+static void DDP_SendTestPacket(int seq, int type, uint32_t offset, bool bPush, const char *hex) {
+	byte packet[64];
+	int len = 10;
+
+	memset(packet, 0, 10);
+	packet[0] = 0x40 | (bPush ? 0x01 : 0);
+	packet[1] = seq;
+	packet[2] = type;
+	packet[3] = 1;
+	packet[4] = offset >> 24;
+	packet[5] = offset >> 16;
+	packet[6] = offset >> 8;
+	packet[7] = offset;
+	while (*hex) {
+		packet[len++] = hexbyte(hex);
+		hex += 2;
+	}
+	packet[8] = (len - 10) >> 8;
+	packet[9] = (len - 10);
+	DDP_Parse(packet, len);
+}
+void Test_DDP_Frames() {
+	// reset whole device
+	SIM_ClearOBK(0);
+
+	SIM_UART_InitReceiveRingBuffer(4096);
+	SIM_ClearUART();
+
+	CMD_ExecuteCommand("startDriver DMX", 0);
+	CMD_ExecuteCommand("Strip_Init 6", 0);
+	CMD_ExecuteCommand("startDriver DDP", 0);
+
+	// sender which never sets PUSH - every packet is sent out
+	DDP_SendTestPacket(0, 0x0B, 0, false, "010101");
+	SELFTEST_ASSERT_PIXEL(0, 1, 1, 1);
+	SELFTEST_ASSERT_HAS_SENT_UART_STRING("00  010101  000000  000000  000000  000000  000000");
+	SIM_ClearUART();
+	DDP_SendTestPacket(0, 0x0B, 3, false, "020202");
+	SELFTEST_ASSERT_HAS_SENT_UART_STRING("00  010101  020202  000000  000000  000000  000000");
+	SIM_ClearUART();
+	// first PUSH, from now on packets are collected until PUSH
+	DDP_SendTestPacket(0, 0x0B, 6, true, "030303");
+	SELFTEST_ASSERT_HAS_SENT_UART_STRING("00  010101  020202  030303  000000  000000  000000");
+	SIM_ClearUART();
+
+	// first half of the frame, no PUSH - nothing is sent out yet
+	DDP_SendTestPacket(1, 0x0B, 0, false, "FF0000" "00FF00" "0000FF");
+	SELFTEST_ASSERT_PIXEL(0, 0xFF, 0, 0);
+	SELFTEST_ASSERT_PIXEL(1, 0, 0xFF, 0);
+	SELFTEST_ASSERT_PIXEL(2, 0, 0, 0xFF);
+	SELFTEST_ASSERT_PIXEL(3, 0, 0, 0);
+	SELFTEST_ASSERT_HAS_UART_EMPTY();
+	// second half at byte offset 9 with PUSH - whole frame is sent
+	DDP_SendTestPacket(2, 0x0B, 9, true, "112233" "445566" "778899");
+	SELFTEST_ASSERT_PIXEL(0, 0xFF, 0, 0);
+	SELFTEST_ASSERT_PIXEL(3, 0x11, 0x22, 0x33);
+	SELFTEST_ASSERT_PIXEL(4, 0x44, 0x55, 0x66);
+	SELFTEST_ASSERT_PIXEL(5, 0x77, 0x88, 0x99);
+	SELFTEST_ASSERT_HAS_SENT_UART_STRING("00  FF0000  00FF00  0000FF  112233  445566  778899");
+	SIM_ClearUART();
+
+	// late packet from previous frame is ignored
+	DDP_SendTestPacket(1, 0x0B, 0, true, "ABABAB");
+	SELFTEST_ASSERT_PIXEL(0, 0xFF, 0, 0);
+	SELFTEST_ASSERT_HAS_UART_EMPTY();
+	SELFTEST_ASSERT_PAGE_CONTAINS("index", "late packets: 1");
+
+	// RGBW data on RGB strip, offset is in bytes, so 8 is pixel 2
+	DDP_SendTestPacket(3, 0x1B, 8, true, "0A0B0C0D" "1A1B1C1D");
+	SELFTEST_ASSERT_PIXEL(1, 0, 0xFF, 0);
+	SELFTEST_ASSERT_PIXEL(2, 0x0A, 0x0B, 0x0C);
+	SELFTEST_ASSERT_PIXEL(3, 0x1A, 0x1B, 0x1C);
+	SELFTEST_ASSERT_PIXEL(4, 0x44, 0x55, 0x66);
+	SIM_ClearUART();
+
+	// sequence 0 means sender does not count packets
+	DDP_SendTestPacket(0, 0x0B, 15, true, "010203");
+	SELFTEST_ASSERT_PIXEL(5, 1, 2, 3);
+	SELFTEST_ASSERT_PAGE_CONTAINS("index", "DDP frames: 6");
+	SIM_ClearUART();
+
+	// same over UDP, frame split in two packets
+	CMD_ExecuteCommand("startDriver DDPSend", 0);
+	CMD_ExecuteCommand("DDP_Send 127.0.0.1 3 0 A1A2A3 3 0", 0);
+	SIM_WaitForDDPPacket();
+	CMD_ExecuteCommand("DDP_Send 127.0.0.1 3 0 B1B2B3 12 1", 0);
+	SIM_WaitForDDPPacket();
+	SELFTEST_ASSERT_PIXEL(1, 0xA1, 0xA2, 0xA3);
+	SELFTEST_ASSERT_PIXEL(4, 0xB1, 0xB2, 0xB3);
+	SIM_ClearUART();
+}
 void Test_WS2812B_and_PWM_CW() {
 	// reset whole device
 	SIM_ClearOBK(0);
@@ -428,6 +525,11 @@ void Test_WS2812B() {
 	{
 		byte ddpPacket[128];
 
+		// version 1 with PUSH flag, offset 0, 9 data bytes
+		memset(ddpPacket, 0, sizeof(ddpPacket));
+		ddpPacket[0] = 0x41;
+		ddpPacket[9] = 9;
+
 		// data starts at offset 10
 		// pixel 0
 		ddpPacket[10] = 0xFF;
@@ -473,6 +575,11 @@ void Test_WS2812B() {
 	{
 		byte ddpPacket[128];
 
+		// version 1 with PUSH flag, offset 0, 12 data bytes
+		memset(ddpPacket, 0, sizeof(ddpPacket));
+		ddpPacket[0] = 0x41;
+		ddpPacket[9] = 12;
+
 		ddpPacket[2] = 0x1A;
 
 		// data starts at offset 10
@@ -585,14 +692,61 @@ void Test_WS2812B() {
 #endif
 }
 
+// strip longer than old 255 pixel limit, written and scaled in batches,
+// like DDP does for every received packet
+void Test_WS2812B_LongStrip() {
+	byte frame[1000 * 3];
+	byte span[10 * 3];
+	int i;
+
+	// reset whole device
+	SIM_ClearOBK(0);
+
+	CMD_ExecuteCommand("startDriver SM16703P", 0);
+	CMD_ExecuteCommand("SM16703P_Init 1000 GRB", 0);
+
+	for (i = 0; i < (int)sizeof(frame); i++) {
+		frame[i] = (byte)(i * 7);
+	}
+	Strip_setMultiplePixel(1000, frame, true);
+	// every pixel must be there, in GRB order
+	for (i = 0; i < 1000; i++) {
+		SELFTEST_ASSERT_PIXEL(i, frame[i * 3 + 1], frame[i * 3], frame[i * 3 + 2]);
+	}
+
+	Strip_scaleAllPixels(128);
+	for (i = 0; i < 1000; i++) {
+		SELFTEST_ASSERT_PIXEL(i, frame[i * 3 + 1] / 2, frame[i * 3] / 2, frame[i * 3 + 2] / 2);
+	}
+
+	// span crossing batch border, neighbours stay untouched
+	for (i = 0; i < (int)sizeof(span); i++) {
+		span[i] = (byte)(200 + i);
+	}
+	Strip_setPixelSpan(60, span, 10, 3);
+	SELFTEST_ASSERT_PIXEL(59, frame[59 * 3 + 1] / 2, frame[59 * 3] / 2, frame[59 * 3 + 2] / 2);
+	for (i = 0; i < 10; i++) {
+		SELFTEST_ASSERT_PIXEL(60 + i, span[i * 3 + 1], span[i * 3], span[i * 3 + 2]);
+	}
+	SELFTEST_ASSERT_PIXEL(70, frame[70 * 3 + 1] / 2, frame[70 * 3] / 2, frame[70 * 3 + 2] / 2);
+
+	// span running past the end is cut
+	Strip_setPixelSpan(995, span, 10, 3);
+	for (i = 0; i < 5; i++) {
+		SELFTEST_ASSERT_PIXEL(995 + i, span[i * 3 + 1], span[i * 3], span[i * 3 + 2]);
+	}
+}
+
 void Test_LEDstrips() {
 	Test_DMX_RGB();
 	Test_DMX_RGBC();
 	Test_DMX_RGBW();
 	Test_DMX_RGBCW();
+	Test_DDP_Frames();
 	Test_WS2812B();
 	Test_WS2812B_and_PWM_CW();
 	Test_WS2812B_and_PWM_White();
+	Test_WS2812B_LongStrip();
 }
 
 #endif
@@ -5,6 +5,7 @@
 #include "hal/hal_wifi.h"
 #include "hal/hal_generic.h"
 #include "hal/hal_flashVars.h"
+#include "hal/hal_flashStats.h"
 #include "hal/hal_adc.h"
 #include "new_common.h"
 
@@ -577,6 +578,8 @@ void Main_OnPingCheckerReply(int ms)
 }
 
 int g_doHomeAssistantDiscoveryIn = 0;
+// next scheduled discovery sends all entities, even unchanged ones
+static bool g_bForceHomeAssistantDiscovery = false;
 int g_bBootMarkedOK = 0;
 int g_rebootReason = 0;
 static int bMQTTconnected = 0;
@@ -646,6 +649,10 @@ void Main_LogPowerSave() {
 void Main_ScheduleHomeAssistantDiscovery(int seconds) {
 	g_doHomeAssistantDiscoveryIn = seconds;
 }
+void Main_ScheduleForcedHomeAssistantDiscovery(int seconds) {
+	g_bForceHomeAssistantDiscovery = true;
+	g_doHomeAssistantDiscoveryIn = seconds;
+}
 #endif
 
 
@@ -941,6 +948,9 @@ void Main_OnEverySecond()
 			g_bBootMarkedOK = true;
 		}
 	}
+	// write debounced retained channels etc
+	HAL_FlashVars_RunEverySecond();
+	HAL_FlashStats_RunEverySecond();
 
 
 #if ENABLE_HA_DISCOVERY
@@ -948,8 +958,11 @@ void Main_OnEverySecond()
 		if (MQTT_IsReady()) {
 			g_doHomeAssistantDiscoveryIn--;
 			if (g_doHomeAssistantDiscoveryIn == 0) {
+				bool bForce = g_bForceHomeAssistantDiscovery;
+
 				ADDLOGF_INFO("Will do request HA discovery now.\n");
-				doHomeAssistantDiscovery(0, 0);
+				g_bForceHomeAssistantDiscovery = false;
+				doHomeAssistantDiscovery(0, 0, bForce);
 			}
 			else {
 				ADDLOGF_INFO("Will scheduled HA discovery in %i seconds\n", g_doHomeAssistantDiscoveryIn);
@@ -1119,7 +1132,7 @@ void QuickTick(void* param)
 	extern void Berry_RunThreads(int deltaMS);
 	Berry_RunThreads(g_deltaTimeMS);
 #endif
-	RepeatingEvents_RunUpdate(g_deltaTimeMS * 0.001f);
+	RepeatingEvents_RunUpdate(g_deltaTimeMS);
 #ifndef OBK_DISABLE_ALL_DRIVERS
 	DRV_RunQuickTick();
 #endif
@@ -1268,6 +1281,9 @@ void Main_Init_AfterDelay_Unsafe(bool bStartAutoRunScripts) {
 #endif
 		CMD_ExecuteCommand("startScript autoexec.bat", COMMAND_FLAG_SOURCE_SCRIPT);
 #if ENABLE_OBK_BERRY
+		extern int Berry_CompileFile(const char *fname, bool bForce);
+		// import prefers autoexec.bec, refresh it first if the source changed
+		Berry_CompileFile("autoexec.be", false);
 		CMD_ExecuteCommand("berry import autoexec", COMMAND_FLAG_SOURCE_SCRIPT);
 #endif
 	}
@@ -35,6 +35,7 @@
 #include "driver/drv_public.h"
 #include "cmnds/cmd_public.h"
 #include "httpserver/new_http.h"
+#include "httpserver/hass.h"
 #include "quicktick.h"
 #include "hal/hal_flashVars.h"
 #include "selftest/selftest_local.h"
@@ -145,6 +146,7 @@ void Sim_RunFrames(int n, bool bApplyRealtimeWait)
 
 bool bObkStarted = false;
 void SIM_Hack_ClearSimulatedPinRoles();
+void SIM_FlashVars_Clear();
 
 void CHANNEL_FreeLabels();
 
@@ -163,6 +165,10 @@ void SIM_ShutdownOBK()
 		SPILED_Shutdown(); // won't hurt
 		CHANNEL_FreeLabels();
 		UART_ResetForSimulator();
+#if ENABLE_HA_DISCOVERY
+		// every test starts with a fresh broker
+		hass_clear_discovery_cache();
+#endif
 		CMD_ExecuteCommand("clearAll", 0);
 		CMD_ExecuteCommand("led_expoMode", 0);
 #if ENABLE_OBK_BERRY
@@ -185,6 +191,11 @@ void SIM_StartOBK(const char *flashPath)
 void SIM_ClearOBK(const char *flashPath)
 {
 	SIM_ShutdownOBK();
+	// otherwise boot count would grow with every test and end in safe mode
+	if (flashPath == 0)
+	{
+		SIM_FlashVars_Clear();
+	}
 	SIM_StartOBK(flashPath);
 }
 void Test_PartitionSearch()
@@ -221,10 +232,12 @@ void Win_DoUnitTests()
 
 	Test_TuyaMCU_Boolean();
 	Test_TuyaMCU_DP22();
+	Test_TuyaMCU_Batch();
 
 	Test_Demo_ConditionalRelay();
 	Test_Expressions_RunTests_Braces();
 	Test_Expressions_RunTests_Basic();
+	Test_Expressions_Compiled();
 	Test_Enums();
 	Test_Backlog();
 	Test_DoorSensor();
@@ -238,6 +251,7 @@ void Win_DoUnitTests()
 	Test_TuyaMCU_Basic();
 	Test_TuyaMCU_Mult();
 	Test_TuyaMCU_RawAccess();
+	Test_TuyaMCU_UARTRing();
 	Test_Battery();
 	Test_TuyaMCU_BatteryPowered();
 	Test_JSON_Lib();
@@ -283,11 +297,15 @@ void Win_DoUnitTests()
 	Test_ChangeHandlers2();
 	Test_ChangeHandlers_EnsureThatChannelVariableIsExpandedAtHandlerRunTime();
 	Test_RepeatingEvents();
+	Test_TimerQueue();
 	Test_ButtonEvents();
 	Test_Commands_Alias();
 	Test_Demo_SignAndValue();
 	Test_LEDDriver();
 	Test_LFS();
+	Test_FlashVars();
+	Test_FlashStats();
+	Test_Logging_Deferred();
 	Test_Scripting();
 	Test_Command_If();
 	Test_Tokenizer();